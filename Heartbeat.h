@@ -0,0 +1,590 @@
+/************************************************************************/
+/**
+ * @file Heartbeat.h
+ * @brief Batched UDP heartbeats of workers, signed by SipHash-2-4
+ * @author Anar Manafov A.Manafov@gsi.de
+ */ /*
+
+        version number:     $LastChangedRevision$
+        created by:         Anar Manafov
+                            2012-11-22
+        last changed by:    $LastChangedBy$ $LastChangedDate$
+
+        Copyright (c) 2012 GSI, Scientific Computing division. All rights reserved.
+*************************************************************************/
+#ifndef HEARTBEAT_H_
+#define HEARTBEAT_H_
+
+// API
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <stdint.h>
+// STD
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <vector>
+// MiscCommon
+#include "ErrorCode.h"
+#include "MiscUtils.h"
+#include "INet.h"
+
+namespace MiscCommon
+{
+    namespace INet
+    {
+        /// a default time after which a silent worker is reported as missed
+        const int g_heartbeatTimeoutMs = 1000;
+        /// a default resolution of the timer wheel, a miss is detected at most one tick late
+        const int g_heartbeatTickMs = 50;
+        /// datagrams received or sent by one system call
+        const size_t HEARTBEAT_BATCH = 64;
+        /**
+         *
+         * @brief The function calculates SipHash-2-4 of _data with a 128 bit _key.
+         *
+         */
+        inline uint64_t siphash24( const unsigned char _key[16], const unsigned char *_data, size_t _len )
+        {
+#define SIP_ROTL( x, b ) ( uint64_t )( ( ( x ) << ( b ) ) | ( ( x ) >> ( 64 - ( b ) ) ) )
+#define SIP_ROUND                                                   \
+            do                                                      \
+            {                                                       \
+                v0 += v1; v1 = SIP_ROTL( v1, 13 ); v1 ^= v0; v0 = SIP_ROTL( v0, 32 ); \
+                v2 += v3; v3 = SIP_ROTL( v3, 16 ); v3 ^= v2;        \
+                v0 += v3; v3 = SIP_ROTL( v3, 21 ); v3 ^= v0;        \
+                v2 += v1; v1 = SIP_ROTL( v1, 17 ); v1 ^= v2; v2 = SIP_ROTL( v2, 32 ); \
+            } while( 0 )
+
+            uint64_t k0( 0 );
+            uint64_t k1( 0 );
+            for( int i = 7; i >= 0; --i )
+            {
+                k0 = ( k0 << 8 ) | _key[i];
+                k1 = ( k1 << 8 ) | _key[i + 8];
+            }
+            uint64_t v0( k0 ^ 0x736f6d6570736575ULL );
+            uint64_t v1( k1 ^ 0x646f72616e646f6dULL );
+            uint64_t v2( k0 ^ 0x6c7967656e657261ULL );
+            uint64_t v3( k1 ^ 0x7465646279746573ULL );
+
+            const size_t blocks( _len / 8 );
+            for( size_t b = 0; b < blocks; ++b )
+            {
+                uint64_t m( 0 );
+                for( int i = 7; i >= 0; --i )
+                    m = ( m << 8 ) | _data[b * 8 + i];
+                v3 ^= m;
+                SIP_ROUND;
+                SIP_ROUND;
+                v0 ^= m;
+            }
+            uint64_t last( static_cast<uint64_t>( _len ) << 56 );
+            for( size_t i = 0; i < _len % 8; ++i )
+                last |= static_cast<uint64_t>( _data[blocks * 8 + i] ) << ( 8 * i );
+            v3 ^= last;
+            SIP_ROUND;
+            SIP_ROUND;
+            v0 ^= last;
+            v2 ^= 0xff;
+            SIP_ROUND;
+            SIP_ROUND;
+            SIP_ROUND;
+            SIP_ROUND;
+            return v0 ^ v1 ^ v2 ^ v3;
+#undef SIP_ROUND
+#undef SIP_ROTL
+        }
+        /**
+         *
+         * @brief A shared secret of the server and its workers, 16 bytes of the given string are used.
+         * @brief The secret must not be empty, an all-zero key would sign anybody's beats.
+         *
+         */
+        struct SHeartbeatKey
+        {
+            explicit SHeartbeatKey( const std::string &_secret )
+            {
+                if( _secret.empty() )
+                    throw std::invalid_argument( "SHeartbeatKey: the secret is empty" );
+                memset( m_key, 0, sizeof( m_key ) );
+                memcpy( m_key, _secret.data(), std::min( _secret.size(), sizeof( m_key ) ) );
+            }
+            unsigned char m_key[16];
+        };
+        /**
+         *
+         * @brief A heartbeat datagram: MAGIC(4) WORKER_ID(4) SEQ(4) SIGNATURE(8),
+         * @brief integers are in the network byte order, the signature is SipHash-2-4 of the first 12 bytes.
+         *
+         */
+        struct SHeartbeat
+        {
+            enum { MAGIC = 0x506f4448, SIGNED_SIZE = 12, SIZE = 20 };
+
+            SHeartbeat():
+                m_worker( 0 ),
+                m_seq( 0 )
+            {
+            }
+            void encode( const SHeartbeatKey &_key, unsigned char _buf[SIZE] ) const
+            {
+                const uint32_t fields[3] = { htonl( MAGIC ), htonl( m_worker ), htonl( m_seq ) };
+                memcpy( _buf, fields, SIGNED_SIZE );
+                const uint64_t sig( siphash24( _key.m_key, _buf, SIGNED_SIZE ) );
+                for( size_t i = 0; i < 8; ++i )
+                    _buf[SIGNED_SIZE + i] = static_cast<unsigned char>( sig >> ( 8 * i ) );
+            }
+            // return: false if the datagram is malformed or its signature is wrong
+            bool decode( const SHeartbeatKey &_key, const unsigned char *_buf, size_t _len )
+            {
+                if( SIZE != _len )
+                    return false;
+                uint32_t fields[3];
+                memcpy( fields, _buf, SIGNED_SIZE );
+                if( htonl( MAGIC ) != fields[0] )
+                    return false;
+                const uint64_t sig( siphash24( _key.m_key, _buf, SIGNED_SIZE ) );
+                for( size_t i = 0; i < 8; ++i )
+                {
+                    if( _buf[SIGNED_SIZE + i] != static_cast<unsigned char>( sig >> ( 8 * i ) ) )
+                        return false;
+                }
+                m_worker = ntohl( fields[1] );
+                m_seq = ntohl( fields[2] );
+                return true;
+            }
+
+            uint32_t m_worker;
+            uint32_t m_seq;
+        };
+        /**
+         *
+         * @brief Counters of CHeartbeatMonitor.
+         *
+         */
+        struct SHeartbeatStats
+        {
+            SHeartbeatStats():
+                m_received( 0 ),
+                m_accepted( 0 ),
+                m_badSignature( 0 ),
+                m_replayed( 0 ),
+                m_unknown( 0 ),
+                m_missed( 0 )
+            {
+            }
+            uint64_t m_received;
+            uint64_t m_accepted;
+            uint64_t m_badSignature;
+            uint64_t m_replayed;
+            // beats of workers, which are not watched
+            uint64_t m_unknown;
+            uint64_t m_missed;
+        };
+        /**
+         *
+         * @brief The class sends heartbeats of one or many workers (e.g. of a whole host) to the monitor.
+         * @brief A sequence number, which starts from the wall clock, grows with every round,
+         * @brief so the monitor rejects replayed datagrams, but accepts beats of a restarted worker.
+         * @brief The monitor listens on IPv4 only, so the host is resolved to an IPv4 address.
+         *
+         */
+        class CHeartbeatSender: public NONCopyable
+        {
+            public:
+                explicit CHeartbeatSender( const SHeartbeatKey &_key ):
+                    m_key( _key ),
+                    m_refused( 0 )
+                {
+                    timeval tv;
+                    gettimeofday( &tv, NULL );
+                    m_seq = static_cast<uint32_t>( tv.tv_sec * 1000 + tv.tv_usec / 1000 );
+                }
+                // a repeated connect replaces the socket of the previous one
+                void connect( unsigned short _nPort, const std::string &_Host )
+                {
+                    Addresses_t addresses;
+                    const int ret = resolve( _Host, _nPort, &addresses );
+                    if( 0 != ret || addresses.empty() )
+                        throw std::runtime_error( "CHeartbeatSender: can't resolve " + _Host );
+                    // "localhost" often resolves to ::1 first, which the monitor doesn't listen on
+                    Addresses_t::const_iterator found = addresses.begin();
+                    while( addresses.end() != found && AF_INET != found->m_addr.ss_family )
+                        ++found;
+                    if( addresses.end() == found )
+                        throw std::runtime_error( "CHeartbeatSender: " + _Host + " has no IPv4 address" );
+                    const SAddress &addr = *found;
+                    m_socket = ::socket( addr.m_addr.ss_family, SOCK_DGRAM, 0 );
+                    if( !m_socket.is_valid() )
+                        throw system_error( "CHeartbeatSender: can't create a socket" );
+                    if( ::connect( m_socket, reinterpret_cast<const sockaddr *>( &addr.m_addr ), addr.m_len ) < 0 )
+                        throw system_error( "CHeartbeatSender: can't connect to " + _Host );
+                }
+                void beat( uint32_t _worker )
+                {
+                    beat( std::vector<uint32_t>( 1, _worker ) );
+                }
+                // sends a beat of every given worker, HEARTBEAT_BATCH datagrams per system call on Linux.
+                // Datagrams, which the kernel drops (a full socket buffer), are lost as on the network.
+                void beat( const std::vector<uint32_t> &_workers )
+                {
+                    ++m_seq;
+                    unsigned char bufs[HEARTBEAT_BATCH][SHeartbeat::SIZE];
+                    for( size_t start = 0; start < _workers.size(); )
+                    {
+                        const size_t count( std::min( HEARTBEAT_BATCH, _workers.size() - start ) );
+                        for( size_t i = 0; i < count; ++i )
+                        {
+                            SHeartbeat beat;
+                            beat.m_worker = _workers[start + i];
+                            beat.m_seq = m_seq;
+                            beat.encode( m_key, bufs[i] );
+                        }
+                        const int sent = sendBatch( bufs, count );
+                        if( sent < 0 )
+                        {
+                            if( EINTR == errno )
+                                continue;
+                            // the monitor isn't running yet, the round is lost
+                            if( ECONNREFUSED == errno )
+                            {
+                                ++m_refused;
+                                return;
+                            }
+                            throw system_error( "CHeartbeatSender: can't send heartbeats" );
+                        }
+                        start += sent;
+                    }
+                }
+                // return: a number of rounds, which were refused by the monitor host (ICMP port unreachable)
+                uint64_t refused() const
+                {
+                    return m_refused;
+                }
+
+            private:
+                // return: a number of sent datagrams or -1 if none was sent (errno is set then)
+                int sendBatch( unsigned char _bufs[][SHeartbeat::SIZE], size_t _count )
+                {
+#ifdef __linux__
+                    iovec iovs[HEARTBEAT_BATCH];
+                    mmsghdr msgs[HEARTBEAT_BATCH];
+                    memset( msgs, 0, sizeof( msgs ) );
+                    for( size_t i = 0; i < _count; ++i )
+                    {
+                        iovs[i].iov_base = _bufs[i];
+                        iovs[i].iov_len = SHeartbeat::SIZE;
+                        msgs[i].msg_hdr.msg_iov = &iovs[i];
+                        msgs[i].msg_hdr.msg_iovlen = 1;
+                    }
+                    return ::sendmmsg( m_socket, msgs, _count, 0 );
+#else
+                    // no sendmmsg, one system call per datagram
+                    for( size_t i = 0; i < _count; ++i )
+                    {
+                        if( ::send( m_socket, _bufs[i], SHeartbeat::SIZE, 0 ) < 0 )
+                            return 0 == i ? -1 : static_cast<int>( i );
+                    }
+                    return _count;
+#endif
+                }
+
+            private:
+                SHeartbeatKey m_key;
+                smart_socket m_socket;
+                uint32_t m_seq;
+                uint64_t m_refused;
+        };
+        /**
+         *
+         * @brief The class tracks liveness of watched workers by their UDP heartbeats.
+         * @brief Datagrams are received in batches (recvmmsg on Linux), a beat only stores its time in the worker table.
+         * @brief A lazy timer wheel checks the deadlines: a worker is put into the slot of its deadline
+         * @brief and moved once per timeout at most, so tracking is O(1) per beat and per worker.
+         * @brief A worker, which didn't send a beat for the timeout, is reported once as missed;
+         * @brief it is alive again with its next beat.
+         * @note Example:
+         * @code
+         *
+         * CHeartbeatMonitor monitor( key );
+         * monitor.bind( 22001 );
+         * for( ... each worker ... )
+         *     monitor.watch( worker_id );
+         * std::vector<uint32_t> missed;
+         * while( true )
+         * {
+         *     monitor.process( 100, &missed );
+         *     ... handle and clear missed ...
+         * }
+         *
+         * // a worker
+         * CHeartbeatSender sender( key );
+         * sender.connect( 22001, server_host );
+         * sender.beat( worker_id ); // every timeout / 3
+         *
+         * @endcode
+         *
+         */
+        class CHeartbeatMonitor: public NONCopyable
+        {
+                struct SWorker
+                {
+                    SWorker():
+                        m_lastSeen( 0 ),
+                        m_seq( 0 ),
+                        m_watched( false ),
+                        m_alive( false ),
+                        m_scheduled( false ),
+                        m_hasSeq( false )
+                    {
+                    }
+                    uint64_t m_lastSeen;
+                    uint32_t m_seq;
+                    bool m_watched;
+                    bool m_alive;
+                    bool m_scheduled;
+                    bool m_hasSeq;
+                };
+                typedef std::vector<SWorker> Workers_t;
+                typedef std::vector<uint32_t> Slot_t;
+
+            public:
+                explicit CHeartbeatMonitor( const SHeartbeatKey &_key, int _timeoutMs = g_heartbeatTimeoutMs,
+                                            int _tickMs = g_heartbeatTickMs ):
+                    m_key( _key ),
+                    m_socket( AF_INET, SOCK_DGRAM, 0 ),
+                    m_timeoutMs( _timeoutMs ),
+                    m_tickMs( _tickMs )
+                {
+                    if( _tickMs <= 0 || _timeoutMs < _tickMs )
+                        throw std::invalid_argument( "CHeartbeatMonitor: bad timeout or tick" );
+                    // the wheel spans the timeout and a tick of rounding
+                    size_t slots( 1 );
+                    while( slots < static_cast<size_t>( _timeoutMs / _tickMs + 2 ) )
+                        slots <<= 1;
+                    m_wheel.resize( slots );
+                    m_tick = monotonic_ms() / m_tickMs;
+                }
+                // return: the bound port
+                unsigned short bind( unsigned short _nPort, const std::string *_Addr = NULL )
+                {
+                    sockaddr_in addr;
+                    memset( &addr, 0, sizeof( addr ) );
+                    addr.sin_family = AF_INET;
+                    addr.sin_port = htons( _nPort );
+                    if( !_Addr )
+                        addr.sin_addr.s_addr = htonl( INADDR_ANY );
+                    else
+                        inet_aton( _Addr->c_str(), &addr.sin_addr );
+                    if( ::bind( m_socket, reinterpret_cast<sockaddr *>( &addr ), sizeof( addr ) ) < 0 )
+                        throw system_error( "CHeartbeatMonitor: bind error" );
+                    // a burst of beats of all workers must not overflow the socket buffer
+                    const int size( 4 * 1024 * 1024 );
+                    setsockopt( m_socket, SOL_SOCKET, SO_RCVBUF, &size, sizeof( size ) );
+                    m_socket.set_nonblock();
+
+                    socklen_t len( sizeof( addr ) );
+                    getsockname( m_socket, reinterpret_cast<sockaddr *>( &addr ), &len );
+                    return ntohs( addr.sin_port );
+                }
+                Socket_t getSocket()
+                {
+                    return m_socket.get();
+                }
+                // starts tracking of the worker, it is reported as missed, if it doesn't beat in the timeout
+                void watch( uint32_t _worker )
+                {
+                    if( _worker >= m_workers.size() )
+                        m_workers.resize( _worker + 1 );
+                    SWorker &worker = m_workers[_worker];
+                    worker.m_watched = true;
+                    worker.m_alive = true;
+                    worker.m_lastSeen = monotonic_ms();
+                    if( !worker.m_scheduled )
+                        schedule( _worker );
+                }
+                void unwatch( uint32_t _worker )
+                {
+                    if( _worker >= m_workers.size() )
+                        return;
+                    // its entry in the wheel is dropped, when the slot comes
+                    SWorker &worker = m_workers[_worker];
+                    worker.m_watched = false;
+                    worker.m_alive = false;
+                    worker.m_hasSeq = false;
+                }
+                bool isAlive( uint32_t _worker ) const
+                {
+                    return ( _worker < m_workers.size() && m_workers[_worker].m_alive );
+                }
+                // return: the monotonic time in ms of the last beat (or of watch)
+                uint64_t lastSeen( uint32_t _worker ) const
+                {
+                    return ( _worker < m_workers.size() ? m_workers[_worker].m_lastSeen : 0 );
+                }
+                const SHeartbeatStats &stats() const
+                {
+                    return m_stats;
+                }
+                // receives pending beats, waiting at most _waitMs for the first one, and checks the deadlines.
+                // Workers, which have missed their beats, are appended to _missed.
+                // return: a number of accepted beats
+                size_t process( int _waitMs, std::vector<uint32_t> *_missed )
+                {
+                    pollfd pfd;
+                    pfd.fd = m_socket;
+                    pfd.events = POLLIN;
+                    pfd.revents = 0;
+                    // don't sleep over the next tick of the wheel
+                    const uint64_t now( monotonic_ms() );
+                    const uint64_t nextTick( ( m_tick + 1 ) * m_tickMs );
+                    const int wait( nextTick > now ? std::min<uint64_t>( _waitMs, nextTick - now ) : 0 );
+                    if( ::poll( &pfd, 1, wait ) < 0 && EINTR != errno )
+                        throw system_error( "CHeartbeatMonitor: poll error" );
+
+                    const size_t accepted( receive() );
+                    expire( monotonic_ms(), _missed );
+                    return accepted;
+                }
+
+            private:
+                size_t receive()
+                {
+                    // one extra byte detects oversized datagrams
+                    unsigned char bufs[HEARTBEAT_BATCH][SHeartbeat::SIZE + 1];
+                    size_t lens[HEARTBEAT_BATCH];
+                    size_t accepted( 0 );
+                    while( true )
+                    {
+                        const int n = receiveBatch( bufs, lens );
+                        if( n < 0 )
+                        {
+                            if( EINTR == errno )
+                                continue;
+                            if( EAGAIN == errno || EWOULDBLOCK == errno )
+                                return accepted;
+                            throw system_error( "CHeartbeatMonitor: can't receive heartbeats" );
+                        }
+
+                        const uint64_t now( monotonic_ms() );
+                        for( int i = 0; i < n; ++i )
+                        {
+                            ++m_stats.m_received;
+                            SHeartbeat beat;
+                            if( !beat.decode( m_key, bufs[i], lens[i] ) )
+                            {
+                                ++m_stats.m_badSignature;
+                                continue;
+                            }
+                            if( beat.m_worker >= m_workers.size() || !m_workers[beat.m_worker].m_watched )
+                            {
+                                ++m_stats.m_unknown;
+                                continue;
+                            }
+                            SWorker &worker = m_workers[beat.m_worker];
+                            // a serial number comparison, which survives the wrap around
+                            if( worker.m_hasSeq && static_cast<int32_t>( beat.m_seq - worker.m_seq ) <= 0 )
+                            {
+                                ++m_stats.m_replayed;
+                                continue;
+                            }
+                            worker.m_seq = beat.m_seq;
+                            worker.m_hasSeq = true;
+                            worker.m_lastSeen = now;
+                            worker.m_alive = true;
+                            if( !worker.m_scheduled )
+                                schedule( beat.m_worker );
+                            ++m_stats.m_accepted;
+                            ++accepted;
+                        }
+                        if( static_cast<size_t>( n ) < HEARTBEAT_BATCH )
+                            return accepted;
+                    }
+                }
+                // return: a number of received datagrams or -1 if none was received (errno is set then)
+                int receiveBatch( unsigned char _bufs[][SHeartbeat::SIZE + 1], size_t _lens[] )
+                {
+#ifdef __linux__
+                    iovec iovs[HEARTBEAT_BATCH];
+                    mmsghdr msgs[HEARTBEAT_BATCH];
+                    memset( msgs, 0, sizeof( msgs ) );
+                    for( size_t i = 0; i < HEARTBEAT_BATCH; ++i )
+                    {
+                        iovs[i].iov_base = _bufs[i];
+                        iovs[i].iov_len = SHeartbeat::SIZE + 1;
+                        msgs[i].msg_hdr.msg_iov = &iovs[i];
+                        msgs[i].msg_hdr.msg_iovlen = 1;
+                    }
+                    const int n = ::recvmmsg( m_socket, msgs, HEARTBEAT_BATCH, MSG_DONTWAIT, NULL );
+                    for( int i = 0; i < n; ++i )
+                        _lens[i] = msgs[i].msg_len;
+                    return n;
+#else
+                    // no recvmmsg, one system call per datagram
+                    for( size_t i = 0; i < HEARTBEAT_BATCH; ++i )
+                    {
+                        const ssize_t len = ::recv( m_socket, _bufs[i], SHeartbeat::SIZE + 1, MSG_DONTWAIT );
+                        if( len < 0 )
+                            return 0 == i ? -1 : static_cast<int>( i );
+                        _lens[i] = len;
+                    }
+                    return HEARTBEAT_BATCH;
+#endif
+                }
+                void schedule( uint32_t _worker )
+                {
+                    SWorker &worker = m_workers[_worker];
+                    // the slot of the first tick at or after the deadline, but never a processed one
+                    const uint64_t deadline( worker.m_lastSeen + m_timeoutMs );
+                    const uint64_t tick( std::max<uint64_t>( ( deadline + m_tickMs - 1 ) / m_tickMs, m_tick + 1 ) );
+                    m_wheel[tick & ( m_wheel.size() - 1 )].push_back( _worker );
+                    worker.m_scheduled = true;
+                }
+                void expire( uint64_t _now, std::vector<uint32_t> *_missed )
+                {
+                    const uint64_t last( _now / m_tickMs );
+                    Slot_t slot;
+                    while( m_tick < last )
+                    {
+                        ++m_tick;
+                        slot.swap( m_wheel[m_tick & ( m_wheel.size() - 1 )] );
+                        for( size_t i = 0; i < slot.size(); ++i )
+                        {
+                            const uint32_t id( slot[i] );
+                            SWorker &worker = m_workers[id];
+                            worker.m_scheduled = false;
+                            if( !worker.m_watched )
+                                continue;
+                            if( worker.m_lastSeen + m_timeoutMs > m_tick * m_tickMs )
+                            {
+                                // it has beaten since it was scheduled
+                                schedule( id );
+                                continue;
+                            }
+                            worker.m_alive = false;
+                            ++m_stats.m_missed;
+                            if( _missed )
+                                _missed->push_back( id );
+                        }
+                        slot.clear();
+                    }
+                }
+
+            private:
+                SHeartbeatKey m_key;
+                smart_socket m_socket;
+                int m_timeoutMs;
+                int m_tickMs;
+                Workers_t m_workers;
+                std::vector<Slot_t> m_wheel;
+                // the last processed tick
+                uint64_t m_tick;
+                SHeartbeatStats m_stats;
+        };
+    }
+}
+
+#endif /* HEARTBEAT_H_ */
@@ -17,17 +17,34 @@
 
 // API
 #include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/stat.h>
+#include <sys/ioctl.h>
+#ifdef __linux__
+#include <linux/sockios.h>
+#endif
 #include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <arpa/inet.h>
 #include <netdb.h>
 #include <fcntl.h>
+#include <poll.h>
+#include <time.h>
+#include <stdint.h>
 // STD
 #include <unistd.h>
+#include <algorithm>
+#include <sstream>
+#include <ostream>
+#include <cstddef>
+#include <cstring>
 #include <stdexcept>
+#include <vector>
 // MiscCommon
 #include "ErrorCode.h"
 #include "MiscUtils.h"
 #include "def.h"
+#include "Metrics.h"
 
 /// this macro indicates an invalid status of the socket
 #define INVALID_SOCKET -1
@@ -50,7 +67,234 @@ namespace MiscCommon
 
         // Forward declaration
         inline std::string socket_error_string( Socket_t _socket, const char *_strMsg = NULL );
+        /**
+         *
+         * @brief Traffic, connections and errors of the helpers of INet, see CMetricsRegistry.
+         *
+         */
+        struct SINetMetrics
+        {
+            SINetMetrics():
+                m_sent( CMetricsRegistry::instance().counter( "misccommon_inet_sent_bytes_total", "Bytes sent by the INet helpers" ) ),
+                m_received( CMetricsRegistry::instance().counter( "misccommon_inet_received_bytes_total", "Bytes received by the INet helpers" ) ),
+                m_connects( CMetricsRegistry::instance().counter( "misccommon_inet_connects_total", "Established outgoing connections" ) ),
+                m_accepts( CMetricsRegistry::instance().counter( "misccommon_inet_accepts_total", "Accepted incoming connections" ) ),
+                m_sendErrors( error( "send" ) ),
+                m_receiveErrors( error( "receive" ) ),
+                m_connectErrors( error( "connect" ) ),
+                m_acceptErrors( error( "accept" ) )
+            {
+            }
+            static SINetMetrics &instance()
+            {
+                static SINetMetrics metrics;
+                return metrics;
+            }
+            CCounter &m_sent;
+            CCounter &m_received;
+            CCounter &m_connects;
+            CCounter &m_accepts;
+            CCounter &m_sendErrors;
+            CCounter &m_receiveErrors;
+            CCounter &m_connectErrors;
+            CCounter &m_acceptErrors;
+
+            static CCounter &error( const std::string &_op )
+            {
+                return CMetricsRegistry::instance().counter( "misccommon_inet_errors_total",
+                                                             "Failed socket operations", metricsLabel( "op", _op ) );
+            }
+        };
+
+        /**
+         *
+         * @brief A sample of the kernel state of a connection: TCP_INFO and the queue depths.
+         * @brief Times are in microseconds, the delivery rate is in bytes per second.
+         *
+         */
+        struct STcpDiag
+        {
+            enum EField
+            {
+                fRTT,
+                fRTT_VAR,
+                fRETRANSMITS,
+                fCWND,
+                fUNACKED,
+                fDELIVERY_RATE,
+                fOUTQ,
+                fINQ,
+                fieldsCOUNT
+            };
+
+            STcpDiag():
+                m_tcp( false )
+            {
+                std::fill( m_values, m_values + fieldsCOUNT, 0 );
+            }
+            uint64_t get( EField _field ) const
+            {
+                return m_values[_field];
+            }
+            static const char *name( EField _field )
+            {
+                const char *names[] = { "rtt_us", "rttvar_us", "retransmits", "cwnd", "unacked",
+                                        "delivery_rate_Bps", "outq_bytes", "inq_bytes"
+                                      };
+                return names[_field];
+            }
+
+            // false if TCP_INFO isn't available (e.g. an AF_UNIX socket), only the queues are set then
+            bool m_tcp;
+            uint64_t m_values[fieldsCOUNT];
+        };
+        /**
+         *
+         * @brief The function samples TCP_INFO and SIOCOUTQ/SIOCINQ of the socket.
+         * @note The diagnostics are Linux only, on other platforms the sample is left empty.
+         * @return false if the socket is invalid or the platform has no diagnostics
+         *
+         */
+        inline bool tcp_diag( Socket_t _socket, STcpDiag *_diag )
+        {
+            if( !_diag )
+                throw std::invalid_argument( "tcp_diag: the given pointer is NULL" );
+            *_diag = STcpDiag();
+
+#ifdef __linux__
+            int outq( 0 );
+            int inq( 0 );
+            if( ::ioctl( _socket, SIOCOUTQ, &outq ) < 0 || ::ioctl( _socket, SIOCINQ, &inq ) < 0 )
+                return false;
+            _diag->m_values[STcpDiag::fOUTQ] = outq;
+            _diag->m_values[STcpDiag::fINQ] = inq;
+
+            // the kernel only appends to tcp_info, the glibc definition ends at tcpi_total_retrans,
+            // the delivery rate (Linux 4.9) follows at a fixed offset
+            const size_t DELIVERY_RATE_OFFSET = 160;
+            unsigned char buf[256];
+            memset( buf, 0, sizeof( buf ) );
+            socklen_t len( sizeof( buf ) );
+            if( getsockopt( _socket, IPPROTO_TCP, TCP_INFO, buf, &len ) < 0 || len < sizeof( tcp_info ) )
+                return true;
+
+            tcp_info info;
+            memcpy( &info, buf, sizeof( info ) );
+            _diag->m_tcp = true;
+            _diag->m_values[STcpDiag::fRTT] = info.tcpi_rtt;
+            _diag->m_values[STcpDiag::fRTT_VAR] = info.tcpi_rttvar;
+            _diag->m_values[STcpDiag::fRETRANSMITS] = info.tcpi_total_retrans;
+            _diag->m_values[STcpDiag::fCWND] = info.tcpi_snd_cwnd;
+            _diag->m_values[STcpDiag::fUNACKED] = info.tcpi_unacked;
+            if( len >= DELIVERY_RATE_OFFSET + sizeof( uint64_t ) )
+                memcpy( &_diag->m_values[STcpDiag::fDELIVERY_RATE], buf + DELIVERY_RATE_OFFSET, sizeof( uint64_t ) );
+            return true;
+#else
+            return false;
+#endif
+        }
+        /**
+         *
+         * @brief The function samples tcp_diag of the socket into the gauges misccommon_tcp_<field>{_labels}
+         * @brief of _registry (misccommon_tcp_rtt_us, misccommon_tcp_outq_bytes, ...).
+         * @brief The registry keeps no per socket state, so the caller samples the connections it watches,
+         * @brief for example by a timer, under stable labels (a peer, a role); gauges keep their last value.
+         * @return false if the socket is invalid, the gauges are left unchanged then
+         *
+         */
+        inline bool publish_tcp_diag( Socket_t _socket, const std::string &_labels,
+                                      CMetricsRegistry &_registry = CMetricsRegistry::instance() )
+        {
+            STcpDiag diag;
+            if( !tcp_diag( _socket, &diag ) )
+                return false;
+            for( size_t i = 0; i < STcpDiag::fieldsCOUNT; ++i )
+            {
+                // non TCP sockets have only the queues
+                if( !diag.m_tcp && STcpDiag::fOUTQ != i && STcpDiag::fINQ != i )
+                    continue;
+                const STcpDiag::EField field( static_cast<STcpDiag::EField>( i ) );
+                _registry.gauge( std::string( "misccommon_tcp_" ) + STcpDiag::name( field ),
+                                 "TCP_INFO/SIOCOUTQ/SIOCINQ sample of a connection", _labels ).set( diag.get( field ) );
+            }
+            return true;
+        }
+        /**
+         *
+         * @brief The class aggregates STcpDiag samples of many connections into percentiles.
+         * @note Example:
+         * @code
+         *
+         * CTcpDiagSummary summary;
+         * for( ... each worker ... )
+         *     summary.add( worker_socket );
+         * std::cout << summary;
+         *
+         * @endcode
+         *
+         */
+        class CTcpDiagSummary
+        {
+            public:
+                void add( const STcpDiag &_diag )
+                {
+                    for( size_t i = 0; i < STcpDiag::fieldsCOUNT; ++i )
+                    {
+                        // TCP_INFO fields of non TCP sockets would distort the percentiles
+                        if( !_diag.m_tcp && STcpDiag::fOUTQ != i && STcpDiag::fINQ != i )
+                            continue;
+                        m_samples[i].push_back( _diag.m_values[i] );
+                    }
+                }
+                // samples the socket and adds it, return: false if the socket is invalid
+                bool add( Socket_t _socket )
+                {
+                    STcpDiag diag;
+                    if( !tcp_diag( _socket, &diag ) )
+                        return false;
+                    add( diag );
+                    return true;
+                }
+                void clear()
+                {
+                    for( size_t i = 0; i < STcpDiag::fieldsCOUNT; ++i )
+                        m_samples[i].clear();
+                }
+                size_t size( STcpDiag::EField _field ) const
+                {
+                    return m_samples[_field].size();
+                }
+                // return: the value of the given percentile (0..100) by the nearest rank, 0 if there are no samples
+                uint64_t percentile( STcpDiag::EField _field, double _percent ) const
+                {
+                    std::vector<uint64_t> values( m_samples[_field] );
+                    if( values.empty() )
+                        return 0;
+                    size_t rank( static_cast<size_t>( values.size() * _percent / 100.0 + 0.5 ) );
+                    rank = std::min( std::max<size_t>( rank, 1 ), values.size() ) - 1;
+                    std::nth_element( values.begin(), values.begin() + rank, values.end() );
+                    return values[rank];
+                }
 
+            private:
+                std::vector<uint64_t> m_samples[STcpDiag::fieldsCOUNT];
+        };
+        inline std::ostream &operator<< ( std::ostream &_stream, const CTcpDiagSummary &_val )
+        {
+            for( size_t i = 0; i < STcpDiag::fieldsCOUNT; ++i )
+            {
+                const STcpDiag::EField field( static_cast<STcpDiag::EField>( i ) );
+                if( 0 == _val.size( field ) )
+                    continue;
+                _stream
+                        << STcpDiag::name( field ) << ": p50 " << _val.percentile( field, 50 )
+                        << " p90 " << _val.percentile( field, 90 )
+                        << " p99 " << _val.percentile( field, 99 )
+                        << " max " << _val.percentile( field, 100 )
+                        << " (" << _val.size( field ) << " sockets)\n";
+            }
+            return _stream;
+        }
         /**
          *
          *  @brief A wrapper for a basic Socket
@@ -124,6 +368,11 @@ namespace MiscCommon
                 {
                     return ( INVALID_SOCKET != m_Socket );
                 }
+                /// samples TCP_INFO and the queue depths of the socket
+                bool tcp_diag( STcpDiag *_diag ) const
+                {
+                    return INet::tcp_diag( m_Socket, _diag );
+                }
                 int shutdown( int _How = SHUT_RDWR )
                 {
                     return ::shutdown( m_Socket, _How );
@@ -169,11 +418,13 @@ namespace MiscCommon
             }
             if( bytes_read < 0 )
             {
+                SINetMetrics::instance().m_receiveErrors.add();
                 if( ECONNRESET == errno || ENOTCONN == errno )
                     _Socket.close();
                 throw system_error( "" );
             }
 
+            SINetMetrics::instance().m_received.add( bytes_read );
             return bytes_read;
         }
         /**
@@ -205,11 +456,13 @@ namespace MiscCommon
             }
             if( bytes_read < 0 )
             {
+                SINetMetrics::instance().m_receiveErrors.add();
                 if( ECONNRESET == errno || ENOTCONN == errno )
                     _Socket.close();
                 throw system_error( "" );
             }
 
+            SINetMetrics::instance().m_received.add( bytes_read );
             _Buf->resize( bytes_read );
             return _Socket;
         }
@@ -240,13 +493,203 @@ namespace MiscCommon
                         continue;
                     }
                     else
+                    {
+                        SINetMetrics::instance().m_sendErrors.add();
                         throw system_error( "send data exception: " );
+                    }
                 }
                 total += n;
             }
 
+            SINetMetrics::instance().m_sent.add( total );
             return total;
         }
+        /**
+         *
+         * @brief A maximum number of descriptors recv_with_fds takes at once.
+         *
+         */
+        const size_t MAX_PASSED_FDS = 16;
+        /**
+         *
+         * @brief The function waits until the given socket is ready for the given poll events.
+         *
+         */
+        inline void wait_socket( Socket_t _socket, short _events )
+        {
+            pollfd pfd;
+            pfd.fd = _socket;
+            pfd.events = _events;
+            pfd.revents = 0;
+            while( ::poll( &pfd, 1, -1 ) < 0 )
+            {
+                if( EINTR != errno )
+                    throw system_error( "poll error: " );
+            }
+        }
+        /**
+         *
+         * @brief The function sends _len bytes of _buf together with the descriptor _fd (SCM_RIGHTS).
+         * @brief It works only on AF_UNIX sockets. The descriptor is attached to the first byte,
+         * @brief the receiver gets its own copy of it, the sender may close _fd right after the call.
+         * @return a number of sent bytes, it may be less than _len
+         *
+         */
+        inline size_t send_with_fd( Socket_t _socket, const unsigned char *_buf, size_t _len, int _fd )
+        {
+            if( 0 == _len )
+                throw std::invalid_argument( "send_with_fd: at least one byte must accompany a descriptor" );
+
+            iovec iov;
+            iov.iov_base = const_cast<unsigned char *>( _buf );
+            iov.iov_len = _len;
+            char control[CMSG_SPACE( sizeof( int ) )];
+            memset( control, 0, sizeof( control ) );
+            msghdr msg;
+            memset( &msg, 0, sizeof( msg ) );
+            msg.msg_iov = &iov;
+            msg.msg_iovlen = 1;
+            msg.msg_control = control;
+            msg.msg_controllen = sizeof( control );
+            cmsghdr *cmsg = CMSG_FIRSTHDR( &msg );
+            cmsg->cmsg_level = SOL_SOCKET;
+            cmsg->cmsg_type = SCM_RIGHTS;
+            cmsg->cmsg_len = CMSG_LEN( sizeof( int ) );
+            memcpy( CMSG_DATA( cmsg ), &_fd, sizeof( int ) );
+
+            while( true )
+            {
+                const ssize_t n = ::sendmsg( _socket, &msg, 0 );
+                if( n >= 0 )
+                {
+                    SINetMetrics::instance().m_sent.add( n );
+                    return n;
+                }
+                if( EINTR == errno )
+                    continue;
+                if( EAGAIN == errno || EWOULDBLOCK == errno )
+                {
+                    wait_socket( _socket, POLLOUT );
+                    continue;
+                }
+                SINetMetrics::instance().m_sendErrors.add();
+                throw system_error( "send descriptor exception: " );
+            }
+        }
+        /**
+         *
+         * @brief The function works as recv, but also collects descriptors passed by send_with_fd.
+         * @brief Received descriptors are appended to _fds (if _fds is NULL, they are closed).
+         * @return the same as recv
+         *
+         */
+        inline ssize_t recv_with_fds( Socket_t _socket, unsigned char *_buf, size_t _len,
+                                      std::vector<int> *_fds, int _flags = 0 )
+        {
+            iovec iov;
+            iov.iov_base = _buf;
+            iov.iov_len = _len;
+            char control[CMSG_SPACE( MAX_PASSED_FDS * sizeof( int ) )];
+            msghdr msg;
+            memset( &msg, 0, sizeof( msg ) );
+            msg.msg_iov = &iov;
+            msg.msg_iovlen = 1;
+            msg.msg_control = control;
+            msg.msg_controllen = sizeof( control );
+#ifdef MSG_CMSG_CLOEXEC
+            _flags |= MSG_CMSG_CLOEXEC;
+#endif
+            const ssize_t n = ::recvmsg( _socket, &msg, _flags );
+            if( n < 0 )
+            {
+                if( EAGAIN != errno && EWOULDBLOCK != errno && EINTR != errno )
+                    SINetMetrics::instance().m_receiveErrors.add();
+                return n;
+            }
+            SINetMetrics::instance().m_received.add( n );
+
+            for( cmsghdr *cmsg = CMSG_FIRSTHDR( &msg ); cmsg; cmsg = CMSG_NXTHDR( &msg, cmsg ) )
+            {
+                if( SOL_SOCKET != cmsg->cmsg_level || SCM_RIGHTS != cmsg->cmsg_type )
+                    continue;
+                const size_t count( ( cmsg->cmsg_len - CMSG_LEN( 0 ) ) / sizeof( int ) );
+                for( size_t i = 0; i < count; ++i )
+                {
+                    int fd( -1 );
+                    memcpy( &fd, CMSG_DATA( cmsg ) + i * sizeof( int ), sizeof( int ) );
+                    if( _fds )
+                        _fds->push_back( fd );
+                    else
+                        ::close( fd );
+                }
+            }
+            if( msg.msg_flags & MSG_CTRUNC )
+                throw std::runtime_error( "recv_with_fds: too many descriptors have been passed at once" );
+            return n;
+        }
+        /**
+         *
+         * @brief The function passes the descriptor _fd to the peer of the AF_UNIX socket.
+         * @brief (for example, an accepted connection to another process)
+         *
+         */
+        inline void send_fd( Socket_t _socket, int _fd )
+        {
+            const unsigned char marker( 0 );
+            send_with_fd( _socket, &marker, 1, _fd );
+        }
+        /**
+         *
+         * @brief The function receives a descriptor sent by send_fd. It blocks on a blocking socket.
+         *
+         */
+        inline int recv_fd( Socket_t _socket )
+        {
+            unsigned char marker( 0 );
+            std::vector<int> fds;
+            while( true )
+            {
+                const ssize_t n = recv_with_fds( _socket, &marker, 1, &fds );
+                if( n > 0 )
+                    break;
+                if( 0 == n )
+                    throw std::runtime_error( "recv_fd: the connection has been closed by the peer" );
+                if( EINTR == errno )
+                    continue;
+                if( EAGAIN == errno || EWOULDBLOCK == errno )
+                {
+                    wait_socket( _socket, POLLIN );
+                    continue;
+                }
+                throw system_error( "receive descriptor exception: " );
+            }
+            if( fds.empty() )
+                throw std::runtime_error( "recv_fd: no descriptor has been received" );
+            for( size_t i = 1; i < fds.size(); ++i )
+                ::close( fds[i] );
+            return fds[0];
+        }
+        /**
+         *
+         * @brief The function fills an address of an AF_UNIX socket.
+         * @brief A path, which starts with '@', is a Linux abstract name, it has no file system entry.
+         * @return the size of the address
+         *
+         */
+        inline socklen_t local_address( const std::string &_path, sockaddr_un *_addr )
+        {
+            memset( _addr, 0, sizeof( sockaddr_un ) );
+            _addr->sun_family = AF_UNIX;
+            if( _path.empty() || _path.size() >= sizeof( _addr->sun_path ) )
+                throw std::invalid_argument( "Bad path of a local socket: \"" + _path + "\"" );
+
+            memcpy( _addr->sun_path, _path.c_str(), _path.size() );
+            if( '@' != _path[0] )
+                return sizeof( sockaddr_un );
+
+            _addr->sun_path[0] = '\0';
+            return offsetof( sockaddr_un, sun_path ) + _path.size();
+        }
         /**
          *
          * @brief This is a stream operator which helps to \b send data to the given socket.
@@ -351,6 +794,497 @@ namespace MiscCommon
 
             *_Host = he->h_name;
         }
+        /**
+         *
+         * @brief Socket profiles: profileLOW_LATENCY disables Nagle (TCP_NODELAY) for command round trips,
+         * @brief profileBULK keeps Nagle and sizes the buffers for throughput.
+         *
+         */
+        enum ESocketProfile
+        {
+            profileDEFAULT,
+            profileLOW_LATENCY,
+            profileBULK
+        };
+        /**
+         *
+         * @brief The function applies the profile to a TCP socket, other sockets are left untouched.
+         * @brief _bufSize sets SO_SNDBUF/SO_RCVBUF of profileBULK, 0 keeps the kernel autotuning.
+         * @note Buffers must be set before listen or connect to affect the TCP window scale.
+         *
+         */
+        inline void apply_profile( Socket_t _socket, ESocketProfile _profile, size_t _bufSize = 0 )
+        {
+            if( profileDEFAULT == _profile )
+                return;
+            sockaddr_storage addr;
+            socklen_t len( sizeof( addr ) );
+            if( getsockname( _socket, reinterpret_cast<sockaddr *>( &addr ), &len ) < 0 )
+                throw system_error( "apply_profile: bad socket" );
+            if( AF_INET != addr.ss_family && AF_INET6 != addr.ss_family )
+                return;
+
+            const int nodelay( profileLOW_LATENCY == _profile ? 1 : 0 );
+            if( setsockopt( _socket, IPPROTO_TCP, TCP_NODELAY, &nodelay, sizeof( nodelay ) ) < 0 )
+                throw system_error( "apply_profile: can't set TCP_NODELAY" );
+            if( profileBULK != _profile || 0 == _bufSize )
+                return;
+            const int size( _bufSize );
+            if( setsockopt( _socket, SOL_SOCKET, SO_SNDBUF, &size, sizeof( size ) ) < 0 ||
+                setsockopt( _socket, SOL_SOCKET, SO_RCVBUF, &size, sizeof( size ) ) < 0 )
+                throw system_error( "apply_profile: can't set the socket buffers" );
+        }
+        /**
+         *
+         * @brief The function sizes the buffers of a bulk connection to twice its bandwidth-delay product,
+         * @brief measured by TCP_INFO (delivery rate * RTT) and clamped to [_min, _max].
+         * @brief SO_SNDBUF and SO_RCVBUF are only grown, each on its own, call it periodically while the transfer runs.
+         * @brief Other options (TCP_NODELAY) are left untouched.
+         * @note The kernel caps the result by net.core.wmem_max/rmem_max.
+         * @note Setting SO_RCVBUF switches the kernel receive autotuning off for the socket.
+         * @return the new buffer size or 0 if the buffers were left unchanged
+         *
+         */
+        inline size_t autotune_buffers( Socket_t _socket, size_t _min = 256 * 1024, size_t _max = 16 * 1024 * 1024 )
+        {
+            STcpDiag diag;
+            if( !tcp_diag( _socket, &diag ) || !diag.m_tcp )
+                return 0;
+            const uint64_t bdp( diag.get( STcpDiag::fDELIVERY_RATE ) * diag.get( STcpDiag::fRTT ) / 1000000 );
+            const size_t target( std::min<uint64_t>( std::max<uint64_t>( 2 * bdp, _min ), _max ) );
+
+            const int options[] = { SO_SNDBUF, SO_RCVBUF };
+            bool changed( false );
+            for( size_t i = 0; i < sizeof( options ) / sizeof( options[0] ); ++i )
+            {
+                int current( 0 );
+                socklen_t len( sizeof( current ) );
+                if( getsockopt( _socket, SOL_SOCKET, options[i], &current, &len ) < 0 )
+                    continue;
+                // the kernel reports twice the requested size for its bookkeeping
+                if( target * 2 <= static_cast<size_t>( current ) )
+                    continue;
+                const int size( target );
+                if( setsockopt( _socket, SOL_SOCKET, options[i], &size, sizeof( size ) ) < 0 )
+                    throw system_error( "autotune_buffers: can't set the socket buffers" );
+                changed = true;
+            }
+            return changed ? target : 0;
+        }
+        /**
+         *
+         * @brief The class corks a TCP socket (TCP_CORK) for its lifetime, so a header and a payload
+         * @brief written by separate calls leave in full segments. The data is flushed on destruction.
+         * @note BSD and macOS have TCP_NOPUSH instead, the guard does nothing where neither exists.
+         *
+         */
+        class CCorkGuard
+        {
+            public:
+                explicit CCorkGuard( Socket_t _socket ):
+                    m_socket( _socket )
+                {
+                    set( 1 );
+                }
+                ~CCorkGuard()
+                {
+                    set( 0 );
+                }
+
+            private:
+                // errors are ignored, corking is an optimization and not a TCP socket just isn't corked
+                void set( int _val )
+                {
+#if defined(TCP_CORK)
+                    setsockopt( m_socket, IPPROTO_TCP, TCP_CORK, &_val, sizeof( _val ) );
+#elif defined(TCP_NOPUSH)
+                    setsockopt( m_socket, IPPROTO_TCP, TCP_NOPUSH, &_val, sizeof( _val ) );
+#else
+                    ( void )_val;
+#endif
+                }
+
+            private:
+                Socket_t m_socket;
+        };
+        /**
+         *
+         * @brief A monotonic time in milliseconds, it is used for connection deadlines.
+         * @brief All monotonic clocks of MiscCommon are metricsNowNs (Metrics.h) in other units.
+         *
+         */
+        inline uint64_t monotonic_ms()
+        {
+            return metricsNowNs() / 1000000;
+        }
+        /**
+         *
+         * @brief A monotonic time in microseconds, see monotonic_ms.
+         *
+         */
+        inline uint64_t monotonic_us()
+        {
+            return metricsNowNs() / 1000;
+        }
+        /**
+         *
+         * @brief An address of a connection attempt.
+         *
+         */
+        struct SAddress
+        {
+            sockaddr_storage m_addr;
+            socklen_t m_len;
+        };
+        typedef std::vector<SAddress> Addresses_t;
+        /**
+         *
+         * @brief The function resolves _Host (a host name or an IPv4/IPv6 address) by getaddrinfo.
+         * @brief IPv6 and IPv4 addresses are interleaved, starting with the first returned family (RFC 6555).
+         * @return 0 or an EAI_XXX error code, see gai_strerror
+         *
+         */
+        inline int resolve( const std::string &_Host, unsigned short _nPort, Addresses_t *_addresses )
+        {
+            addrinfo hints;
+            memset( &hints, 0, sizeof( hints ) );
+            hints.ai_family = AF_UNSPEC;
+            hints.ai_socktype = SOCK_STREAM;
+            hints.ai_flags = AI_NUMERICSERV | AI_ADDRCONFIG;
+            std::stringstream port;
+            port << _nPort;
+            addrinfo *res( NULL );
+            const int ret = getaddrinfo( _Host.c_str(), port.str().c_str(), &hints, &res );
+            if( 0 != ret )
+                return ret;
+
+            Addresses_t first;
+            Addresses_t second;
+            for( addrinfo *ai = res; ai; ai = ai->ai_next )
+            {
+                SAddress addr;
+                memset( &addr, 0, sizeof( addr ) );
+                memcpy( &addr.m_addr, ai->ai_addr, ai->ai_addrlen );
+                addr.m_len = ai->ai_addrlen;
+                if( first.empty() || first[0].m_addr.ss_family == ai->ai_family )
+                    first.push_back( addr );
+                else
+                    second.push_back( addr );
+            }
+            freeaddrinfo( res );
+
+            _addresses->clear();
+            for( size_t i = 0; i < first.size() || i < second.size(); ++i )
+            {
+                if( i < first.size() )
+                    _addresses->push_back( first[i] );
+                if( i < second.size() )
+                    _addresses->push_back( second[i] );
+            }
+            return 0;
+        }
+        /**
+         *
+         * @brief A policy of connection attempts.
+         *
+         */
+        struct SConnectPolicy
+        {
+            SConnectPolicy():
+                m_timeoutMs( 10000 ),
+                m_attempts( 1 ),
+                m_backoffMs( 200 ),
+                m_maxBackoffMs( 5000 ),
+                m_staggerMs( 250 ),
+                m_profile( profileDEFAULT ),
+                m_bufSize( 0 )
+            {
+            }
+            // a deadline of one attempt, which races all addresses of the host
+            int m_timeoutMs;
+            // a number of attempts, failed attempts are repeated after the backoff
+            size_t m_attempts;
+            // the backoff doubles after each failed attempt up to m_maxBackoffMs
+            int m_backoffMs;
+            int m_maxBackoffMs;
+            // a delay before the next address is tried in parallel with the pending ones (happy eyeballs)
+            int m_staggerMs;
+            // applied to the sockets before they connect
+            ESocketProfile m_profile;
+            size_t m_bufSize;
+        };
+        /**
+         *
+         * @brief A connection request of connect_all.
+         *
+         */
+        struct SConnectTarget
+        {
+            SConnectTarget( const std::string &_host = "", unsigned short _port = 0 ):
+                m_host( _host ),
+                m_port( _port )
+            {
+            }
+            std::string m_host;
+            unsigned short m_port;
+        };
+        typedef std::vector<SConnectTarget> ConnectTargets_t;
+        /**
+         *
+         * @brief A result of connect_all: a connected blocking socket or INVALID_SOCKET and an error description.
+         *
+         */
+        struct SConnectResult
+        {
+            SConnectResult():
+                m_socket( INVALID_SOCKET ),
+                m_errno( 0 )
+            {
+            }
+            Socket_t m_socket;
+            int m_errno;
+            std::string m_error;
+        };
+        typedef std::vector<SConnectResult> ConnectResults_t;
+        /**
+         *
+         * @brief A state of one target of connect_all.
+         *
+         */
+        struct SConnectJob
+        {
+            enum EState { stCONNECTING, stBACKOFF };
+            size_t m_target;
+            EState m_state;
+            Addresses_t m_addresses;
+            size_t m_next;
+            size_t m_attempt;
+            int m_backoffMs;
+            // the deadline of the attempt in the stCONNECTING state, the end of the backoff otherwise
+            uint64_t m_deadline;
+            uint64_t m_nextStart;
+            std::vector<Socket_t> m_pending;
+        };
+        typedef std::vector<SConnectJob> ConnectJobs_t;
+        /**
+         *
+         * @brief The function connects to all targets concurrently by non-blocking sockets.
+         * @brief At most _maxInFlight targets are being connected at once, the rest waits for a free slot.
+         * @brief Addresses of a target are raced happy eyeballs style: the next address is tried, when the previous
+         * @brief one fails or hasn't answered in SConnectPolicy::m_staggerMs, the first established connection wins.
+         * @brief An attempt, which has failed or exceeded SConnectPolicy::m_timeoutMs, is repeated after the backoff.
+         * @note Host names are resolved by a blocking getaddrinfo when a target gets its slot.
+         * @note The caller takes ownership of the sockets in _results.
+         *
+         */
+        inline void connect_all( const ConnectTargets_t &_targets, ConnectResults_t *_results,
+                                 size_t _maxInFlight = 256, const SConnectPolicy &_policy = SConnectPolicy() )
+        {
+            if( !_results )
+                throw std::invalid_argument( "connect_all: the results pointer is NULL" );
+            if( 0 == _maxInFlight )
+                throw std::invalid_argument( "connect_all: _maxInFlight must be positive" );
+
+
+            _results->clear();
+            _results->resize( _targets.size() );
+            ConnectJobs_t jobs;
+            size_t started( 0 );
+            std::vector<pollfd> pfds;
+            std::vector<std::pair<size_t, size_t> > owners;
+
+            while( started < _targets.size() || !jobs.empty() )
+            {
+                // give free slots to the waiting targets
+                while( jobs.size() < _maxInFlight && started < _targets.size() )
+                {
+                    const size_t i( started++ );
+                    SConnectJob job;
+                    job.m_target = i;
+                    const int ret = resolve( _targets[i].m_host, _targets[i].m_port, &job.m_addresses );
+                    if( 0 != ret || job.m_addresses.empty() )
+                    {
+                        ( *_results )[i].m_errno = EHOSTUNREACH;
+                        ( *_results )[i].m_error = "Can't resolve " + _targets[i].m_host + ": " +
+                                                   ( 0 != ret ? gai_strerror( ret ) : "no addresses" );
+                        SINetMetrics::instance().m_connectErrors.add();
+                        continue;
+                    }
+                    const uint64_t now( monotonic_ms() );
+                    job.m_state = SConnectJob::stCONNECTING;
+                    job.m_next = 0;
+                    job.m_attempt = 1;
+                    job.m_backoffMs = _policy.m_backoffMs;
+                    job.m_deadline = now + _policy.m_timeoutMs;
+                    job.m_nextStart = now;
+                    jobs.push_back( job );
+                }
+
+                // start due addresses, expire attempts and backoffs
+                uint64_t now( monotonic_ms() );
+                uint64_t wakeup( now + 60000 );
+                for( size_t j = 0; j < jobs.size(); )
+                {
+                    SConnectJob &job = jobs[j];
+                    SConnectResult &result = ( *_results )[job.m_target];
+                    bool done( false );
+                    if( SConnectJob::stBACKOFF == job.m_state && now >= job.m_deadline )
+                    {
+                        job.m_state = SConnectJob::stCONNECTING;
+                        job.m_next = 0;
+                        job.m_deadline = now + _policy.m_timeoutMs;
+                        job.m_nextStart = now;
+                    }
+                    if( SConnectJob::stCONNECTING == job.m_state )
+                    {
+                        while( !done && job.m_next < job.m_addresses.size() && now >= job.m_nextStart && now < job.m_deadline )
+                        {
+                            const SAddress &addr = job.m_addresses[job.m_next++];
+                            const Socket_t s = ::socket( addr.m_addr.ss_family, SOCK_STREAM, 0 );
+                            if( s < 0 )
+                                throw system_error( "connect_all: can't create a socket" );
+                            fcntl( s, F_SETFL, fcntl( s, F_GETFL ) | O_NONBLOCK );
+                            apply_profile( s, _policy.m_profile, _policy.m_bufSize );
+                            if( 0 == ::connect( s, reinterpret_cast<const sockaddr *>( &addr.m_addr ), addr.m_len ) )
+                            {
+                                fcntl( s, F_SETFL, fcntl( s, F_GETFL ) & ~O_NONBLOCK );
+                                result.m_socket = s;
+                                SINetMetrics::instance().m_connects.add();
+                                done = true;
+                            }
+                            else if( EINPROGRESS == errno )
+                            {
+                                job.m_pending.push_back( s );
+                                job.m_nextStart = now + _policy.m_staggerMs;
+                            }
+                            else
+                            {
+                                result.m_errno = errno;
+                                ::close( s );
+                            }
+                        }
+                        const bool exhausted( job.m_pending.empty() && job.m_next >= job.m_addresses.size() );
+                        if( !done && ( now >= job.m_deadline || exhausted ) )
+                        {
+                            for( size_t k = 0; k < job.m_pending.size(); ++k )
+                                ::close( job.m_pending[k] );
+                            job.m_pending.clear();
+                            if( !exhausted || 0 == result.m_errno )
+                                result.m_errno = ETIMEDOUT;
+                            if( job.m_attempt >= _policy.m_attempts )
+                            {
+                                std::stringstream ss;
+                                ss << "Can't connect to " << _targets[job.m_target].m_host << ":" << _targets[job.m_target].m_port
+                                   << " (" << job.m_attempt << " attempt(s)): " << strerror( result.m_errno );
+                                result.m_error = ss.str();
+                                SINetMetrics::instance().m_connectErrors.add();
+                                done = true;
+                            }
+                            else
+                            {
+                                ++job.m_attempt;
+                                job.m_state = SConnectJob::stBACKOFF;
+                                job.m_deadline = now + job.m_backoffMs;
+                                job.m_backoffMs = std::min( job.m_backoffMs * 2, _policy.m_maxBackoffMs );
+                            }
+                        }
+                    }
+                    if( done )
+                    {
+                        for( size_t k = 0; k < job.m_pending.size(); ++k )
+                            ::close( job.m_pending[k] );
+                        jobs.erase( jobs.begin() + j );
+                        continue;
+                    }
+                    wakeup = std::min( wakeup, job.m_deadline );
+                    if( SConnectJob::stCONNECTING == job.m_state && job.m_next < job.m_addresses.size() )
+                        wakeup = std::min( wakeup, job.m_nextStart );
+                    ++j;
+                }
+                if( jobs.empty() )
+                    continue;
+
+                // wait for the pending connections
+                pfds.clear();
+                owners.clear();
+                for( size_t j = 0; j < jobs.size(); ++j )
+                {
+                    for( size_t k = 0; k < jobs[j].m_pending.size(); ++k )
+                    {
+                        pollfd pfd;
+                        pfd.fd = jobs[j].m_pending[k];
+                        pfd.events = POLLOUT;
+                        pfd.revents = 0;
+                        pfds.push_back( pfd );
+                        owners.push_back( std::make_pair( j, k ) );
+                    }
+                }
+                now = monotonic_ms();
+                const int timeout( wakeup > now ? static_cast<int>( wakeup - now ) : 0 );
+                const int ready = ::poll( pfds.empty() ? NULL : &pfds[0], pfds.size(), timeout );
+                if( ready < 0 && EINTR != errno )
+                    throw system_error( "connect_all: poll error" );
+                if( ready <= 0 )
+                    continue;
+
+                now = monotonic_ms();
+                // walk backwards, so erasing a pending socket doesn't shift the ones still to be checked
+                for( size_t p = pfds.size(); p-- > 0; )
+                {
+                    if( 0 == pfds[p].revents )
+                        continue;
+                    SConnectJob &job = jobs[owners[p].first];
+                    SConnectResult &result = ( *_results )[job.m_target];
+                    if( INVALID_SOCKET != result.m_socket )
+                        continue;
+                    int err( 0 );
+                    socklen_t len( sizeof( err ) );
+                    if( getsockopt( pfds[p].fd, SOL_SOCKET, SO_ERROR, &err, &len ) < 0 )
+                        err = errno;
+                    job.m_pending.erase( job.m_pending.begin() + owners[p].second );
+                    if( 0 == err )
+                    {
+                        fcntl( pfds[p].fd, F_SETFL, fcntl( pfds[p].fd, F_GETFL ) & ~O_NONBLOCK );
+                        result.m_socket = pfds[p].fd;
+                        result.m_errno = 0;
+                        SINetMetrics::instance().m_connects.add();
+                        for( size_t k = 0; k < job.m_pending.size(); ++k )
+                            ::close( job.m_pending[k] );
+                        job.m_pending.clear();
+                        // the job is removed by the next pass
+                        job.m_next = job.m_addresses.size();
+                        continue;
+                    }
+                    ::close( pfds[p].fd );
+                    result.m_errno = err;
+                    // a failed address doesn't wait for the stagger delay
+                    job.m_nextStart = now;
+                }
+                // remove the connected jobs
+                for( size_t j = 0; j < jobs.size(); )
+                {
+                    if( INVALID_SOCKET != ( *_results )[jobs[j].m_target].m_socket )
+                        jobs.erase( jobs.begin() + j );
+                    else
+                        ++j;
+                }
+            }
+        }
+        /**
+         *
+         * @brief The function connects to _Host:_nPort with the given policy.
+         * @return a connected blocking socket, an exception is thrown on failure
+         *
+         */
+        inline Socket_t connect_to( const std::string &_Host, unsigned short _nPort,
+                                    const SConnectPolicy &_policy = SConnectPolicy() )
+        {
+            ConnectResults_t results;
+            connect_all( ConnectTargets_t( 1, SConnectTarget( _Host, _nPort ) ), &results, 1, _policy );
+            if( INVALID_SOCKET == results[0].m_socket )
+                throw std::runtime_error( results[0].m_error );
+            return results[0].m_socket;
+        }
         /**
          *
          * @brief CSocketServer implements a simple socket server.
@@ -359,8 +1293,17 @@ namespace MiscCommon
         class CSocketServer
         {
             public:
-                CSocketServer() : m_Socket( AF_INET, SOCK_STREAM, 0 )
+                CSocketServer() : m_Socket( AF_INET, SOCK_STREAM, 0 ), m_profile( profileDEFAULT )
+                {}
+                /// _domain is AF_INET or AF_UNIX, _type is SOCK_STREAM or (for AF_UNIX) SOCK_SEQPACKET
+                CSocketServer( int _domain, int _type = SOCK_STREAM ) : m_Socket( _domain, _type, 0 ), m_profile( profileDEFAULT )
                 {}
+                /// the profile is applied to the listening socket (call it before Listen) and to accepted sockets
+                void setProfile( ESocketProfile _profile, size_t _bufSize = 0 )
+                {
+                    m_profile = _profile;
+                    apply_profile( m_Socket, _profile, _bufSize );
+                }
                 void Bind( unsigned short _nPort, const std::string *_Addr = NULL ) throw( std::exception )
                 {
                     if( m_Socket < 0 )
@@ -378,6 +1321,34 @@ namespace MiscCommon
                         throw std::runtime_error( socket_error_string( m_Socket, "Socket bind error..." ) );
                 }
 
+                /// binds an AF_UNIX server to _path, a socket file left by a dead server is replaced
+                void BindLocal( const std::string &_path ) throw( std::exception )
+                {
+                    if( m_Socket < 0 )
+                        throw std::runtime_error( "NULL socket has been given to BindLocal" );
+
+                    sockaddr_un addr;
+                    const socklen_t size = local_address( _path, &addr );
+                    if( ::bind( m_Socket, reinterpret_cast<sockaddr *>( &addr ), size ) == 0 )
+                        return;
+                    if( EADDRINUSE != errno || '@' == _path[0] )
+                        throw system_error( "Local socket bind error: " + _path );
+
+                    // nobody listens on a stale socket file
+                    int type( SOCK_STREAM );
+                    socklen_t len( sizeof( type ) );
+                    ::getsockopt( m_Socket, SOL_SOCKET, SO_TYPE, &type, &len );
+                    smart_socket probe( AF_UNIX, type, 0 );
+                    if( ::connect( probe, reinterpret_cast<sockaddr *>( &addr ), size ) == 0 ||
+                        ECONNREFUSED != errno )
+                        throw std::runtime_error( "Local socket " + _path + " is already in use" );
+                    struct stat st;
+                    if( 0 == ::lstat( _path.c_str(), &st ) && S_ISSOCK( st.st_mode ) )
+                        ::unlink( _path.c_str() );
+                    if( ::bind( m_Socket, reinterpret_cast<sockaddr *>( &addr ), size ) < 0 )
+                        throw system_error( "Local socket bind error: " + _path );
+                }
+
                 void Listen( int _Backlog ) throw( std::exception )
                 {
                     if( ::listen( m_Socket, _Backlog ) < 0 )
@@ -386,7 +1357,15 @@ namespace MiscCommon
 
                 Socket_t Accept() const throw( std::exception )
                 {
-                    return ::accept( m_Socket, NULL, NULL );
+                    const Socket_t socket = ::accept( m_Socket, NULL, NULL );
+                    if( socket >= 0 )
+                        SINetMetrics::instance().m_accepts.add();
+                    else if( EAGAIN != errno && EWOULDBLOCK != errno && EINTR != errno )
+                        SINetMetrics::instance().m_acceptErrors.add();
+                    // accepted sockets inherit the buffers, but TCP_NODELAY is set explicitly
+                    if( socket >= 0 && profileLOW_LATENCY == m_profile )
+                        apply_profile( socket, m_profile );
+                    return socket;
                 }
                 Socket_t getSocket()
                 {
@@ -400,9 +1379,15 @@ namespace MiscCommon
                 {
                     return m_Socket.detach();
                 }
+                // adopts an already listening socket, e.g. one handed over by a previous process
+                void attach( Socket_t _socket )
+                {
+                    m_Socket = _socket;
+                }
 
             protected:
                 smart_socket m_Socket;
+                ESocketProfile m_profile;
         };
         /**
          *
@@ -412,23 +1397,43 @@ namespace MiscCommon
         class CSocketClient
         {
             public:
-                CSocketClient() : m_Socket( AF_INET, SOCK_STREAM, 0 )
+                CSocketClient() : m_Socket( AF_INET, SOCK_STREAM, 0 ), m_profile( profileDEFAULT ), m_bufSize( 0 )
+                {}
+                /// _domain is AF_INET or AF_UNIX, _type is SOCK_STREAM or (for AF_UNIX) SOCK_SEQPACKET
+                CSocketClient( int _domain, int _type = SOCK_STREAM ) : m_Socket( _domain, _type, 0 ), m_profile( profileDEFAULT ), m_bufSize( 0 )
                 {}
+                /// the profile is applied by connect, unless its policy has a profile
+                void setProfile( ESocketProfile _profile, size_t _bufSize = 0 )
+                {
+                    m_profile = _profile;
+                    m_bufSize = _bufSize;
+                }
 
-                void connect( unsigned short _nPort, const std::string &_Addr )
+                /// connects to _Addr (a host name or an IPv4/IPv6 address), see connect_all for the policy
+                void connect( unsigned short _nPort, const std::string &_Addr, const SConnectPolicy &_policy = SConnectPolicy() )
+                {
+                    SConnectPolicy policy( _policy );
+                    if( profileDEFAULT == policy.m_profile )
+                    {
+                        policy.m_profile = m_profile;
+                        policy.m_bufSize = m_bufSize;
+                    }
+                    m_Socket = connect_to( _Addr, _nPort, policy );
+                }
+                /// connects an AF_UNIX client to the server at _path
+                void connectLocal( const std::string &_path )
                 {
                     if( m_Socket < 0 )
-                        throw std::runtime_error( socket_error_string( m_Socket, "there was NULL socket given as a client socket to Connect" ) );
-
-                    sockaddr_in addr;
-                    addr.sin_family = AF_INET;
-                    addr.sin_port = htons( _nPort );
-                    std::string ip;
-                    host2ip( _Addr, &ip );
-                    inet_aton( ip.c_str(), &addr.sin_addr );
+                        throw std::runtime_error( "there was NULL socket given as a client socket to connectLocal" );
 
-                    if( ::connect( m_Socket, ( struct sockaddr * ) & addr, sizeof( addr ) ) < 0 )
-                        throw std::runtime_error( socket_error_string( m_Socket, "Can't connect to the server" ) );
+                    sockaddr_un addr;
+                    const socklen_t size = local_address( _path, &addr );
+                    if( ::connect( m_Socket, reinterpret_cast<sockaddr *>( &addr ), size ) < 0 )
+                    {
+                        SINetMetrics::instance().m_connectErrors.add();
+                        throw system_error( "Can't connect to the local server " + _path );
+                    }
+                    SINetMetrics::instance().m_connects.add();
                 }
 
                 Socket_t getSocket()
@@ -446,6 +1451,8 @@ namespace MiscCommon
 
             protected:
                 smart_socket m_Socket;
+                ESocketProfile m_profile;
+                size_t m_bufSize;
         };
         /**
          *
@@ -454,10 +1461,9 @@ namespace MiscCommon
          */
         struct SSocket2String_Trait
         {
-            bool operator()( Socket_t _socket, sockaddr_in *_addr ) const
+            bool operator()( Socket_t _socket, sockaddr_storage *_addr, socklen_t *_size ) const
             {
-                socklen_t size = sizeof( sockaddr );
-                return ( getsockname( _socket, reinterpret_cast<sockaddr *>( _addr ), &size ) == -1 ) ? false : true;
+                return ( getsockname( _socket, reinterpret_cast<sockaddr *>( _addr ), _size ) == -1 ) ? false : true;
             }
         };
         /**
@@ -467,16 +1473,16 @@ namespace MiscCommon
          */
         struct SSocketPeer2String_Trait
         {
-            bool operator()( Socket_t _socket, sockaddr_in *_addr ) const
+            bool operator()( Socket_t _socket, sockaddr_storage *_addr, socklen_t *_size ) const
             {
-                socklen_t size = sizeof( sockaddr );
-                return ( getpeername( _socket, reinterpret_cast<sockaddr *>( _addr ), &size ) == -1 ) ? false : true;
+                return ( getpeername( _socket, reinterpret_cast<sockaddr *>( _addr ), _size ) == -1 ) ? false : true;
             }
         };
         /**
          *
          * @brief A template class, which makes a string representation of the socket.
-         * @brief In a form of [Host name]:[Port].
+         * @brief In a form of [Host name]:[Port] or a path for AF_UNIX sockets.
+         * @brief Numeric IPv6 addresses are put in brackets: [::1]:22001.
          *
          */
         template <class _Type>
@@ -487,10 +1493,44 @@ namespace MiscCommon
                 if( !_Str )
                     return ;
 
-                sockaddr_in addr;
-                if( !_Type()( _Socket, &addr ) )
+                sockaddr_storage storage;
+                socklen_t size( sizeof( storage ) );
+                if( !_Type()( _Socket, &storage, &size ) )
                     return ;
 
+                if( AF_UNIX == storage.ss_family )
+                {
+                    const sockaddr_un *local = reinterpret_cast<const sockaddr_un *>( &storage );
+                    const size_t len( size > offsetof( sockaddr_un, sun_path ) ? size - offsetof( sockaddr_un, sun_path ) : 0 );
+                    if( len > 0 && '\0' == local->sun_path[0] )
+                        *_Str = "@" + std::string( local->sun_path + 1, len - 1 );
+                    else
+                        *_Str = std::string( local->sun_path, strnlen( local->sun_path, len ) );
+                    return ;
+                }
+                if( AF_INET6 == storage.ss_family )
+                {
+                    const sockaddr_in6 &addr = *reinterpret_cast<const sockaddr_in6 *>( &storage );
+                    char host[NI_MAXHOST];
+                    // the numeric form, if the name can't be looked up
+                    const sockaddr *sa( reinterpret_cast<const sockaddr *>( &storage ) );
+                    if( 0 != getnameinfo( sa, size, host, sizeof( host ), NULL, 0, 0 ) &&
+                        0 != getnameinfo( sa, size, host, sizeof( host ), NULL, 0, NI_NUMERICHOST ) )
+                        return ;
+                    const std::string name( host );
+                    std::stringstream ss;
+                    if( std::string::npos != name.find( ':' ) )
+                        ss << "[" << name << "]";
+                    else
+                        ss << name;
+                    ss << ":" << ntohs( addr.sin6_port );
+                    *_Str = ss.str();
+                    return ;
+                }
+                if( AF_INET != storage.ss_family )
+                    return ;
+
+                const sockaddr_in &addr = *reinterpret_cast<const sockaddr_in *>( &storage );
                 std::string host;
                 ip2host( inet_ntoa( addr.sin_addr ), &host );
 
@@ -585,7 +1625,7 @@ namespace MiscCommon
             return 0;
         }
 
-        // The following 4 functions convert values between host and network byte order.
+        // The following functions convert 16, 32 and 64 bit values between host and network byte order.
         // Whenever data should be send to a remote peer the _normalizeWrite must be used.
         // Whenever data are going to be read from the _normalizeRead must be used to check that Endianness is correct.
         inline uint16_t _normalizeRead16( uint16_t _value )
@@ -604,6 +1644,18 @@ namespace MiscCommon
         {
             return htonl( _value );
         }
+        // there is no standard 64 bit ntoh, the two halves are swapped on little endian hosts
+        inline uint64_t _normalizeRead64( uint64_t _value )
+        {
+            const uint32_t test( 1 );
+            if( 1 == htonl( test ) )
+                return _value;
+            return ( static_cast<uint64_t>( ntohl( _value & 0xFFFFFFFF ) ) << 32 ) | ntohl( _value >> 32 );
+        }
+        inline uint64_t _normalizeWrite64( uint64_t _value )
+        {
+            return _normalizeRead64( _value );
+        }
         /**
          *
          * @brief A helper function, which insures that whole buffer was written.
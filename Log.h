@@ -28,6 +28,7 @@
 #include "Res.h"
 #include "def.h"
 #include "SysHelper.h"
+#include "Metrics.h"
 
 namespace MiscCommon
 {
@@ -49,6 +50,44 @@ namespace MiscCommon
         e_FieldSeparator = 0x20,
         e_WhiteSpace = 0x20
     };
+    /**
+     *
+     * @brief Messages of CLog by severity, see CMetricsRegistry.
+     * @brief A message is dropped, if its severity is filtered out by the log level or the stream has failed.
+     *
+     */
+    struct SLogMetrics
+    {
+        enum { SEVERITIES = 5 };
+        SLogMetrics()
+        {
+            const char *names[SEVERITIES] = { "info", "warning", "fault", "critical_error", "debug" };
+            CMetricsRegistry &registry( CMetricsRegistry::instance() );
+            for( size_t i = 0; i < SEVERITIES; ++i )
+            {
+                const std::string severity( metricsLabel( "severity", names[i] ) );
+                m_messages[i] = &registry.counter( "misccommon_log_messages_total", "Log messages written", severity );
+                m_filtered[i] = &registry.counter( "misccommon_log_dropped_total", "Log messages dropped",
+                                                   severity + "," + metricsLabel( "reason", "level" ) );
+                m_failed[i] = &registry.counter( "misccommon_log_dropped_total", "Log messages dropped",
+                                                 severity + "," + metricsLabel( "reason", "stream" ) );
+            }
+        }
+        static SLogMetrics &instance()
+        {
+            static SLogMetrics metrics;
+            return metrics;
+        }
+        // the index of a severity bit
+        static size_t index( LOG_SEVERITY _Severity )
+        {
+            const size_t ret( _Severity ? __builtin_ctz( _Severity ) : SEVERITIES );
+            return ( ret < SEVERITIES ) ? ret : SEVERITIES - 1;
+        }
+        CCounter *m_messages[SEVERITIES];
+        CCounter *m_filtered[SEVERITIES];
+        CCounter *m_failed[SEVERITIES];
+    };
     /**
      *
      * @brief A simple template class which represents the Log engine of library.
@@ -68,8 +107,13 @@ namespace MiscCommon
             void push( LOG_SEVERITY _Severity, unsigned long _ErrorCode,
                        const std::string &_Module, const std::string &_Message )
             {
+                SLogMetrics &metrics( SLogMetrics::instance() );
+                const size_t severity( SLogMetrics::index( _Severity ) );
                 if(( _Severity & m_logLevel ) != _Severity )
+                {
+                    metrics.m_filtered[severity]->add();
                     return;
+                }
 
                 // Thread ID
                 pid_t tid = gettid();
@@ -87,10 +131,15 @@ namespace MiscCommon
                 {
                     *m_stream << strMsg.str() << std::endl;
                     m_stream->flush();
+                    if( m_stream->good() )
+                        metrics.m_messages[severity]->add();
+                    else
+                        metrics.m_failed[severity]->add();
                 }
                 else
                 {
                     std::cout << strMsg.str() << std::endl;
+                    metrics.m_messages[severity]->add();
                 }
             }
 
@@ -0,0 +1,485 @@
+/************************************************************************/
+/**
+ * @file Metrics.h
+ * @brief Counters, gauges and latency histograms with a Prometheus text exposition
+ * @author Anar Manafov A.Manafov@gsi.de
+ */ /*
+
+        version number:     $LastChangedRevision$
+        created by:         Anar Manafov
+                            2012-11-29
+        last changed by:    $LastChangedBy$ $LastChangedDate$
+
+        Copyright (c) 2012 GSI, Scientific Computing division. All rights reserved.
+*************************************************************************/
+#ifndef METRICS_H_
+#define METRICS_H_
+
+// API
+#include <stdint.h>
+#include <stdlib.h>
+#include <time.h>
+// STD
+#include <algorithm>
+#include <cctype>
+#include <cstring>
+#include <map>
+#include <new>
+#include <ostream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+// MiscCommon
+#include "MiscUtils.h"
+#include "SysHelper.h"
+
+namespace MiscCommon
+{
+    /// a number of shards of a metric, threads are spread over them round robin
+    const size_t METRICS_SHARDS = 16;
+    /// shards of different threads never share a cache line
+    const size_t METRICS_CACHE_LINE = 64;
+    /**
+     *
+     * @brief The function returns the shard of the calling thread.
+     *
+     */
+    inline size_t metricsShard()
+    {
+        static __thread size_t shard = 0;
+        if( 0 == shard )
+        {
+            static size_t next = 0;
+            shard = __sync_add_and_fetch( &next, 1 );
+        }
+        return shard % METRICS_SHARDS;
+    }
+    /**
+     *
+     * @brief The function returns CLOCK_MONOTONIC in nanoseconds.
+     *
+     */
+    inline uint64_t metricsNowNs()
+    {
+        timespec ts;
+        clock_gettime( CLOCK_MONOTONIC, &ts );
+        return static_cast<uint64_t>( ts.tv_sec ) * 1000000000ULL + ts.tv_nsec;
+    }
+    /**
+     *
+     * @brief The function formats a label of a metric, _value is escaped: key="value".
+     *
+     */
+    inline std::string metricsLabel( const std::string &_key, const std::string &_value )
+    {
+        std::string ret( _key + "=\"" );
+        for( size_t i = 0; i < _value.size(); ++i )
+        {
+            if( '\\' == _value[i] || '"' == _value[i] )
+                ret += '\\';
+            if( '\n' == _value[i] )
+                ret += "\\n";
+            else
+                ret += _value[i];
+        }
+        return ret + '"';
+    }
+    /**
+     *
+     * @brief A base of objects, which are allocated on a cache line boundary also by new.
+     *
+     */
+    class CCacheAligned
+    {
+        public:
+            static void *operator new( size_t _size )
+            {
+                void *p( NULL );
+                if( 0 != posix_memalign( &p, METRICS_CACHE_LINE, _size ) )
+                    throw std::bad_alloc();
+                return p;
+            }
+            static void operator delete( void *_p )
+            {
+                free( _p );
+            }
+    };
+    /**
+     *
+     * @brief A monotonic counter.
+     * @brief An update is one atomic add to the shard of the calling thread, so threads don't contend
+     * @brief for a cache line. A reader sums the shards.
+     *
+     */
+    class CCounter: public CCacheAligned, public NONCopyable
+    {
+        public:
+            CCounter()
+            {
+                memset( m_slots, 0, sizeof( m_slots ) );
+            }
+            void add( uint64_t _n = 1 )
+            {
+                __sync_fetch_and_add( &m_slots[metricsShard()].m_value, _n );
+            }
+            uint64_t value() const
+            {
+                uint64_t ret( 0 );
+                for( size_t i = 0; i < METRICS_SHARDS; ++i )
+                    ret += m_slots[i].m_value;
+                return ret;
+            }
+
+        private:
+            struct SSlot
+            {
+                volatile uint64_t m_value;
+            } __attribute__(( aligned( METRICS_CACHE_LINE ) ) );
+            SSlot m_slots[METRICS_SHARDS];
+    };
+    /**
+     *
+     * @brief A value, which goes up and down (connections, queue depth, ...).
+     * @brief It can't be sharded, since set must replace the value of all threads.
+     *
+     */
+    class CGauge: public NONCopyable
+    {
+        public:
+            CGauge():
+                m_value( 0 )
+            {
+            }
+            void set( int64_t _value )
+            {
+                __sync_lock_test_and_set( &m_value, _value );
+            }
+            void add( int64_t _delta )
+            {
+                __sync_fetch_and_add( &m_value, _delta );
+            }
+            int64_t value() const
+            {
+                return m_value;
+            }
+
+        private:
+            volatile int64_t m_value;
+    };
+    /**
+     *
+     * @brief Merged buckets of CHistogram.
+     *
+     */
+    struct SHistogramSnapshot
+    {
+        SHistogramSnapshot():
+            m_count( 0 ),
+            m_sum( 0 )
+        {
+        }
+        /// a number of values <= _bound, exact for the bucket bounds (powers of two in particular)
+        uint64_t cumulative( uint64_t _bound ) const;
+        /// an upper bound of the _q quantile (0 <= _q <= 1), 0 if there are no values
+        uint64_t quantile( double _q ) const;
+
+        std::vector<uint64_t> m_buckets;
+        uint64_t m_count;
+        uint64_t m_sum;
+    };
+    /**
+     *
+     * @brief An HDR-style histogram of integer values (latencies in ns, sizes in bytes, ...).
+     * @brief Buckets are log-linear: each power of two is split into 2^SUB_BITS buckets, so a value is
+     * @brief known with an error below 1/2^SUB_BITS over the whole range, without configuring bounds.
+     * @brief A bucket holds values (lower, upper], values above 2^MAX_BITS are counted in the last bucket.
+     * @brief Shards are the same as of CCounter.
+     *
+     */
+    class CHistogram: public CCacheAligned, public NONCopyable
+    {
+        public:
+            enum
+            {
+                SUB_BITS = 3,
+                SUB_BUCKETS = 1 << SUB_BITS,
+                MAX_BITS = 40,
+                BUCKETS = ( MAX_BITS - SUB_BITS + 1 ) * SUB_BUCKETS
+            };
+
+        public:
+            CHistogram()
+            {
+                memset( m_shards, 0, sizeof( m_shards ) );
+            }
+            void record( uint64_t _value )
+            {
+                SShard &shard = m_shards[metricsShard()];
+                __sync_fetch_and_add( &shard.m_buckets[bucket( _value )], 1 );
+                __sync_fetch_and_add( &shard.m_sum, _value );
+            }
+            void snapshot( SHistogramSnapshot *_snapshot ) const
+            {
+                if( !_snapshot )
+                    throw std::invalid_argument( "CHistogram::snapshot: the snapshot pointer is NULL" );
+                _snapshot->m_buckets.assign( BUCKETS, 0 );
+                _snapshot->m_count = 0;
+                _snapshot->m_sum = 0;
+                for( size_t s = 0; s < METRICS_SHARDS; ++s )
+                {
+                    for( size_t i = 0; i < BUCKETS; ++i )
+                    {
+                        const uint64_t n( m_shards[s].m_buckets[i] );
+                        _snapshot->m_buckets[i] += n;
+                        _snapshot->m_count += n;
+                    }
+                    _snapshot->m_sum += m_shards[s].m_sum;
+                }
+            }
+            static size_t bucket( uint64_t _value )
+            {
+                // buckets are taken of _value - 1, so powers of two are upper bounds
+                uint64_t x( _value > 0 ? _value - 1 : 0 );
+                if( x >= ( 1ULL << MAX_BITS ) )
+                    x = ( 1ULL << MAX_BITS ) - 1;
+                if( x < SUB_BUCKETS )
+                    return x;
+                const size_t e( 63 - __builtin_clzll( x ) );
+                return ( e - SUB_BITS + 1 ) * SUB_BUCKETS + ( ( x >> ( e - SUB_BITS ) ) & ( SUB_BUCKETS - 1 ) );
+            }
+            /// the largest value of the bucket
+            static uint64_t upperBound( size_t _bucket )
+            {
+                if( _bucket < SUB_BUCKETS )
+                    return _bucket + 1;
+                const size_t e( _bucket / SUB_BUCKETS + SUB_BITS - 1 );
+                return static_cast<uint64_t>( SUB_BUCKETS + _bucket % SUB_BUCKETS + 1 ) << ( e - SUB_BITS );
+            }
+
+        private:
+            struct SShard
+            {
+                volatile uint64_t m_buckets[BUCKETS];
+                volatile uint64_t m_sum;
+            } __attribute__(( aligned( METRICS_CACHE_LINE ) ) );
+            SShard m_shards[METRICS_SHARDS];
+    };
+    inline uint64_t SHistogramSnapshot::cumulative( uint64_t _bound ) const
+    {
+        uint64_t ret( 0 );
+        for( size_t i = 0; i < m_buckets.size() && CHistogram::upperBound( i ) <= _bound; ++i )
+            ret += m_buckets[i];
+        return ret;
+    }
+    inline uint64_t SHistogramSnapshot::quantile( double _q ) const
+    {
+        if( 0 == m_count )
+            return 0;
+        // the rank of the value, 1 based
+        uint64_t rank( static_cast<uint64_t>( _q * m_count + 0.5 ) );
+        rank = std::max<uint64_t>( 1, std::min( rank, m_count ) );
+        uint64_t seen( 0 );
+        for( size_t i = 0; i < m_buckets.size(); ++i )
+        {
+            seen += m_buckets[i];
+            if( seen >= rank )
+                return CHistogram::upperBound( i );
+        }
+        return CHistogram::upperBound( m_buckets.size() - 1 );
+    }
+    /**
+     *
+     * @brief The class records its life time (ns) into a histogram.
+     *
+     */
+    class CHistogramTimer: public NONCopyable
+    {
+        public:
+            CHistogramTimer( CHistogram &_histogram ):
+                m_histogram( _histogram ),
+                m_start( metricsNowNs() )
+            {
+            }
+            ~CHistogramTimer()
+            {
+                m_histogram.record( metricsNowNs() - m_start );
+            }
+
+        private:
+            CHistogram &m_histogram;
+            uint64_t m_start;
+    };
+    /**
+     *
+     * @brief The registry of all metrics of a process.
+     * @brief A metric is identified by its name and labels, it is created by the first call and lives
+     * @brief until the process exits. Lookups take a mutex, so callers keep the returned reference.
+     * @brief Labels are given in the exposition form: key1="value1",key2="value2" (see metricsLabel).
+     * @note Example:
+     * @code
+     *
+     * static CCounter &requests = CMetricsRegistry::instance().counter( "agent_requests_total", "Handled requests" );
+     * requests.add();
+     * ...
+     * CMetricsRegistry::instance().writePrometheus( std::cout );
+     *
+     * @endcode
+     *
+     */
+    class CMetricsRegistry: public NONCopyable
+    {
+        public:
+            typedef enum EType
+            {
+                typeCOUNTER,
+                typeGAUGE,
+                typeHISTOGRAM
+            } EType_t;
+
+        private:
+            struct SFamily
+            {
+                SFamily():
+                    m_type( typeCOUNTER ),
+                    m_scale( 1 )
+                {
+                }
+                EType_t m_type;
+                std::string m_help;
+                // a factor of histogram values in the exposition (1e-9 exposes ns as seconds)
+                double m_scale;
+                std::map<std::string, CCounter*> m_counters;
+                std::map<std::string, CGauge*> m_gauges;
+                std::map<std::string, CHistogram*> m_histograms;
+            };
+            typedef std::map<std::string, SFamily> Families_t;
+
+        public:
+            CMetricsRegistry()
+            {
+            }
+            ~CMetricsRegistry()
+            {
+                for( Families_t::iterator f = m_families.begin(); f != m_families.end(); ++f )
+                {
+                    for( std::map<std::string, CCounter*>::iterator i = f->second.m_counters.begin(); i != f->second.m_counters.end(); ++i )
+                        delete i->second;
+                    for( std::map<std::string, CGauge*>::iterator i = f->second.m_gauges.begin(); i != f->second.m_gauges.end(); ++i )
+                        delete i->second;
+                    for( std::map<std::string, CHistogram*>::iterator i = f->second.m_histograms.begin(); i != f->second.m_histograms.end(); ++i )
+                        delete i->second;
+                }
+            }
+            /// the registry of the process, it is never destroyed, threads may update metrics until exit
+            static CMetricsRegistry &instance()
+            {
+                static CMetricsRegistry *registry = new CMetricsRegistry;
+                return *registry;
+            }
+            CCounter &counter( const std::string &_name, const std::string &_help, const std::string &_labels = "" )
+            {
+                smart_mutex lock( m_mutex );
+                CCounter *&ret = family( typeCOUNTER, _name, _help, 1 ).m_counters[_labels];
+                if( !ret )
+                    ret = new CCounter;
+                return *ret;
+            }
+            CGauge &gauge( const std::string &_name, const std::string &_help, const std::string &_labels = "" )
+            {
+                smart_mutex lock( m_mutex );
+                CGauge *&ret = family( typeGAUGE, _name, _help, 1 ).m_gauges[_labels];
+                if( !ret )
+                    ret = new CGauge;
+                return *ret;
+            }
+            CHistogram &histogram( const std::string &_name, const std::string &_help,
+                                   const std::string &_labels = "", double _scale = 1 )
+            {
+                smart_mutex lock( m_mutex );
+                CHistogram *&ret = family( typeHISTOGRAM, _name, _help, _scale ).m_histograms[_labels];
+                if( !ret )
+                    ret = new CHistogram;
+                return *ret;
+            }
+            /// writes all metrics in the Prometheus text format (version 0.0.4)
+            void writePrometheus( std::ostream &_stream ) const
+            {
+                std::ostringstream ss;
+                ss.precision( 12 );
+                SHistogramSnapshot snapshot;
+                smart_mutex lock( m_mutex );
+                for( Families_t::const_iterator f = m_families.begin(); f != m_families.end(); ++f )
+                {
+                    const std::string &name( f->first );
+                    const SFamily &family( f->second );
+                    ss << "# HELP " << name << ' ' << escapeHelp( family.m_help ) << '\n'
+                       << "# TYPE " << name << ' '
+                       << ( typeCOUNTER == family.m_type ? "counter" : ( typeGAUGE == family.m_type ? "gauge" : "histogram" ) ) << '\n';
+                    for( std::map<std::string, CCounter*>::const_iterator i = family.m_counters.begin(); i != family.m_counters.end(); ++i )
+                        ss << name << braces( i->first ) << ' ' << i->second->value() << '\n';
+                    for( std::map<std::string, CGauge*>::const_iterator i = family.m_gauges.begin(); i != family.m_gauges.end(); ++i )
+                        ss << name << braces( i->first ) << ' ' << i->second->value() << '\n';
+                    for( std::map<std::string, CHistogram*>::const_iterator i = family.m_histograms.begin(); i != family.m_histograms.end(); ++i )
+                    {
+                        i->second->snapshot( &snapshot );
+                        const std::string prefix( i->first.empty() ? "" : i->first + "," );
+                        // the buckets of powers of two, a stable set of series for every scrape
+                        for( size_t bits = 0; bits <= CHistogram::MAX_BITS; ++bits )
+                        {
+                            const uint64_t bound( 1ULL << bits );
+                            ss << name << "_bucket{" << prefix << "le=\"" << bound * family.m_scale << "\"} "
+                               << snapshot.cumulative( bound ) << '\n';
+                        }
+                        ss << name << "_bucket{" << prefix << "le=\"+Inf\"} " << snapshot.m_count << '\n'
+                           << name << "_sum" << braces( i->first ) << ' ' << snapshot.m_sum * family.m_scale << '\n'
+                           << name << "_count" << braces( i->first ) << ' ' << snapshot.m_count << '\n';
+                    }
+                }
+                _stream << ss.str();
+            }
+
+        private:
+            SFamily &family( EType_t _type, const std::string &_name, const std::string &_help, double _scale )
+            {
+                if( _name.empty() || isdigit( _name[0] ) ||
+                    std::string::npos != _name.find_first_not_of( "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789_:" ) )
+                    throw std::invalid_argument( "Bad metric name: \"" + _name + "\"" );
+                Families_t::iterator found = m_families.find( _name );
+                if( m_families.end() != found )
+                {
+                    if( found->second.m_type != _type )
+                        throw std::logic_error( "The metric \"" + _name + "\" is already registered with another type" );
+                    return found->second;
+                }
+                SFamily &ret = m_families[_name];
+                ret.m_type = _type;
+                ret.m_help = _help;
+                ret.m_scale = _scale;
+                return ret;
+            }
+            static std::string braces( const std::string &_labels )
+            {
+                return _labels.empty() ? _labels : "{" + _labels + "}";
+            }
+            static std::string escapeHelp( const std::string &_help )
+            {
+                std::string ret;
+                for( size_t i = 0; i < _help.size(); ++i )
+                {
+                    if( '\\' == _help[i] )
+                        ret += "\\\\";
+                    else if( '\n' == _help[i] )
+                        ret += "\\n";
+                    else
+                        ret += _help[i];
+                }
+                return ret;
+            }
+
+        private:
+            mutable CMutex m_mutex;
+            Families_t m_families;
+    };
+};
+#endif /* METRICS_H_ */
@@ -0,0 +1,275 @@
+/************************************************************************/
+/**
+ * @file MetricsServer.h
+ * @brief A local HTTP endpoint, which serves the metrics registry in the Prometheus text format
+ * @author Anar Manafov A.Manafov@gsi.de
+ */ /*
+
+        version number:     $LastChangedRevision$
+        created by:         Anar Manafov
+                            2012-11-29
+        last changed by:    $LastChangedBy$ $LastChangedDate$
+
+        Copyright (c) 2012 GSI, Scientific Computing division. All rights reserved.
+*************************************************************************/
+#ifndef METRICSSERVER_H_
+#define METRICSSERVER_H_
+
+// API
+#include <pthread.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+// STD
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+// MiscCommon
+#include "ErrorCode.h"
+#include "MiscUtils.h"
+#include "INet.h"
+#include "Metrics.h"
+
+namespace MiscCommon
+{
+#ifdef MSG_NOSIGNAL
+    const int METRICS_SEND_FLAGS = MSG_NOSIGNAL;
+#else
+    const int METRICS_SEND_FLAGS = 0;
+#endif
+    /**
+     *
+     * @brief The class serves CMetricsRegistry over HTTP: "GET /metrics" returns the Prometheus text format.
+     * @brief It listens on a TCP port and/or on an AF_UNIX socket, one request per connection.
+     * @brief Requests are served either by its own thread (start) or by the caller (process).
+     * @note Example:
+     * @code
+     *
+     * CMetricsServer server;
+     * server.listenLocal( "/tmp/pod-agent.metrics" );
+     * server.start();
+     * ...
+     * // curl --unix-socket /tmp/pod-agent.metrics http://localhost/metrics
+     *
+     * @endcode
+     *
+     */
+    class CMetricsServer: public NONCopyable
+    {
+        public:
+            /// a limit of a request head
+            static const size_t MAX_REQUEST_SIZE = 8192;
+
+        public:
+            CMetricsServer( CMetricsRegistry &_registry = CMetricsRegistry::instance() ):
+                m_registry( _registry ),
+                m_running( false )
+            {
+                if( ::pipe( m_wakeup ) < 0 )
+                    throw system_error( "CMetricsServer: can't create a pipe" );
+            }
+            ~CMetricsServer()
+            {
+                stop();
+                for( size_t i = 0; i < m_servers.size(); ++i )
+                    delete m_servers[i];
+                ::close( m_wakeup[0] );
+                ::close( m_wakeup[1] );
+            }
+            /// listens on _addr:_port (_port 0 - any free port)
+            /// return: the port
+            unsigned short listen( unsigned short _port, const std::string &_addr = "127.0.0.1" )
+            {
+                if( m_running )
+                    throw std::logic_error( "CMetricsServer: can't listen, when the server is running" );
+                INet::CSocketServer *server = new INet::CSocketServer;
+                m_servers.push_back( server );
+                int reuse( 1 );
+                ::setsockopt( server->getSocket(), SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof( reuse ) );
+                server->Bind( _port, &_addr );
+                server->Listen( 16 );
+                server->setNonBlock();
+                sockaddr_in addr;
+                socklen_t size( sizeof( addr ) );
+                if( ::getsockname( server->getSocket(), reinterpret_cast<sockaddr *>( &addr ), &size ) < 0 )
+                    throw system_error( "CMetricsServer: getsockname failed" );
+                return ntohs( addr.sin_port );
+            }
+            /// listens on an AF_UNIX socket, see INet::local_address for abstract names
+            void listenLocal( const std::string &_path )
+            {
+                if( m_running )
+                    throw std::logic_error( "CMetricsServer: can't listen, when the server is running" );
+                INet::CSocketServer *server = new INet::CSocketServer( AF_UNIX );
+                m_servers.push_back( server );
+                server->BindLocal( _path );
+                server->Listen( 16 );
+                server->setNonBlock();
+            }
+            /// waits at most _timeoutMs (-1 - no limit) and serves pending requests
+            /// return: a number of served requests, 0 also if stop has been called
+            size_t process( int _timeoutMs )
+            {
+                std::vector<pollfd> pfds( m_servers.size() + 1 );
+                for( size_t i = 0; i < m_servers.size(); ++i )
+                {
+                    pfds[i].fd = m_servers[i]->getSocket();
+                    pfds[i].events = POLLIN;
+                    pfds[i].revents = 0;
+                }
+                pfds.back().fd = m_wakeup[0];
+                pfds.back().events = POLLIN;
+                pfds.back().revents = 0;
+                const int ready = ::poll( &pfds[0], pfds.size(), _timeoutMs );
+                if( ready < 0 && EINTR != errno )
+                    throw system_error( "CMetricsServer: poll error" );
+                if( ready <= 0 || pfds.back().revents )
+                    return 0;
+
+                size_t served( 0 );
+                for( size_t i = 0; i < m_servers.size(); ++i )
+                {
+                    if( !pfds[i].revents )
+                        continue;
+                    // listeners are non-blocking: a client, which has reset its connection
+                    // after poll, leaves nothing to accept (EAGAIN) instead of blocking the server
+                    INet::smart_socket client( m_servers[i]->Accept() );
+                    if( !client.is_valid() )
+                        continue;
+                    // some systems pass O_NONBLOCK of the listener to accepted sockets
+                    client.set_nonblock( false );
+                    serve( client );
+                    ++served;
+                }
+                return served;
+            }
+            /// serves requests in a thread of the server
+            void start()
+            {
+                if( m_running )
+                    return;
+                if( m_servers.empty() )
+                    throw std::logic_error( "CMetricsServer: call listen or listenLocal before start" );
+                if( 0 != pthread_create( &m_thread, NULL, &CMetricsServer::threadMain, this ) )
+                    throw std::runtime_error( "CMetricsServer: can't create a thread" );
+                m_running = true;
+            }
+            void stop()
+            {
+                if( !m_running )
+                    return;
+                const char wake( 0 );
+                while( ::write( m_wakeup[1], &wake, 1 ) < 0 && EINTR == errno )
+                    ;
+                pthread_join( m_thread, NULL );
+                m_running = false;
+                char drain( 0 );
+                while( ::read( m_wakeup[0], &drain, 1 ) < 0 && EINTR == errno )
+                    ;
+            }
+
+        private:
+            static void *threadMain( void *_this )
+            {
+                CMetricsServer *self = reinterpret_cast<CMetricsServer *>( _this );
+                while( true )
+                {
+                    pollfd pfd;
+                    pfd.fd = self->m_wakeup[0];
+                    pfd.events = POLLIN;
+                    pfd.revents = 0;
+                    if( ::poll( &pfd, 1, 0 ) > 0 )
+                        break;
+                    try
+                    {
+                        self->process( -1 );
+                    }
+                    catch( ... )
+                    {
+                        // a failed poll is retried, the metrics are only read here
+                        usleep( 100000 );
+                    }
+                }
+                return NULL;
+            }
+            void serve( INet::smart_socket &_client )
+            {
+                // a slow client doesn't block the others for long
+                timeval timeout;
+                timeout.tv_sec = 1;
+                timeout.tv_usec = 0;
+                ::setsockopt( _client, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof( timeout ) );
+                ::setsockopt( _client, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof( timeout ) );
+
+                std::string request;
+                char buf[1024];
+                while( std::string::npos == request.find( "\r\n\r\n" ) && std::string::npos == request.find( "\n\n" ) &&
+                       request.size() < MAX_REQUEST_SIZE )
+                {
+                    const ssize_t n = ::recv( _client, buf, sizeof( buf ), 0 );
+                    if( n < 0 && EINTR == errno )
+                        continue;
+                    if( n <= 0 )
+                        break;
+                    request.append( buf, n );
+                }
+
+                // the request line: METHOD PATH VERSION
+                std::istringstream line( request.substr( 0, request.find( '\n' ) ) );
+                std::string method;
+                std::string path;
+                line >> method >> path;
+                path = path.substr( 0, path.find( '?' ) );
+
+                std::string status( "200 OK" );
+                std::string body;
+                if( "GET" != method && "HEAD" != method )
+                {
+                    status = "405 Method Not Allowed";
+                    body = "Only GET is supported.\n";
+                }
+                else if( "/metrics" != path && "/" != path )
+                {
+                    status = "404 Not Found";
+                    body = "Metrics are served at /metrics.\n";
+                }
+                else
+                {
+                    std::ostringstream ss;
+                    m_registry.writePrometheus( ss );
+                    body = ss.str();
+                }
+
+                std::ostringstream response;
+                response
+                        << "HTTP/1.0 " << status << "\r\n"
+                        << "Content-Type: text/plain; version=0.0.4; charset=utf-8\r\n"
+                        << "Content-Length: " << body.size() << "\r\n"
+                        << "Connection: close\r\n\r\n";
+                if( "HEAD" != method )
+                    response << body;
+                const std::string out( response.str() );
+                // not sendall: it spins on EAGAIN, which is the send timeout here
+                size_t sent( 0 );
+                while( sent < out.size() )
+                {
+                    const ssize_t n = ::send( _client, out.c_str() + sent, out.size() - sent, METRICS_SEND_FLAGS );
+                    if( n < 0 && EINTR == errno )
+                        continue;
+                    if( n <= 0 )
+                        break; // the client has gone away or is too slow
+                    sent += n;
+                }
+            }
+
+        private:
+            CMetricsRegistry &m_registry;
+            std::vector<INet::CSocketServer *> m_servers;
+            int m_wakeup[2];
+            pthread_t m_thread;
+            bool m_running;
+    };
+};
+#endif /* METRICSSERVER_H_ */
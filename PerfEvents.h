@@ -0,0 +1,277 @@
+/************************************************************************/
+/**
+ * @file PerfEvents.h
+ * @brief Hardware counters (cycles, instructions, cache and branch misses) by perf_event_open
+ * @author Anar Manafov A.Manafov@gsi.de
+ */ /*
+
+        version number:     $LastChangedRevision$
+        created by:         Anar Manafov
+                            2012-12-01
+        last changed by:    $LastChangedBy$ $LastChangedDate$
+
+        Copyright (c) 2012 GSI, Scientific Computing division. All rights reserved.
+*************************************************************************/
+#ifndef PERFEVENTS_H_
+#define PERFEVENTS_H_
+
+// API
+#include <stdint.h>
+#include <unistd.h>
+#if defined(__linux__)
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#endif
+// STD
+#include <cstring>
+#include <string>
+// MiscCommon
+#include "ErrorCode.h"
+#include "MiscUtils.h"
+
+namespace MiscCommon
+{
+    /**
+     *
+     * @brief Counters of CPerfGroup.
+     *
+     */
+    typedef enum EPerfCounter
+    {
+        perfCYCLES = 0,
+        perfINSTRUCTIONS,
+        perfCACHE_MISSES,
+        perfBRANCH_MISSES,
+        perfCOUNTERS
+    } EPerfCounter_t;
+
+    inline const char *perfCounterName( EPerfCounter_t _counter )
+    {
+        switch( _counter )
+        {
+            case perfCYCLES:
+                return "cycles";
+            case perfINSTRUCTIONS:
+                return "instructions";
+            case perfCACHE_MISSES:
+                return "cache_misses";
+            case perfBRANCH_MISSES:
+                return "branch_misses";
+            default:
+                return "unknown";
+        }
+    }
+    /**
+     *
+     * @brief Values of the counters, a counter is valid if it could be opened.
+     *
+     */
+    struct SPerfValues
+    {
+        SPerfValues():
+            m_valid( 0 )
+        {
+            memset( m_values, 0, sizeof( m_values ) );
+        }
+        bool valid( EPerfCounter_t _counter ) const
+        {
+            return m_valid & ( 1u << _counter );
+        }
+        // all counters valid, a start of a sum
+        static SPerfValues zero()
+        {
+            SPerfValues ret;
+            ret.m_valid = ( 1u << perfCOUNTERS ) - 1;
+            return ret;
+        }
+        // the difference of two reads of the same group
+        SPerfValues operator-( const SPerfValues &_val ) const
+        {
+            SPerfValues ret;
+            ret.m_valid = m_valid & _val.m_valid;
+            for( size_t i = 0; i < perfCOUNTERS; ++i )
+                ret.m_values[i] = ( m_values[i] > _val.m_values[i] ) ? m_values[i] - _val.m_values[i] : 0;
+            return ret;
+        }
+        SPerfValues &operator+=( const SPerfValues &_val )
+        {
+            m_valid &= _val.m_valid;
+            for( size_t i = 0; i < perfCOUNTERS; ++i )
+                m_values[i] += _val.m_values[i];
+            return *this;
+        }
+
+        uint64_t m_values[perfCOUNTERS];
+        // a bit per EPerfCounter
+        unsigned m_valid;
+    };
+    /**
+     *
+     * @brief The class counts hardware events of the calling thread from its construction on.
+     * @brief The counters are a perf group: they are scheduled on the PMU together and read by one call,
+     * @brief so their ratios (IPC, misses per instruction) are consistent.
+     * @brief A counter, which can't be opened (no PMU in a VM, perf_event_paranoid, seccomp), is skipped
+     * @brief and marked invalid, the group never throws because of perf being restricted.
+     * @brief Only user space events are counted, which perf_event_paranoid <= 2 allows for own threads.
+     * @note _inherit also counts threads created by the calling thread after the construction,
+     * @note the counters are not a group then, the kernel doesn't read inherited groups.
+     * @note Example:
+     * @code
+     *
+     * CPerfGroup perf;
+     * SPerfValues delta;
+     * {
+     *     CPerfScope scope( perf, &delta );
+     *     work();
+     * }
+     * if( delta.valid( perfINSTRUCTIONS ) )
+     *     cout << delta.m_values[perfINSTRUCTIONS] << " instructions" << endl;
+     *
+     * @endcode
+     *
+     */
+    class CPerfGroup: public NONCopyable
+    {
+        public:
+            explicit CPerfGroup( bool _inherit = false ):
+                m_inherit( _inherit ),
+                m_valid( 0 ),
+                m_count( 0 )
+            {
+                for( size_t i = 0; i < perfCOUNTERS; ++i )
+                    m_fds[i] = -1;
+#if defined(__linux__)
+                const uint64_t configs[perfCOUNTERS] =
+                {
+                    PERF_COUNT_HW_CPU_CYCLES,
+                    PERF_COUNT_HW_INSTRUCTIONS,
+                    PERF_COUNT_HW_CACHE_MISSES,
+                    PERF_COUNT_HW_BRANCH_MISSES
+                };
+                for( size_t i = 0; i < perfCOUNTERS; ++i )
+                {
+                    perf_event_attr attr;
+                    memset( &attr, 0, sizeof( attr ) );
+                    attr.size = sizeof( attr );
+                    attr.type = PERF_TYPE_HARDWARE;
+                    attr.config = configs[i];
+                    attr.exclude_kernel = 1;
+                    attr.exclude_hv = 1;
+                    attr.inherit = _inherit ? 1 : 0;
+                    attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+                    if( !_inherit )
+                        attr.read_format |= PERF_FORMAT_GROUP;
+                    // the first opened counter leads the group
+                    const int leader( ( _inherit || 0 == m_count ) ? -1 : m_fds[m_order[0]] );
+                    const int fd = syscall( __NR_perf_event_open, &attr, 0, -1, leader, 0 );
+                    if( fd < 0 )
+                    {
+                        if( m_error.empty() )
+                            m_error = std::string( "perf_event_open( " ) + perfCounterName( EPerfCounter_t( i ) ) + " ): " +
+                                      errno2str() + ( EACCES == errno || EPERM == errno ? " (see /proc/sys/kernel/perf_event_paranoid)" : "" );
+                        continue;
+                    }
+                    m_fds[i] = fd;
+                    m_order[m_count++] = i;
+                    m_valid |= 1u << i;
+                }
+#else
+                m_error = "perf_event_open is not supported on this platform";
+#endif
+            }
+            ~CPerfGroup()
+            {
+                for( size_t i = 0; i < perfCOUNTERS; ++i )
+                {
+                    if( -1 != m_fds[i] )
+                        ::close( m_fds[i] );
+                }
+            }
+            /// return: true if at least one counter is measured
+            bool available() const
+            {
+                return 0 != m_valid;
+            }
+            /// why a counter is missing, empty if all counters are measured
+            const std::string &error() const
+            {
+                return m_error;
+            }
+            /// reads the counters, they are scaled up, if the kernel had to multiplex them
+            /// return: false if the counters couldn't be read, _values are not valid then
+            bool read( SPerfValues *_values ) const
+            {
+                _values->m_valid = 0;
+                if( 0 == m_count )
+                    return false;
+                if( m_inherit )
+                {
+                    for( size_t i = 0; i < m_count; ++i )
+                    {
+                        uint64_t buf[3];
+                        if( ::read( m_fds[m_order[i]], buf, sizeof( buf ) ) != sizeof( buf ) )
+                            return false;
+                        _values->m_values[m_order[i]] = scale( buf[0], buf[1], buf[2] );
+                    }
+                }
+                else
+                {
+                    // nr, time enabled, time running, values
+                    uint64_t buf[3 + perfCOUNTERS];
+                    const ssize_t size( ( 3 + m_count ) * sizeof( uint64_t ) );
+                    if( ::read( m_fds[m_order[0]], buf, size ) != size || buf[0] != m_count )
+                        return false;
+                    for( size_t i = 0; i < m_count; ++i )
+                        _values->m_values[m_order[i]] = scale( buf[3 + i], buf[1], buf[2] );
+                }
+                _values->m_valid = m_valid;
+                return true;
+            }
+
+        private:
+            static uint64_t scale( uint64_t _value, uint64_t _enabled, uint64_t _running )
+            {
+                if( 0 == _running )
+                    return 0;
+                if( _running >= _enabled )
+                    return _value;
+                return static_cast<uint64_t>( static_cast<double>( _value ) * _enabled / _running );
+            }
+
+        private:
+            bool m_inherit;
+            int m_fds[perfCOUNTERS];
+            // opened counters in the order of the group read
+            size_t m_order[perfCOUNTERS];
+            unsigned m_valid;
+            size_t m_count;
+            std::string m_error;
+    };
+    /**
+     *
+     * @brief The class stores the counter deltas of its life time in _delta.
+     *
+     */
+    class CPerfScope: public NONCopyable
+    {
+        public:
+            CPerfScope( const CPerfGroup &_group, SPerfValues *_delta ):
+                m_group( _group ),
+                m_delta( _delta )
+            {
+                m_group.read( &m_start );
+            }
+            ~CPerfScope()
+            {
+                SPerfValues end;
+                m_group.read( &end );
+                *m_delta = end - m_start;
+            }
+
+        private:
+            const CPerfGroup &m_group;
+            SPerfValues *m_delta;
+            SPerfValues m_start;
+    };
+};
+#endif /* PERFEVENTS_H_ */
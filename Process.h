@@ -39,6 +39,7 @@
 #include "MiscUtils.h"
 #include "CustomIterator.h"
 #include "stlx.h"
+#include "Trace.h"
 
 namespace MiscCommon
 {
@@ -438,6 +439,7 @@ namespace MiscCommon
     inline void do_execv( const std::string &_Command, const StringVector_t &_Params,
                           size_t _Delay, std::string *_output, std::string *_errout = NULL ) throw( std::exception )
     {
+        CTraceSpan span( "do_execv", "process" );
         pid_t child_pid;
         std::vector<const char*> cargs; //careful with c_str()!!!
         cargs.push_back( _Command.c_str() );
@@ -518,6 +520,7 @@ namespace MiscCommon
             *_errout = ss.str();
 
         }
+        CTraceSpan wait( "do_execv: wait", "process" );
         for( size_t i = 0; i < _Delay; ++i )
         {
             int stat;
@@ -15,6 +15,7 @@
 #include "SysHelper.h"
 #include "Process.h"
 #include "INet.h"
+#include "Trace.h"
 //=============================================================================
 using namespace std;
 using namespace MiscCommon;
@@ -70,6 +71,7 @@ void CSSHTunnel::create( const string &_connectionStr,
                          size_t _localPort, size_t _remotePort,
                          const string &_openDomain )
 {
+    CTraceSpan span( "CSSHTunnel::create", "ssh" );
     // delete tunnel's file
     killTunnel();
     // create an ssh tunnel on PoD Server port
@@ -127,6 +129,7 @@ void CSSHTunnel::create( const string &_connectionStr,
             }
     }
     // wait for tunnel to start
+    CTraceSpan wait( "CSSHTunnel::create: wait", "ssh" );
     short count( 0 );
     const short max_try( 600 ); // force to wait for about 30 secs
     pid();
@@ -0,0 +1,533 @@
+/************************************************************************/
+/**
+ * @file Trace.h
+ * @brief Scoped tracing spans in per-thread rings with a Chrome trace export
+ * @author Anar Manafov A.Manafov@gsi.de
+ */ /*
+
+        version number:     $LastChangedRevision$
+        created by:         Anar Manafov
+                            2012-11-30
+        last changed by:    $LastChangedBy$ $LastChangedDate$
+
+        Copyright (c) 2012 GSI, Scientific Computing division. All rights reserved.
+*************************************************************************/
+#ifndef TRACE_H_
+#define TRACE_H_
+
+// API
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+#include <unistd.h>
+// STD
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <ostream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+// MiscCommon
+#include "ErrorCode.h"
+#include "Metrics.h"
+#include "MiscUtils.h"
+#include "PerfEvents.h"
+#include "SysHelper.h"
+
+namespace MiscCommon
+{
+    /// a default number of events in the ring of a thread, the oldest events are overwritten
+    const size_t g_traceEventsPerThread = 16384;
+    /**
+     *
+     * @brief The function returns a timestamp of a span: the TSC on x86, CLOCK_MONOTONIC ns elsewhere.
+     *
+     */
+    inline uint64_t traceTimestamp()
+    {
+#if defined( __i386__ ) || defined( __x86_64__ )
+        uint32_t lo( 0 );
+        uint32_t hi( 0 );
+        __asm__ __volatile__( "rdtsc" : "=a"( lo ), "=d"( hi ) );
+        return ( static_cast<uint64_t>( hi ) << 32 ) | lo;
+#else
+        return metricsNowNs();
+#endif
+    }
+    /**
+     *
+     * @brief The function orders stores of an event before the store of the ring head (and loads vice versa).
+     *
+     */
+    inline void traceBarrier()
+    {
+#if defined( __i386__ ) || defined( __x86_64__ )
+        // x86 doesn't reorder stores with stores and loads with loads
+        __asm__ __volatile__( "" : : : "memory" );
+#else
+        __sync_synchronize();
+#endif
+    }
+    /**
+     *
+     * @brief The flag of tracing, spans cost a load and a branch, when it is off.
+     *
+     */
+    inline volatile bool &traceFlag()
+    {
+        static volatile bool enabled = false;
+        return enabled;
+    }
+    inline bool traceEnabled()
+    {
+        return traceFlag();
+    }
+    /**
+     *
+     * @brief A finished span. Names are not copied, they must be string literals.
+     *
+     */
+    struct STraceEvent
+    {
+        const char *m_name;
+        const char *m_category;
+        // an optional numeric argument (a command id, a size, ...)
+        const char *m_argName;
+        uint64_t m_arg;
+        uint64_t m_start;
+        uint64_t m_duration;
+        pid_t m_tid;
+        // hardware counter deltas of the span, a bit per EPerfCounter in m_perfValid
+        uint64_t m_perf[perfCOUNTERS];
+        unsigned m_perfValid;
+    };
+    /**
+     *
+     * @brief A ring of events of one thread.
+     * @brief Only the owner thread writes, it never waits. A reader copies the ring and drops the events,
+     * @brief which could have been overwritten during the copy, so it gets at most capacity - 1 events.
+     *
+     */
+    class CTraceRing: public NONCopyable
+    {
+        public:
+            CTraceRing( size_t _capacity ):
+                m_events( _capacity ),
+                m_head( 0 ),
+                m_floor( 0 ),
+                m_tid( 0 ),
+                m_perf( NULL )
+            {
+            }
+            ~CTraceRing()
+            {
+                delete m_perf;
+            }
+            void push( const STraceEvent &_event )
+            {
+                const uint64_t head( m_head );
+                m_events[head % m_events.size()] = _event;
+                traceBarrier();
+                m_head = head + 1;
+            }
+            /// appends the events of the ring to _events
+            void snapshot( std::vector<STraceEvent> *_events ) const
+            {
+                const uint64_t head( m_head );
+                const uint64_t floor( m_floor );
+                traceBarrier();
+                const uint64_t first( std::max<uint64_t>( floor, head > m_events.size() ? head - m_events.size() : 0 ) );
+                const size_t offset( _events->size() );
+                for( uint64_t i = first; i < head; ++i )
+                    _events->push_back( m_events[i % m_events.size()] );
+                traceBarrier();
+                // the writer may be overwriting the event after - capacity right now
+                const uint64_t after( m_head );
+                const uint64_t valid( after >= m_events.size() ? after - m_events.size() + 1 : 0 );
+                if( valid > first )
+                    _events->erase( _events->begin() + offset,
+                                    _events->begin() + offset + std::min<uint64_t>( valid - first, head - first ) );
+            }
+            /// forgets the recorded events, the writer isn't disturbed
+            void clear()
+            {
+                m_floor = m_head;
+            }
+            pid_t tid() const
+            {
+                return m_tid;
+            }
+            void setTid( pid_t _tid )
+            {
+                m_tid = _tid;
+            }
+            /// the counters of the owner thread, NULL until the first span with counters
+            const CPerfGroup *perf() const
+            {
+                return m_perf;
+            }
+            /// the ring takes ownership of _perf, only the owner thread calls it
+            void setPerf( CPerfGroup *_perf )
+            {
+                delete m_perf;
+                m_perf = _perf;
+            }
+
+        private:
+            std::vector<STraceEvent> m_events;
+            volatile uint64_t m_head;
+            volatile uint64_t m_floor;
+            // 0 - the ring is free, its thread has exited
+            volatile pid_t m_tid;
+            CPerfGroup *m_perf;
+    };
+    /**
+     *
+     * @brief The tracer of a process: the rings of all threads and the export of their events.
+     * @brief The export is the Chrome trace event JSON, it is loaded by chrome://tracing and by Perfetto UI.
+     * @note Example:
+     * @code
+     *
+     * // spans also get cycles, instructions, cache and branch misses, if perf events are available
+     * CTracer::instance().enable( g_traceEventsPerThread, true );
+     * CTracer::instance().dumpOnSignal( SIGUSR2, "/tmp/pod-agent.trace.json" );
+     * ...
+     * void CAgent::registerWorker( ... )
+     * {
+     *     CTraceSpan span( "CAgent::registerWorker", "agent" );
+     *     ...
+     * }
+     *
+     * @endcode
+     *
+     */
+    class CTracer: public NONCopyable
+    {
+        public:
+            /// the tracer of the process, it is never destroyed, threads may record until exit
+            static CTracer &instance()
+            {
+                static CTracer *tracer = new CTracer;
+                return *tracer;
+            }
+            /// switches tracing on, rings are created with _eventsPerThread events.
+            /// _perfCounters adds hardware counter deltas (see CPerfGroup) to spans,
+            /// it costs two read syscalls per span, a span then takes about a microsecond longer.
+            void enable( size_t _eventsPerThread = g_traceEventsPerThread, bool _perfCounters = false )
+            {
+                if( 0 == _eventsPerThread )
+                    throw std::invalid_argument( "CTracer::enable: a ring must have at least one event" );
+                smart_mutex lock( m_mutex );
+                m_capacity = _eventsPerThread;
+                if( 0 == m_startNs )
+                {
+                    m_startNs = metricsNowNs();
+                    m_startTicks = traceTimestamp();
+                }
+                m_perfCounters = _perfCounters;
+                traceFlag() = true;
+            }
+            /// switches tracing off, the recorded events are kept
+            void disable()
+            {
+                traceFlag() = false;
+            }
+            /// the ring of the calling thread
+            CTraceRing *ring()
+            {
+                static __thread CTraceRing *ring = NULL;
+                if( !ring )
+                    ring = attach();
+                return ring;
+            }
+            /// the counters of the calling thread, NULL if spans are recorded without counters
+            const CPerfGroup *perf( CTraceRing *_ring )
+            {
+                if( !m_perfCounters )
+                    return NULL;
+                // a thread opens its counters once, unavailable counters aren't retried
+                if( !_ring->perf() )
+                    _ring->setPerf( new CPerfGroup );
+                return _ring->perf()->available() ? _ring->perf() : NULL;
+            }
+            /// forgets all recorded events
+            void clear()
+            {
+                smart_mutex lock( m_mutex );
+                for( size_t i = 0; i < m_rings.size(); ++i )
+                    m_rings[i]->clear();
+            }
+            /// copies the recorded events of all threads
+            void snapshot( std::vector<STraceEvent> *_events ) const
+            {
+                if( !_events )
+                    throw std::invalid_argument( "CTracer::snapshot: the events pointer is NULL" );
+                smart_mutex lock( m_mutex );
+                for( size_t i = 0; i < m_rings.size(); ++i )
+                    m_rings[i]->snapshot( _events );
+            }
+            /// writes the recorded events as a Chrome trace (timestamps are CLOCK_MONOTONIC in us)
+            void writeChromeTrace( std::ostream &_stream ) const
+            {
+                std::vector<STraceEvent> events;
+                snapshot( &events );
+                const double ticksPerNs( calibrate() );
+
+                std::ostringstream ss;
+                ss.setf( std::ios::fixed );
+                ss.precision( 3 );
+                ss << "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[";
+                const pid_t pid( getpid() );
+                for( size_t i = 0; i < events.size(); ++i )
+                {
+                    const STraceEvent &e = events[i];
+                    const double start( m_startNs + ( static_cast<double>( e.m_start ) - m_startTicks ) / ticksPerNs );
+                    ss << ( i ? ",\n" : "\n" )
+                       << "{\"name\":\"" << escape( e.m_name ) << "\",\"cat\":\"" << escape( e.m_category )
+                       << "\",\"ph\":\"X\",\"pid\":" << pid << ",\"tid\":" << e.m_tid
+                       << ",\"ts\":" << start / 1000 << ",\"dur\":" << e.m_duration / ticksPerNs / 1000;
+                    const char *sep( "" );
+                    if( e.m_argName || e.m_perfValid )
+                        ss << ",\"args\":{";
+                    if( e.m_argName )
+                    {
+                        ss << "\"" << escape( e.m_argName ) << "\":" << e.m_arg;
+                        sep = ",";
+                    }
+                    for( size_t c = 0; c < perfCOUNTERS; ++c )
+                    {
+                        if( !( e.m_perfValid & ( 1u << c ) ) )
+                            continue;
+                        ss << sep << "\"" << perfCounterName( EPerfCounter_t( c ) ) << "\":" << e.m_perf[c];
+                        sep = ",";
+                    }
+                    if( e.m_argName || e.m_perfValid )
+                        ss << "}";
+                    ss << "}";
+                }
+                ss << "\n]}\n";
+                _stream << ss.str();
+            }
+            /// writes the trace to _path, through a temporary file, so a reader never sees a partial trace
+            void writeChromeTrace( const std::string &_path ) const
+            {
+                const std::string tmp( _path + ".tmp" );
+                {
+                    std::ofstream f( tmp.c_str() );
+                    if( !f.is_open() )
+                        throw std::runtime_error( "Can't open the trace file " + tmp );
+                    writeChromeTrace( f );
+                    if( !f.good() )
+                        throw std::runtime_error( "Can't write the trace file " + tmp );
+                }
+                if( ::rename( tmp.c_str(), _path.c_str() ) < 0 )
+                    throw system_error( "Can't rename the trace file to " + _path );
+            }
+            /// writes the trace to _path every time the process gets _signum.
+            /// The file is written by a thread of the tracer, the signal handler only wakes it up.
+            void dumpOnSignal( int _signum, const std::string &_path )
+            {
+                smart_mutex lock( m_mutex );
+                if( -1 != signalPipe()[0] )
+                    throw std::logic_error( "CTracer::dumpOnSignal: the dump is already bound to a signal" );
+                if( ::pipe( signalPipe() ) < 0 )
+                    throw system_error( "CTracer::dumpOnSignal: can't create a pipe" );
+                // the handler must not block, when dumps are pending
+                fcntl( signalPipe()[1], F_SETFL, fcntl( signalPipe()[1], F_GETFL ) | O_NONBLOCK );
+                m_dumpPath = _path;
+                pthread_t thread;
+                if( 0 != pthread_create( &thread, NULL, &CTracer::dumpThread, this ) )
+                    throw std::runtime_error( "CTracer::dumpOnSignal: can't create a thread" );
+                pthread_detach( thread );
+
+                struct sigaction sa;
+                memset( &sa, 0, sizeof( sa ) );
+                sa.sa_handler = &CTracer::onSignal;
+                sigemptyset( &sa.sa_mask );
+                sa.sa_flags = SA_RESTART;
+                if( ::sigaction( _signum, &sa, NULL ) < 0 )
+                    throw system_error( "CTracer::dumpOnSignal: can't install the signal handler" );
+            }
+
+        private:
+            CTracer():
+                m_capacity( g_traceEventsPerThread ),
+                m_startNs( 0 ),
+                m_startTicks( 0 ),
+                m_perfCounters( false )
+            {
+                pthread_key_create( &m_key, &CTracer::release );
+            }
+            CTraceRing *attach()
+            {
+                smart_mutex lock( m_mutex );
+                CTraceRing *ret( NULL );
+                // a ring of an exited thread is reused, its events stay with the old thread id
+                for( size_t i = 0; i < m_rings.size() && !ret; ++i )
+                {
+                    if( 0 == m_rings[i]->tid() )
+                        ret = m_rings[i];
+                }
+                if( !ret )
+                {
+                    ret = new CTraceRing( m_capacity );
+                    m_rings.push_back( ret );
+                }
+                ret->setTid( gettid() );
+                pthread_setspecific( m_key, ret );
+                return ret;
+            }
+            static void release( void *_ring )
+            {
+                CTraceRing *ring = reinterpret_cast<CTraceRing *>( _ring );
+                // the counters belong to the exiting thread, the next owner opens its own
+                ring->setPerf( NULL );
+                ring->setTid( 0 );
+            }
+            // return: timestamp ticks per ns, measured since enable (at least 10 ms)
+            double calibrate() const
+            {
+                if( 0 == m_startNs )
+                    return 1;
+                uint64_t ns( metricsNowNs() );
+                if( ns - m_startNs < 10000000 )
+                {
+                    usleep( ( 10000000 - ( ns - m_startNs ) ) / 1000 + 1 );
+                    ns = metricsNowNs();
+                }
+                const uint64_t ticks( traceTimestamp() );
+                return static_cast<double>( ticks - m_startTicks ) / ( ns - m_startNs );
+            }
+            static std::string escape( const char *_str )
+            {
+                std::string ret;
+                for( ; _str && *_str; ++_str )
+                {
+                    if( '"' == *_str || '\\' == *_str )
+                        ret += '\\';
+                    if( static_cast<unsigned char>( *_str ) >= 0x20 )
+                        ret += *_str;
+                }
+                return ret;
+            }
+            static int *signalPipe()
+            {
+                static int fds[2] = { -1, -1 };
+                return fds;
+            }
+            static void onSignal( int )
+            {
+                const int saved( errno );
+                const char wake( 0 );
+                if( ::write( signalPipe()[1], &wake, 1 ) < 0 )
+                {
+                    // a dump is pending already
+                }
+                errno = saved;
+            }
+            static void *dumpThread( void *_this )
+            {
+                CTracer *self = reinterpret_cast<CTracer *>( _this );
+                char wake( 0 );
+                while( true )
+                {
+                    const ssize_t n = ::read( signalPipe()[0], &wake, 1 );
+                    if( n < 0 && EINTR == errno )
+                        continue;
+                    if( n <= 0 )
+                        break;
+                    try
+                    {
+                        self->writeChromeTrace( self->m_dumpPath );
+                    }
+                    catch( ... )
+                    {
+                        // the next signal tries again
+                    }
+                }
+                return NULL;
+            }
+
+        private:
+            mutable CMutex m_mutex;
+            std::vector<CTraceRing *> m_rings;
+            pthread_key_t m_key;
+            size_t m_capacity;
+            // the clock calibration: CLOCK_MONOTONIC and the timestamp at the first enable
+            uint64_t m_startNs;
+            uint64_t m_startTicks;
+            std::string m_dumpPath;
+            volatile bool m_perfCounters;
+    };
+    /**
+     *
+     * @brief A span: the time from the construction to the destruction of the object.
+     * @brief _name and _category must be string literals, they are not copied.
+     * @brief The span records hardware counter deltas, if the tracer is enabled with counters.
+     *
+     */
+    class CTraceSpan: public NONCopyable
+    {
+        public:
+            CTraceSpan( const char *_name, const char *_category ):
+                m_ring( traceEnabled() ? CTracer::instance().ring() : NULL ),
+                m_perf( NULL )
+            {
+                if( !m_ring )
+                    return;
+                m_event.m_name = _name;
+                m_event.m_category = _category;
+                m_event.m_argName = NULL;
+                m_event.m_arg = 0;
+                m_event.m_tid = m_ring->tid();
+                m_event.m_perfValid = 0;
+                m_perf = CTracer::instance().perf( m_ring );
+                if( m_perf )
+                {
+                    // the counters are read outside of the timed interval
+                    SPerfValues start;
+                    m_perf->read( &start );
+                    std::copy( start.m_values, start.m_values + perfCOUNTERS, m_event.m_perf );
+                    m_event.m_perfValid = start.m_valid;
+                }
+                m_event.m_start = traceTimestamp();
+            }
+            ~CTraceSpan()
+            {
+                if( !m_ring )
+                    return;
+                m_event.m_duration = traceTimestamp() - m_event.m_start;
+                if( m_perf && m_event.m_perfValid )
+                {
+                    SPerfValues end;
+                    m_perf->read( &end );
+                    for( size_t c = 0; c < perfCOUNTERS; ++c )
+                        m_event.m_perf[c] = end.m_values[c] > m_event.m_perf[c] ? end.m_values[c] - m_event.m_perf[c] : 0;
+                    m_event.m_perfValid &= end.m_valid;
+                }
+                m_ring->push( m_event );
+            }
+            /// attaches a numeric argument, _name must be a string literal
+            void setArg( const char *_name, uint64_t _value )
+            {
+                m_event.m_argName = _name;
+                m_event.m_arg = _value;
+            }
+            /// the span is not recorded (e.g. nothing has been done)
+            void dismiss()
+            {
+                m_ring = NULL;
+            }
+
+        private:
+            CTraceRing *m_ring;
+            const CPerfGroup *m_perf;
+            STraceEvent m_event;
+    };
+};
+#endif /* TRACE_H_ */
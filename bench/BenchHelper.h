@@ -0,0 +1,314 @@
+/************************************************************************/
+/**
+ * @file BenchHelper.h
+ * @brief Helpers for MiscCommon benchmarks
+ * @author Anar Manafov A.Manafov@gsi.de
+ */ /*
+
+        version number:     $LastChangedRevision$
+        created by:         Anar Manafov
+                            2012-10-02
+        last changed by:    $LastChangedBy$ $LastChangedDate$
+
+        Copyright (c) 2012 GSI, Scientific Computing division. All rights reserved.
+*************************************************************************/
+#ifndef BENCHHELPER_H_
+#define BENCHHELPER_H_
+//=============================================================================
+// API
+#include <time.h>
+#include <unistd.h>
+// STD
+#include <algorithm>
+#include <iostream>
+#include <iomanip>
+#include <string>
+#include <vector>
+// BOOST
+#include <boost/function.hpp>
+// MiscCommon
+#include "Metrics.h"
+#include "PerfEvents.h"
+//=============================================================================
+namespace MiscCommon
+{
+    namespace Bench
+    {
+        /**
+         *
+         * @brief A simple monotonic stop watch.
+         *
+         */
+        class CStopWatch
+        {
+            public:
+                CStopWatch()
+                {
+                    start();
+                }
+                void start()
+                {
+                    m_start = metricsNowNs();
+                }
+                // elapsed time in seconds
+                double elapsed() const
+                {
+                    return ( metricsNowNs() - m_start ) * 1e-9;
+                }
+
+            private:
+                uint64_t m_start;
+        };
+        /**
+         *
+         * @brief prints a result of a benchmark: ns per operation and throughput if _bytes are given,
+         * @brief IPC and hardware events per operation if _perf (counted for _ops operations) is given.
+         *
+         */
+        inline void report( const std::string &_name, size_t _ops, double _sec, size_t _bytes = 0,
+                            std::ostream &_stream = std::cout, const SPerfValues *_perf = NULL )
+        {
+            _stream
+                    << std::left << std::setw( 40 ) << _name
+                    << std::right << std::setw( 12 ) << _ops << " ops "
+                    << std::fixed << std::setprecision( 1 ) << std::setw( 12 ) << ( _sec * 1e9 / _ops ) << " ns/op";
+            if( _bytes > 0 )
+                _stream << std::setw( 12 ) << ( _bytes / _sec / ( 1024 * 1024 ) ) << " MB/s";
+            if( NULL != _perf && _perf->valid( perfCYCLES ) && _perf->valid( perfINSTRUCTIONS ) &&
+                _perf->m_values[perfCYCLES] > 0 )
+                _stream << std::setprecision( 2 ) << std::setw( 7 )
+                        << static_cast<double>( _perf->m_values[perfINSTRUCTIONS] ) / _perf->m_values[perfCYCLES] << " IPC";
+            if( NULL != _perf && _perf->valid( perfCYCLES ) )
+                _stream << std::setprecision( 1 ) << std::setw( 12 )
+                        << static_cast<double>( _perf->m_values[perfCYCLES] ) / _ops << " cyc/op";
+            if( NULL != _perf && _perf->valid( perfCACHE_MISSES ) )
+                _stream << std::setprecision( 2 ) << std::setw( 10 )
+                        << static_cast<double>( _perf->m_values[perfCACHE_MISSES] ) / _ops << " cache-miss/op";
+            if( NULL != _perf && _perf->valid( perfBRANCH_MISSES ) )
+                _stream << std::setprecision( 2 ) << std::setw( 10 )
+                        << static_cast<double>( _perf->m_values[perfBRANCH_MISSES] ) / _ops << " br-miss/op";
+            _stream << std::endl;
+        }
+        /**
+         *
+         * @brief prevents the compiler from optimizing out a result of a benchmarked call.
+         *
+         */
+        template<class _T>
+        inline void doNotOptimize( const _T &_val )
+        {
+            asm volatile( "" : : "g"( &_val ) : "memory" );
+        }
+        /**
+         *
+         * @brief A suite of named benchmarks with a machine-readable (JSON) report.
+         * @brief A benchmark runs a given number of iterations. The suite doubles the number
+         * @brief until a run takes at least the minimum time, then repeats the run and reports the median,
+         * @brief so the result doesn't depend on the timer resolution and on a single noisy run.
+         * @brief Hardware counters (see CPerfGroup) of the repetitions, including threads started by a benchmark,
+         * @brief are reported per operation, if perf events are available.
+         * @note Example:
+         * @code
+         *
+         * void benchTrim( size_t _iterations );
+         *
+         * CBenchSuite suite;
+         * suite.add( "MiscUtils/trim", &benchTrim );
+         * suite.run( "", 0.2, 5 );
+         * suite.writeJSON( file );
+         *
+         * @endcode
+         *
+         */
+        class CBenchSuite
+        {
+            public:
+                typedef boost::function<void( size_t _iterations )> Bench_t;
+                struct SResult
+                {
+                    SResult():
+                        m_iterations( 0 ),
+                        m_nsPerOp( 0 ),
+                        m_minNsPerOp( 0 ),
+                        m_maxNsPerOp( 0 ),
+                        m_bytesPerOp( 0 ),
+                        m_perfValid( 0 )
+                    {
+                        std::fill( m_perfPerOp, m_perfPerOp + perfCOUNTERS, 0.0 );
+                    }
+                    std::string m_name;
+                    size_t m_iterations;
+                    // the median of the repetitions
+                    double m_nsPerOp;
+                    double m_minNsPerOp;
+                    double m_maxNsPerOp;
+                    size_t m_bytesPerOp;
+                    // the mean of the repetitions, a bit per EPerfCounter in m_perfValid
+                    double m_perfPerOp[perfCOUNTERS];
+                    unsigned m_perfValid;
+                };
+                typedef std::vector<SResult> Results_t;
+
+            private:
+                struct SBench
+                {
+                    std::string m_name;
+                    Bench_t m_bench;
+                    size_t m_bytesPerOp;
+                };
+
+            public:
+                CBenchSuite():
+                    m_perfCounters( true )
+                {
+                }
+                // _bytesPerOp (if not 0) adds the throughput to the report
+                void add( const std::string &_name, const Bench_t &_bench, size_t _bytesPerOp = 0 )
+                {
+                    SBench bench;
+                    bench.m_name = _name;
+                    bench.m_bench = _bench;
+                    bench.m_bytesPerOp = _bytesPerOp;
+                    m_benches.push_back( bench );
+                }
+                // hardware counters are measured by default
+                void perfCounters( bool _enable )
+                {
+                    m_perfCounters = _enable;
+                }
+                // runs the benchmarks, which names contain _filter, and prints their results to _stream
+                void run( const std::string &_filter, double _minTimeSec, size_t _repetitions,
+                          std::ostream &_stream = std::cout )
+                {
+                    if( !m_perfCounters )
+                    {
+                        runBenches( _filter, _minTimeSec, _repetitions, _stream, NULL );
+                        return;
+                    }
+                    // inherited counters: multithreaded benchmarks count their worker threads too
+                    CPerfGroup perf( true );
+                    if( !perf.error().empty() )
+                        _stream << "# hardware counters: " << ( perf.available() ? "partial, " : "unavailable, " )
+                                << perf.error() << std::endl;
+                    runBenches( _filter, _minTimeSec, _repetitions, _stream, perf.available() ? &perf : NULL );
+                }
+                const Results_t &results() const
+                {
+                    return m_results;
+                }
+                void writeJSON( std::ostream &_stream ) const
+                {
+                    char host[256] = "";
+                    gethostname( host, sizeof( host ) - 1 );
+                    _stream
+                            << "{\n  \"context\": {\"host\": \"" << escape( host ) << "\", \"time\": " << time( NULL )
+                            << ", \"compiler\": \"" << escape( __VERSION__ ) << "\"},\n  \"benchmarks\": [";
+                    for( size_t i = 0; i < m_results.size(); ++i )
+                    {
+                        const SResult &r = m_results[i];
+                        _stream
+                                << ( i ? "," : "" ) << "\n    {\"name\": \"" << escape( r.m_name ) << "\""
+                                << ", \"iterations\": " << r.m_iterations
+                                << std::fixed << std::setprecision( 3 )
+                                << ", \"ns_per_op\": " << r.m_nsPerOp
+                                << ", \"min_ns_per_op\": " << r.m_minNsPerOp
+                                << ", \"max_ns_per_op\": " << r.m_maxNsPerOp
+                                << ", \"bytes_per_op\": " << r.m_bytesPerOp;
+                        for( size_t c = 0; c < perfCOUNTERS; ++c )
+                        {
+                            if( r.m_perfValid & ( 1u << c ) )
+                                _stream << ", \"" << perfCounterName( EPerfCounter_t( c ) ) << "_per_op\": " << r.m_perfPerOp[c];
+                        }
+                        _stream << "}";
+                    }
+                    _stream << "\n  ]\n}" << std::endl;
+                }
+
+            private:
+                void runBenches( const std::string &_filter, double _minTimeSec, size_t _repetitions,
+                                 std::ostream &_stream, const CPerfGroup *_perf )
+                {
+                    for( size_t i = 0; i < m_benches.size(); ++i )
+                    {
+                        const SBench &bench = m_benches[i];
+                        if( std::string::npos == bench.m_name.find( _filter ) )
+                            continue;
+
+                        size_t iterations( 1 );
+                        double sec( measure( bench.m_bench, iterations ) );
+                        while( sec < _minTimeSec && iterations < ( static_cast<size_t>( 1 ) << 40 ) )
+                        {
+                            // aim at the minimum time, but at most 10 times more iterations at once
+                            const double factor( sec > 0 ? std::min( 10.0, 1.2 * _minTimeSec / sec ) : 10.0 );
+                            iterations = std::max( iterations + 1, static_cast<size_t>( iterations * factor ) );
+                            sec = measure( bench.m_bench, iterations );
+                        }
+                        std::vector<double> samples( 1, sec * 1e9 / iterations );
+                        SPerfValues counters( SPerfValues::zero() );
+                        for( size_t r = 1; r < _repetitions; ++r )
+                            samples.push_back( measure( bench.m_bench, iterations, _perf, &counters ) * 1e9 / iterations );
+                        if( 1 == _repetitions )
+                            measure( bench.m_bench, iterations, _perf, &counters );
+                        const size_t measured( std::max<size_t>( 1, _repetitions - 1 ) );
+                        if( NULL == _perf )
+                            counters.m_valid = 0;
+                        std::sort( samples.begin(), samples.end() );
+
+                        SResult result;
+                        result.m_name = bench.m_name;
+                        result.m_iterations = iterations;
+                        result.m_nsPerOp = samples[samples.size() / 2];
+                        result.m_minNsPerOp = samples.front();
+                        result.m_maxNsPerOp = samples.back();
+                        result.m_bytesPerOp = bench.m_bytesPerOp;
+                        result.m_perfValid = counters.m_valid;
+                        for( size_t c = 0; c < perfCOUNTERS; ++c )
+                        {
+                            result.m_perfPerOp[c] = static_cast<double>( counters.m_values[c] ) / ( measured * iterations );
+                            // the mean of a repetition for the report
+                            counters.m_values[c] /= measured;
+                        }
+                        m_results.push_back( result );
+                        report( result.m_name, iterations, result.m_nsPerOp * iterations * 1e-9,
+                                result.m_bytesPerOp * iterations, _stream, &counters );
+                    }
+                }
+                // adds the counter deltas of the run to _counters, if _perf is given
+                static double measure( const Bench_t &_bench, size_t _iterations,
+                                       const CPerfGroup *_perf = NULL, SPerfValues *_counters = NULL )
+                {
+                    SPerfValues start;
+                    if( NULL != _perf )
+                        _perf->read( &start );
+                    CStopWatch watch;
+                    _bench( _iterations );
+                    const double sec( watch.elapsed() );
+                    if( NULL != _perf )
+                    {
+                        SPerfValues end;
+                        _perf->read( &end );
+                        *_counters += end - start;
+                    }
+                    return sec;
+                }
+                static std::string escape( const std::string &_str )
+                {
+                    std::string ret;
+                    for( size_t i = 0; i < _str.size(); ++i )
+                    {
+                        if( '"' == _str[i] || '\\' == _str[i] )
+                            ret += '\\';
+                        ret += ( static_cast<unsigned char>( _str[i] ) < 0x20 ) ? ' ' : _str[i];
+                    }
+                    return ret;
+                }
+
+            private:
+                std::vector<SBench> m_benches;
+                Results_t m_results;
+                bool m_perfCounters;
+        };
+    }
+}
+//=============================================================================
+#endif /* BENCHHELPER_H_ */
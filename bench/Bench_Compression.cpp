@@ -0,0 +1,165 @@
+/************************************************************************/
+/**
+ * @file Bench_Compression.cpp
+ * @brief Benchmarks of pod_protocol payload compression
+ * @author Anar Manafov A.Manafov@gsi.de
+ */ /*
+
+        version number:     $LastChangedRevision$
+        created by:         Anar Manafov
+                            2012-10-09
+        last changed by:    $LastChangedBy$ $LastChangedDate$
+
+        Copyright (c) 2012 GSI, Scientific Computing division. All rights reserved.
+*************************************************************************/
+// STD
+#include <sstream>
+// pod-protocol
+#include "Protocol.h"
+#include "ProtocolCommands.h"
+#include "Compression.h"
+// MiscCommon
+#include "BenchHelper.h"
+//=============================================================================
+using namespace std;
+using namespace MiscCommon;
+using namespace MiscCommon::Bench;
+using namespace PROOFAgent;
+//=============================================================================
+BYTEVector_t hostInfo( size_t _idx )
+{
+    SHostInfoCmd cmd;
+    cmd.m_username = "pod";
+    stringstream ss;
+    ss << "lxb" << _idx << ".gsi.de";
+    cmd.m_host = ss.str();
+    cmd.m_version = "3.12";
+    cmd.m_PoDPath = "/lustre/hebe/pod/PoD/3.12";
+    cmd.m_xpdPort = 21001;
+    cmd.m_xpdPid = 10000 + _idx;
+    cmd.m_agentPort = 22001;
+    cmd.m_agentPid = 20000 + _idx;
+    cmd.m_timeStamp = 1349700000 + _idx;
+    BYTEVector_t data;
+    cmd.convertToData( &data );
+    return data;
+}
+//=============================================================================
+BYTEVector_t wnList( size_t _entries )
+{
+    SWnListCmd cmd;
+    for( size_t i = 0; i < _entries; ++i )
+    {
+        stringstream ss;
+        ss << "pod@lxb" << i << ".gsi.de:21001";
+        cmd.m_container.push_back( ss.str() );
+    }
+    BYTEVector_t data;
+    cmd.convertToData( &data );
+    return data;
+}
+//=============================================================================
+void benchPayload( const string &_name, ECompressionCodec _codec, const BYTEVector_t &_data,
+                   const CCompressionDict *_dict )
+{
+    const size_t ops( 256 * 1024 * 1024 / ( _data.size() * 8 ) + 1 );
+
+    BYTEVector_t payload;
+    CStopWatch sw;
+    for( size_t i = 0; i < ops; ++i )
+    {
+        if( !compressPayload( _codec, _data, &payload, _dict ) )
+        {
+            cout << _name << ": not compressible" << endl;
+            return;
+        }
+    }
+    report( _name + " compress", ops, sw.elapsed(), ops * _data.size() );
+
+    sw.start();
+    for( size_t i = 0; i < ops; ++i )
+    {
+        BYTEVector_t raw;
+        decompressPayload( payload, &raw, _dict );
+        doNotOptimize( raw );
+    }
+    report( _name + " decompress", ops, sw.elapsed(), ops * _data.size() );
+
+    cout << "    ratio " << fixed << setprecision( 2 )
+         << static_cast<double>( _data.size() ) / payload.size()
+         << " (" << _data.size() << " -> " << payload.size() << " bytes)" << endl;
+}
+//=============================================================================
+// every worker sends its own SHostInfoCmd, a dictionary helps most here
+void benchHostInfoMessages( const string &_name, ECompressionCodec _codec, size_t _entries,
+                            const CCompressionDict *_dict )
+{
+    vector<BYTEVector_t> msgs;
+    msgs.reserve( _entries );
+    size_t raw( 0 );
+    for( size_t i = 0; i < _entries; ++i )
+    {
+        msgs.push_back( hostInfo( i ) );
+        raw += msgs.back().size();
+    }
+
+    size_t compressed( 0 );
+    BYTEVector_t payload;
+    CStopWatch sw;
+    for( size_t i = 0; i < _entries; ++i )
+        compressed += compressPayload( _codec, msgs[i], &payload, _dict ) ? payload.size() : msgs[i].size();
+    report( _name, _entries, sw.elapsed(), raw );
+
+    cout << "    ratio " << fixed << setprecision( 2 )
+         << static_cast<double>( raw ) / compressed
+         << " (" << raw << " -> " << compressed << " bytes)" << endl;
+}
+//=============================================================================
+int main()
+{
+    const ECompressionCodec codecs[] = { codecZLIB, codecZSTD, codecLZ4 };
+    const char *names[] = { "zlib", "zstd", "lz4" };
+    const uint32_t caps[] = { capZLIB, capZSTD, capLZ4 };
+
+    // train a dictionary on typical host-info payloads
+    vector<BYTEVector_t> samples;
+    for( size_t i = 0; i < 1000; ++i )
+        samples.push_back( hostInfo( i ) );
+    CCompressionDict dict;
+    dict.train( samples );
+    cout << "dictionary size: " << dict.data().size() << " bytes" << endl;
+
+    const size_t entries[] = { 1000, 10000, 100000 };
+    for( size_t c = 0; c < sizeof( codecs ) / sizeof( codecs[0] ); ++c )
+    {
+        if( !( compressionCaps() & caps[c] ) )
+        {
+            cout << names[c] << ": not available" << endl;
+            continue;
+        }
+
+        for( size_t e = 0; e < sizeof( entries ) / sizeof( entries[0] ); ++e )
+        {
+            stringstream ss;
+            ss << names[c] << " WnList " << entries[e];
+            benchPayload( ss.str(), codecs[c], wnList( entries[e] ), NULL );
+
+            BYTEVector_t batch;
+            for( size_t i = 0; i < entries[e]; ++i )
+            {
+                const BYTEVector_t info( hostInfo( i ) );
+                batch.insert( batch.end(), info.begin(), info.end() );
+            }
+            ss.str( "" );
+            ss << names[c] << " HostInfo batch " << entries[e];
+            benchPayload( ss.str(), codecs[c], batch, NULL );
+
+            ss.str( "" );
+            ss << names[c] << " HostInfo msgs " << entries[e];
+            benchHostInfoMessages( ss.str(), codecs[c], entries[e], NULL );
+            benchHostInfoMessages( ss.str() + " +dict", codecs[c], entries[e], &dict );
+        }
+    }
+
+    return 0;
+}
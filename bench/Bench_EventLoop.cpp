@@ -0,0 +1,262 @@
+/************************************************************************/
+/**
+ * @file Bench_EventLoop.cpp
+ * @brief Round trips of many connections: an event loop server vs a thread per connection
+ * @author Anar Manafov A.Manafov@gsi.de
+ */ /*
+
+        version number:     $LastChangedRevision$
+        created by:         Anar Manafov
+                            2012-11-23
+        last changed by:    $LastChangedBy$ $LastChangedDate$
+
+        Copyright (c) 2012 GSI, Scientific Computing division. All rights reserved.
+*************************************************************************/
+// STD
+#include <cstdlib>
+#include <cstring>
+// API
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+// BOOST
+#include <boost/bind.hpp>
+#include <boost/thread.hpp>
+// MiscCommon
+#include "INet.h"
+#include "BenchHelper.h"
+// pod-protocol
+#include "ProtocolCommands.h"
+#include "AsyncConnection.h"
+//=============================================================================
+using namespace std;
+using namespace MiscCommon;
+using namespace MiscCommon::INet;
+using namespace MiscCommon::Bench;
+using namespace PROOFAgent;
+//=============================================================================
+double cpuSeconds()
+{
+    rusage usage;
+    getrusage( RUSAGE_SELF, &usage );
+    return usage.ru_utime.tv_sec + usage.ru_stime.tv_sec + ( usage.ru_utime.tv_usec + usage.ru_stime.tv_usec ) * 1e-6;
+}
+//=============================================================================
+// the event loop server: echoes messages, a connection is finished by cmdSHUTDOWN
+class CLoopServer
+{
+    public:
+        CLoopServer( CEventLoop &_loop, int _listener, size_t _connections ):
+            m_loop( _loop ),
+            m_listener( _listener ),
+            m_left( _connections )
+        {
+            m_loop.add( m_listener, EPOLLIN, boost::bind( &CLoopServer::onAccept, this, _1 ) );
+        }
+        ~CLoopServer()
+        {
+            for( size_t i = 0; i < m_conns.size(); ++i )
+                delete m_conns[i];
+        }
+        void onAccept( uint32_t )
+        {
+            const int s( ::accept( m_listener, NULL, NULL ) );
+            if( s < 0 )
+                return;
+            CAsyncConnection *conn = new CAsyncConnection( m_loop, s );
+            apply_profile( s, profileLOW_LATENCY );
+            m_conns.push_back( conn );
+            conn->readMsg( boost::bind( &CLoopServer::onMsg, this, conn, _1, _2, _3 ) );
+        }
+        void onMsg( CAsyncConnection *_conn, bool _ok, const SMessageHeader &_header, const BYTEVector_t &_data )
+        {
+            if( !_ok || cmdSHUTDOWN == _header.m_cmd )
+            {
+                _conn->close();
+                if( 0 == --m_left )
+                {
+                    m_loop.remove( m_listener );
+                    m_loop.stop();
+                }
+                return;
+            }
+            _conn->write( _header.m_cmd, _data );
+            _conn->readMsg( boost::bind( &CLoopServer::onMsg, this, _conn, _1, _2, _3 ) );
+        }
+
+    private:
+        CEventLoop &m_loop;
+        int m_listener;
+        size_t m_left;
+        vector<CAsyncConnection *> m_conns;
+};
+//=============================================================================
+// the thread per connection server: a blocking CProtocol conversation
+void serveConnection( int _socket )
+{
+    smart_socket socket( _socket );
+    CProtocol protocol;
+    try
+    {
+        while( true )
+        {
+            while( !protocol.checkoutNextMsg() )
+            {
+                if( CProtocol::stDISCONNECT == protocol.read( socket.get() ) )
+                    return;
+            }
+            if( cmdSHUTDOWN == protocol.msgHeader().m_cmd )
+                return;
+            protocol.write( socket.get(), protocol.msgHeader().m_cmd, protocol.msgData() );
+        }
+    }
+    catch( const exception &_e )
+    {
+        cerr << _e.what() << endl;
+    }
+}
+//=============================================================================
+// a client: _pings round trips one after another
+class CPinger
+{
+    public:
+        CPinger( CEventLoop &_loop, size_t _pings, size_t _size, size_t *_running ):
+            m_loop( _loop ),
+            m_conn( NULL ),
+            m_data( _size, 'p' ),
+            m_pings( _pings ),
+            m_running( _running )
+        {
+        }
+        ~CPinger()
+        {
+            delete m_conn;
+        }
+        void onConnected( CAsyncConnection *_conn, int _errno )
+        {
+            if( !_conn )
+            {
+                cerr << "connect failed: " << strerror( _errno ) << endl;
+                _exit( 1 );
+            }
+            m_conn = _conn;
+            apply_profile( m_conn->socket(), profileLOW_LATENCY );
+            ping();
+        }
+        void ping()
+        {
+            m_conn->write( cmdGET_WRK_NUM, m_data );
+            m_conn->readMsg( boost::bind( &CPinger::onReply, this, _1 ) );
+        }
+        void onReply( bool _ok )
+        {
+            if( _ok && --m_pings > 0 )
+            {
+                ping();
+                return;
+            }
+            m_conn->writeSimpleCmd( cmdSHUTDOWN );
+            if( 0 == --*m_running )
+                m_loop.stop();
+        }
+
+    private:
+        CEventLoop &m_loop;
+        CAsyncConnection *m_conn;
+        BYTEVector_t m_data;
+        size_t m_pings;
+        size_t *m_running;
+};
+//=============================================================================
+void runClients( unsigned short _port, size_t _connections, size_t _pings, size_t _size )
+{
+    CEventLoop loop;
+    size_t running( _connections );
+    vector<CPinger *> pingers;
+    for( size_t i = 0; i < _connections; ++i )
+    {
+        pingers.push_back( new CPinger( loop, _pings, _size, &running ) );
+        CAsyncConnection::connect( loop, "127.0.0.1", _port, 10000,
+                                   boost::bind( &CPinger::onConnected, pingers.back(), _1, _2 ) );
+    }
+    loop.run();
+    // let the last cmdSHUTDOWN go out
+    loop.runOnce( 100 );
+    for( size_t i = 0; i < pingers.size(); ++i )
+        delete pingers[i];
+}
+//=============================================================================
+pid_t startClients( unsigned short _port, size_t _connections, size_t _pings, size_t _size )
+{
+    const pid_t pid = fork();
+    if( pid < 0 )
+        throw system_error( "fork failed" );
+    if( 0 == pid )
+    {
+        runClients( _port, _connections, _pings, _size );
+        _exit( 0 );
+    }
+    return pid;
+}
+//=============================================================================
+void bench( const string &_name, bool _loop, size_t _connections, size_t _pings, size_t _size )
+{
+    CSocketServer server;
+    const string loopback( "127.0.0.1" );
+    server.Bind( 0, &loopback );
+    server.Listen( _connections );
+    sockaddr_in addr;
+    socklen_t len( sizeof( addr ) );
+    getsockname( server.getSocket(), reinterpret_cast<sockaddr *>( &addr ), &len );
+
+    CStopWatch watch;
+    const double cpuStart( cpuSeconds() );
+    const pid_t pid( startClients( ntohs( addr.sin_port ), _connections, _pings, _size ) );
+    if( _loop )
+    {
+        CEventLoop loop;
+        CLoopServer loopServer( loop, server.getSocket(), _connections );
+        loop.run();
+    }
+    else
+    {
+        boost::thread_group threads;
+        for( size_t i = 0; i < _connections; ++i )
+        {
+            const int s( ::accept( server.getSocket(), NULL, NULL ) );
+            if( s < 0 )
+                throw system_error( "accept failed" );
+            apply_profile( s, profileLOW_LATENCY );
+            threads.create_thread( boost::bind( &serveConnection, s ) );
+        }
+        threads.join_all();
+    }
+    const double sec( watch.elapsed() );
+    const double cpu( cpuSeconds() - cpuStart );
+    int status( 0 );
+    waitpid( pid, &status, 0 );
+    if( !WIFEXITED( status ) || 0 != WEXITSTATUS( status ) )
+        throw runtime_error( "the clients have failed" );
+
+    report( _name, _connections * _pings, sec, _connections * _pings * _size * 2 );
+    cout << "    server CPU " << cpu * 1e9 / ( _connections * _pings ) << " ns per round trip" << endl;
+}
+//=============================================================================
+int main( int argc, char *argv[] )
+{
+    const size_t connections( argc > 1 ? atoi( argv[1] ) : 200 );
+    const size_t pings( argc > 2 ? atoi( argv[2] ) : 200 );
+    const size_t size( argc > 3 ? atoi( argv[3] ) : 64 );
+    try
+    {
+        cout << connections << " connections x " << pings << " round trips of " << size << " bytes" << endl;
+        bench( "echo: event loop server", true, connections, pings, size );
+        bench( "echo: thread per connection", false, connections, pings, size );
+    }
+    catch( const exception &_e )
+    {
+        cerr << _e.what() << endl;
+        return 1;
+    }
+    return 0;
+}
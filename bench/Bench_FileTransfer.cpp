@@ -0,0 +1,137 @@
+/************************************************************************/
+/**
+ * @file Bench_FileTransfer.cpp
+ * @brief Loopback benchmark of pod_protocol file uploads: sendfile/splice vs read/write
+ * @author Anar Manafov A.Manafov@gsi.de
+ */ /*
+
+        version number:     $LastChangedRevision$
+        created by:         Anar Manafov
+                            2012-10-30
+        last changed by:    $LastChangedBy$ $LastChangedDate$
+
+        Copyright (c) 2012 GSI, Scientific Computing division. All rights reserved.
+*************************************************************************/
+// STD
+#include <cstdlib>
+#include <fstream>
+// API
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+// pod-protocol
+#include "Protocol.h"
+#include "ProtocolCommands.h"
+#include "FileTransfer.h"
+// MiscCommon
+#include "INet.h"
+#include "BenchHelper.h"
+//=============================================================================
+using namespace std;
+using namespace MiscCommon;
+using namespace MiscCommon::INet;
+using namespace MiscCommon::Bench;
+using namespace PROOFAgent;
+//=============================================================================
+double cpuTime( int _who )
+{
+    rusage usage;
+    getrusage( _who, &usage );
+    return usage.ru_utime.tv_sec + usage.ru_utime.tv_usec * 1e-6 +
+           usage.ru_stime.tv_sec + usage.ru_stime.tv_usec * 1e-6;
+}
+//=============================================================================
+void benchUpload( const string &_name, const string &_path, const string &_dir, size_t _size, bool _zeroCopy )
+{
+    CSocketServer server;
+    const string loopback( "127.0.0.1" );
+    server.Bind( 0, &loopback );
+    server.Listen( 1 );
+    sockaddr_in addr;
+    socklen_t len( sizeof( addr ) );
+    getsockname( server.getSocket(), reinterpret_cast<sockaddr *>( &addr ), &len );
+
+    const double cpuSelf( cpuTime( RUSAGE_SELF ) );
+    const double cpuChildren( cpuTime( RUSAGE_CHILDREN ) );
+    CStopWatch sw;
+
+    const pid_t pid = fork();
+    if( pid < 0 )
+        throw system_error( "fork failed" );
+    if( 0 == pid )
+    {
+        CSocketClient client;
+        client.connect( ntohs( addr.sin_port ), loopback );
+        CProtocol protocol;
+        protocol.negotiate( protocolCaps() );
+        CFileSender sender;
+        sender.setZeroCopy( _zeroCopy );
+        const SFileStatusCmd status = sender.upload( client.getSocket(), &protocol, _path, "bench.dat" );
+        _exit( fileOK == status.m_status ? 0 : 1 );
+    }
+
+    smart_socket socket( server.Accept() );
+    CProtocol protocol;
+    protocol.negotiate( protocolCaps() );
+    while( !protocol.checkoutNextMsg() )
+    {
+        if( CProtocol::stOK != protocol.read( socket.get() ) )
+            throw runtime_error( "the sender has disconnected" );
+    }
+    BYTEVector_t data;
+    protocol.getMsg( &data );
+    SFileUploadCmd offer;
+    offer.convertFromData( data );
+
+    CFileReceiver receiver( _dir );
+    receiver.setZeroCopy( _zeroCopy );
+    const SFileStatusCmd status = receiver.receive( socket.get(), &protocol, offer );
+    int exitStatus( 0 );
+    waitpid( pid, &exitStatus, 0 );
+    const double sec( sw.elapsed() );
+
+    report( _name, 1, sec, _size );
+    cout << "    cpu: receiver " << fixed << setprecision( 3 ) << cpuTime( RUSAGE_SELF ) - cpuSelf
+         << " s, sender " << cpuTime( RUSAGE_CHILDREN ) - cpuChildren << " s"
+         << ( ( fileOK == status.m_status && 0 == exitStatus ) ? "" : " (FAILED)" ) << endl;
+
+    ::unlink( ( _dir + "/bench.dat" ).c_str() );
+}
+//=============================================================================
+int main( int argc, char *argv[] )
+{
+    // a size of the file in MB
+    const size_t size( ( argc > 1 ? atoi( argv[1] ) : 512 ) * 1024 * 1024 );
+
+    char dirTemplate[] = "/tmp/MiscCommon_bench_XXXXXX";
+    if( !mkdtemp( dirTemplate ) )
+        throw system_error( "mkdtemp failed" );
+    const string dir( dirTemplate );
+    const string src( dir + "/src.dat" );
+    {
+        ofstream f( src.c_str(), ios_base::binary );
+        string block( 1024 * 1024, '\0' );
+        uint32_t seed( 1 );
+        for( size_t i = 0; i < size; i += block.size() )
+        {
+            for( size_t j = 0; j < block.size(); ++j )
+            {
+                seed = seed * 1103515245 + 12345;
+                block[j] = seed >> 16;
+            }
+            f.write( block.data(), block.size() );
+        }
+    }
+
+    // the first run warms up the page cache
+    benchUpload( "upload read/write (warm up)", src, dir, size, false );
+    for( int i = 0; i < 3; ++i )
+    {
+        benchUpload( "upload read/write", src, dir, size, false );
+        benchUpload( "upload sendfile/splice", src, dir, size, true );
+    }
+
+    ::unlink( src.c_str() );
+    ::rmdir( dir.c_str() );
+    return 0;
+}
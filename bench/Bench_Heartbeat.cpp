@@ -0,0 +1,122 @@
+/************************************************************************/
+/**
+ * @file Bench_Heartbeat.cpp
+ * @brief CPU cost and miss detection latency of UDP heartbeats of many workers
+ * @author Anar Manafov A.Manafov@gsi.de
+ */ /*
+
+        version number:     $LastChangedRevision$
+        created by:         Anar Manafov
+                            2012-11-22
+        last changed by:    $LastChangedBy$ $LastChangedDate$
+
+        Copyright (c) 2012 GSI, Scientific Computing division. All rights reserved.
+*************************************************************************/
+// STD
+#include <cstdlib>
+// API
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <signal.h>
+#include <unistd.h>
+// MiscCommon
+#include "Heartbeat.h"
+#include "BenchHelper.h"
+//=============================================================================
+using namespace std;
+using namespace MiscCommon;
+using namespace MiscCommon::INet;
+using namespace MiscCommon::Bench;
+//=============================================================================
+double cpuSeconds()
+{
+    rusage usage;
+    getrusage( RUSAGE_SELF, &usage );
+    return usage.ru_utime.tv_sec + usage.ru_stime.tv_sec + ( usage.ru_utime.tv_usec + usage.ru_stime.tv_usec ) * 1e-6;
+}
+//=============================================================================
+// the workers: all of them beat every _periodMs, the last 1% goes silent after _silentAfterMs
+void beat( unsigned short _port, size_t _workers, int _periodMs, int _silentAfterMs )
+{
+    const SHeartbeatKey key( "bench-secret-key" );
+    CHeartbeatSender sender( key );
+    sender.connect( _port, "127.0.0.1" );
+    vector<uint32_t> all;
+    for( size_t i = 0; i < _workers; ++i )
+        all.push_back( i );
+    const vector<uint32_t> alive( all.begin(), all.begin() + _workers * 99 / 100 );
+    const uint64_t start( monotonic_ms() );
+    while( true )
+    {
+        const uint64_t round( monotonic_ms() );
+        sender.beat( round - start < static_cast<uint64_t>( _silentAfterMs ) ? all : alive );
+        const uint64_t spent( monotonic_ms() - round );
+        if( spent < static_cast<uint64_t>( _periodMs ) )
+            usleep( ( _periodMs - spent ) * 1000 );
+    }
+}
+//=============================================================================
+int main( int argc, char *argv[] )
+{
+    const size_t workers( argc > 1 ? atoi( argv[1] ) : 100000 );
+    const int timeoutMs( argc > 2 ? atoi( argv[2] ) : 1000 );
+    const int periodMs( timeoutMs / 3 );
+    const int silentAfterMs( 3 * timeoutMs );
+    try
+    {
+        const SHeartbeatKey key( "bench-secret-key" );
+        CHeartbeatMonitor monitor( key, timeoutMs );
+        const string loopback( "127.0.0.1" );
+        const unsigned short port( monitor.bind( 0, &loopback ) );
+        for( size_t i = 0; i < workers; ++i )
+            monitor.watch( i );
+
+        const pid_t pid = fork();
+        if( pid < 0 )
+            throw system_error( "fork failed" );
+        if( 0 == pid )
+        {
+            beat( port, workers, periodMs, silentAfterMs );
+            _exit( 0 );
+        }
+
+        // the workers are watched before the first beat, misses of the startup are not counted
+        const uint64_t start( monotonic_ms() );
+        const double cpuStart( cpuSeconds() );
+        vector<uint32_t> missed;
+        size_t beats( 0 );
+        size_t detected( 0 );
+        uint64_t maxLag( 0 );
+        while( monotonic_ms() - start < static_cast<uint64_t>( silentAfterMs + 2 * timeoutMs ) )
+        {
+            missed.clear();
+            beats += monitor.process( 100, &missed );
+            if( monotonic_ms() - start < static_cast<uint64_t>( silentAfterMs ) )
+                continue;
+            // a lag of the detection after the deadline of the last beat
+            const uint64_t now( monotonic_ms() );
+            for( size_t i = 0; i < missed.size(); ++i )
+                maxLag = max( maxLag, now - monitor.lastSeen( missed[i] ) - timeoutMs );
+            detected += missed.size();
+        }
+        const double cpu( cpuSeconds() - cpuStart );
+        const double wall( ( monotonic_ms() - start ) * 1e-3 );
+        kill( pid, SIGKILL );
+        waitpid( pid, NULL, 0 );
+
+        report( "heartbeat accepted (monitor CPU)", beats, cpu );
+        const SHeartbeatStats &stats = monitor.stats();
+        cout
+                << "    " << workers << " workers, a beat every " << periodMs << " ms, timeout " << timeoutMs << " ms\n"
+                << "    monitor CPU load " << 100 * cpu / wall << " %, received " << stats.m_received
+                << ", missed " << stats.m_missed << " (1% silent: " << workers / 100 << ")\n"
+                << "    " << detected << " silent workers were detected at most " << maxLag
+                << " ms after the timeout of their last beat" << endl;
+    }
+    catch( const exception &_e )
+    {
+        cerr << _e.what() << endl;
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,198 @@
+/************************************************************************/
+/**
+ * @file Bench_LocalSocket.cpp
+ * @brief Latency and throughput of pod_protocol over TCP loopback vs AF_UNIX sockets vs shared memory
+ * @author Anar Manafov A.Manafov@gsi.de
+ */ /*
+
+        version number:     $LastChangedRevision$
+        created by:         Anar Manafov
+                            2012-11-14
+        last changed by:    $LastChangedBy$ $LastChangedDate$
+
+        Copyright (c) 2012 GSI, Scientific Computing division. All rights reserved.
+*************************************************************************/
+// STD
+#include <cstdlib>
+#include <sstream>
+// API
+#include <netinet/tcp.h>
+#include <sys/wait.h>
+#include <unistd.h>
+// pod-protocol
+#include "Protocol.h"
+#include "ProtocolCommands.h"
+#include "ShmTransport.h"
+// MiscCommon
+#include "INet.h"
+#include "BenchHelper.h"
+//=============================================================================
+using namespace std;
+using namespace MiscCommon;
+using namespace MiscCommon::INet;
+using namespace MiscCommon::Bench;
+using namespace PROOFAgent;
+//=============================================================================
+enum ETransport
+{
+    trTCP,
+    trUNIX_STREAM,
+    trUNIX_SEQPACKET,
+    trSHM
+};
+//=============================================================================
+// return: a connected pair, [0] - the client, [1] - the server side
+void connectPair( ETransport _transport, int _fds[2] )
+{
+    if( trTCP == _transport )
+    {
+        CSocketServer server;
+        const string loopback( "127.0.0.1" );
+        server.Bind( 0, &loopback );
+        server.Listen( 1 );
+        sockaddr_in addr;
+        socklen_t len( sizeof( addr ) );
+        getsockname( server.getSocket(), reinterpret_cast<sockaddr *>( &addr ), &len );
+        CSocketClient client;
+        client.connect( ntohs( addr.sin_port ), loopback );
+        _fds[1] = server.Accept();
+        _fds[0] = client.detach();
+        const int on( 1 );
+        setsockopt( _fds[0], IPPROTO_TCP, TCP_NODELAY, &on, sizeof( on ) );
+        setsockopt( _fds[1], IPPROTO_TCP, TCP_NODELAY, &on, sizeof( on ) );
+        return;
+    }
+
+    // the shared memory segment is passed over an AF_UNIX stream
+    const int type( trUNIX_SEQPACKET == _transport ? SOCK_SEQPACKET : SOCK_STREAM );
+    stringstream path;
+    path << "@pod-bench-" << getpid();
+    CSocketServer server( AF_UNIX, type );
+    server.BindLocal( path.str() );
+    server.Listen( 1 );
+    CSocketClient client( AF_UNIX, type );
+    client.connectLocal( path.str() );
+    _fds[1] = server.Accept();
+    _fds[0] = client.detach();
+}
+//=============================================================================
+void setup( ETransport _transport, CProtocol *_protocol, CShmTransport *_shm )
+{
+    if( trSHM == _transport )
+        _protocol->setShm( _shm );
+    // the transport itself is measured, the flow control is measured by Bench_Protocol
+    _protocol->negotiate( protocolCaps() & ~capCREDIT );
+    _protocol->setCompressionThreshold( 0xFFFFFFFF );
+    _protocol->setSeqPacket( trUNIX_SEQPACKET == _transport );
+}
+//=============================================================================
+// the peer: answers cmdGET_WRK_NUM with cmdWRK_NUM, answers cmdSHUTDOWN with a number of received bytes
+void serve( ETransport _transport, int _socket )
+{
+    CShmTransport shm;
+    if( trSHM == _transport )
+        shm.receiveFrom( _socket );
+    CProtocol protocol;
+    setup( _transport, &protocol, &shm );
+    uint64_t received( 0 );
+    while( true )
+    {
+        if( !protocol.checkoutNextMsg() )
+        {
+            if( CProtocol::stDISCONNECT == protocol.read( _socket ) )
+                return;
+            continue;
+        }
+        const SMessageHeader &header = protocol.msgHeader();
+        received += header.m_len;
+        if( cmdGET_WRK_NUM == header.m_cmd )
+            protocol.write( _socket, cmdWRK_NUM, BYTEVector_t( 2, 1 ) );
+        else if( cmdSHUTDOWN == header.m_cmd )
+            protocol.write( _socket, cmdSHUTDOWN, BYTEVector_t( reinterpret_cast<unsigned char *>( &received ),
+                                                                  reinterpret_cast<unsigned char *>( &received ) + sizeof( received ) ) );
+    }
+}
+//=============================================================================
+void waitFor( CProtocol *_protocol, int _socket, uint16_t _cmd )
+{
+    while( true )
+    {
+        while( _protocol->checkoutNextMsg() )
+        {
+            if( _cmd == _protocol->msgHeader().m_cmd )
+                return;
+        }
+        if( CProtocol::stDISCONNECT == _protocol->read( _socket ) )
+            throw runtime_error( "the peer has disconnected" );
+    }
+}
+//=============================================================================
+void benchTransport( const string &_name, ETransport _transport, size_t _pings, size_t _mb )
+{
+    int fds[2];
+    connectPair( _transport, fds );
+    const pid_t pid = fork();
+    if( pid < 0 )
+        throw system_error( "fork failed" );
+    if( 0 == pid )
+    {
+        ::close( fds[0] );
+        serve( _transport, fds[1] );
+        _exit( 0 );
+    }
+    ::close( fds[1] );
+    smart_socket socket( fds[0] );
+
+    CShmTransport shm;
+    if( trSHM == _transport )
+    {
+        shm.create();
+        shm.sendTo( socket.get() );
+    }
+    CProtocol protocol;
+    setup( _transport, &protocol, &shm );
+
+    // latency: a round trip of a small request
+    CStopWatch sw;
+    for( size_t i = 0; i < _pings; ++i )
+    {
+        protocol.writeSimpleCmd( socket.get(), cmdGET_WRK_NUM );
+        waitFor( &protocol, socket.get(), cmdWRK_NUM );
+    }
+    const double rtt( sw.elapsed() );
+    report( _name + " round trip GET_WRK_NUM", _pings, rtt );
+    report( _name + " one way (rtt / 2)", _pings, rtt / 2 );
+
+    // throughput: one way bulk messages, confirmed by the peer at the end
+    const BYTEVector_t bulk( 64 * 1024, 'b' );
+    const size_t count( _mb * 16 );
+    sw.start();
+    for( size_t i = 0; i < count; ++i )
+        protocol.write( socket.get(), cmdWNs_LIST, bulk );
+    protocol.writeSimpleCmd( socket.get(), cmdSHUTDOWN );
+    waitFor( &protocol, socket.get(), cmdSHUTDOWN );
+    report( _name + " bulk 64 KB", count, sw.elapsed(), count * bulk.size() );
+
+    shm.close();
+    socket.close();
+    waitpid( pid, NULL, 0 );
+}
+//=============================================================================
+int main( int argc, char *argv[] )
+{
+    const size_t pings( argc > 1 ? atoi( argv[1] ) : 20000 );
+    const size_t mb( argc > 2 ? atoi( argv[2] ) : 512 );
+    try
+    {
+        benchTransport( "TCP loopback", trTCP, pings, mb );
+        benchTransport( "AF_UNIX stream", trUNIX_STREAM, pings, mb );
+        benchTransport( "AF_UNIX seqpacket", trUNIX_SEQPACKET, pings, mb );
+        benchTransport( "shared memory", trSHM, pings, mb );
+    }
+    catch( const exception &_e )
+    {
+        cerr << _e.what() << endl;
+        return 1;
+    }
+    return 0;
+}
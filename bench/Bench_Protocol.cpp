@@ -0,0 +1,149 @@
+/************************************************************************/
+/**
+ * @file Bench_Protocol.cpp
+ * @brief Benchmarks of pod_protocol message encoding/decoding
+ * @author Anar Manafov A.Manafov@gsi.de
+ */ /*
+
+        version number:     $LastChangedRevision$
+        created by:         Anar Manafov
+                            2012-10-02
+        last changed by:    $LastChangedBy$ $LastChangedDate$
+
+        Copyright (c) 2012 GSI, Scientific Computing division. All rights reserved.
+*************************************************************************/
+// STD
+#include <sstream>
+// pod-protocol
+#include "Protocol.h"
+#include "ProtocolCommands.h"
+#include "CRC32C.h"
+#include "CmdDispatcher.h"
+// API
+#include <unistd.h>
+// MiscCommon
+#include "BenchHelper.h"
+//=============================================================================
+using namespace std;
+using namespace MiscCommon;
+using namespace MiscCommon::Bench;
+using namespace PROOFAgent;
+//=============================================================================
+void benchHeader( const string &_name, uint32_t _caps, size_t _payload )
+{
+    const size_t ops( 64 * 1024 * 1024 / ( _payload + 64 ) + 1000 );
+    BYTEVector_t data( _payload, 'x' );
+
+    stringstream ss;
+    ss << _name << " encode " << _payload << "B";
+    CStopWatch sw;
+    size_t bytes( 0 );
+    for( size_t i = 0; i < ops; ++i )
+    {
+        BYTEVector_t msg( createMsg( cmdWNs_LIST, data, _caps ) );
+        bytes += msg.size();
+        doNotOptimize( msg );
+    }
+    report( ss.str(), ops, sw.elapsed(), bytes );
+
+    const BYTEVector_t msg( createMsg( cmdWNs_LIST, data, _caps ) );
+    ss.str( "" );
+    ss << _name << " decode " << _payload << "B";
+    sw.start();
+    for( size_t i = 0; i < ops; ++i )
+    {
+        BYTEVector_t res;
+        SMessageHeader header = parseMsg( &res, msg );
+        doNotOptimize( header );
+    }
+    report( ss.str(), ops, sw.elapsed(), ops * msg.size() );
+}
+//=============================================================================
+size_t g_hostInfos( 0 );
+void onHostInfo( const SHostInfoCmd &_cmd )
+{
+    g_hostInfos += _cmd.m_xpdPort;
+}
+//=============================================================================
+// a batch of host-info messages is pushed through a pipe,
+// then handled either by getMsg + switch or by CCmdDispatcher
+void benchDispatch( const string &_name, int _mode )
+{
+    SHostInfoCmd cmd;
+    cmd.m_username = "pod";
+    cmd.m_host = "lxb1234.gsi.de";
+    cmd.m_version = "3.12";
+    cmd.m_PoDPath = "/lustre/hebe/pod/PoD/3.12";
+    cmd.m_xpdPort = 1;
+    BYTEVector_t data;
+    cmd.convertToData( &data );
+    const BYTEVector_t msg( createMsg( cmdHOST_INFO, data, capHEADER_V2 ) );
+    BYTEVector_t batch;
+    while( batch.size() + msg.size() < 32 * 1024 )
+        batch.insert( batch.end(), msg.begin(), msg.end() );
+    const size_t batchMsgs( batch.size() / msg.size() );
+
+    int fds[2];
+    if( 0 != pipe( fds ) )
+        return;
+
+    CCmdDispatcher dispatcher;
+    dispatcher.registerCmd<SHostInfoCmd>( cmdHOST_INFO, &onHostInfo );
+    dispatcher.setTiming( 2 == _mode );
+
+    CProtocol protocol;
+    const size_t rounds( 2000 );
+    CStopWatch sw;
+    for( size_t r = 0; r < rounds; ++r )
+    {
+        if( static_cast<ssize_t>( batch.size() ) != ::write( fds[1], &batch[0], batch.size() ) )
+            break;
+        protocol.read( fds[0] );
+        if( 0 == _mode )
+        {
+            while( protocol.checkoutNextMsg() )
+            {
+                BYTEVector_t res;
+                const SMessageHeader header = protocol.getMsg( &res );
+                switch( header.m_cmd )
+                {
+                    case cmdHOST_INFO:
+                        {
+                            SHostInfoCmd info;
+                            info.convertFromData( res );
+                            onHostInfo( info );
+                        }
+                        break;
+                    default:
+                        break;
+                }
+            }
+        }
+        else
+        {
+            dispatcher.dispatchAll( &protocol );
+        }
+    }
+    report( _name, rounds * batchMsgs, sw.elapsed(), rounds * batch.size() );
+    ::close( fds[0] );
+    ::close( fds[1] );
+}
+//=============================================================================
+int main()
+{
+    cout << "CRC32C hardware: " << ( crc32cHardware() ? "yes" : "no" ) << endl;
+
+    const size_t sizes[] = { 0, 16, 256, 4096, 65536 };
+    for( size_t i = 0; i < sizeof( sizes ) / sizeof( sizes[0] ); ++i )
+    {
+        benchHeader( "v1", 0, sizes[i] );
+        benchHeader( "v2", capHEADER_V2, sizes[i] );
+        benchHeader( "v2+crc32c", capHEADER_V2 | capCRC32C, sizes[i] );
+    }
+
+    benchDispatch( "HostInfo getMsg + switch", 0 );
+    benchDispatch( "HostInfo dispatcher", 1 );
+    benchDispatch( "HostInfo dispatcher + latency", 2 );
+
+    return 0;
+}
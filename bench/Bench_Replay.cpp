@@ -0,0 +1,302 @@
+/************************************************************************/
+/**
+ * @file Bench_Replay.cpp
+ * @brief Replays a capture file (see Capture.h) through CProtocol and the command decoders
+ * @author Anar Manafov A.Manafov@gsi.de
+ */ /*
+
+        version number:     $LastChangedRevision$
+        created by:         Anar Manafov
+                            2012-11-26
+        last changed by:    $LastChangedBy$ $LastChangedDate$
+
+        Copyright (c) 2012 GSI, Scientific Computing division. All rights reserved.
+*************************************************************************/
+// STD
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <new>
+#include <sstream>
+// API
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <unistd.h>
+// BOOST
+#include <boost/bind.hpp>
+// MiscCommon
+#include "ErrorCode.h"
+#include "BenchHelper.h"
+// pod-protocol
+#include "Protocol.h"
+#include "ProtocolCommands.h"
+#include "CmdDispatcher.h"
+#include "Capture.h"
+//=============================================================================
+using namespace std;
+using namespace MiscCommon;
+using namespace MiscCommon::Bench;
+using namespace PROOFAgent;
+//=============================================================================
+// heap allocations of the process, the replay reports them per message
+size_t g_allocations = 0;
+void *operator new( size_t _size ) throw( std::bad_alloc )
+{
+    ++g_allocations;
+    void *p = malloc( _size ? _size : 1 );
+    if( !p )
+        throw std::bad_alloc();
+    return p;
+}
+void operator delete( void *_p ) throw()
+{
+    free( _p );
+}
+//=============================================================================
+template<class _Cmd>
+void decoded( const _Cmd &_cmd, size_t *_count )
+{
+    doNotOptimize( _cmd );
+    ++*_count;
+}
+//=============================================================================
+void raw( const SMessageHeader &, const BYTEVector_t &, size_t *_count )
+{
+    ++*_count;
+}
+//=============================================================================
+// the decoders of the commands, which have arguments
+void registerDecoders( CCmdDispatcher *_dispatcher, size_t *_count )
+{
+    _dispatcher->registerCmd<SVersionCmd>( cmdVERSION, boost::bind( &decoded<SVersionCmd>, _1, _count ) );
+    _dispatcher->registerCmd<SHostInfoCmd>( cmdHOST_INFO, boost::bind( &decoded<SHostInfoCmd>, _1, _count ) );
+    _dispatcher->registerCmd<SIdCmd>( cmdID, boost::bind( &decoded<SIdCmd>, _1, _count ) );
+    _dispatcher->registerCmd<SIdCmd>( cmdSET_ID, boost::bind( &decoded<SIdCmd>, _1, _count ) );
+    _dispatcher->registerCmd<SWnListCmd>( cmdWNs_LIST, boost::bind( &decoded<SWnListCmd>, _1, _count ) );
+    _dispatcher->registerCmd<SEpochCmd>( cmdGET_WNs_LIST_DELTA, boost::bind( &decoded<SEpochCmd>, _1, _count ) );
+    _dispatcher->registerCmd<SWnListDeltaCmd>( cmdWNs_LIST_DELTA, boost::bind( &decoded<SWnListDeltaCmd>, _1, _count ) );
+    _dispatcher->registerCmd<SCreditCmd>( cmdCREDIT, boost::bind( &decoded<SCreditCmd>, _1, _count ) );
+    _dispatcher->registerCmd<SFileUploadCmd>( cmdFILE_UPLOAD, boost::bind( &decoded<SFileUploadCmd>, _1, _count ) );
+    _dispatcher->registerCmd<SFileOffsetCmd>( cmdFILE_UPLOAD_OFFSET, boost::bind( &decoded<SFileOffsetCmd>, _1, _count ) );
+    _dispatcher->registerCmd<SFileStatusCmd>( cmdFILE_UPLOAD_STATUS, boost::bind( &decoded<SFileStatusCmd>, _1, _count ) );
+    _dispatcher->registerCmd<SProtocolStateCmd>( cmdHANDOVER_CONNECTION, boost::bind( &decoded<SProtocolStateCmd>, _1, _count ) );
+    _dispatcher->registerCmd<SHandoverDoneCmd>( cmdHANDOVER_DONE, boost::bind( &decoded<SHandoverDoneCmd>, _1, _count ) );
+    _dispatcher->setFallback( boost::bind( &raw, _1, _2, _count ) );
+}
+//=============================================================================
+// a synthetic session of an agent with _workers workers,
+// it is replayed, when no capture file is given
+void synthesize( const string &_path, size_t _workers, size_t _rounds )
+{
+    ::unlink( _path.c_str() );
+    CCaptureWriter capture( _path );
+    const uint32_t caps( protocolCaps() );
+    BYTEVector_t data;
+
+    SWnListCmd list;
+    for( size_t i = 0; i < _workers; ++i )
+    {
+        stringstream ss;
+        ss << "worker" << i << ".gsi.de:21001";
+        list.m_container.push_back( ss.str() );
+    }
+    for( size_t w = 0; w < _workers; ++w )
+    {
+        SVersionCmd version;
+        version.m_caps = caps;
+        version.convertToData( &data );
+        BYTEVector_t msg( createMsg( cmdVERSION, data, 0 ) );
+        capture.record( w, dirOUT, &msg[0], msg.size() );
+        capture.record( w, dirIN, &msg[0], msg.size() );
+
+        SHostInfoCmd info;
+        info.m_username = "pod";
+        info.m_host = "worker.gsi.de";
+        info.m_version = "3.12";
+        info.m_PoDPath = "/opt/PoD";
+        info.m_agentPid = 1000 + w;
+        info.convertToData( &data );
+        msg = createMsg( cmdHOST_INFO, data, caps );
+        capture.record( w, dirIN, &msg[0], msg.size() );
+
+        SIdCmd id;
+        id.m_id = w;
+        id.convertToData( &data );
+        msg = createMsg( cmdID, data, caps );
+        capture.record( w, dirOUT, &msg[0], msg.size() );
+    }
+    for( size_t r = 0; r < _rounds; ++r )
+    {
+        for( size_t w = 0; w < _workers; ++w )
+        {
+            BYTEVector_t msg( createMsg( cmdGET_WRK_NUM, BYTEVector_t(), caps ) );
+            capture.record( w, dirOUT, &msg[0], msg.size() );
+            SIdCmd num;
+            num.m_id = 8;
+            num.convertToData( &data );
+            msg = createMsg( cmdWRK_NUM, data, caps );
+            capture.record( w, dirIN, &msg[0], msg.size() );
+        }
+        // the UI asks for the list of workers now and then
+        BYTEVector_t msg( createMsg( cmdGET_WNs_LIST, BYTEVector_t(), caps ) );
+        capture.record( _workers, dirIN, &msg[0], msg.size() );
+        list.convertToData( &data );
+        msg = createMsg( cmdWNs_LIST, data, caps );
+        capture.record( _workers, dirOUT, &msg[0], msg.size() );
+    }
+}
+//=============================================================================
+// a receiving side of one direction of a captured connection
+struct SStream
+{
+    CProtocol m_protocol;
+};
+typedef map<pair<uint32_t, int>, SStream *> Streams_t;
+//=============================================================================
+void usage()
+{
+    cout
+            << "usage: MiscCommon_bench_Replay [--original] [--loops N] [capture file]\n"
+            << "    --original  keep the original pace of the capture, the default is the maximum speed\n"
+            << "    --loops N   replay the capture N times\n"
+            << "    without a file a synthetic session of an agent is replayed" << endl;
+}
+//=============================================================================
+int main( int argc, char *argv[] )
+{
+    bool original( false );
+    size_t loops( 1 );
+    string path;
+    for( int i = 1; i < argc; ++i )
+    {
+        if( 0 == strcmp( argv[i], "--original" ) )
+            original = true;
+        else if( 0 == strcmp( argv[i], "--loops" ) && i + 1 < argc )
+            loops = max( 1, atoi( argv[++i] ) );
+        else if( '-' == argv[i][0] )
+        {
+            usage();
+            return 1;
+        }
+        else
+            path = argv[i];
+    }
+
+    try
+    {
+        bool synthetic( false );
+        if( path.empty() )
+        {
+            stringstream ss;
+            ss << "/tmp/MiscCommon_replay." << getpid() << ".podcap";
+            path = ss.str();
+            synthesize( path, 500, 20 );
+            synthetic = true;
+        }
+
+        // the messages go through a socket, as they would in the agent
+        int fds[2];
+        if( 0 != socketpair( AF_UNIX, SOCK_STREAM, 0, fds ) )
+            throw system_error( "Can't create a socket pair" );
+        fcntl( fds[0], F_SETFL, O_NONBLOCK );
+        fcntl( fds[1], F_SETFL, O_NONBLOCK );
+
+        size_t decodedCount( 0 );
+        CCmdDispatcher dispatcher;
+        dispatcher.setTiming( false );
+        registerDecoders( &dispatcher, &decodedCount );
+
+        Streams_t streams;
+        vector<uint64_t> latencies;
+        size_t records( 0 );
+        size_t bytes( 0 );
+        size_t errors( 0 );
+        size_t allocations( 0 );
+        double sec( 0 );
+        for( size_t loop = 0; loop < loops; ++loop )
+        {
+            CCaptureReader reader( path );
+            SCaptureRecord record;
+            uint64_t firstTime( 0 );
+            CStopWatch pace;
+            while( reader.next( &record ) )
+            {
+                if( 0 == firstTime )
+                    firstTime = record.m_timeNs;
+                if( original )
+                {
+                    const double due( ( record.m_timeNs - firstTime ) * 1e-9 );
+                    const double now( pace.elapsed() );
+                    if( due > now )
+                        usleep( static_cast<useconds_t>( ( due - now ) * 1e6 ) );
+                }
+                SStream *&stream = streams[make_pair( record.m_connection, static_cast<int>( record.m_dir ) )];
+                if( !stream )
+                    stream = new SStream;
+
+                const size_t allocBefore( g_allocations );
+                CStopWatch sw;
+                try
+                {
+                    size_t sent( 0 );
+                    size_t dispatched( 0 );
+                    while( sent < record.m_msg.size() || 0 == dispatched )
+                    {
+                        if( sent < record.m_msg.size() )
+                        {
+                            const ssize_t n = ::write( fds[0], &record.m_msg[sent], record.m_msg.size() - sent );
+                            if( n < 0 && EAGAIN != errno )
+                                throw system_error( "Can't feed the capture" );
+                            sent += ( n > 0 ? n : 0 );
+                        }
+                        const CProtocol::EStatus_t status( stream->m_protocol.read( fds[1] ) );
+                        if( CProtocol::stOK == status )
+                            dispatched += dispatcher.dispatchAll( &stream->m_protocol );
+                        else if( sent == record.m_msg.size() )
+                            break;
+                    }
+                }
+                catch( const exception &_e )
+                {
+                    // for example, a message compressed with a dictionary
+                    if( 0 == errors++ )
+                        cerr << "replay error: " << _e.what() << endl;
+                }
+                const double elapsed( sw.elapsed() );
+                allocations += g_allocations - allocBefore;
+                sec += elapsed;
+                latencies.push_back( static_cast<uint64_t>( elapsed * 1e9 ) );
+                ++records;
+                bytes += record.m_msg.size();
+            }
+        }
+        ::close( fds[0] );
+        ::close( fds[1] );
+        for( Streams_t::iterator iter = streams.begin(); iter != streams.end(); ++iter )
+            delete iter->second;
+        if( synthetic )
+            ::unlink( path.c_str() );
+        if( 0 == records )
+        {
+            cout << "the capture is empty" << endl;
+            return 0;
+        }
+
+        sort( latencies.begin(), latencies.end() );
+        report( "replay: feed, read, decode", records, sec, bytes );
+        cout
+                << "    " << records << " records of " << streams.size() << " streams, " << decodedCount << " decoded, "
+                << errors << " errors\n"
+                << "    " << records / sec << " msgs/s, " << static_cast<double>( allocations ) / records << " allocations/msg\n"
+                << "    latency p50 " << latencies[latencies.size() / 2]
+                << " ns, p99 " << latencies[latencies.size() * 99 / 100]
+                << " ns, max " << latencies.back() << " ns" << endl;
+    }
+    catch( const exception &_e )
+    {
+        cerr << _e.what() << endl;
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,178 @@
+/************************************************************************/
+/**
+ * @file Bench_SocketProfile.cpp
+ * @brief Command round trips and bulk throughput over TCP loopback with different socket profiles
+ * @author Anar Manafov A.Manafov@gsi.de
+ */ /*
+
+        version number:     $LastChangedRevision$
+        created by:         Anar Manafov
+                            2012-11-21
+        last changed by:    $LastChangedBy$ $LastChangedDate$
+
+        Copyright (c) 2012 GSI, Scientific Computing division. All rights reserved.
+*************************************************************************/
+// STD
+#include <cstdlib>
+// API
+#include <sys/wait.h>
+#include <unistd.h>
+// pod-protocol
+#include "Protocol.h"
+#include "ProtocolCommands.h"
+// MiscCommon
+#include "INet.h"
+#include "BenchHelper.h"
+//=============================================================================
+using namespace std;
+using namespace MiscCommon;
+using namespace MiscCommon::INet;
+using namespace MiscCommon::Bench;
+using namespace PROOFAgent;
+//=============================================================================
+enum EMode
+{
+    modeDEFAULT,
+    modeLOW_LATENCY,
+    modeCORK,
+    modeBULK
+};
+//=============================================================================
+ESocketProfile profileOf( EMode _mode )
+{
+    if( modeLOW_LATENCY == _mode )
+        return profileLOW_LATENCY;
+    if( modeBULK == _mode )
+        return profileBULK;
+    return profileDEFAULT;
+}
+//=============================================================================
+// the peer: answers cmdGET_WRK_NUM with cmdWRK_NUM, answers cmdSHUTDOWN with cmdSHUTDOWN
+void serve( int _socket )
+{
+    CProtocol protocol;
+    while( true )
+    {
+        if( !protocol.checkoutNextMsg() )
+        {
+            if( CProtocol::stDISCONNECT == protocol.read( _socket ) )
+                return;
+            continue;
+        }
+        const uint16_t cmd( protocol.msgHeader().m_cmd );
+        if( cmdGET_WRK_NUM == cmd )
+            protocol.write( _socket, cmdWRK_NUM, BYTEVector_t( 2, 1 ) );
+        else if( cmdSHUTDOWN == cmd )
+            protocol.writeSimpleCmd( _socket, cmdSHUTDOWN );
+    }
+}
+//=============================================================================
+void waitFor( CProtocol *_protocol, int _socket, uint16_t _cmd )
+{
+    while( true )
+    {
+        while( _protocol->checkoutNextMsg() )
+        {
+            if( _cmd == _protocol->msgHeader().m_cmd )
+                return;
+        }
+        if( CProtocol::stDISCONNECT == _protocol->read( _socket ) )
+            throw runtime_error( "the peer has disconnected" );
+    }
+}
+//=============================================================================
+// writes a header and a payload by separate calls, as CFileSender does
+void writeSplit( CProtocol *_protocol, int _socket, uint16_t _cmd, const BYTEVector_t &_data )
+{
+    _protocol->writeMsg( _socket, createMsgHeader( _cmd, _data.size() ) );
+    sendall( _socket, &_data[0], _data.size(), 0 );
+}
+//=============================================================================
+void benchProfile( const string &_name, EMode _mode, size_t _pings, size_t _mb )
+{
+    CSocketServer server;
+    const string loopback( "127.0.0.1" );
+    server.Bind( 0, &loopback );
+    server.setProfile( profileOf( _mode ) );
+    server.Listen( 1 );
+    sockaddr_in addr;
+    socklen_t len( sizeof( addr ) );
+    getsockname( server.getSocket(), reinterpret_cast<sockaddr *>( &addr ), &len );
+    CSocketClient client;
+    client.setProfile( profileOf( _mode ) );
+    client.connect( ntohs( addr.sin_port ), loopback );
+    const int accepted( server.Accept() );
+
+    const pid_t pid = fork();
+    if( pid < 0 )
+        throw system_error( "fork failed" );
+    if( 0 == pid )
+    {
+        serve( accepted );
+        _exit( 0 );
+    }
+    ::close( accepted );
+    const int socket( client.getSocket() );
+    CProtocol protocol;
+
+    // latency: a small request, written as a header and a payload, Nagle holds the payload
+    // until the header is acknowledged, and the peer delays the acknowledgement
+    const BYTEVector_t request( 16, 'r' );
+    CStopWatch sw;
+    for( size_t i = 0; i < _pings; ++i )
+    {
+        if( modeCORK == _mode )
+        {
+            CCorkGuard cork( socket );
+            writeSplit( &protocol, socket, cmdGET_WRK_NUM, request );
+        }
+        else
+            writeSplit( &protocol, socket, cmdGET_WRK_NUM, request );
+        waitFor( &protocol, socket, cmdWRK_NUM );
+    }
+    report( _name + " split request round trip", _pings, sw.elapsed() );
+
+    // throughput: one way bulk messages, confirmed by the peer at the end
+    const BYTEVector_t bulk( 64 * 1024, 'b' );
+    const size_t count( _mb * 16 );
+    size_t tuned( 0 );
+    sw.start();
+    for( size_t i = 0; i < count; ++i )
+    {
+        protocol.write( socket, cmdWNs_LIST, bulk );
+        if( modeBULK == _mode && 0 == i % 256 )
+            tuned = max( tuned, autotune_buffers( socket ) );
+    }
+    protocol.writeSimpleCmd( socket, cmdSHUTDOWN );
+    waitFor( &protocol, socket, cmdSHUTDOWN );
+    report( _name + " bulk 64 KB", count, sw.elapsed(), count * bulk.size() );
+    if( tuned > 0 )
+        cout << "    buffers autotuned to " << tuned / 1024 << " KB" << endl;
+
+    STcpDiag diag;
+    tcp_diag( socket, &diag );
+    cout << "    rtt " << diag.get( STcpDiag::fRTT ) << " us, cwnd " << diag.get( STcpDiag::fCWND ) << endl;
+
+    ::shutdown( socket, SHUT_RDWR );
+    waitpid( pid, NULL, 0 );
+}
+//=============================================================================
+int main( int argc, char *argv[] )
+{
+    // the default profile stalls on the delayed acknowledgement (up to 40 ms per round trip)
+    const size_t pings( argc > 1 ? atoi( argv[1] ) : 100 );
+    const size_t mb( argc > 2 ? atoi( argv[2] ) : 512 );
+    try
+    {
+        benchProfile( "default", modeDEFAULT, pings, mb );
+        benchProfile( "low latency (TCP_NODELAY)", modeLOW_LATENCY, pings, mb );
+        benchProfile( "default + TCP_CORK", modeCORK, pings, mb );
+        benchProfile( "bulk (BDP autotuning)", modeBULK, pings, mb );
+    }
+    catch( const exception &_e )
+    {
+        cerr << _e.what() << endl;
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,478 @@
+/************************************************************************/
+/**
+ * @file Bench_Suite.cpp
+ * @brief Micro-benchmarks of the MiscCommon hot paths with a JSON report
+ * @author Anar Manafov A.Manafov@gsi.de
+ */ /*
+
+        version number:     $LastChangedRevision$
+        created by:         Anar Manafov
+                            2012-11-28
+        last changed by:    $LastChangedBy$ $LastChangedDate$
+
+        Copyright (c) 2012 GSI, Scientific Computing division. All rights reserved.
+*************************************************************************/
+// STD
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+// API
+#include <sched.h>
+#include <unistd.h>
+// BOOST
+#include <boost/bind.hpp>
+#include <boost/thread.hpp>
+// MiscCommon
+#include "Log.h"
+#include "Process.h"
+#include "SysHelper.h"
+#include "MiscUtils.h"
+#include "HexView.h"
+#include "Metrics.h"
+#include "Trace.h"
+#include "BenchHelper.h"
+// pipe_log_engine
+#include "logEngine.h"
+// pod-protocol
+#include "Protocol.h"
+#include "ProtocolCommands.h"
+//=============================================================================
+using namespace std;
+using namespace MiscCommon;
+using namespace MiscCommon::Bench;
+using namespace PROOFAgent;
+//=============================================================================
+// pod-protocol
+//=============================================================================
+void benchCreateMsg( size_t _iterations, uint32_t _caps, const BYTEVector_t *_data )
+{
+    for( size_t i = 0; i < _iterations; ++i )
+    {
+        const BYTEVector_t msg( createMsg( cmdWNs_LIST, *_data, _caps ) );
+        doNotOptimize( msg );
+    }
+}
+//=============================================================================
+void benchParseMsg( size_t _iterations, const BYTEVector_t *_msg )
+{
+    BYTEVector_t data;
+    for( size_t i = 0; i < _iterations; ++i )
+    {
+        data.clear();
+        const SMessageHeader header( parseMsg( &data, *_msg ) );
+        doNotOptimize( header );
+    }
+}
+//=============================================================================
+template<class _Cmd>
+void benchEncode( size_t _iterations, const _Cmd *_sample )
+{
+    _Cmd cmd( *_sample );
+    BYTEVector_t data;
+    for( size_t i = 0; i < _iterations; ++i )
+    {
+        data.clear();
+        cmd.convertToData( &data );
+        doNotOptimize( data );
+    }
+}
+//=============================================================================
+template<class _Cmd>
+void benchDecode( size_t _iterations, const BYTEVector_t *_data )
+{
+    for( size_t i = 0; i < _iterations; ++i )
+    {
+        _Cmd cmd;
+        cmd.convertFromData( *_data );
+        doNotOptimize( cmd );
+    }
+}
+//=============================================================================
+// the samples live as long as the suite
+template<class _Cmd>
+void addCmd( CBenchSuite *_suite, const string &_name, const _Cmd &_sample )
+{
+    static vector<_Cmd> samples;
+    static vector<BYTEVector_t> encoded;
+    samples.reserve( 16 );
+    encoded.reserve( 16 );
+    samples.push_back( _sample );
+    encoded.push_back( BYTEVector_t() );
+    _Cmd copy( _sample );
+    copy.convertToData( &encoded.back() );
+    _suite->add( "cmd/" + _name + "/encode", boost::bind( &benchEncode<_Cmd>, _1, &samples.back() ), encoded.back().size() );
+    _suite->add( "cmd/" + _name + "/decode", boost::bind( &benchDecode<_Cmd>, _1, &encoded.back() ), encoded.back().size() );
+}
+//=============================================================================
+void addProtocol( CBenchSuite *_suite )
+{
+    static const BYTEVector_t small( 64, 'x' );
+    static const BYTEVector_t large( 4096, 'x' );
+    struct SCase
+    {
+        const char *m_name;
+        uint32_t m_caps;
+        const BYTEVector_t *m_data;
+    };
+    const SCase cases[] =
+    {
+        { "v1/64B", 0, &small },
+        { "v2/64B", capHEADER_V2, &small },
+        { "v2+crc/64B", capHEADER_V2 | capCRC32C, &small },
+        { "v2+crc/4KB", capHEADER_V2 | capCRC32C, &large }
+    };
+    static vector<BYTEVector_t> msgs;
+    msgs.reserve( sizeof( cases ) / sizeof( cases[0] ) );
+    for( size_t i = 0; i < sizeof( cases ) / sizeof( cases[0] ); ++i )
+    {
+        msgs.push_back( createMsg( cmdWNs_LIST, *cases[i].m_data, cases[i].m_caps ) );
+        _suite->add( string( "protocol/createMsg/" ) + cases[i].m_name,
+                     boost::bind( &benchCreateMsg, _1, cases[i].m_caps, cases[i].m_data ), msgs.back().size() );
+        _suite->add( string( "protocol/parseMsg/" ) + cases[i].m_name,
+                     boost::bind( &benchParseMsg, _1, &msgs.back() ), msgs.back().size() );
+    }
+
+    SVersionCmd version;
+    addCmd( _suite, "SVersionCmd", version );
+    SHostInfoCmd info;
+    info.m_username = "pod";
+    info.m_host = "lxb1234.gsi.de";
+    info.m_version = "3.12";
+    info.m_PoDPath = "/opt/PoD/3.12";
+    info.m_xpdPort = 21001;
+    info.m_xpdPid = 4321;
+    info.m_agentPort = 22001;
+    info.m_agentPid = 4322;
+    info.m_timeStamp = 1354000000;
+    addCmd( _suite, "SHostInfoCmd", info );
+    SIdCmd id;
+    id.m_id = 17;
+    addCmd( _suite, "SIdCmd", id );
+    SWnListCmd list;
+    for( size_t i = 0; i < 100; ++i )
+    {
+        stringstream ss;
+        ss << "pod@lxb" << 1000 + i << ".gsi.de:21001";
+        list.m_container.push_back( ss.str() );
+    }
+    addCmd( _suite, "SWnListCmd/100", list );
+    SEpochCmd epoch;
+    epoch.m_epoch = 42;
+    epoch.m_instance = 0x5eed;
+    addCmd( _suite, "SEpochCmd", epoch );
+    SWnListDeltaCmd delta;
+    delta.m_epoch = 43;
+    delta.m_instance = 0x5eed;
+    delta.m_full = 0;
+    delta.m_added.assign( list.m_container.begin(), list.m_container.begin() + 5 );
+    delta.m_removed.assign( list.m_container.begin() + 5, list.m_container.begin() + 7 );
+    addCmd( _suite, "SWnListDeltaCmd", delta );
+    SCreditCmd credit;
+    credit.m_bytes = 1 << 20;
+    addCmd( _suite, "SCreditCmd", credit );
+    SFileUploadCmd upload;
+    upload.m_size = 1 << 30;
+    upload.m_crc = 0xDEADBEEF;
+    upload.m_name = "proofserv.log";
+    addCmd( _suite, "SFileUploadCmd", upload );
+    SFileOffsetCmd offset;
+    offset.m_offset = 1 << 20;
+    addCmd( _suite, "SFileOffsetCmd", offset );
+    SFileStatusCmd status;
+    status.m_crc = 0xDEADBEEF;
+    addCmd( _suite, "SFileStatusCmd", status );
+    SHandoverListenerCmd listener;
+    listener.m_name = "agent";
+    addCmd( _suite, "SHandoverListenerCmd", listener );
+    SProtocolStateCmd state;
+    state.m_caps = protocolCaps();
+    state.m_name = "wn-17";
+    state.m_buffered.assign( 256, 'b' );
+    addCmd( _suite, "SProtocolStateCmd", state );
+    SHandoverDoneCmd done;
+    done.m_count = 3;
+    addCmd( _suite, "SHandoverDoneCmd", done );
+}
+//=============================================================================
+// logging
+//=============================================================================
+void pushLog( CLog<ofstream> *_log, size_t _count )
+{
+    for( size_t i = 0; i < _count; ++i )
+        _log->push( LOG_SEVERITY_INFO, 0, "bench", "a message of a typical length of the agent log" );
+}
+//=============================================================================
+// _iterations messages of _threads threads
+void benchLogPush( size_t _iterations, size_t _threads )
+{
+    ofstream stream( "/dev/null" );
+    CLog<ofstream> log( &stream, LOG_SEVERITY_INFO );
+    boost::thread_group threads;
+    for( size_t i = 0; i < _threads; ++i )
+        threads.create_thread( boost::bind( &pushLog, &log, _iterations / _threads + ( i < _iterations % _threads ? 1 : 0 ) ) );
+    threads.join_all();
+}
+//=============================================================================
+void benchLogEngine( size_t _iterations, const CLogEngine *_engine )
+{
+    const string msg( "a message of a typical length of the agent log\n" );
+    for( size_t i = 0; i < _iterations; ++i )
+    {
+        try
+        {
+            ( *_engine )( msg, "bench" );
+        }
+        catch( const exception & )
+        {
+            // the pipe is full, the engine thread is behind
+            sched_yield();
+        }
+    }
+}
+//=============================================================================
+// metrics
+//=============================================================================
+void addCounter( CCounter *_counter, size_t _count )
+{
+    for( size_t i = 0; i < _count; ++i )
+        _counter->add();
+}
+//=============================================================================
+// _iterations updates of _threads threads
+void benchCounter( size_t _iterations, size_t _threads )
+{
+    CCounter counter;
+    boost::thread_group threads;
+    for( size_t i = 0; i < _threads; ++i )
+        threads.create_thread( boost::bind( &addCounter, &counter, _iterations / _threads + ( i < _iterations % _threads ? 1 : 0 ) ) );
+    threads.join_all();
+    doNotOptimize( counter.value() );
+}
+//=============================================================================
+void benchHistogram( size_t _iterations, CHistogram *_histogram )
+{
+    for( size_t i = 0; i < _iterations; ++i )
+        _histogram->record( i & 0xFFFF );
+}
+//=============================================================================
+void benchTimedHistogram( size_t _iterations, CHistogram *_histogram )
+{
+    for( size_t i = 0; i < _iterations; ++i )
+        CHistogramTimer timer( *_histogram );
+}
+//=============================================================================
+// tracing
+//=============================================================================
+void benchTraceSpan( size_t _iterations, bool _enabled )
+{
+    if( _enabled )
+        CTracer::instance().enable();
+    for( size_t i = 0; i < _iterations; ++i )
+        CTraceSpan span( "bench", "bench" );
+    CTracer::instance().disable();
+    CTracer::instance().clear();
+}
+//=============================================================================
+// system helpers
+//=============================================================================
+void benchExecv( size_t _iterations )
+{
+    const StringVector_t params;
+    string output;
+    for( size_t i = 0; i < _iterations; ++i )
+        do_execv( "/bin/true", params, 10, &output );
+}
+//=============================================================================
+void benchGetProcByName( size_t _iterations )
+{
+    for( size_t i = 0; i < _iterations; ++i )
+    {
+        const vectorPid_t pids( getprocbyname( "MiscCommon_bench" ) );
+        doNotOptimize( pids );
+    }
+}
+//=============================================================================
+void benchSmartPath( size_t _iterations, const string *_path )
+{
+    for( size_t i = 0; i < _iterations; ++i )
+    {
+        string path( *_path );
+        smart_path( &path );
+        doNotOptimize( path );
+    }
+}
+//=============================================================================
+void benchReplace( size_t _iterations, const string *_text )
+{
+    const string what( "$POD_LOCATION" );
+    const string with( "/opt/PoD/3.12" );
+    for( size_t i = 0; i < _iterations; ++i )
+    {
+        string text( *_text );
+        replace( &text, what, with );
+        doNotOptimize( text );
+    }
+}
+//=============================================================================
+void benchTrim( size_t _iterations )
+{
+    const string padded( "        a value of a config file        " );
+    for( size_t i = 0; i < _iterations; ++i )
+    {
+        string text( padded );
+        trim( &text, ' ' );
+        doNotOptimize( text );
+    }
+}
+//=============================================================================
+void benchToLower( size_t _iterations )
+{
+    const string mixed( "LXB1234.GSI.DE:21001/PoD-Agent/Worker" );
+    for( size_t i = 0; i < _iterations; ++i )
+    {
+        string text( mixed );
+        to_lower( text );
+        doNotOptimize( text );
+    }
+}
+//=============================================================================
+void benchHexView( size_t _iterations, const BYTEVector_t *_data )
+{
+    for( size_t i = 0; i < _iterations; ++i )
+    {
+        stringstream ss;
+        ss << BYTEVectorHexView_t( *_data );
+        doNotOptimize( ss );
+    }
+}
+//=============================================================================
+void usage()
+{
+    cout
+            << "usage: MiscCommon_bench [--filter TEXT] [--min-time SEC] [--repetitions N] [--json FILE] [--no-perf]\n"
+            << "    --filter TEXT     run only the benchmarks, which names contain TEXT\n"
+            << "    --min-time SEC    a minimum time of a run (0.2)\n"
+            << "    --repetitions N   runs of each benchmark, the median is reported (5)\n"
+            << "    --json FILE       write the results as JSON, see bench_compare.py\n"
+            << "    --no-perf         don't measure hardware counters (cycles, instructions, cache and branch misses)" << endl;
+}
+//=============================================================================
+int main( int argc, char *argv[] )
+{
+    string filter;
+    string json;
+    double minTime( 0.2 );
+    size_t repetitions( 5 );
+    bool perf( true );
+    for( int i = 1; i < argc; ++i )
+    {
+        const string arg( argv[i] );
+        if( "--no-perf" == arg )
+        {
+            perf = false;
+            continue;
+        }
+        if( i + 1 >= argc )
+        {
+            usage();
+            return 1;
+        }
+        if( "--filter" == arg )
+            filter = argv[++i];
+        else if( "--min-time" == arg )
+            minTime = atof( argv[++i] );
+        else if( "--repetitions" == arg )
+            repetitions = max( 1, atoi( argv[++i] ) );
+        else if( "--json" == arg )
+            json = argv[++i];
+        else
+        {
+            usage();
+            return 1;
+        }
+    }
+
+    try
+    {
+        CBenchSuite suite;
+        suite.perfCounters( perf );
+        addProtocol( &suite );
+
+        const size_t threads[] = { 1, 2, 4, 8 };
+        for( size_t i = 0; i < sizeof( threads ) / sizeof( threads[0] ); ++i )
+        {
+            stringstream ss;
+            ss << "log/CLog::push/threads:" << threads[i];
+            suite.add( ss.str(), boost::bind( &benchLogPush, _1, threads[i] ) );
+        }
+        // the engine prints to stdout, it goes nowhere during the benchmark
+        CLogEngine engine;
+        stringstream pipe;
+        pipe << "/tmp/MiscCommon_bench." << getpid() << ".pipe";
+        engine.start( pipe.str() );
+        suite.add( "log/CLogEngine::operator()", boost::bind( &benchLogEngine, _1, &engine ) );
+
+        for( size_t i = 0; i < sizeof( threads ) / sizeof( threads[0] ); ++i )
+        {
+            stringstream ss;
+            ss << "metrics/CCounter::add/threads:" << threads[i];
+            suite.add( ss.str(), boost::bind( &benchCounter, _1, threads[i] ) );
+        }
+        static CHistogram histogram;
+        suite.add( "metrics/CHistogram::record", boost::bind( &benchHistogram, _1, &histogram ) );
+        suite.add( "metrics/CHistogramTimer", boost::bind( &benchTimedHistogram, _1, &histogram ) );
+        suite.add( "trace/CTraceSpan/off", boost::bind( &benchTraceSpan, _1, false ) );
+        suite.add( "trace/CTraceSpan/on", boost::bind( &benchTraceSpan, _1, true ) );
+
+        suite.add( "sys/do_execv", &benchExecv );
+        suite.add( "sys/getprocbyname", &benchGetProcByName );
+        static const string homePath( "~/.PoD/etc/../PoD.cfg" );
+        static const string envPath( "$HOME/.PoD/PoD.cfg" );
+        suite.add( "sys/smart_path/home", boost::bind( &benchSmartPath, _1, &homePath ) );
+        suite.add( "sys/smart_path/env", boost::bind( &benchSmartPath, _1, &envPath ) );
+
+        static string text;
+        for( size_t i = 0; i < 10; ++i )
+            text += "export PATH=$POD_LOCATION/bin:$PATH; source $POD_LOCATION/PoD_env.sh; ";
+        suite.add( "util/replace/1KB", boost::bind( &benchReplace, _1, &text ), text.size() );
+        suite.add( "util/trim", &benchTrim );
+        suite.add( "util/to_lower", &benchToLower );
+        static BYTEVector_t bytes;
+        for( size_t i = 0; i < 256; ++i )
+            bytes.push_back( i );
+        suite.add( "util/CHexView/256B", boost::bind( &benchHexView, _1, &bytes ), bytes.size() );
+
+        // the log engine thread prints the messages to cout, they go nowhere,
+        // the report goes to the real stdout
+        ostream out( cout.rdbuf() );
+        ofstream devnull( "/dev/null" );
+        streambuf *stdoutBuf( cout.rdbuf( devnull.rdbuf() ) );
+        try
+        {
+            suite.run( filter, minTime, repetitions, out );
+        }
+        catch( ... )
+        {
+            engine.stop();
+            cout.rdbuf( stdoutBuf );
+            throw;
+        }
+        engine.stop();
+        cout.rdbuf( stdoutBuf );
+
+        if( !json.empty() )
+        {
+            ofstream file( json.c_str() );
+            if( !file.is_open() )
+                throw runtime_error( "Can't write " + json );
+            suite.writeJSON( file );
+        }
+    }
+    catch( const exception &_e )
+    {
+        cerr << _e.what() << endl;
+        return 1;
+    }
+    return 0;
+}
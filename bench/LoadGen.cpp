@@ -0,0 +1,688 @@
+/************************************************************************/
+/**
+ * @file LoadGen.cpp
+ * @brief A load generator, which simulates many PoD workers connected to an agent
+ * @author Anar Manafov A.Manafov@gsi.de
+ */ /*
+
+        version number:     $LastChangedRevision$
+        created by:         Anar Manafov
+                            2012-11-27
+        last changed by:    $LastChangedBy$ $LastChangedDate$
+
+        Copyright (c) 2012 GSI, Scientific Computing division. All rights reserved.
+*************************************************************************/
+// STD
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+// API
+#include <dirent.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/wait.h>
+#include <unistd.h>
+// BOOST
+#include <boost/bind.hpp>
+// MiscCommon
+#include "INet.h"
+#include "BenchHelper.h"
+// pod-protocol
+#include "Protocol.h"
+#include "ProtocolCommands.h"
+#include "EventLoop.h"
+#include "AsyncConnection.h"
+//=============================================================================
+using namespace std;
+using namespace MiscCommon;
+using namespace MiscCommon::INet;
+using namespace MiscCommon::Bench;
+using namespace PROOFAgent;
+//=============================================================================
+struct SConfig
+{
+    SConfig():
+        m_workers( 1000 ),
+        m_durationSec( 10 ),
+        m_port( 0 ),
+        m_serverPid( 0 ),
+        m_wrkNumMs( 1000 ),
+        m_listMs( 5000 ),
+        m_churnPerSec( 1 ),
+        m_stormAtSec( 0 ),
+        m_stormPercent( 50 )
+    {
+    }
+    size_t m_workers;
+    int m_durationSec;
+    // an external agent, the embedded one is started, if the port is 0
+    string m_host;
+    unsigned short m_port;
+    pid_t m_serverPid;
+    // a period of cmdGET_WRK_NUM and of cmdGET_WNs_LIST of every worker, 0 - never
+    int m_wrkNumMs;
+    int m_listMs;
+    // a percentage of the workers, which reconnect every second
+    double m_churnPerSec;
+    // at this second m_stormPercent of the workers drop their connections and reconnect at once, 0 - no storm
+    int m_stormAtSec;
+    int m_stormPercent;
+};
+//=============================================================================
+// latencies in us
+class CLatency
+{
+    public:
+        void add( uint64_t _us )
+        {
+            m_values.push_back( _us );
+        }
+        size_t size() const
+        {
+            return m_values.size();
+        }
+        uint64_t percentile( double _percent )
+        {
+            if( m_values.empty() )
+                return 0;
+            sort( m_values.begin(), m_values.end() );
+            const size_t rank( static_cast<size_t>( _percent / 100 * ( m_values.size() - 1 ) ) );
+            return m_values[rank];
+        }
+
+    private:
+        vector<uint64_t> m_values;
+};
+inline ostream &operator<< ( ostream &_stream, CLatency &_val )
+{
+    return _stream
+           << "p50 " << _val.percentile( 50 ) << " us, p99 " << _val.percentile( 99 )
+           << " us, max " << _val.percentile( 100 ) << " us";
+}
+//=============================================================================
+struct SStats
+{
+    SStats():
+        m_connects( 0 ),
+        m_connectErrors( 0 ),
+        m_disconnects( 0 ),
+        m_requests( 0 ),
+        m_replies( 0 ),
+        m_skipped( 0 ),
+        m_bytes( 0 )
+    {
+    }
+    size_t m_connects;
+    size_t m_connectErrors;
+    // closed by the agent
+    size_t m_disconnects;
+    size_t m_requests;
+    size_t m_replies;
+    // requests not sent, because the previous one has not been answered yet
+    size_t m_skipped;
+    size_t m_bytes;
+    CLatency m_connect;
+    CLatency m_registration;
+    CLatency m_wrkNum;
+    CLatency m_list;
+};
+//=============================================================================
+//=============================================================================
+// the embedded agent: answers the requests of the workers
+class CAgent
+{
+    public:
+        CAgent( CEventLoop &_loop, int _listener ):
+            m_loop( _loop ),
+            m_listener( _listener ),
+            m_nextId( 1 )
+        {
+            m_loop.add( m_listener, EPOLLIN, boost::bind( &CAgent::onAccept, this, _1 ) );
+        }
+        void onAccept( uint32_t )
+        {
+            // a storm fills the backlog, take it all
+            while( true )
+            {
+                const int s( ::accept( m_listener, NULL, NULL ) );
+                if( s < 0 )
+                    return;
+                CAsyncConnection *conn = new CAsyncConnection( m_loop, s );
+                conn->readMsg( boost::bind( &CAgent::onMsg, this, conn, _1, _2, _3 ) );
+            }
+        }
+        void onMsg( CAsyncConnection *_conn, bool _ok, const SMessageHeader &_header, const BYTEVector_t &_data )
+        {
+            if( !_ok )
+            {
+                m_hosts.erase( _conn );
+                m_loop.post( boost::bind( &CAgent::destroy, _conn ) );
+                return;
+            }
+            BYTEVector_t data;
+            switch( _header.m_cmd )
+            {
+                case cmdVERSION:
+                    {
+                        SVersionCmd peer;
+                        peer.convertFromData( _data );
+                        SVersionCmd version;
+                        version.convertToData( &data );
+                        _conn->write( cmdVERSION, data );
+                        _conn->protocol().negotiate( peer.m_caps );
+                        break;
+                    }
+                case cmdHOST_INFO:
+                    {
+                        SHostInfoCmd info;
+                        info.convertFromData( _data );
+                        stringstream ss;
+                        ss << info.m_username << "@" << info.m_host << ":" << info.m_agentPid;
+                        m_hosts[_conn] = ss.str();
+                        break;
+                    }
+                case cmdGET_ID:
+                    {
+                        SIdCmd id;
+                        id.m_id = m_nextId++;
+                        id.convertToData( &data );
+                        _conn->write( cmdID, data );
+                        break;
+                    }
+                case cmdGET_WRK_NUM:
+                    {
+                        SIdCmd num;
+                        num.m_id = 1;
+                        num.convertToData( &data );
+                        _conn->write( cmdWRK_NUM, data );
+                        break;
+                    }
+                case cmdGET_WNs_LIST:
+                    {
+                        SWnListCmd list;
+                        for( Hosts_t::const_iterator iter = m_hosts.begin(); iter != m_hosts.end(); ++iter )
+                            list.m_container.push_back( iter->second );
+                        list.convertToData( &data );
+                        _conn->write( cmdWNs_LIST, data );
+                        break;
+                    }
+            }
+            _conn->readMsg( boost::bind( &CAgent::onMsg, this, _conn, _1, _2, _3 ) );
+        }
+        static void destroy( CAsyncConnection *_conn )
+        {
+            delete _conn;
+        }
+
+    private:
+        typedef map<CAsyncConnection *, string> Hosts_t;
+        CEventLoop &m_loop;
+        int m_listener;
+        uint32_t m_nextId;
+        Hosts_t m_hosts;
+};
+//=============================================================================
+pid_t startAgent( unsigned short *_port )
+{
+    CSocketServer server;
+    const string loopback( "127.0.0.1" );
+    server.Bind( 0, &loopback );
+    server.Listen( SOMAXCONN );
+    server.setNonBlock();
+    sockaddr_in addr;
+    socklen_t len( sizeof( addr ) );
+    getsockname( server.getSocket(), reinterpret_cast<sockaddr *>( &addr ), &len );
+    *_port = ntohs( addr.sin_port );
+
+    const pid_t pid = fork();
+    if( pid < 0 )
+        throw system_error( "fork failed" );
+    if( 0 == pid )
+    {
+        try
+        {
+            CEventLoop loop;
+            CAgent agent( loop, server.getSocket() );
+            loop.run();
+        }
+        catch( const exception &_e )
+        {
+            cerr << "agent: " << _e.what() << endl;
+        }
+        _exit( 0 );
+    }
+    // smart_socket would shut the listening socket down for the agent too
+    ::close( server.detach() );
+    return pid;
+}
+//=============================================================================
+//=============================================================================
+// a simulated worker: a blocking connect by CSocketClient, then the conversation in the event loop
+class CWorker
+{
+    public:
+        CWorker( CEventLoop &_loop, const SConfig &_config, SStats &_stats, size_t _index ):
+            m_loop( _loop ),
+            m_config( _config ),
+            m_stats( _stats ),
+            m_index( _index ),
+            m_socket( -1 ),
+            m_protocol( NULL ),
+            m_pending( 0 ),
+            m_sentUs( 0 ),
+            m_registrationUs( 0 ),
+            m_wrkTimer( 0 ),
+            m_listTimer( 0 )
+        {
+        }
+        ~CWorker()
+        {
+            disconnect();
+        }
+        bool isConnected() const
+        {
+            return ( -1 != m_socket );
+        }
+        void connect()
+        {
+            disconnect();
+            const uint64_t start( monotonic_us() );
+            try
+            {
+                CSocketClient client;
+                client.setProfile( profileLOW_LATENCY );
+                client.connect( m_config.m_port, m_config.m_host );
+                m_socket = client.detach();
+            }
+            catch( const exception & )
+            {
+                ++m_stats.m_connectErrors;
+                return;
+            }
+            m_stats.m_connect.add( monotonic_us() - start );
+            ++m_stats.m_connects;
+            m_protocol = new CProtocol;
+            fcntl( m_socket, F_SETFL, fcntl( m_socket, F_GETFL, 0 ) | O_NONBLOCK );
+            m_loop.add( m_socket, EPOLLIN, boost::bind( &CWorker::onEvents, this, _1 ) );
+
+            // the handshake goes in the v1 framing, the rest is negotiated
+            SVersionCmd version;
+            BYTEVector_t data;
+            version.convertToData( &data );
+            m_registrationUs = start;
+            request( cmdVERSION, data, cmdVERSION );
+        }
+        void disconnect()
+        {
+            if( !isConnected() )
+                return;
+            cancelTimers();
+            m_loop.remove( m_socket );
+            ::close( m_socket );
+            m_socket = -1;
+            delete m_protocol;
+            m_protocol = NULL;
+            m_pending = 0;
+        }
+
+    private:
+        // sends a request, _reply is the command of the answer, 0 - none
+        void request( uint16_t _cmd, const BYTEVector_t &_data, uint16_t _reply )
+        {
+            if( 0 != _reply && 0 != m_pending )
+            {
+                ++m_stats.m_skipped;
+                return;
+            }
+            m_protocol->write( m_socket, _cmd, _data );
+            ++m_stats.m_requests;
+            if( 0 != _reply )
+            {
+                m_pending = _reply;
+                m_sentUs = monotonic_us();
+            }
+        }
+        void onEvents( uint32_t )
+        {
+            try
+            {
+                if( CProtocol::stDISCONNECT == m_protocol->read( m_socket ) )
+                {
+                    ++m_stats.m_disconnects;
+                    disconnect();
+                    return;
+                }
+                while( isConnected() && m_protocol->checkoutNextMsg() )
+                    onMsg( m_protocol->msgHeader(), m_protocol->msgData() );
+                if( isConnected() )
+                    m_protocol->grantCredit( m_socket );
+            }
+            catch( const exception & )
+            {
+                ++m_stats.m_disconnects;
+                disconnect();
+            }
+        }
+        void onMsg( const SMessageHeader &_header, const BYTEVector_t &_data )
+        {
+            m_stats.m_bytes += _header.m_len;
+            if( _header.m_cmd != m_pending )
+                return;
+            m_pending = 0;
+            ++m_stats.m_replies;
+            const uint64_t latency( monotonic_us() - m_sentUs );
+            BYTEVector_t data;
+            switch( _header.m_cmd )
+            {
+                case cmdVERSION:
+                    {
+                        SVersionCmd version;
+                        version.convertFromData( _data );
+                        m_protocol->negotiate( version.m_caps );
+                        SHostInfoCmd info;
+                        info.m_username = "pod";
+                        stringstream ss;
+                        ss << "worker" << m_index << ".loadgen";
+                        info.m_host = ss.str();
+                        info.m_version = "3.12";
+                        info.m_PoDPath = "/opt/PoD";
+                        info.m_agentPid = m_index;
+                        info.convertToData( &data );
+                        request( cmdHOST_INFO, data, 0 );
+                        request( cmdGET_ID, BYTEVector_t(), cmdID );
+                        break;
+                    }
+                case cmdID:
+                    m_stats.m_registration.add( monotonic_us() - m_registrationUs );
+                    scheduleWrkNum();
+                    scheduleList();
+                    break;
+                case cmdWRK_NUM:
+                    m_stats.m_wrkNum.add( latency );
+                    break;
+                case cmdWNs_LIST:
+                    m_stats.m_list.add( latency );
+                    break;
+            }
+        }
+        // the first request of a period is spread over the period, so the workers don't go in lockstep
+        static int jitter( int _periodMs )
+        {
+            return _periodMs / 2 + rand() % ( _periodMs + 1 );
+        }
+        void scheduleWrkNum()
+        {
+            if( m_config.m_wrkNumMs > 0 )
+                m_wrkTimer = m_loop.addTimer( jitter( m_config.m_wrkNumMs ), boost::bind( &CWorker::onWrkNumTimer, this ) );
+        }
+        void scheduleList()
+        {
+            if( m_config.m_listMs > 0 )
+                m_listTimer = m_loop.addTimer( jitter( m_config.m_listMs ), boost::bind( &CWorker::onListTimer, this ) );
+        }
+        void onWrkNumTimer()
+        {
+            m_wrkTimer = 0;
+            request( cmdGET_WRK_NUM, BYTEVector_t(), cmdWRK_NUM );
+            scheduleWrkNum();
+        }
+        void onListTimer()
+        {
+            m_listTimer = 0;
+            request( cmdGET_WNs_LIST, BYTEVector_t(), cmdWNs_LIST );
+            scheduleList();
+        }
+        void cancelTimers()
+        {
+            if( 0 != m_wrkTimer )
+                m_loop.cancelTimer( m_wrkTimer );
+            if( 0 != m_listTimer )
+                m_loop.cancelTimer( m_listTimer );
+            m_wrkTimer = m_listTimer = 0;
+        }
+
+    private:
+        CEventLoop &m_loop;
+        const SConfig &m_config;
+        SStats &m_stats;
+        size_t m_index;
+        int m_socket;
+        CProtocol *m_protocol;
+        // a command of the awaited answer, 0 - none
+        uint16_t m_pending;
+        uint64_t m_sentUs;
+        uint64_t m_registrationUs;
+        CEventLoop::TimerId_t m_wrkTimer;
+        CEventLoop::TimerId_t m_listTimer;
+};
+typedef vector<CWorker *> Workers_t;
+//=============================================================================
+//=============================================================================
+// resources of a process from /proc
+struct SProcUsage
+{
+    SProcUsage():
+        m_cpuSec( 0 ),
+        m_rssKb( 0 ),
+        m_hwmKb( 0 ),
+        m_fds( 0 )
+    {
+    }
+    double m_cpuSec;
+    size_t m_rssKb;
+    size_t m_hwmKb;
+    size_t m_fds;
+};
+SProcUsage procUsage( pid_t _pid )
+{
+    SProcUsage usage;
+    stringstream path;
+    path << "/proc/" << _pid;
+
+    ifstream stat( ( path.str() + "/stat" ).c_str() );
+    string line;
+    getline( stat, line );
+    // the fields after the command name, utime and stime are the 14th and the 15th fields
+    const size_t pos( line.rfind( ')' ) );
+    if( string::npos != pos )
+    {
+        stringstream ss( line.substr( pos + 2 ) );
+        string field;
+        unsigned long utime( 0 );
+        unsigned long stime( 0 );
+        for( int i = 3; i < 14 && ss >> field; ++i )
+            ;
+        ss >> utime >> stime;
+        usage.m_cpuSec = static_cast<double>( utime + stime ) / sysconf( _SC_CLK_TCK );
+    }
+
+    ifstream status( ( path.str() + "/status" ).c_str() );
+    while( getline( status, line ) )
+    {
+        if( 0 == line.compare( 0, 6, "VmRSS:" ) )
+            usage.m_rssKb = atol( line.c_str() + 6 );
+        else if( 0 == line.compare( 0, 6, "VmHWM:" ) )
+            usage.m_hwmKb = atol( line.c_str() + 6 );
+    }
+
+    DIR *dir = opendir( ( path.str() + "/fd" ).c_str() );
+    if( dir )
+    {
+        while( dirent *entry = readdir( dir ) )
+        {
+            if( '.' != entry->d_name[0] )
+                ++usage.m_fds;
+        }
+        closedir( dir );
+    }
+    return usage;
+}
+//=============================================================================
+//=============================================================================
+// the workers of the churn reconnect one after another
+void onChurn( CEventLoop *_loop, Workers_t *_workers, const SConfig *_config, double *_due )
+{
+    // 10 rounds a second
+    *_due += _workers->size() * _config->m_churnPerSec / 100 / 10;
+    for( ; *_due >= 1; *_due -= 1 )
+        ( *_workers )[rand() % _workers->size()]->connect();
+    _loop->addTimer( 100, boost::bind( &onChurn, _loop, _workers, _config, _due ) );
+}
+//=============================================================================
+// a reconnect storm: the workers drop their connections and connect again at once
+void onStorm( Workers_t *_workers, const SConfig *_config, SStats *_stats, double *_stormSec )
+{
+    const size_t count( _workers->size() * _config->m_stormPercent / 100 );
+    for( size_t i = 0; i < count; ++i )
+        ( *_workers )[i]->disconnect();
+    const size_t before( _stats->m_connect.size() );
+    CStopWatch watch;
+    for( size_t i = 0; i < count; ++i )
+        ( *_workers )[i]->connect();
+    *_stormSec = watch.elapsed();
+    report( "loadgen: reconnect storm", max<size_t>( 1, _stats->m_connect.size() - before ), *_stormSec );
+}
+//=============================================================================
+void usage()
+{
+    cout
+            << "usage: MiscCommon_bench_LoadGen [options]\n"
+            << "    --workers N         simulated workers (1000)\n"
+            << "    --duration S        seconds of the load after the workers have connected (10)\n"
+            << "    --agent HOST:PORT   an external agent, the embedded one is started by default\n"
+            << "    --agent-pid PID     the process of the external agent, for the resource report\n"
+            << "    --wrk-num-ms MS     a period of cmdGET_WRK_NUM of a worker, 0 - never (1000)\n"
+            << "    --list-ms MS        a period of cmdGET_WNs_LIST of a worker, 0 - never (5000)\n"
+            << "    --churn PERCENT     workers, which reconnect every second (1)\n"
+            << "    --storm-at S        a second of a reconnect storm, 0 - none (0)\n"
+            << "    --storm PERCENT     workers of the storm (50)" << endl;
+}
+//=============================================================================
+bool parseArgs( int argc, char *argv[], SConfig *_config )
+{
+    for( int i = 1; i < argc; ++i )
+    {
+        const string arg( argv[i] );
+        if( i + 1 >= argc )
+            return false;
+        const string val( argv[++i] );
+        if( "--workers" == arg )
+            _config->m_workers = atoi( val.c_str() );
+        else if( "--duration" == arg )
+            _config->m_durationSec = atoi( val.c_str() );
+        else if( "--agent" == arg )
+        {
+            const size_t pos( val.rfind( ':' ) );
+            if( string::npos == pos )
+                return false;
+            _config->m_host = val.substr( 0, pos );
+            _config->m_port = atoi( val.c_str() + pos + 1 );
+        }
+        else if( "--agent-pid" == arg )
+            _config->m_serverPid = atoi( val.c_str() );
+        else if( "--wrk-num-ms" == arg )
+            _config->m_wrkNumMs = atoi( val.c_str() );
+        else if( "--list-ms" == arg )
+            _config->m_listMs = atoi( val.c_str() );
+        else if( "--churn" == arg )
+            _config->m_churnPerSec = atof( val.c_str() );
+        else if( "--storm-at" == arg )
+            _config->m_stormAtSec = atoi( val.c_str() );
+        else if( "--storm" == arg )
+            _config->m_stormPercent = atoi( val.c_str() );
+        else
+            return false;
+    }
+    return ( _config->m_workers > 0 && _config->m_durationSec > 0 );
+}
+//=============================================================================
+int main( int argc, char *argv[] )
+{
+    SConfig config;
+    if( !parseArgs( argc, argv, &config ) )
+    {
+        usage();
+        return 1;
+    }
+    signal( SIGPIPE, SIG_IGN );
+    pid_t agent( 0 );
+    try
+    {
+        if( 0 == config.m_port )
+        {
+            agent = startAgent( &config.m_port );
+            config.m_host = "127.0.0.1";
+            config.m_serverPid = agent;
+        }
+
+        CEventLoop loop;
+        SStats stats;
+        Workers_t workers;
+        for( size_t i = 0; i < config.m_workers; ++i )
+            workers.push_back( new CWorker( loop, config, stats, i ) );
+
+        // the initial connect, the workers register while the others are connecting
+        CStopWatch watch;
+        for( size_t i = 0; i < workers.size(); ++i )
+        {
+            workers[i]->connect();
+            loop.runOnce( 0 );
+        }
+        const double connectSec( watch.elapsed() );
+        report( "loadgen: initial connect", max<size_t>( 1, stats.m_connects ), connectSec );
+
+        double churnDue( 0 );
+        if( config.m_churnPerSec > 0 )
+            loop.addTimer( 100, boost::bind( &onChurn, &loop, &workers, &config, &churnDue ) );
+        double stormSec( 0 );
+        if( config.m_stormAtSec > 0 )
+            loop.addTimer( config.m_stormAtSec * 1000, boost::bind( &onStorm, &workers, &config, &stats, &stormSec ) );
+        const SProcUsage before( config.m_serverPid ? procUsage( config.m_serverPid ) : SProcUsage() );
+        const size_t requestsBefore( stats.m_requests );
+        watch.start();
+        while( watch.elapsed() < config.m_durationSec )
+            loop.runOnce( 100 );
+        const double sec( watch.elapsed() );
+        const SProcUsage after( config.m_serverPid ? procUsage( config.m_serverPid ) : SProcUsage() );
+
+        size_t connected( 0 );
+        for( size_t i = 0; i < workers.size(); ++i )
+            connected += workers[i]->isConnected() ? 1 : 0;
+        report( "loadgen: requests", max<size_t>( 1, stats.m_requests - requestsBefore ), sec, stats.m_bytes );
+        cout
+                << "    " << config.m_workers << " workers, " << connected << " connected at the end\n"
+                << "    connects " << stats.m_connects << ", failed " << stats.m_connectErrors
+                << ", dropped by the agent " << stats.m_disconnects << "\n"
+                << "    requests " << stats.m_requests << ", replies " << stats.m_replies
+                << ", skipped (an answer was pending) " << stats.m_skipped << "\n"
+                << "    connect:      " << stats.m_connect << "\n"
+                << "    registration: " << stats.m_registration << "\n"
+                << "    wrk num:      " << stats.m_wrkNum << "\n"
+                << "    wn list:      " << stats.m_list << endl;
+        if( config.m_serverPid )
+        {
+            cout
+                    << "    agent: CPU " << 100 * ( after.m_cpuSec - before.m_cpuSec ) / sec << " %"
+                    << ", RSS " << after.m_rssKb << " kB (peak " << after.m_hwmKb << " kB)"
+                    << ", " << after.m_fds << " descriptors" << endl;
+        }
+
+        for( size_t i = 0; i < workers.size(); ++i )
+            delete workers[i];
+    }
+    catch( const exception &_e )
+    {
+        cerr << _e.what() << endl;
+        if( agent > 0 )
+            kill( agent, SIGKILL );
+        return 1;
+    }
+    if( agent > 0 )
+    {
+        kill( agent, SIGTERM );
+        waitpid( agent, NULL, 0 );
+    }
+    return 0;
+}
@@ -0,0 +1,72 @@
+#!/usr/bin/env python3
+#************************************************************************
+#
+# bench_compare.py
+#
+# Anar Manafov A.Manafov@gsi.de
+#
+#
+#        version number:    $LastChangedRevision$
+#        created by:        Anar Manafov
+#                           2012-11-28
+#        last changed by:   $LastChangedBy$ $LastChangedDate$
+#
+#        Copyright (c) 2012 GSI, Scientific Computing division. All rights reserved.
+#*************************************************************************
+"""Compares a JSON report of MiscCommon_bench with a stored baseline.
+
+    MiscCommon_bench --json baseline.json       # once, on the reference build
+    MiscCommon_bench --json current.json        # after a change, on the same machine
+    bench_compare.py baseline.json current.json [--threshold 10]
+
+A benchmark is a regression if its median and its fastest run are both slower
+than the baseline by more than the threshold (percent), so a single noisy run
+is not flagged. The exit status is 1 if there are regressions.
+"""
+import argparse
+import json
+import sys
+
+
+def load(path):
+    with open(path) as f:
+        return dict((b["name"], b) for b in json.load(f)["benchmarks"])
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("baseline")
+    parser.add_argument("current")
+    parser.add_argument("--threshold", type=float, default=10.0, help="a slowdown in percent (10)")
+    args = parser.parse_args()
+
+    baseline = load(args.baseline)
+    current = load(args.current)
+    regressions = 0
+    print("%-45s %12s %12s %8s" % ("benchmark", "base ns/op", "ns/op", "change"))
+    for name in sorted(current):
+        cur = current[name]
+        base = baseline.get(name)
+        if base is None:
+            print("%-45s %12s %12.1f %8s" % (name, "-", cur["ns_per_op"], "new"))
+            continue
+        change = 100.0 * (cur["ns_per_op"] - base["ns_per_op"]) / base["ns_per_op"]
+        min_change = 100.0 * (cur["min_ns_per_op"] - base["min_ns_per_op"]) / base["min_ns_per_op"]
+        mark = ""
+        if change > args.threshold and min_change > args.threshold:
+            mark = "  REGRESSION"
+            regressions += 1
+        elif change < -args.threshold and min_change < -args.threshold:
+            mark = "  faster"
+        print("%-45s %12.1f %12.1f %+7.1f%%%s" % (name, base["ns_per_op"], cur["ns_per_op"], change, mark))
+    for name in sorted(set(baseline) - set(current)):
+        print("%-45s %12.1f %12s %8s" % (name, baseline[name]["ns_per_op"], "-", "missing"))
+
+    if regressions:
+        print("%d regression(s) above %.0f%%" % (regressions, args.threshold))
+        return 1
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,409 @@
+/************************************************************************/
+/**
+ * @file AsyncConnection.cpp
+ * @brief Asynchronous protocol connections on top of CEventLoop
+ * @author Anar Manafov A.Manafov@gsi.de
+ */ /*
+
+        version number:     $LastChangedRevision$
+        created by:         Anar Manafov
+                            2012-11-23
+        last changed by:    $LastChangedBy$ $LastChangedDate$
+
+        Copyright (c) 2012 GSI, Scientific Computing division. All rights reserved.
+*************************************************************************/
+#include "AsyncConnection.h"
+// STD
+#include <stdexcept>
+// API
+#include <fcntl.h>
+#include <unistd.h>
+// BOOST
+#include <boost/bind.hpp>
+// MiscCommon
+#include "ErrorCode.h"
+#include "INet.h"
+//=============================================================================
+using namespace std;
+using namespace PROOFAgent;
+using namespace MiscCommon;
+//=============================================================================
+namespace
+{
+    /**
+     *
+     * @brief Connects to the addresses of a host one after another without blocking the loop.
+     * @brief The object deletes itself, when it has called the handler.
+     *
+     */
+    class CConnector
+    {
+        public:
+            CConnector( CEventLoop &_loop, const string &_host, unsigned short _port,
+                        int _timeoutMs, const CAsyncConnection::ConnectHandler_t &_handler ):
+                m_loop( _loop ),
+                m_host( _host ),
+                m_port( _port ),
+                m_timeoutMs( _timeoutMs ),
+                m_handler( _handler ),
+                m_next( 0 ),
+                m_socket( -1 ),
+                m_timer( 0 ),
+                m_errno( 0 )
+            {
+            }
+            void start()
+            {
+                if( 0 != INet::resolve( m_host, m_port, &m_addresses ) )
+                {
+                    finish( -1, EHOSTUNREACH );
+                    return;
+                }
+                m_timer = m_loop.addTimer( m_timeoutMs, boost::bind( &CConnector::onTimeout, this ) );
+                tryNext();
+            }
+
+        private:
+            void tryNext()
+            {
+                while( m_next < m_addresses.size() )
+                {
+                    const INet::SAddress &addr = m_addresses[m_next++];
+                    const int s = ::socket( addr.m_addr.ss_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0 );
+                    if( s < 0 )
+                    {
+                        m_errno = errno;
+                        continue;
+                    }
+                    if( 0 == ::connect( s, reinterpret_cast<const sockaddr *>( &addr.m_addr ), addr.m_len ) )
+                    {
+                        finish( s, 0 );
+                        return;
+                    }
+                    if( EINPROGRESS == errno )
+                    {
+                        m_socket = s;
+                        m_loop.add( s, EPOLLOUT, boost::bind( &CConnector::onEvents, this, _1 ) );
+                        return;
+                    }
+                    m_errno = errno;
+                    ::close( s );
+                }
+                finish( -1, m_errno ? m_errno : ECONNREFUSED );
+            }
+            void onEvents( uint32_t /*_events*/ )
+            {
+                int err( 0 );
+                socklen_t len( sizeof( err ) );
+                if( ::getsockopt( m_socket, SOL_SOCKET, SO_ERROR, &err, &len ) < 0 )
+                    err = errno;
+                m_loop.remove( m_socket );
+                const int s( m_socket );
+                m_socket = -1;
+                if( 0 == err )
+                {
+                    finish( s, 0 );
+                    return;
+                }
+                ::close( s );
+                m_errno = err;
+                tryNext();
+            }
+            void onTimeout()
+            {
+                m_timer = 0;
+                if( -1 != m_socket )
+                {
+                    m_loop.remove( m_socket );
+                    ::close( m_socket );
+                    m_socket = -1;
+                }
+                finish( -1, ETIMEDOUT );
+            }
+            void finish( int _socket, int _errno )
+            {
+                if( 0 != m_timer )
+                    m_loop.cancelTimer( m_timer );
+                const CAsyncConnection::ConnectHandler_t handler( m_handler );
+                CEventLoop &loop = m_loop;
+                delete this;
+                handler( _socket < 0 ? NULL : new CAsyncConnection( loop, _socket ), _errno );
+            }
+
+        private:
+            CEventLoop &m_loop;
+            string m_host;
+            unsigned short m_port;
+            int m_timeoutMs;
+            CAsyncConnection::ConnectHandler_t m_handler;
+            INet::Addresses_t m_addresses;
+            size_t m_next;
+            int m_socket;
+            CEventLoop::TimerId_t m_timer;
+            int m_errno;
+    };
+}
+//=============================================================================
+//=============================================================================
+//=============================================================================
+CAsyncConnection::CAsyncConnection( CEventLoop &_loop, int _socket ):
+    m_loop( _loop ),
+    m_socket( _socket ),
+    m_queue( m_protocol ),
+    m_events( 0 ),
+    m_deliveryPosted( false ),
+    m_alive( new bool( true ) )
+{
+    const int flags = ::fcntl( m_socket, F_GETFL, 0 );
+    if( flags < 0 || ::fcntl( m_socket, F_SETFL, flags | O_NONBLOCK ) < 0 )
+    {
+        ::close( m_socket );
+        throw system_error( "Can't make the socket non-blocking" );
+    }
+    try
+    {
+        m_loop.add( m_socket, m_events, boost::bind( &CAsyncConnection::onEvents, this, _1 ) );
+    }
+    catch( ... )
+    {
+        ::close( m_socket );
+        throw;
+    }
+}
+//=============================================================================
+CAsyncConnection::~CAsyncConnection()
+{
+    *m_alive = false;
+    if( isOpen() )
+    {
+        m_loop.remove( m_socket );
+        ::close( m_socket );
+    }
+}
+//=============================================================================
+// memberof to silence doxygen warning:
+// warning: no matching class member found for
+// This happens because doxygen is not handling namespaces in arguments properly
+/**
+ * @memberof PROOFAgent::CAsyncConnection
+ *
+ */
+void CAsyncConnection::connect( CEventLoop &_loop, const string &_host, unsigned short _port,
+                                int _timeoutMs, const ConnectHandler_t &_handler )
+{
+    CConnector *connector = new CConnector( _loop, _host, _port, _timeoutMs, _handler );
+    _loop.post( boost::bind( &CConnector::start, connector ) );
+}
+//=============================================================================
+void CAsyncConnection::readMsg( const MsgHandler_t &_handler )
+{
+    if( !isOpen() )
+    {
+        m_loop.post( boost::bind( _handler, false, SMessageHeader(), BYTEVector_t() ) );
+        return;
+    }
+    m_readers.push_back( _handler );
+    // messages which came along with the previous ones are already in the buffer
+    if( m_protocol.bufferedSize() > 0 && !m_deliveryPosted )
+    {
+        m_deliveryPosted = true;
+        m_loop.post( boost::bind( &CAsyncConnection::deliverPosted, this, m_alive ) );
+    }
+    updateEvents();
+}
+//=============================================================================
+// memberof to silence doxygen warning:
+// warning: no matching class member found for
+// This happens because doxygen is not handling namespaces in arguments properly
+/**
+ * @memberof PROOFAgent::CAsyncConnection
+ *
+ */
+void CAsyncConnection::write( uint16_t _cmd, const BYTEVector_t &_data, const DoneHandler_t &_handler )
+{
+    if( !isOpen() )
+    {
+        if( _handler )
+            m_loop.post( boost::bind( _handler, false ) );
+        return;
+    }
+    m_queue.push( _cmd, _data );
+    if( _handler )
+        m_writers.push_back( _handler );
+    // try to send right away, the completion handlers are called from the loop anyway
+    bool empty( false );
+    try
+    {
+        empty = m_queue.flush( m_socket );
+    }
+    catch( const exception & )
+    {
+        m_loop.post( boost::bind( &CAsyncConnection::closePosted, this, m_alive ) );
+        return;
+    }
+    if( empty && !m_writers.empty() )
+        m_loop.post( boost::bind( &CAsyncConnection::flushPosted, this, m_alive ) );
+    updateEvents();
+}
+//=============================================================================
+void CAsyncConnection::close()
+{
+    if( !isOpen() )
+        return;
+    m_loop.remove( m_socket );
+    ::close( m_socket );
+    m_socket = -1;
+
+    Alive_t alive( m_alive );
+    deque<MsgHandler_t> readers;
+    readers.swap( m_readers );
+    vector<DoneHandler_t> writers;
+    writers.swap( m_writers );
+    const SMessageHeader header;
+    const BYTEVector_t data;
+    for( size_t i = 0; i < readers.size(); ++i )
+    {
+        readers[i]( false, header, data );
+        if( !*alive )
+            return;
+    }
+    for( size_t i = 0; i < writers.size(); ++i )
+    {
+        writers[i]( false );
+        if( !*alive )
+            return;
+    }
+}
+//=============================================================================
+void CAsyncConnection::deliverPosted( CAsyncConnection *_this, Alive_t _alive )
+{
+    if( !*_alive )
+        return;
+    _this->m_deliveryPosted = false;
+    if( _this->deliver() )
+        _this->updateEvents();
+}
+//=============================================================================
+void CAsyncConnection::flushPosted( CAsyncConnection *_this, Alive_t _alive )
+{
+    if( *_alive && _this->isOpen() )
+        _this->flush();
+}
+//=============================================================================
+void CAsyncConnection::closePosted( CAsyncConnection *_this, Alive_t _alive )
+{
+    if( *_alive )
+        _this->close();
+}
+//=============================================================================
+void CAsyncConnection::onEvents( uint32_t _events )
+{
+    if( ( _events & ( EPOLLOUT | EPOLLERR ) ) && !flush() )
+        return;
+
+    if( _events & ( EPOLLIN | EPOLLHUP | EPOLLERR ) )
+    {
+        // one read per wake up, the descriptor is level triggered and is reported again,
+        // if the socket has more
+        CProtocol::EStatus_t status;
+        try
+        {
+            status = m_protocol.read( m_socket );
+        }
+        catch( const exception & )
+        {
+            close();
+            return;
+        }
+        if( CProtocol::stDISCONNECT == status )
+        {
+            close();
+            return;
+        }
+        if( CProtocol::stOK == status && !deliver() )
+            return;
+        // a credit of the peer may unblock the queue
+        if( !m_queue.empty() && !m_protocol.hasSendCredit() )
+        {
+            m_protocol.absorbCredits();
+            if( !flush() )
+                return;
+        }
+    }
+    updateEvents();
+}
+//=============================================================================
+bool CAsyncConnection::deliver()
+{
+    Alive_t alive( m_alive );
+    while( !m_readers.empty() && isOpen() )
+    {
+        try
+        {
+            if( !m_protocol.checkoutNextMsg() )
+                break;
+        }
+        catch( const exception & )
+        {
+            close();
+            return false;
+        }
+        const MsgHandler_t handler( m_readers.front() );
+        m_readers.pop_front();
+        handler( true, m_protocol.msgHeader(), m_protocol.msgData() );
+        if( !*alive )
+            return false;
+    }
+    if( !isOpen() )
+        return false;
+    // the peer may send more, when the messages have been consumed
+    if( m_queue.grantCredit() )
+        return flush();
+    return true;
+}
+//=============================================================================
+bool CAsyncConnection::flush()
+{
+    bool empty( false );
+    try
+    {
+        empty = m_queue.flush( m_socket );
+    }
+    catch( const exception & )
+    {
+        close();
+        return false;
+    }
+    if( empty && !m_writers.empty() )
+    {
+        Alive_t alive( m_alive );
+        vector<DoneHandler_t> writers;
+        writers.swap( m_writers );
+        for( size_t i = 0; i < writers.size(); ++i )
+        {
+            writers[i]( true );
+            if( !*alive )
+                return false;
+        }
+    }
+    if( !isOpen() )
+        return false;
+    updateEvents();
+    return true;
+}
+//=============================================================================
+void CAsyncConnection::updateEvents()
+{
+    if( !isOpen() )
+        return;
+    uint32_t events( 0 );
+    // a blocked queue waits for a credit of the peer
+    if( !m_readers.empty() || ( !m_queue.empty() && !m_queue.canSend() ) )
+        events |= EPOLLIN;
+    if( m_queue.canSend() )
+        events |= EPOLLOUT;
+    if( events == m_events )
+        return;
+    m_loop.modify( m_socket, events );
+    m_events = events;
+}
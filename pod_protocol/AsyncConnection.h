@@ -0,0 +1,145 @@
+/************************************************************************/
+/**
+ * @file AsyncConnection.h
+ * @brief Asynchronous protocol connections on top of CEventLoop
+ * @author Anar Manafov A.Manafov@gsi.de
+ */ /*
+
+        version number:     $LastChangedRevision$
+        created by:         Anar Manafov
+                            2012-11-23
+        last changed by:    $LastChangedBy$ $LastChangedDate$
+
+        Copyright (c) 2012 GSI, Scientific Computing division. All rights reserved.
+*************************************************************************/
+#ifndef ASYNCCONNECTION_H_
+#define ASYNCCONNECTION_H_
+//=============================================================================
+// STD
+#include <deque>
+#include <string>
+#include <vector>
+// BOOST
+#include <boost/function.hpp>
+#include <boost/shared_ptr.hpp>
+// MiscCommon
+#include "def.h"
+#include "MiscUtils.h"
+// pod-protocol
+#include "Protocol.h"
+#include "OutputQueue.h"
+#include "EventLoop.h"
+//=============================================================================
+namespace PROOFAgent
+{
+//=============================================================================
+    /**
+     *
+     * @brief The class runs a protocol connection in an event loop.
+     * @brief Each operation takes a completion handler, which is called from the loop, when the operation is done,
+     * @brief so a conversation is written as a chain of handlers instead of a state machine around stAGAIN.
+     * @brief Read requests are served in their order, a message is read from the socket only,
+     * @brief when somebody waits for it. Writes are queued (see COutputQueue) and never block.
+     * @note A handler may delete the connection, but only by CEventLoop::post, or after close.
+     * @note Example:
+     * @code
+     *
+     * void onWrkNum( CAsyncConnection *_conn, bool _ok, const SMessageHeader &_header, const BYTEVector_t &_data )
+     * {
+     *     if( !_ok )
+     *         return; // closed
+     *     ... use _data ...
+     *     _conn->write( cmdGET_WRK_NUM, BYTEVector_t() );
+     *     _conn->readMsg( boost::bind( &onWrkNum, _conn, _1, _2, _3 ) );
+     * }
+     *
+     * void onConnected( CAsyncConnection *_conn, int _errno )
+     * {
+     *     if( !_conn )
+     *         return; // _errno tells why
+     *     _conn->write( cmdGET_WRK_NUM, BYTEVector_t() );
+     *     _conn->readMsg( boost::bind( &onWrkNum, _conn, _1, _2, _3 ) );
+     * }
+     *
+     * CEventLoop loop;
+     * CAsyncConnection::connect( loop, "server", 22001, 5000, &onConnected );
+     * loop.run();
+     *
+     * @endcode
+     *
+     */
+    class CAsyncConnection: public MiscCommon::NONCopyable
+    {
+        public:
+            // _ok is false if the connection is closed, the message is valid only during the call
+            typedef boost::function<void( bool _ok, const SMessageHeader &_header,
+                                          const MiscCommon::BYTEVector_t &_data )> MsgHandler_t;
+            // _ok is false if the connection was closed before the message was sent
+            typedef boost::function<void( bool _ok )> DoneHandler_t;
+            // _connection is NULL on failure, the handler takes the ownership of it
+            typedef boost::function<void( CAsyncConnection *_connection, int _errno )> ConnectHandler_t;
+
+        public:
+            // takes the ownership of the connected socket
+            CAsyncConnection( CEventLoop &_loop, int _socket );
+            ~CAsyncConnection();
+
+            // connects without blocking the loop, at most _timeoutMs for all addresses of _host.
+            // The host name is resolved by a blocking getaddrinfo.
+            static void connect( CEventLoop &_loop, const std::string &_host, unsigned short _port,
+                                 int _timeoutMs, const ConnectHandler_t &_handler );
+
+            // calls _handler with the next message
+            void readMsg( const MsgHandler_t &_handler );
+            // queues the message, _handler (if any) is called when the queue has been sent up to this message
+            void write( uint16_t _cmd, const MiscCommon::BYTEVector_t &_data, const DoneHandler_t &_handler = DoneHandler_t() );
+            void writeSimpleCmd( uint16_t _cmd, const DoneHandler_t &_handler = DoneHandler_t() )
+            {
+                write( _cmd, MiscCommon::BYTEVector_t(), _handler );
+            }
+            // closes the socket, waiting handlers are called with _ok == false
+            void close();
+            bool isOpen() const
+            {
+                return ( -1 != m_socket );
+            }
+            int socket() const
+            {
+                return m_socket;
+            }
+            // negotiation, compression and flow control settings of the connection
+            CProtocol &protocol()
+            {
+                return m_protocol;
+            }
+            COutputQueue &outputQueue()
+            {
+                return m_queue;
+            }
+
+        private:
+            typedef boost::shared_ptr<bool> Alive_t;
+            static void deliverPosted( CAsyncConnection *_this, Alive_t _alive );
+            static void flushPosted( CAsyncConnection *_this, Alive_t _alive );
+            static void closePosted( CAsyncConnection *_this, Alive_t _alive );
+            void onEvents( uint32_t _events );
+            // return: false if the connection has been closed or destroyed by a handler
+            bool deliver();
+            bool flush();
+            void updateEvents();
+
+        private:
+            CEventLoop &m_loop;
+            int m_socket;
+            CProtocol m_protocol;
+            COutputQueue m_queue;
+            std::deque<MsgHandler_t> m_readers;
+            std::vector<DoneHandler_t> m_writers;
+            uint32_t m_events;
+            bool m_deliveryPosted;
+            // false when the object is destroyed, handlers check it after they have called the user
+            Alive_t m_alive;
+    };
+}
+//=============================================================================
+#endif /* ASYNCCONNECTION_H_ */
@@ -0,0 +1,116 @@
+/************************************************************************/
+/**
+ * @file CRC32C.cpp
+ * @brief CRC32C (Castagnoli) checksum used by the v2 protocol header
+ * @author Anar Manafov A.Manafov@gsi.de
+ */ /*
+
+        version number:     $LastChangedRevision$
+        created by:         Anar Manafov
+                            2012-10-02
+        last changed by:    $LastChangedBy$ $LastChangedDate$
+
+        Copyright (c) 2012 GSI, Scientific Computing division. All rights reserved.
+*************************************************************************/
+#include "CRC32C.h"
+// STD
+#include <cstring>
+
+#if defined(__GNUC__) && defined(__x86_64__)
+#define CRC32C_X86_64
+#elif defined(__aarch64__) && defined(__ARM_FEATURE_CRC32)
+#define CRC32C_ARM64
+#include <arm_acle.h>
+#endif
+//=============================================================================
+using namespace PROOFAgent;
+//=============================================================================
+namespace
+{
+    // reversed Castagnoli polynomial
+    const uint32_t CRC32C_POLY = 0x82F63B78;
+//=============================================================================
+    struct SCRC32CTable
+    {
+        SCRC32CTable()
+        {
+            for( uint32_t i = 0; i < 256; ++i )
+            {
+                uint32_t crc( i );
+                for( int j = 0; j < 8; ++j )
+                    crc = ( crc & 1 ) ? ( crc >> 1 ) ^ CRC32C_POLY : ( crc >> 1 );
+                m_table[i] = crc;
+            }
+        }
+        uint32_t m_table[256];
+    };
+    const SCRC32CTable g_crcTable;
+//=============================================================================
+    uint32_t crc32c_sw( uint32_t _crc, const unsigned char *_buf, size_t _len )
+    {
+        for( size_t i = 0; i < _len; ++i )
+            _crc = g_crcTable.m_table[( _crc ^ _buf[i] ) & 0xFF] ^ ( _crc >> 8 );
+        return _crc;
+    }
+//=============================================================================
+#if defined(CRC32C_X86_64)
+    __attribute__(( target( "sse4.2" ) ) )
+    uint32_t crc32c_hw( uint32_t _crc, const unsigned char *_buf, size_t _len )
+    {
+        unsigned long long crc( _crc );
+        for( ; _len >= 8; _len -= 8, _buf += 8 )
+        {
+            unsigned long long val;
+            memcpy( &val, _buf, sizeof( val ) );
+            crc = __builtin_ia32_crc32di( crc, val );
+        }
+        uint32_t crc32( static_cast<uint32_t>( crc ) );
+        for( ; _len > 0; --_len, ++_buf )
+            crc32 = __builtin_ia32_crc32qi( crc32, *_buf );
+        return crc32;
+    }
+    bool hasHardwareCRC()
+    {
+        static const bool ret( __builtin_cpu_supports( "sse4.2" ) );
+        return ret;
+    }
+#elif defined(CRC32C_ARM64)
+    uint32_t crc32c_hw( uint32_t _crc, const unsigned char *_buf, size_t _len )
+    {
+        for( ; _len >= 8; _len -= 8, _buf += 8 )
+        {
+            uint64_t val;
+            memcpy( &val, _buf, sizeof( val ) );
+            _crc = __crc32cd( _crc, val );
+        }
+        for( ; _len > 0; --_len, ++_buf )
+            _crc = __crc32cb( _crc, *_buf );
+        return _crc;
+    }
+    bool hasHardwareCRC()
+    {
+        return true;
+    }
+#else
+    uint32_t crc32c_hw( uint32_t _crc, const unsigned char *_buf, size_t _len )
+    {
+        return crc32c_sw( _crc, _buf, _len );
+    }
+    bool hasHardwareCRC()
+    {
+        return false;
+    }
+#endif
+}
+//=============================================================================
+uint32_t PROOFAgent::crc32c( uint32_t _crc, const unsigned char *_buf, size_t _len )
+{
+    _crc = ~_crc;
+    _crc = hasHardwareCRC() ? crc32c_hw( _crc, _buf, _len ) : crc32c_sw( _crc, _buf, _len );
+    return ~_crc;
+}
+//=============================================================================
+bool PROOFAgent::crc32cHardware()
+{
+    return hasHardwareCRC();
+}
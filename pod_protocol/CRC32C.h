@@ -0,0 +1,46 @@
+/************************************************************************/
+/**
+ * @file CRC32C.h
+ * @brief CRC32C (Castagnoli) checksum used by the v2 protocol header
+ * @author Anar Manafov A.Manafov@gsi.de
+ */ /*
+
+        version number:     $LastChangedRevision$
+        created by:         Anar Manafov
+                            2012-10-02
+        last changed by:    $LastChangedBy$ $LastChangedDate$
+
+        Copyright (c) 2012 GSI, Scientific Computing division. All rights reserved.
+*************************************************************************/
+#ifndef CRC32C_H_
+#define CRC32C_H_
+//=============================================================================
+// STD
+#include <cstddef>
+// API
+#include <stdint.h>
+//=============================================================================
+namespace PROOFAgent
+{
+//=============================================================================
+    /**
+     *
+     * @brief Updates a CRC32C checksum with the given buffer.
+     * @brief Uses the SSE4.2 (x86) or ARMv8 CRC32 instructions when the CPU has them,
+     * @brief otherwise falls back to a table driven implementation.
+     * @param[in] _crc - a checksum of the preceding data, 0 for the first chunk.
+     * @param[in] _buf - data to checksum.
+     * @param[in] _len - size of the data.
+     * @return the updated checksum.
+     *
+     */
+    uint32_t crc32c( uint32_t _crc, const unsigned char *_buf, size_t _len );
+    /**
+     *
+     * @brief returns true if crc32c uses hardware CRC instructions on this host.
+     *
+     */
+    bool crc32cHardware();
+}
+//=============================================================================
+#endif /* CRC32C_H_ */
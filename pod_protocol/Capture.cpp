@@ -0,0 +1,136 @@
+/************************************************************************/
+/**
+ * @file Capture.cpp
+ * @brief Capture files of protocol messages for the replay of real traffic
+ * @author Anar Manafov A.Manafov@gsi.de
+ */ /*
+
+        version number:     $LastChangedRevision$
+        created by:         Anar Manafov
+                            2012-11-26
+        last changed by:    $LastChangedBy$ $LastChangedDate$
+
+        Copyright (c) 2012 GSI, Scientific Computing division. All rights reserved.
+*************************************************************************/
+#include "Capture.h"
+// STD
+#include <stdexcept>
+#include <cstring>
+// API
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <time.h>
+#include <unistd.h>
+// MiscCommon
+#include "ErrorCode.h"
+//=============================================================================
+using namespace std;
+using namespace PROOFAgent;
+using namespace MiscCommon;
+//=============================================================================
+namespace
+{
+    const char g_captureMagic[] = "PODCAP1\n";
+    const size_t MAGIC_SIZE = sizeof( g_captureMagic ) - 1;
+    // TIME + CONNECTION + DIR + LEN
+    const size_t RECORD_HEADER_SIZE = 8 + 4 + 1 + 4;
+
+    void putLE( unsigned char *_buf, uint64_t _val, size_t _size )
+    {
+        for( size_t i = 0; i < _size; ++i )
+            _buf[i] = static_cast<unsigned char>( _val >> ( 8 * i ) );
+    }
+    uint64_t getLE( const unsigned char *_buf, size_t _size )
+    {
+        uint64_t val( 0 );
+        for( size_t i = 0; i < _size; ++i )
+            val |= static_cast<uint64_t>( _buf[i] ) << ( 8 * i );
+        return val;
+    }
+}
+//=============================================================================
+//=============================================================================
+//=============================================================================
+// memberof to silence doxygen warning:
+// warning: no matching class member found for
+// This happens because doxygen is not handling namespaces in arguments properly
+/**
+ * @memberof PROOFAgent::CCaptureWriter
+ *
+ */
+CCaptureWriter::CCaptureWriter( const string &_path )
+{
+    m_fd = ::open( _path.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644 );
+    if( m_fd < 0 )
+        throw system_error( "Can't open the capture file " + _path );
+    struct stat info;
+    if( 0 == ::fstat( m_fd, &info ) && 0 == info.st_size &&
+        static_cast<ssize_t>( MAGIC_SIZE ) != ::write( m_fd, g_captureMagic, MAGIC_SIZE ) )
+    {
+        ::close( m_fd );
+        throw system_error( "Can't write the capture file " + _path );
+    }
+}
+//=============================================================================
+CCaptureWriter::~CCaptureWriter()
+{
+    ::close( m_fd );
+}
+//=============================================================================
+void CCaptureWriter::record( uint32_t _connection, ECaptureDir _dir, const unsigned char *_msg, size_t _size )
+{
+    timespec ts;
+    clock_gettime( CLOCK_REALTIME, &ts );
+    unsigned char header[RECORD_HEADER_SIZE];
+    putLE( header, static_cast<uint64_t>( ts.tv_sec ) * 1000000000ULL + ts.tv_nsec, 8 );
+    putLE( header + 8, _connection, 4 );
+    header[12] = static_cast<unsigned char>( _dir );
+    putLE( header + 13, _size, 4 );
+
+    iovec iov[2];
+    iov[0].iov_base = header;
+    iov[0].iov_len = sizeof( header );
+    iov[1].iov_base = const_cast<unsigned char *>( _msg );
+    iov[1].iov_len = _size;
+    // the capture must not break the traffic, a failed record is lost
+    ::writev( m_fd, iov, 2 );
+}
+//=============================================================================
+//=============================================================================
+//=============================================================================
+// memberof to silence doxygen warning:
+// warning: no matching class member found for
+// This happens because doxygen is not handling namespaces in arguments properly
+/**
+ * @memberof PROOFAgent::CCaptureReader
+ *
+ */
+CCaptureReader::CCaptureReader( const string &_path ):
+    m_file( _path.c_str(), ios::in | ios::binary )
+{
+    if( !m_file.is_open() )
+        throw runtime_error( "Can't open the capture file " + _path );
+    char magic[MAGIC_SIZE];
+    if( !m_file.read( magic, MAGIC_SIZE ) || 0 != memcmp( magic, g_captureMagic, MAGIC_SIZE ) )
+        throw runtime_error( "Not a capture file: " + _path );
+}
+//=============================================================================
+bool CCaptureReader::next( SCaptureRecord *_record )
+{
+    unsigned char header[RECORD_HEADER_SIZE];
+    if( !m_file.read( reinterpret_cast<char *>( header ), sizeof( header ) ) )
+    {
+        if( 0 != m_file.gcount() )
+            throw runtime_error( "The capture file is truncated." );
+        return false;
+    }
+    _record->m_timeNs = getLE( header, 8 );
+    _record->m_connection = getLE( header + 8, 4 );
+    _record->m_dir = ( dirOUT == header[12] ) ? dirOUT : dirIN;
+    _record->m_msg.resize( getLE( header + 13, 4 ) );
+    if( !_record->m_msg.empty() &&
+        !m_file.read( reinterpret_cast<char *>( &_record->m_msg[0] ), _record->m_msg.size() ) )
+        throw runtime_error( "The capture file is truncated." );
+    return true;
+}
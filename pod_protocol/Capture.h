@@ -0,0 +1,100 @@
+/************************************************************************/
+/**
+ * @file Capture.h
+ * @brief Capture files of protocol messages for the replay of real traffic
+ * @author Anar Manafov A.Manafov@gsi.de
+ */ /*
+
+        version number:     $LastChangedRevision$
+        created by:         Anar Manafov
+                            2012-11-26
+        last changed by:    $LastChangedBy$ $LastChangedDate$
+
+        Copyright (c) 2012 GSI, Scientific Computing division. All rights reserved.
+*************************************************************************/
+#ifndef CAPTURE_H_
+#define CAPTURE_H_
+//=============================================================================
+// STD
+#include <fstream>
+#include <string>
+// API
+#include <stdint.h>
+// MiscCommon
+#include "def.h"
+#include "MiscUtils.h"
+//=============================================================================
+namespace PROOFAgent
+{
+//=============================================================================
+    enum ECaptureDir
+    {
+        dirIN = 0, // received by the capturing side
+        dirOUT = 1 // sent by the capturing side
+    };
+//=============================================================================
+    // a captured message as it was framed on the wire
+    struct SCaptureRecord
+    {
+        SCaptureRecord():
+            m_timeNs( 0 ),
+            m_connection( 0 ),
+            m_dir( dirIN )
+        {
+        }
+        // wall clock time (CLOCK_REALTIME) in ns
+        uint64_t m_timeNs;
+        uint32_t m_connection;
+        ECaptureDir m_dir;
+        MiscCommon::BYTEVector_t m_msg;
+    };
+//=============================================================================
+    /**
+     *
+     * @brief The class appends framed messages to a capture file.
+     * @brief The file starts with the magic "PODCAP1\n", followed by records:
+     * @brief | TIME ns (8) | CONNECTION (4) | DIR (1) | LEN (4) | MESSAGE (LEN) |, integers are little endian.
+     * @brief A record is written by one write call to a file opened with O_APPEND,
+     * @brief so one writer can be shared by the connections of several threads and even processes.
+     * @note Example:
+     * @code
+     *
+     * CCaptureWriter capture( "/tmp/agent.podcap" );
+     * protocol.setCapture( &capture, connectionId );
+     * ... the traffic of the connection is captured ...
+     *
+     * @endcode
+     *
+     */
+    class CCaptureWriter: public MiscCommon::NONCopyable
+    {
+        public:
+            // the file is created or appended to
+            CCaptureWriter( const std::string &_path );
+            ~CCaptureWriter();
+
+            void record( uint32_t _connection, ECaptureDir _dir, const unsigned char *_msg, size_t _size );
+
+        private:
+            int m_fd;
+    };
+//=============================================================================
+    /**
+     *
+     * @brief The class reads records of a capture file one after another.
+     *
+     */
+    class CCaptureReader: public MiscCommon::NONCopyable
+    {
+        public:
+            CCaptureReader( const std::string &_path );
+
+            // return: false at the end of the file
+            bool next( SCaptureRecord *_record );
+
+        private:
+            std::ifstream m_file;
+    };
+}
+//=============================================================================
+#endif /* CAPTURE_H_ */
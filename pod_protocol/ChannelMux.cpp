@@ -0,0 +1,330 @@
+/************************************************************************/
+/**
+ * @file ChannelMux.cpp
+ * @brief Multiplexing of logical channels over one protocol connection
+ * @author Anar Manafov A.Manafov@gsi.de
+ */ /*
+
+        version number:     $LastChangedRevision$
+        created by:         Anar Manafov
+                            2012-11-12
+        last changed by:    $LastChangedBy$ $LastChangedDate$
+
+        Copyright (c) 2012 GSI, Scientific Computing division. All rights reserved.
+*************************************************************************/
+#include "ChannelMux.h"
+// STD
+#include <stdexcept>
+#include <sstream>
+// API
+#include <sys/socket.h>
+// MiscCommon
+#include "ErrorCode.h"
+// pod-protocol
+#include "ProtocolCommands.h"
+//=============================================================================
+using namespace std;
+using namespace PROOFAgent;
+using namespace MiscCommon;
+//=============================================================================
+namespace
+{
+#ifdef MSG_NOSIGNAL
+    const int SEND_FLAGS = MSG_DONTWAIT | MSG_NOSIGNAL;
+#else
+    const int SEND_FLAGS = MSG_DONTWAIT;
+#endif
+    // MAGIC + FLAGS + CMD + LEN + CHANNEL + CRC32C
+    const size_t MAX_FRAME_OVERHEAD = 1 + 1 + 3 + 5 + 5 + 4;
+}
+//=============================================================================
+//=============================================================================
+//=============================================================================
+CChannelMux::CChannelMux( CProtocol &_protocol ):
+    m_protocol( _protocol ),
+    m_quantum( g_channelChunkSize + MAX_FRAME_OVERHEAD ),
+    m_window( g_channelWindow ),
+    m_offset( 0 )
+{
+}
+//=============================================================================
+void CChannelMux::setQuantum( size_t _bytes )
+{
+    m_quantum = max( _bytes, g_channelChunkSize + MAX_FRAME_OVERHEAD );
+}
+//=============================================================================
+// memberof to silence doxygen warning:
+// warning: no matching class member found for
+// This happens because doxygen is not handling namespaces in arguments properly
+/**
+ * @memberof PROOFAgent::CChannelMux
+ *
+ */
+void CChannelMux::send( uint32_t _channel, const BYTEVector_t &_data )
+{
+    if( 0 == _channel )
+        throw invalid_argument( "Channel 0 is reserved for the connection." );
+    if( !( m_protocol.caps() & capCHANNELS ) )
+        throw logic_error( "The peer doesn't support logical channels." );
+
+    SOutChannel &out = m_out[_channel];
+    if( out.m_closed )
+    {
+        stringstream ss;
+        ss << "Channel " << _channel << " is closed.";
+        throw logic_error( ss.str() );
+    }
+
+    BYTEVector_t chunk;
+    for( size_t pos = 0; pos < _data.size(); pos += g_channelChunkSize )
+    {
+        const size_t len( min( g_channelChunkSize, _data.size() - pos ) );
+        chunk.assign( _data.begin() + pos, _data.begin() + pos + len );
+        enqueue( _channel, &out, cmdCHANNEL_DATA, chunk, len );
+    }
+}
+//=============================================================================
+void CChannelMux::close( uint32_t _channel )
+{
+    OutChannels_t::iterator found = m_out.find( _channel );
+    if( m_out.end() == found || found->second.m_closed )
+        return;
+
+    enqueue( _channel, &found->second, cmdCHANNEL_CLOSE, BYTEVector_t(), 0 );
+    found->second.m_closed = true;
+}
+//=============================================================================
+// memberof to silence doxygen warning:
+// warning: no matching class member found for
+// This happens because doxygen is not handling namespaces in arguments properly
+/**
+ * @memberof PROOFAgent::CChannelMux
+ *
+ */
+void CChannelMux::sendCmd( uint16_t _cmd, const BYTEVector_t &_data )
+{
+    m_connection.push_back( m_protocol.buildMsg( _cmd, _data ) );
+}
+//=============================================================================
+// memberof to silence doxygen warning:
+// warning: no matching class member found for
+// This happens because doxygen is not handling namespaces in arguments properly
+/**
+ * @memberof PROOFAgent::CChannelMux
+ *
+ */
+void CChannelMux::enqueue( uint32_t _channel, SOutChannel *_out, uint16_t _cmd,
+                           const BYTEVector_t &_data, size_t _payload )
+{
+    _out->m_frames.push_back( SFrame() );
+    SFrame &frame = _out->m_frames.back();
+    frame.m_msg = createMsg( _cmd, _data, m_protocol.caps(), 0, _channel );
+    frame.m_payload = _payload;
+    _out->m_queued += _payload;
+    if( !_out->m_inRing )
+    {
+        _out->m_inRing = true;
+        m_ring.push_back( _channel );
+    }
+}
+//=============================================================================
+// memberof to silence doxygen warning:
+// warning: no matching class member found for
+// This happens because doxygen is not handling namespaces in arguments properly
+/**
+ * @memberof PROOFAgent::CChannelMux
+ *
+ */
+bool CChannelMux::nextFrame( BYTEVector_t *_msg )
+{
+    // deficit round robin: a channel gets a quantum per round and sends chunks while they fit into it.
+    // The loop stops after a full round without a fitting chunk, i.e. when all channels wait for credits.
+    size_t idle( 0 );
+    while( !m_ring.empty() && idle <= m_ring.size() )
+    {
+        const uint32_t id( m_ring.front() );
+        OutChannels_t::iterator found = m_out.find( id );
+        SOutChannel &out = found->second;
+        if( out.m_frames.empty() )
+        {
+            m_ring.pop_front();
+            out.m_inRing = false;
+            out.m_turn = false;
+            out.m_deficit = 0;
+            if( out.m_closed )
+                m_out.erase( found );
+            continue;
+        }
+
+        if( !out.m_turn )
+        {
+            out.m_deficit += m_quantum;
+            out.m_turn = true;
+        }
+
+        SFrame &frame = out.m_frames.front();
+        const bool hasCredit( 0 == frame.m_payload || out.m_credit > 0 );
+        if( hasCredit && frame.m_msg.size() <= out.m_deficit )
+        {
+            if( !m_protocol.hasSendCredit() )
+                return false;
+            m_protocol.consumeSendCredit( frame.m_msg.size() );
+            out.m_deficit -= frame.m_msg.size();
+            out.m_credit -= frame.m_payload;
+            out.m_queued -= frame.m_payload;
+            _msg->swap( frame.m_msg );
+            out.m_frames.pop_front();
+            return true;
+        }
+
+        // the turn is over, a channel without a credit doesn't save its quantum
+        out.m_turn = false;
+        if( !hasCredit )
+            out.m_deficit = 0;
+        m_ring.pop_front();
+        m_ring.push_back( id );
+        ++idle;
+    }
+    return false;
+}
+//=============================================================================
+bool CChannelMux::flush( int _socket )
+{
+    while( true )
+    {
+        if( m_current.empty() )
+        {
+            m_offset = 0;
+            if( !m_control.empty() )
+            {
+                m_current.swap( m_control.front() );
+                m_control.pop_front();
+            }
+            else if( !m_connection.empty() && m_protocol.hasSendCredit() )
+            {
+                m_protocol.consumeSendCredit( m_connection.front().size() );
+                m_current.swap( m_connection.front() );
+                m_connection.pop_front();
+            }
+            else if( !nextFrame( &m_current ) )
+            {
+                return m_ring.empty() && m_connection.empty();
+            }
+        }
+
+        const ssize_t n = ::send( _socket, &m_current[m_offset], m_current.size() - m_offset, SEND_FLAGS );
+        if( n < 0 )
+        {
+            if( EINTR == errno )
+                continue;
+            if( EAGAIN == errno || EWOULDBLOCK == errno )
+                return false;
+            throw system_error( "send data exception: " );
+        }
+
+        m_offset += n;
+        if( m_offset == m_current.size() )
+        {
+            m_protocol.captureSent( m_current );
+            m_current.clear();
+        }
+    }
+}
+//=============================================================================
+size_t CChannelMux::queuedBytes( uint32_t _channel ) const
+{
+    OutChannels_t::const_iterator found = m_out.find( _channel );
+    return ( m_out.end() == found ) ? 0 : found->second.m_queued;
+}
+//=============================================================================
+int64_t CChannelMux::sendCredit( uint32_t _channel ) const
+{
+    OutChannels_t::const_iterator found = m_out.find( _channel );
+    return ( m_out.end() == found ) ? static_cast<int64_t>( g_channelInitialCredit ) : found->second.m_credit;
+}
+//=============================================================================
+bool CChannelMux::onMsg()
+{
+    const SMessageHeader &header = m_protocol.msgHeader();
+    const uint32_t id( header.m_channel );
+    if( 0 == id )
+        return false;
+
+    switch( header.m_cmd )
+    {
+        case cmdCHANNEL_DATA:
+            {
+                SInChannel &in = m_in[id];
+                // the sender may overdraw its credit by at most one chunk
+                if( in.m_consumed >= in.m_granted )
+                {
+                    stringstream ss;
+                    ss << "The peer has violated the flow control of channel " << id << ".";
+                    throw runtime_error( ss.str() );
+                }
+                in.m_consumed += header.m_len;
+                if( m_onData )
+                    m_onData( id, m_protocol.msgData() );
+            }
+            return true;
+        case cmdCHANNEL_CLOSE:
+            m_in.erase( id );
+            if( m_onClose )
+                m_onClose( id );
+            return true;
+        case cmdCREDIT:
+            {
+                OutChannels_t::iterator found = m_out.find( id );
+                // a credit of an already closed channel is dropped
+                if( m_out.end() == found )
+                    return true;
+                SCreditCmd credit;
+                credit.convertFromData( m_protocol.msgData() );
+                found->second.m_credit += credit.m_bytes;
+            }
+            return true;
+        default:
+            return false;
+    }
+}
+//=============================================================================
+void CChannelMux::pause( uint32_t _channel )
+{
+    m_in[_channel].m_paused = true;
+}
+//=============================================================================
+void CChannelMux::resume( uint32_t _channel )
+{
+    InChannels_t::iterator found = m_in.find( _channel );
+    if( m_in.end() != found )
+        found->second.m_paused = false;
+}
+//=============================================================================
+void CChannelMux::grantCredits()
+{
+    BYTEVector_t msg;
+    if( m_protocol.buildCredit( &msg ) )
+    {
+        m_control.push_back( BYTEVector_t() );
+        m_control.back().swap( msg );
+    }
+
+    InChannels_t::iterator iter = m_in.begin();
+    InChannels_t::iterator iter_end = m_in.end();
+    for( ; iter != iter_end; ++iter )
+    {
+        SInChannel &in = iter->second;
+        if( in.m_paused )
+            continue;
+        const uint64_t outstanding( in.m_granted > in.m_consumed ? in.m_granted - in.m_consumed : 0 );
+        if( outstanding >= m_window / 2 )
+            continue;
+
+        SCreditCmd credit;
+        credit.m_bytes = m_window - outstanding;
+        in.m_granted += credit.m_bytes;
+        BYTEVector_t data;
+        credit.convertToData( &data );
+        m_control.push_back( createMsg( cmdCREDIT, data, m_protocol.caps(), 0, iter->first ) );
+    }
+}
@@ -0,0 +1,187 @@
+/************************************************************************/
+/**
+ * @file ChannelMux.h
+ * @brief Multiplexing of logical channels over one protocol connection
+ * @author Anar Manafov A.Manafov@gsi.de
+ */ /*
+
+        version number:     $LastChangedRevision$
+        created by:         Anar Manafov
+                            2012-11-12
+        last changed by:    $LastChangedBy$ $LastChangedDate$
+
+        Copyright (c) 2012 GSI, Scientific Computing division. All rights reserved.
+*************************************************************************/
+#ifndef CHANNELMUX_H_
+#define CHANNELMUX_H_
+//=============================================================================
+// STD
+#include <deque>
+#include <map>
+// BOOST
+#include <boost/function.hpp>
+// MiscCommon
+#include "def.h"
+// pod-protocol
+#include "Protocol.h"
+//=============================================================================
+namespace PROOFAgent
+{
+//=============================================================================
+    // a channel is split in chunks of this size, it bounds the head-of-line blocking of other channels
+    const size_t g_channelChunkSize = 16 * 1024;
+    // bytes, which a channel may send right after it is opened without a grant
+    const size_t g_channelInitialCredit = 64 * 1024;
+    // a default amount of not yet consumed bytes a channel may send
+    const size_t g_channelWindow = 256 * 1024;
+//=============================================================================
+    /**
+     *
+     * @brief The class multiplexes many logical channels (e.g. forwarded PROOF sessions)
+     * @brief over one connection. Channel ids are carried in the v2 message header (capCHANNELS).
+     * @brief Every channel has its own credit (cmdCREDIT sent on the channel), so a stalled consumer
+     * @brief blocks only its own channel. Channels share the connection in deficit round robin order
+     * @brief by chunks of at most g_channelChunkSize bytes.
+     * @note Channel 0 is the connection itself and can't be used by send.
+     * @note While the mux is in use, messages of the connection must be sent by sendCmd, not by CProtocol::write:
+     * @note flush may leave a frame partially sent, and a message written directly would be spliced into it.
+     * @note Channels are opened implicitly by the first chunk and closed by close().
+     * @note Example:
+     * @code
+     *
+     * CChannelMux mux( protocol );
+     * mux.setDataHandler( boost::bind( &CSessions::onData, &sessions, _1, _2 ) );
+     * mux.send( session_id, bytes_from_proof );
+     * // in the event loop:
+     * while( protocol.checkoutNextMsg() )
+     * {
+     *     if( !mux.onMsg() )
+     *         ... a command of the connection ...
+     * }
+     * mux.grantCredits();
+     * if( !mux.flush( socket ) )
+     *     ... wait for POLLOUT ...
+     *
+     * @endcode
+     *
+     */
+    class CChannelMux
+    {
+        public:
+            typedef boost::function<void( uint32_t, const MiscCommon::BYTEVector_t& )> DataHandler_t;
+            typedef boost::function<void( uint32_t )> CloseHandler_t;
+
+        private:
+            struct SFrame
+            {
+                SFrame():
+                    m_payload( 0 )
+                {
+                }
+                MiscCommon::BYTEVector_t m_msg;
+                // bytes of the channel, 0 for cmdCHANNEL_CLOSE
+                size_t m_payload;
+            };
+            struct SOutChannel
+            {
+                SOutChannel():
+                    m_credit( g_channelInitialCredit ),
+                    m_deficit( 0 ),
+                    m_queued( 0 ),
+                    m_inRing( false ),
+                    m_turn( false ),
+                    m_closed( false )
+                {
+                }
+                std::deque<SFrame> m_frames;
+                int64_t m_credit;
+                size_t m_deficit;
+                size_t m_queued;
+                bool m_inRing;
+                // the quantum of the current round has been added
+                bool m_turn;
+                bool m_closed;
+            };
+            struct SInChannel
+            {
+                SInChannel():
+                    m_granted( g_channelInitialCredit ),
+                    m_consumed( 0 ),
+                    m_paused( false )
+                {
+                }
+                uint64_t m_granted;
+                uint64_t m_consumed;
+                bool m_paused;
+            };
+            typedef std::map<uint32_t, SOutChannel> OutChannels_t;
+            typedef std::map<uint32_t, SInChannel> InChannels_t;
+
+        public:
+            // _protocol must have negotiated capCHANNELS, the caller keeps the ownership
+            CChannelMux( CProtocol &_protocol );
+            void setDataHandler( const DataHandler_t &_handler )
+            {
+                m_onData = _handler;
+            }
+            void setCloseHandler( const CloseHandler_t &_handler )
+            {
+                m_onClose = _handler;
+            }
+            // bytes a channel may send per round, not less than a chunk
+            void setQuantum( size_t _bytes );
+            // the receive window of each channel, should not be less than g_channelInitialCredit
+            void setChannelWindow( size_t _bytes )
+            {
+                m_window = _bytes;
+            }
+
+            // queues bytes of the channel
+            void send( uint32_t _channel, const MiscCommon::BYTEVector_t &_data );
+            // queues cmdCHANNEL_CLOSE after the bytes of the channel, which are already queued
+            void close( uint32_t _channel );
+            // queues a message of the connection (channel 0), it is sent between frames of channels
+            void sendCmd( uint16_t _cmd, const MiscCommon::BYTEVector_t &_data );
+            // writes as much as the socket takes without blocking
+            // return: true if nothing is left to send
+            bool flush( int _socket );
+            // not yet sent bytes of the channel
+            size_t queuedBytes( uint32_t _channel ) const;
+            // the credit the peer has granted to the channel
+            int64_t sendCredit( uint32_t _channel ) const;
+
+            // handles the message, which has been checked out by the protocol
+            // return: false if the message doesn't belong to a channel
+            bool onMsg();
+            // stops granting credits to the channel, the peer stops when its credit is spent
+            void pause( uint32_t _channel );
+            void resume( uint32_t _channel );
+            // queues credits of the connection and of channels, which have consumed a half of the window
+            void grantCredits();
+
+        private:
+            bool nextFrame( MiscCommon::BYTEVector_t *_msg );
+            void enqueue( uint32_t _channel, SOutChannel *_out, uint16_t _cmd,
+                          const MiscCommon::BYTEVector_t &_data, size_t _payload );
+
+        private:
+            CProtocol &m_protocol;
+            DataHandler_t m_onData;
+            CloseHandler_t m_onClose;
+            size_t m_quantum;
+            size_t m_window;
+            OutChannels_t m_out;
+            InChannels_t m_in;
+            // channels with queued frames in the round robin order
+            std::deque<uint32_t> m_ring;
+            // credits, they overtake channel frames and are not subject of the flow control
+            std::deque<MiscCommon::BYTEVector_t> m_control;
+            // messages of the connection, they overtake channel frames, but need the credit of the connection
+            std::deque<MiscCommon::BYTEVector_t> m_connection;
+            // the frame, which is being sent
+            MiscCommon::BYTEVector_t m_current;
+            size_t m_offset;
+    };
+}
+//=============================================================================
+#endif /* CHANNELMUX_H_ */
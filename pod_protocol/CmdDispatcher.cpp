@@ -0,0 +1,190 @@
+/************************************************************************/
+/**
+ * @file CmdDispatcher.cpp
+ * @brief A registry of typed handlers of protocol commands
+ * @author Anar Manafov A.Manafov@gsi.de
+ */ /*
+
+        version number:     $LastChangedRevision$
+        created by:         Anar Manafov
+                            2012-11-02
+        last changed by:    $LastChangedBy$ $LastChangedDate$
+
+        Copyright (c) 2012 GSI, Scientific Computing division. All rights reserved.
+*************************************************************************/
+#include "CmdDispatcher.h"
+// STD
+#include <iomanip>
+#include <sstream>
+// API
+#include <time.h>
+// BOOST
+#include <boost/bind.hpp>
+// MiscCommon
+#include "Metrics.h"
+#include "Trace.h"
+// pod-protocol
+#include "ProtocolCommands.h"
+//=============================================================================
+using namespace std;
+using namespace PROOFAgent;
+using namespace MiscCommon;
+//=============================================================================
+namespace
+{
+    void replyTrace( CProtocol *_protocol, int _socket, const SMessageHeader &, const BYTEVector_t & )
+    {
+        stringstream ss;
+        CTracer::instance().writeChromeTrace( ss );
+        const string json( ss.str() );
+        _protocol->write( _socket, cmdTRACE_DATA, BYTEVector_t( json.begin(), json.end() ) );
+    }
+}
+//=============================================================================
+//=============================================================================
+//=============================================================================
+void SCmdStats::add( uint64_t _ns )
+{
+    m_totalNs += _ns;
+    size_t bucket( 0 );
+    while( _ns > 1 && bucket < HISTOGRAM_SIZE - 1 )
+    {
+        _ns >>= 1;
+        ++bucket;
+    }
+    ++m_histogram[bucket];
+}
+//=============================================================================
+uint64_t SCmdStats::percentile( double _percent ) const
+{
+    uint64_t timed( 0 );
+    for( size_t i = 0; i < HISTOGRAM_SIZE; ++i )
+        timed += m_histogram[i];
+    if( 0 == timed )
+        return 0;
+
+    const uint64_t rank( static_cast<uint64_t>( timed * _percent / 100.0 + 0.5 ) );
+    uint64_t sum( 0 );
+    for( size_t i = 0; i < HISTOGRAM_SIZE; ++i )
+    {
+        sum += m_histogram[i];
+        if( sum >= rank && m_histogram[i] > 0 )
+            return ( 1ULL << ( i + 1 ) );
+    }
+    return ( 1ULL << HISTOGRAM_SIZE );
+}
+//=============================================================================
+//=============================================================================
+//=============================================================================
+// memberof to silence doxygen warning:
+// warning: no matching class member found for
+// This happens because doxygen is not handling namespaces in arguments properly
+/**
+ * @memberof PROOFAgent::CCmdDispatcher
+ *
+ */
+void CCmdDispatcher::registerRaw( uint16_t _cmd, const RawHandler_t &_handler )
+{
+    if( _cmd >= m_handlers.size() )
+        m_handlers.resize( _cmd + 1 );
+    m_handlers[_cmd].m_handler = _handler;
+}
+//=============================================================================
+void CCmdDispatcher::unregister( uint16_t _cmd )
+{
+    if( _cmd < m_handlers.size() )
+        m_handlers[_cmd].m_handler.clear();
+}
+//=============================================================================
+bool CCmdDispatcher::dispatch( const CProtocol &_protocol )
+{
+    const SMessageHeader &header = _protocol.msgHeader();
+    SEntry *entry = ( header.m_cmd < m_handlers.size() && m_handlers[header.m_cmd].m_handler ) ?
+                    &m_handlers[header.m_cmd] : &m_fallback;
+    if( !entry->m_handler )
+    {
+        ++m_fallback.m_stats.m_count;
+        return false;
+    }
+
+    call( entry, header, _protocol.msgData() );
+    return true;
+}
+//=============================================================================
+size_t CCmdDispatcher::dispatchAll( CProtocol *_protocol )
+{
+    size_t count( 0 );
+    while( _protocol->checkoutNextMsg() )
+    {
+        dispatch( *_protocol );
+        ++count;
+    }
+    return count;
+}
+//=============================================================================
+// memberof to silence doxygen warning:
+// warning: no matching class member found for
+// This happens because doxygen is not handling namespaces in arguments properly
+/**
+ * @memberof PROOFAgent::CCmdDispatcher
+ *
+ */
+void CCmdDispatcher::call( SEntry *_entry, const SMessageHeader &_header, const BYTEVector_t &_data )
+{
+    ++_entry->m_stats.m_count;
+    const uint64_t start( m_timing ? metricsNowNs() : 0 );
+    try
+    {
+        _entry->m_handler( _header, _data );
+    }
+    catch( ... )
+    {
+        ++_entry->m_stats.m_errors;
+        throw;
+    }
+    if( m_timing )
+        _entry->m_stats.add( metricsNowNs() - start );
+}
+//=============================================================================
+const SCmdStats &CCmdDispatcher::stats( uint16_t _cmd ) const
+{
+    return ( _cmd < m_handlers.size() && m_handlers[_cmd].m_handler ) ?
+           m_handlers[_cmd].m_stats : m_fallback.m_stats;
+}
+//=============================================================================
+void CCmdDispatcher::resetStats()
+{
+    Container_t::iterator iter = m_handlers.begin();
+    Container_t::iterator iter_end = m_handlers.end();
+    for( ; iter != iter_end; ++iter )
+        iter->m_stats = SCmdStats();
+    m_fallback.m_stats = SCmdStats();
+}
+//=============================================================================
+void CCmdDispatcher::printStats( ostream &_stream ) const
+{
+    _stream
+            << setw( 10 ) << "cmd" << setw( 12 ) << "count" << setw( 10 ) << "errors"
+            << setw( 12 ) << "avg ns" << setw( 12 ) << "p50 ns" << setw( 12 ) << "p99 ns" << "\n";
+    for( size_t i = 0; i <= m_handlers.size(); ++i )
+    {
+        const bool fallback( i == m_handlers.size() );
+        const SCmdStats &stats = fallback ? m_fallback.m_stats : m_handlers[i].m_stats;
+        if( 0 == stats.m_count )
+            continue;
+
+        if( fallback )
+            _stream << setw( 10 ) << "fallback";
+        else
+            _stream << setw( 10 ) << i;
+        _stream
+                << setw( 12 ) << stats.m_count << setw( 10 ) << stats.m_errors
+                << setw( 12 ) << ( stats.m_count > 0 ? stats.m_totalNs / stats.m_count : 0 )
+                << setw( 12 ) << stats.percentile( 50 ) << setw( 12 ) << stats.percentile( 99 ) << "\n";
+    }
+}
+//=============================================================================
+void PROOFAgent::registerTraceDump( CCmdDispatcher *_dispatcher, CProtocol *_protocol, int _socket )
+{
+    _dispatcher->registerRaw( cmdTRACE_DUMP, boost::bind( &replyTrace, _protocol, _socket, _1, _2 ) );
+}
@@ -0,0 +1,169 @@
+/************************************************************************/
+/**
+ * @file CmdDispatcher.h
+ * @brief A registry of typed handlers of protocol commands
+ * @author Anar Manafov A.Manafov@gsi.de
+ */ /*
+
+        version number:     $LastChangedRevision$
+        created by:         Anar Manafov
+                            2012-11-02
+        last changed by:    $LastChangedBy$ $LastChangedDate$
+
+        Copyright (c) 2012 GSI, Scientific Computing division. All rights reserved.
+*************************************************************************/
+#ifndef CMDDISPATCHER_H_
+#define CMDDISPATCHER_H_
+//=============================================================================
+// STD
+#include <algorithm>
+#include <vector>
+#include <ostream>
+// BOOST
+#include <boost/function.hpp>
+// MiscCommon
+#include "def.h"
+// pod-protocol
+#include "Protocol.h"
+//=============================================================================
+namespace PROOFAgent
+{
+//=============================================================================
+    /**
+     *
+     * @brief Statistics of a command: a number of calls and a log2 histogram of handler latencies.
+     *
+     */
+    struct SCmdStats
+    {
+        // bucket i counts calls, which took [2^i, 2^(i+1)) ns
+        enum { HISTOGRAM_SIZE = 40 };
+
+        SCmdStats():
+            m_count( 0 ),
+            m_errors( 0 ),
+            m_totalNs( 0 )
+        {
+            std::fill( m_histogram, m_histogram + HISTOGRAM_SIZE, 0 );
+        }
+        void add( uint64_t _ns );
+        // return: an upper bound of the latency of the given percentile (0..100) in ns
+        uint64_t percentile( double _percent ) const;
+
+        uint64_t m_count;
+        // handlers, which have thrown
+        uint64_t m_errors;
+        uint64_t m_totalNs;
+        uint64_t m_histogram[HISTOGRAM_SIZE];
+    };
+//=============================================================================
+    /**
+     *
+     * @brief The class dispatches received messages to handlers registered per command id.
+     * @brief Typed handlers get the command decoded directly from the message buffer of CProtocol,
+     * @brief without a copy made by CProtocol::getMsg.
+     * @note Example:
+     * @code
+     *
+     * void onHostInfo( const SHostInfoCmd &_cmd );
+     * void onShutdown( const SMessageHeader &_header, const BYTEVector_t &_data );
+     *
+     * CCmdDispatcher dispatcher;
+     * dispatcher.registerCmd<SHostInfoCmd>( cmdHOST_INFO, &onHostInfo );
+     * dispatcher.registerRaw( cmdSHUTDOWN, &onShutdown );
+     * ...
+     * if( CProtocol::stOK == protocol.read( socket ) )
+     *     dispatcher.dispatchAll( &protocol );
+     *
+     * @endcode
+     *
+     */
+    class CCmdDispatcher
+    {
+        public:
+            typedef boost::function<void ( const SMessageHeader &, const MiscCommon::BYTEVector_t & )> RawHandler_t;
+
+        private:
+            template<class _Cmd>
+            struct STypedHandler
+            {
+                STypedHandler( const boost::function<void ( const _Cmd & )> &_handler ):
+                    m_handler( _handler )
+                {
+                }
+                void operator()( const SMessageHeader &, const MiscCommon::BYTEVector_t &_data ) const
+                {
+                    _Cmd cmd;
+                    cmd.convertFromData( _data );
+                    m_handler( cmd );
+                }
+                boost::function<void ( const _Cmd & )> m_handler;
+            };
+            struct SEntry
+            {
+                RawHandler_t m_handler;
+                SCmdStats m_stats;
+            };
+            typedef std::vector<SEntry> Container_t;
+
+        public:
+            CCmdDispatcher():
+                m_timing( true )
+            {
+            }
+            // _Cmd is one of the SBasicCmd commands
+            template<class _Cmd>
+            void registerCmd( uint16_t _cmd, const boost::function<void ( const _Cmd & )> &_handler )
+            {
+                registerRaw( _cmd, STypedHandler<_Cmd>( _handler ) );
+            }
+            // a handler of commands without arguments or with a custom decoding
+            void registerRaw( uint16_t _cmd, const RawHandler_t &_handler );
+            void unregister( uint16_t _cmd );
+            // gets all commands, which have no handler
+            void setFallback( const RawHandler_t &_handler )
+            {
+                m_fallback.m_handler = _handler;
+            }
+            // switches off the latency measurement, counters are always updated
+            void setTiming( bool _timing )
+            {
+                m_timing = _timing;
+            }
+            // dispatches the current message of _protocol (after checkoutNextMsg returned true)
+            // return: false if there is neither a handler nor a fallback for the command
+            bool dispatch( const CProtocol &_protocol );
+            // checks out and dispatches all complete messages of _protocol
+            // return: a number of dispatched messages
+            size_t dispatchAll( CProtocol *_protocol );
+            // statistics of the command, the statistics of the fallback are returned for unknown commands
+            const SCmdStats &stats( uint16_t _cmd ) const;
+            const SCmdStats &fallbackStats() const
+            {
+                return m_fallback.m_stats;
+            }
+            void resetStats();
+            // prints statistics of all commands, which were called at least once
+            void printStats( std::ostream &_stream ) const;
+
+        private:
+            void call( SEntry *_entry, const SMessageHeader &_header, const MiscCommon::BYTEVector_t &_data );
+
+        private:
+            Container_t m_handlers;
+            SEntry m_fallback;
+            bool m_timing;
+    };
+    inline std::ostream &operator<< ( std::ostream &_stream, const CCmdDispatcher &_val )
+    {
+        _val.printStats( _stream );
+        return _stream;
+    }
+//=============================================================================
+    // registers a handler, which answers cmdTRACE_DUMP by cmdTRACE_DATA on _socket
+    // with the trace of this process (see CTracer::writeChromeTrace).
+    // The caller keeps the ownership of _protocol, it must outlive the registration.
+    void registerTraceDump( CCmdDispatcher *_dispatcher, CProtocol *_protocol, int _socket );
+}
+//=============================================================================
+#endif /* CMDDISPATCHER_H_ */
@@ -0,0 +1,405 @@
+/************************************************************************/
+/**
+ * @file Compression.cpp
+ * @brief Payload compression of protocol messages
+ * @author Anar Manafov A.Manafov@gsi.de
+ */ /*
+
+        version number:     $LastChangedRevision$
+        created by:         Anar Manafov
+                            2012-10-09
+        last changed by:    $LastChangedBy$ $LastChangedDate$
+
+        Copyright (c) 2012 GSI, Scientific Computing division. All rights reserved.
+*************************************************************************/
+#include "Compression.h"
+// STD
+#include <cstring>
+#include <stdexcept>
+#include <sstream>
+#include <algorithm>
+#include <map>
+// API
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+#ifdef HAVE_LZ4
+#include <lz4.h>
+#endif
+// pod-protocol
+#include "Protocol.h"
+#include "CRC32C.h"
+//=============================================================================
+using namespace std;
+using namespace PROOFAgent;
+using namespace MiscCommon;
+//=============================================================================
+namespace
+{
+    // CODEC + DICT_ID + RAW LEN
+    const size_t MAX_PREFIX_SIZE = 1 + 4 + 5;
+
+    // the best possible compression ratio of a codec, 0 - the codec is not supported.
+    // A peer can't claim a larger raw size without a corrupted payload,
+    // so a tiny message can't make us allocate g_maxDecompressedSize.
+    size_t maxRatio( unsigned char _codec )
+    {
+        switch( _codec )
+        {
+#ifdef HAVE_ZLIB
+            case codecZLIB:
+                // a 258 bytes match in less than 2 bits
+                return 1032;
+#endif
+#ifdef HAVE_ZSTD
+            case codecZSTD:
+                // an RLE block: 128 KB out of a 3 bytes header and a byte
+                return 32768;
+#endif
+#ifdef HAVE_LZ4
+            case codecLZ4:
+                // a match length is extended by a byte per 255 bytes
+                return 255;
+#endif
+            default:
+                return 0;
+        }
+    }
+
+    typedef pair<size_t, string> Field_t;
+    struct SFieldWeightLess
+    {
+        bool operator()( const Field_t &_a, const Field_t &_b ) const
+        {
+            return ( _a.first * _a.second.size() < _b.first * _b.second.size() );
+        }
+    };
+//=============================================================================
+#ifdef HAVE_ZLIB
+    bool zlibCompress( const BYTEVector_t &_data, unsigned char *_out, size_t *_outSize,
+                       const CCompressionDict *_dict )
+    {
+        z_stream strm;
+        memset( &strm, 0, sizeof( strm ) );
+        if( Z_OK != deflateInit( &strm, Z_DEFAULT_COMPRESSION ) )
+            return false;
+
+        if( _dict && Z_OK != deflateSetDictionary( &strm, &_dict->data()[0], _dict->data().size() ) )
+        {
+            deflateEnd( &strm );
+            return false;
+        }
+
+        strm.next_in = const_cast<Bytef *>( &_data[0] );
+        strm.avail_in = _data.size();
+        strm.next_out = _out;
+        strm.avail_out = *_outSize;
+        const int ret = deflate( &strm, Z_FINISH );
+        *_outSize = strm.total_out;
+        deflateEnd( &strm );
+        return ( Z_STREAM_END == ret );
+    }
+    void zlibDecompress( const unsigned char *_in, size_t _inSize, BYTEVector_t *_out,
+                         const CCompressionDict *_dict )
+    {
+        z_stream strm;
+        memset( &strm, 0, sizeof( strm ) );
+        if( Z_OK != inflateInit( &strm ) )
+            throw runtime_error( "Compression: can't initialize zlib" );
+
+        strm.next_in = const_cast<Bytef *>( _in );
+        strm.avail_in = _inSize;
+        strm.next_out = &( *_out )[0];
+        strm.avail_out = _out->size();
+        int ret = inflate( &strm, Z_FINISH );
+        if( Z_NEED_DICT == ret && _dict )
+        {
+            if( Z_OK == inflateSetDictionary( &strm, &_dict->data()[0], _dict->data().size() ) )
+                ret = inflate( &strm, Z_FINISH );
+        }
+        const size_t total = strm.total_out;
+        inflateEnd( &strm );
+        if( Z_STREAM_END != ret || total != _out->size() )
+            throw runtime_error( "Compression: zlib payload is corrupted" );
+    }
+#endif
+//=============================================================================
+#ifdef HAVE_ZSTD
+    bool zstdCompress( const BYTEVector_t &_data, unsigned char *_out, size_t *_outSize,
+                       const CCompressionDict *_dict )
+    {
+        ZSTD_CCtx *ctx = ZSTD_createCCtx();
+        if( !ctx )
+            return false;
+        const size_t ret = _dict ?
+                           ZSTD_compress_usingDict( ctx, _out, *_outSize, &_data[0], _data.size(),
+                                                    &_dict->data()[0], _dict->data().size(), 3 ) :
+                           ZSTD_compressCCtx( ctx, _out, *_outSize, &_data[0], _data.size(), 3 );
+        ZSTD_freeCCtx( ctx );
+        if( ZSTD_isError( ret ) )
+            return false;
+        *_outSize = ret;
+        return true;
+    }
+    void zstdDecompress( const unsigned char *_in, size_t _inSize, BYTEVector_t *_out,
+                         const CCompressionDict *_dict )
+    {
+        ZSTD_DCtx *ctx = ZSTD_createDCtx();
+        if( !ctx )
+            throw runtime_error( "Compression: can't initialize zstd" );
+        const size_t ret = _dict ?
+                           ZSTD_decompress_usingDict( ctx, &( *_out )[0], _out->size(), _in, _inSize,
+                                                      &_dict->data()[0], _dict->data().size() ) :
+                           ZSTD_decompressDCtx( ctx, &( *_out )[0], _out->size(), _in, _inSize );
+        ZSTD_freeDCtx( ctx );
+        if( ZSTD_isError( ret ) || ret != _out->size() )
+            throw runtime_error( "Compression: zstd payload is corrupted" );
+    }
+#endif
+//=============================================================================
+#ifdef HAVE_LZ4
+    bool lz4Compress( const BYTEVector_t &_data, unsigned char *_out, size_t *_outSize,
+                      const CCompressionDict *_dict )
+    {
+        LZ4_stream_t stream;
+        LZ4_initStream( &stream, sizeof( stream ) );
+        if( _dict )
+            LZ4_loadDict( &stream, reinterpret_cast<const char *>( &_dict->data()[0] ), _dict->data().size() );
+        const int ret = LZ4_compress_fast_continue( &stream, reinterpret_cast<const char *>( &_data[0] ),
+                                                    reinterpret_cast<char *>( _out ), _data.size(), *_outSize, 1 );
+        if( ret <= 0 )
+            return false;
+        *_outSize = ret;
+        return true;
+    }
+    void lz4Decompress( const unsigned char *_in, size_t _inSize, BYTEVector_t *_out,
+                        const CCompressionDict *_dict )
+    {
+        const int ret = _dict ?
+                        LZ4_decompress_safe_usingDict( reinterpret_cast<const char *>( _in ),
+                                                       reinterpret_cast<char *>( &( *_out )[0] ), _inSize, _out->size(),
+                                                       reinterpret_cast<const char *>( &_dict->data()[0] ), _dict->data().size() ) :
+                        LZ4_decompress_safe( reinterpret_cast<const char *>( _in ),
+                                             reinterpret_cast<char *>( &( *_out )[0] ), _inSize, _out->size() );
+        if( ret < 0 || static_cast<size_t>( ret ) != _out->size() )
+            throw runtime_error( "Compression: lz4 payload is corrupted" );
+    }
+#endif
+}
+//=============================================================================
+//=============================================================================
+//=============================================================================
+void CCompressionDict::assign( const BYTEVector_t &_dict )
+{
+    m_dict = _dict;
+    m_id = m_dict.empty() ? 0 : crc32c( 0, &m_dict[0], m_dict.size() );
+}
+//=============================================================================
+void CCompressionDict::train( const vector<BYTEVector_t> &_samples, size_t _maxSize )
+{
+    // count NUL-separated fields, the strings of SHostInfoCmd and SWnListCmd
+    map<string, size_t> fields;
+    vector<BYTEVector_t>::const_iterator iter = _samples.begin();
+    vector<BYTEVector_t>::const_iterator iter_end = _samples.end();
+    for( ; iter != iter_end; ++iter )
+    {
+        BYTEVector_t::const_iterator first = iter->begin();
+        while( first != iter->end() )
+        {
+            BYTEVector_t::const_iterator last = find( first, iter->end(), '\0' );
+            if( last != iter->end() )
+                ++last;
+            ++fields[string( first, last )];
+            first = last;
+        }
+    }
+
+    vector<Field_t> sorted;
+    sorted.reserve( fields.size() );
+    map<string, size_t>::const_iterator fld = fields.begin();
+    map<string, size_t>::const_iterator fld_end = fields.end();
+    for( ; fld != fld_end; ++fld )
+    {
+        // unique fields can't help to compress other messages
+        if( fld->second > 1 )
+            sorted.push_back( Field_t( fld->second, fld->first ) );
+    }
+    sort( sorted.begin(), sorted.end(), SFieldWeightLess() );
+
+    // the most valuable fields go to the end of the dictionary,
+    // where they are cheaper to reference for compressors
+    BYTEVector_t dict;
+    vector<Field_t>::const_reverse_iterator rit = sorted.rbegin();
+    vector<Field_t>::const_reverse_iterator rit_end = sorted.rend();
+    for( ; rit != rit_end; ++rit )
+    {
+        if( dict.size() + rit->second.size() > _maxSize )
+            continue;
+        dict.insert( dict.begin(), rit->second.begin(), rit->second.end() );
+    }
+    assign( dict );
+}
+//=============================================================================
+uint32_t PROOFAgent::compressionCaps()
+{
+    uint32_t caps( 0 );
+#ifdef HAVE_ZLIB
+    caps |= capZLIB;
+#endif
+#ifdef HAVE_ZSTD
+    caps |= capZSTD;
+#endif
+#ifdef HAVE_LZ4
+    caps |= capLZ4;
+#endif
+    return caps;
+}
+//=============================================================================
+ECompressionCodec PROOFAgent::selectCodec( uint32_t _caps )
+{
+    _caps &= compressionCaps();
+    if( _caps & capZSTD )
+        return codecZSTD;
+    if( _caps & capLZ4 )
+        return codecLZ4;
+    if( _caps & capZLIB )
+        return codecZLIB;
+    return codecNONE;
+}
+//=============================================================================
+bool PROOFAgent::compressPayload( ECompressionCodec _codec, const BYTEVector_t &_data,
+                                  BYTEVector_t *_out, const CCompressionDict *_dict )
+{
+    if( _data.empty() || _data.size() > g_maxDecompressedSize )
+        return false;
+
+    if( _dict && _dict->empty() )
+        _dict = NULL;
+
+    _out->clear();
+    _out->push_back( _dict ? ( _codec | codecDICT ) : _codec );
+    if( _dict )
+    {
+        const uint32_t id( _dict->id() );
+        _out->push_back( id & 0xFF );
+        _out->push_back(( id >> 8 ) & 0xFF );
+        _out->push_back(( id >> 16 ) & 0xFF );
+        _out->push_back(( id >> 24 ) & 0xFF );
+    }
+    putVarint( _out, _data.size() );
+
+    // there is no gain if the compressed data is not smaller than the original one
+    const size_t prefix( _out->size() );
+    if( prefix >= _data.size() )
+        return false;
+    size_t outSize( _data.size() - prefix );
+    _out->resize( MAX_PREFIX_SIZE + _data.size() );
+
+    bool ret( false );
+    switch( _codec )
+    {
+#ifdef HAVE_ZLIB
+        case codecZLIB:
+            ret = zlibCompress( _data, &( *_out )[prefix], &outSize, _dict );
+            break;
+#endif
+#ifdef HAVE_ZSTD
+        case codecZSTD:
+            ret = zstdCompress( _data, &( *_out )[prefix], &outSize, _dict );
+            break;
+#endif
+#ifdef HAVE_LZ4
+        case codecLZ4:
+            ret = lz4Compress( _data, &( *_out )[prefix], &outSize, _dict );
+            break;
+#endif
+        default:
+            break;
+    }
+    if( !ret || prefix + outSize >= _data.size() )
+        return false;
+
+    _out->resize( prefix + outSize );
+    return true;
+}
+//=============================================================================
+void PROOFAgent::decompressPayload( const BYTEVector_t &_payload, BYTEVector_t *_out,
+                                    const CCompressionDict *_dict )
+{
+    if( _payload.empty() )
+        throw runtime_error( "Compression: the payload is empty" );
+
+    const unsigned char codec( _payload[0] );
+    size_t pos( 1 );
+    if( codec & codecDICT )
+    {
+        if( _payload.size() < pos + sizeof( uint32_t ) )
+            throw runtime_error( "Compression: the payload is too short" );
+        const uint32_t id = _payload[pos] | ( _payload[pos + 1] << 8 ) | ( _payload[pos + 2] << 16 ) |
+                            ( static_cast<uint32_t>( _payload[pos + 3] ) << 24 );
+        pos += sizeof( uint32_t );
+        if( !_dict || _dict->id() != id )
+        {
+            stringstream ss;
+            ss << "Compression: the payload requires an unknown dictionary 0x" << hex << id;
+            throw runtime_error( ss.str() );
+        }
+    }
+    else
+    {
+        _dict = NULL;
+    }
+
+    // the codec is checked before anything is allocated
+    const size_t ratio( maxRatio( codec & ~codecDICT ) );
+    if( 0 == ratio )
+    {
+        stringstream ss;
+        ss << "Compression: unsupported codec " << static_cast<int>( codec & ~codecDICT );
+        throw runtime_error( ss.str() );
+    }
+
+    uint32_t rawSize( 0 );
+    const size_t n = getVarint( &_payload[0] + pos, _payload.size() - pos, 5, &rawSize );
+    if( 0 == n || rawSize > g_maxDecompressedSize ||
+        rawSize > static_cast<uint64_t>( _payload.size() - pos - n ) * ratio )
+        throw runtime_error( "Compression: invalid size of the payload" );
+    pos += n;
+    // nothing to decompress, the codecs would get a pointer into an empty buffer
+    if( 0 == rawSize )
+        return;
+
+    const size_t offset( _out->size() );
+    BYTEVector_t raw( rawSize );
+    switch( codec & ~codecDICT )
+    {
+#ifdef HAVE_ZLIB
+        case codecZLIB:
+            zlibDecompress( &_payload[0] + pos, _payload.size() - pos, &raw, _dict );
+            break;
+#endif
+#ifdef HAVE_ZSTD
+        case codecZSTD:
+            zstdDecompress( &_payload[0] + pos, _payload.size() - pos, &raw, _dict );
+            break;
+#endif
+#ifdef HAVE_LZ4
+        case codecLZ4:
+            lz4Decompress( &_payload[0] + pos, _payload.size() - pos, &raw, _dict );
+            break;
+#endif
+        default:
+            {
+                stringstream ss;
+                ss << "Compression: unsupported codec " << static_cast<int>( codec & ~codecDICT );
+                throw runtime_error( ss.str() );
+            }
+    }
+    if( 0 == offset )
+        _out->swap( raw );
+    else
+        _out->insert( _out->end(), raw.begin(), raw.end() );
+}
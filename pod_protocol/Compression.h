@@ -0,0 +1,102 @@
+/************************************************************************/
+/**
+ * @file Compression.h
+ * @brief Payload compression of protocol messages
+ * @author Anar Manafov A.Manafov@gsi.de
+ */ /*
+
+        version number:     $LastChangedRevision$
+        created by:         Anar Manafov
+                            2012-10-09
+        last changed by:    $LastChangedBy$ $LastChangedDate$
+
+        Copyright (c) 2012 GSI, Scientific Computing division. All rights reserved.
+*************************************************************************/
+#ifndef COMPRESSION_H_
+#define COMPRESSION_H_
+//=============================================================================
+// STD
+#include <vector>
+// API
+#include <stdint.h>
+// MiscCommon
+#include "def.h"
+//=============================================================================
+namespace PROOFAgent
+{
+//=============================================================================
+// a compressed payload (flagCOMPRESSED is set in the v2 header)
+// | CODEC (1) | DICT_ID (4, if CODEC & codecDICT) | RAW LEN (varint) | compressed DATA |
+    enum ECompressionCodec
+    {
+        codecNONE = 0,
+        codecZLIB = 1,
+        codecZSTD = 2,
+        codecLZ4 = 3,
+        // the payload was compressed using a shared dictionary
+        codecDICT = 0x80
+    };
+    // messages smaller than this are never compressed
+    const size_t g_compressionThreshold = 512;
+    // a protection against decompression bombs
+    const uint32_t g_maxDecompressedSize = 256 * 1024 * 1024;
+//=============================================================================
+    /**
+     *
+     * @brief A dictionary, which is shared by peers to improve compression of small, similar messages.
+     * @brief Both peers must use the same dictionary. It is identified by a CRC32C of its content.
+     *
+     */
+    class CCompressionDict
+    {
+        public:
+            CCompressionDict():
+                m_id( 0 )
+            {
+            }
+            void assign( const MiscCommon::BYTEVector_t &_dict );
+            // builds a dictionary out of typical payloads (for example, SHostInfoCmd messages)
+            // the most frequent NUL-separated fields are placed at the end of the dictionary
+            void train( const std::vector<MiscCommon::BYTEVector_t> &_samples, size_t _maxSize = 16 * 1024 );
+            const MiscCommon::BYTEVector_t &data() const
+            {
+                return m_dict;
+            }
+            uint32_t id() const
+            {
+                return m_id;
+            }
+            bool empty() const
+            {
+                return m_dict.empty();
+            }
+
+        private:
+            MiscCommon::BYTEVector_t m_dict;
+            uint32_t m_id;
+    };
+//=============================================================================
+    // returns the compression capabilities (capZLIB, capZSTD, capLZ4) of this build
+    uint32_t compressionCaps();
+    // returns the preferred codec out of the given capabilities or codecNONE
+    ECompressionCodec selectCodec( uint32_t _caps );
+    /**
+     *
+     * @brief compresses _data and writes a compressed payload to _out.
+     * @return false if the codec is unavailable or compression doesn't reduce the size,
+     * @return in that case the data must be sent uncompressed.
+     *
+     */
+    bool compressPayload( ECompressionCodec _codec, const MiscCommon::BYTEVector_t &_data,
+                          MiscCommon::BYTEVector_t *_out, const CCompressionDict *_dict = NULL );
+    /**
+     *
+     * @brief decompresses a payload, created by compressPayload.
+     * @exception std::runtime_error - thrown if the payload is corrupted or the dictionary doesn't match.
+     *
+     */
+    void decompressPayload( const MiscCommon::BYTEVector_t &_payload, MiscCommon::BYTEVector_t *_out,
+                            const CCompressionDict *_dict = NULL );
+}
+//=============================================================================
+#endif /* COMPRESSION_H_ */
@@ -0,0 +1,188 @@
+/************************************************************************/
+/**
+ * @file EventLoop.cpp
+ * @brief An epoll event loop with timers
+ * @author Anar Manafov A.Manafov@gsi.de
+ */ /*
+
+        version number:     $LastChangedRevision$
+        created by:         Anar Manafov
+                            2012-11-23
+        last changed by:    $LastChangedBy$ $LastChangedDate$
+
+        Copyright (c) 2012 GSI, Scientific Computing division. All rights reserved.
+*************************************************************************/
+#include "EventLoop.h"
+// STD
+#include <stdexcept>
+// API
+#include <time.h>
+#include <unistd.h>
+// MiscCommon
+#include "ErrorCode.h"
+#include "INet.h"
+//=============================================================================
+using namespace std;
+using namespace PROOFAgent;
+using namespace MiscCommon;
+//=============================================================================
+namespace
+{
+    // events taken by one epoll_wait
+    const size_t MAX_EVENTS = 256;
+}
+//=============================================================================
+//=============================================================================
+//=============================================================================
+CEventLoop::CEventLoop():
+    m_count( 0 ),
+    m_nextTimer( 1 ),
+    m_events( MAX_EVENTS ),
+    m_stop( false )
+{
+    m_epoll = epoll_create( MAX_EVENTS );
+    if( m_epoll < 0 )
+        throw system_error( "Can't create an epoll instance" );
+}
+//=============================================================================
+CEventLoop::~CEventLoop()
+{
+    ::close( m_epoll );
+}
+//=============================================================================
+void CEventLoop::add( int _fd, uint32_t _events, const FdHandler_t &_handler )
+{
+    if( _fd < 0 )
+        throw invalid_argument( "CEventLoop::add: bad descriptor" );
+    if( static_cast<size_t>( _fd ) >= m_fds.size() )
+        m_fds.resize( _fd + 1 );
+    SFd &fd = m_fds[_fd];
+    if( fd.m_active )
+        throw logic_error( "CEventLoop::add: the descriptor is already registered" );
+
+    ++fd.m_generation;
+    epoll_event ev;
+    ev.events = _events;
+    ev.data.u64 = ( static_cast<uint64_t>( fd.m_generation ) << 32 ) | static_cast<uint32_t>( _fd );
+    if( epoll_ctl( m_epoll, EPOLL_CTL_ADD, _fd, &ev ) < 0 )
+        throw system_error( "Can't add a descriptor to the event loop" );
+    fd.m_handler = _handler;
+    fd.m_active = true;
+    ++m_count;
+}
+//=============================================================================
+void CEventLoop::modify( int _fd, uint32_t _events )
+{
+    if( _fd < 0 || static_cast<size_t>( _fd ) >= m_fds.size() || !m_fds[_fd].m_active )
+        throw logic_error( "CEventLoop::modify: the descriptor is not registered" );
+    epoll_event ev;
+    ev.events = _events;
+    ev.data.u64 = ( static_cast<uint64_t>( m_fds[_fd].m_generation ) << 32 ) | static_cast<uint32_t>( _fd );
+    if( epoll_ctl( m_epoll, EPOLL_CTL_MOD, _fd, &ev ) < 0 )
+        throw system_error( "Can't modify a descriptor of the event loop" );
+}
+//=============================================================================
+void CEventLoop::remove( int _fd )
+{
+    if( _fd < 0 || static_cast<size_t>( _fd ) >= m_fds.size() || !m_fds[_fd].m_active )
+        return;
+    epoll_event ev;
+    epoll_ctl( m_epoll, EPOLL_CTL_DEL, _fd, &ev );
+    SFd &fd = m_fds[_fd];
+    fd.m_active = false;
+    // the handler may be running right now, it is destroyed, when the slot is reused
+    --m_count;
+}
+//=============================================================================
+CEventLoop::TimerId_t CEventLoop::addTimer( int _ms, const Handler_t &_handler )
+{
+    const TimerId_t id( m_nextTimer++ );
+    const uint64_t deadline( INet::monotonic_ms() + ( _ms > 0 ? _ms : 0 ) );
+    m_timers.insert( make_pair( make_pair( deadline, id ), _handler ) );
+    m_timerDeadlines[id] = deadline;
+    return id;
+}
+//=============================================================================
+bool CEventLoop::cancelTimer( TimerId_t _id )
+{
+    map<TimerId_t, uint64_t>::iterator found = m_timerDeadlines.find( _id );
+    if( m_timerDeadlines.end() == found )
+        return false;
+    m_timers.erase( make_pair( found->second, _id ) );
+    m_timerDeadlines.erase( found );
+    return true;
+}
+//=============================================================================
+void CEventLoop::post( const Handler_t &_handler )
+{
+    m_posted.push_back( _handler );
+}
+//=============================================================================
+void CEventLoop::run()
+{
+    m_stop = false;
+    while( !m_stop && ( m_count > 0 || !m_timers.empty() || !m_posted.empty() ) )
+        runOnce( -1 );
+}
+//=============================================================================
+size_t CEventLoop::runOnce( int _timeoutMs )
+{
+    // don't sleep over the next timer or with posted calls
+    int timeout( _timeoutMs );
+    if( !m_posted.empty() )
+        timeout = 0;
+    else if( !m_timers.empty() )
+    {
+        const uint64_t now( INet::monotonic_ms() );
+        const uint64_t deadline( m_timers.begin()->first.first );
+        const int untilTimer( deadline > now ? static_cast<int>( deadline - now ) : 0 );
+        if( timeout < 0 || untilTimer < timeout )
+            timeout = untilTimer;
+    }
+
+    const int n = epoll_wait( m_epoll, &m_events[0], m_events.size(), timeout );
+    if( n < 0 && EINTR != errno )
+        throw system_error( "epoll_wait error" );
+
+    size_t called( 0 );
+    for( int i = 0; i < n; ++i )
+    {
+        const int fd( static_cast<uint32_t>( m_events[i].data.u64 ) );
+        const uint32_t generation( m_events[i].data.u64 >> 32 );
+        // removed by one of the previous handlers
+        if( !m_fds[fd].m_active || m_fds[fd].m_generation != generation )
+            continue;
+        // the handler may remove the descriptor and so destroy itself, a copy is called
+        const FdHandler_t handler( m_fds[fd].m_handler );
+        handler( m_events[i].events );
+        ++called;
+    }
+    called += runTimers();
+    called += runPosted();
+    return called;
+}
+//=============================================================================
+size_t CEventLoop::runTimers()
+{
+    size_t called( 0 );
+    const uint64_t now( INet::monotonic_ms() );
+    while( !m_timers.empty() && m_timers.begin()->first.first <= now )
+    {
+        const Handler_t handler( m_timers.begin()->second );
+        m_timerDeadlines.erase( m_timers.begin()->first.second );
+        m_timers.erase( m_timers.begin() );
+        handler();
+        ++called;
+    }
+    return called;
+}
+//=============================================================================
+size_t CEventLoop::runPosted()
+{
+    // calls posted by these handlers run in the next round
+    vector<Handler_t> posted;
+    posted.swap( m_posted );
+    for( size_t i = 0; i < posted.size(); ++i )
+        posted[i]();
+    return posted.size();
+}
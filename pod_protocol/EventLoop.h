@@ -0,0 +1,122 @@
+/************************************************************************/
+/**
+ * @file EventLoop.h
+ * @brief An epoll event loop with timers
+ * @author Anar Manafov A.Manafov@gsi.de
+ */ /*
+
+        version number:     $LastChangedRevision$
+        created by:         Anar Manafov
+                            2012-11-23
+        last changed by:    $LastChangedBy$ $LastChangedDate$
+
+        Copyright (c) 2012 GSI, Scientific Computing division. All rights reserved.
+*************************************************************************/
+#ifndef EVENTLOOP_H_
+#define EVENTLOOP_H_
+//=============================================================================
+// STD
+#include <map>
+#include <vector>
+// API
+#include <stdint.h>
+#include <sys/epoll.h>
+// BOOST
+#include <boost/function.hpp>
+// MiscCommon
+#include "MiscUtils.h"
+//=============================================================================
+namespace PROOFAgent
+{
+//=============================================================================
+    /**
+     *
+     * @brief The class runs handlers of ready descriptors (epoll), of expired timers and of posted calls.
+     * @brief A loop belongs to one thread, several loops can run in several threads.
+     * @brief Handlers may add and remove descriptors and timers, also their own ones.
+     * @note The loop and CAsyncConnection are Linux only (epoll), pod_protocol builds them only there.
+     * @note Example:
+     * @code
+     *
+     * CEventLoop loop;
+     * loop.add( socket, EPOLLIN, boost::bind( &CServer::onAccept, &server, _1 ) );
+     * loop.addTimer( 1000, boost::bind( &CServer::onTimer, &server ) );
+     * loop.run();
+     *
+     * @endcode
+     *
+     */
+    class CEventLoop: public MiscCommon::NONCopyable
+    {
+        public:
+            // _events are the epoll events of the descriptor (EPOLLIN, EPOLLOUT, EPOLLERR, EPOLLHUP)
+            typedef boost::function<void( uint32_t _events )> FdHandler_t;
+            typedef boost::function<void()> Handler_t;
+            typedef uint64_t TimerId_t;
+
+        private:
+            struct SFd
+            {
+                SFd():
+                    m_generation( 0 ),
+                    m_active( false )
+                {
+                }
+                FdHandler_t m_handler;
+                // distinguishes a new descriptor from a removed one with the same number
+                uint32_t m_generation;
+                bool m_active;
+            };
+            typedef std::vector<SFd> Fds_t;
+            // timers in the order of their deadlines (ms), the id keeps equal deadlines apart
+            typedef std::map<std::pair<uint64_t, TimerId_t>, Handler_t> Timers_t;
+
+        public:
+            CEventLoop();
+            ~CEventLoop();
+
+            // the caller keeps the ownership of the descriptor and must remove it before closing
+            void add( int _fd, uint32_t _events, const FdHandler_t &_handler );
+            void modify( int _fd, uint32_t _events );
+            void remove( int _fd );
+            // calls _handler once after _ms milliseconds
+            TimerId_t addTimer( int _ms, const Handler_t &_handler );
+            // return: false if the timer has already fired or has been canceled
+            bool cancelTimer( TimerId_t _id );
+            // calls _handler from the loop, after the current handler has returned.
+            // Use it, for example, to delete an object from its own handler.
+            void post( const Handler_t &_handler );
+            // runs until stop is called or there are no descriptors, timers and posted calls left
+            void run();
+            // waits at most _timeoutMs (-1 - no limit) and runs the handlers once
+            // return: a number of called handlers
+            size_t runOnce( int _timeoutMs );
+            void stop()
+            {
+                m_stop = true;
+            }
+            // a number of registered descriptors
+            size_t size() const
+            {
+                return m_count;
+            }
+
+        private:
+            size_t runTimers();
+            size_t runPosted();
+
+        private:
+            int m_epoll;
+            Fds_t m_fds;
+            size_t m_count;
+            Timers_t m_timers;
+            // deadlines of active timers by id
+            std::map<TimerId_t, uint64_t> m_timerDeadlines;
+            TimerId_t m_nextTimer;
+            std::vector<Handler_t> m_posted;
+            std::vector<epoll_event> m_events;
+            bool m_stop;
+    };
+}
+//=============================================================================
+#endif /* EVENTLOOP_H_ */
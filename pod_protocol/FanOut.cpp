@@ -0,0 +1,259 @@
+/************************************************************************/
+/**
+ * @file FanOut.cpp
+ * @brief Parallel scatter/gather of a request over many protocol connections
+ * @author Anar Manafov A.Manafov@gsi.de
+ */ /*
+
+        version number:     $LastChangedRevision$
+        created by:         Anar Manafov
+                            2012-11-06
+        last changed by:    $LastChangedBy$ $LastChangedDate$
+
+        Copyright (c) 2012 GSI, Scientific Computing division. All rights reserved.
+*************************************************************************/
+#include "FanOut.h"
+// STD
+#include <map>
+#include <stdexcept>
+// API
+#include <fcntl.h>
+#include <poll.h>
+#include <time.h>
+// BOOST
+#include <boost/shared_ptr.hpp>
+// MiscCommon
+#include "ErrorCode.h"
+#include "INet.h"
+// pod-protocol
+#include "CmdDispatcher.h"
+#include "OutputQueue.h"
+//=============================================================================
+using namespace std;
+using namespace PROOFAgent;
+using namespace MiscCommon;
+//=============================================================================
+namespace
+{
+    // switches sockets to the non-blocking mode and restores their flags on destruction
+    class CNonBlockGuard
+    {
+            typedef map<int, int> Flags_t;
+
+        public:
+            ~CNonBlockGuard()
+            {
+                Flags_t::const_iterator iter = m_flags.begin();
+                Flags_t::const_iterator iter_end = m_flags.end();
+                for( ; iter != iter_end; ++iter )
+                    ::fcntl( iter->first, F_SETFL, iter->second );
+            }
+            void add( int _socket )
+            {
+                const int flags = ::fcntl( _socket, F_GETFL );
+                if( flags < 0 || ( flags & O_NONBLOCK ) )
+                    return;
+                m_flags[_socket] = flags;
+                ::fcntl( _socket, F_SETFL, flags | O_NONBLOCK );
+            }
+
+        private:
+            Flags_t m_flags;
+    };
+
+    typedef boost::shared_ptr<COutputQueue> QueuePtr_t;
+
+    // writes as much of the request as the socket takes without blocking
+    // return: false if the connection is broken
+    bool flushRequest( int _socket, COutputQueue *_queue )
+    {
+        try
+        {
+            _queue->flush( _socket );
+            return true;
+        }
+        catch( const exception& )
+        {
+            return false;
+        }
+    }
+}
+//=============================================================================
+//=============================================================================
+//=============================================================================
+// memberof to silence doxygen warning:
+// warning: no matching class member found for
+// This happens because doxygen is not handling namespaces in arguments properly
+/**
+ * @memberof PROOFAgent::CFanOutQuery
+ *
+ */
+bool CFanOutQuery::run( uint16_t _cmd, const BYTEVector_t &_data, uint16_t _replyCmd, int _timeoutMs )
+{
+    m_replies.clear();
+    m_laggards.clear();
+    m_failed.clear();
+
+    const uint64_t start( INet::monotonic_us() );
+    const uint64_t deadline( start + static_cast<uint64_t>( _timeoutMs ) * 1000 );
+    CNonBlockGuard guard;
+
+    // scatter: the request is framed once per framing (see SFraming).
+    // It is written without blocking, the rest is flushed by the gather loop,
+    // so a connection with a full socket buffer or without a flow control credit delays only itself.
+    typedef map<SFraming, BYTEVector_t> Msgs_t;
+    Msgs_t msgs;
+    vector<QueuePtr_t> queues( m_targets.size() );
+    vector<size_t> msgSizes( m_targets.size() );
+    vector<size_t> pending;
+    pending.reserve( m_targets.size() );
+    for( size_t i = 0; i < m_targets.size(); ++i )
+    {
+        const STarget &target = m_targets[i];
+        guard.add( target.m_socket );
+
+        const SFraming framing( target.m_protocol->framing() );
+        Msgs_t::iterator found = msgs.find( framing );
+        if( msgs.end() == found )
+            found = msgs.insert( make_pair( framing,
+                                            target.m_protocol->buildMsg( _cmd, _data ) ) ).first;
+        queues[i].reset( new COutputQueue( *target.m_protocol ) );
+        queues[i]->pushMsg( laneCONTROL, found->second );
+        msgSizes[i] = found->second.size();
+        if( flushRequest( target.m_socket, queues[i].get() ) )
+            pending.push_back( i );
+        else
+            m_failed.push_back( target.m_socket );
+    }
+
+    // gather
+    vector<pollfd> fds;
+    vector<size_t> stillPending;
+    while( !pending.empty() )
+    {
+        const uint64_t now( INet::monotonic_us() );
+        if( now >= deadline )
+            break;
+
+        fds.resize( pending.size() );
+        for( size_t i = 0; i < pending.size(); ++i )
+        {
+            const COutputQueue &queue = *queues[pending[i]];
+            fds[i].fd = m_targets[pending[i]].m_socket;
+            // without a credit the request waits for cmdCREDIT, which comes with POLLIN
+            fds[i].events = POLLIN | ( ( !queue.empty() && queue.canSend() ) ? POLLOUT : 0 );
+            fds[i].revents = 0;
+        }
+
+        const int timeout( ( deadline - now + 999 ) / 1000 );
+        const int ready = ::poll( &fds[0], fds.size(), timeout );
+        if( ready < 0 )
+        {
+            if( EINTR == errno )
+                continue;
+            throw system_error( "Error occurred while waiting for answers" );
+        }
+        if( 0 == ready )
+            continue;
+
+        stillPending.clear();
+        for( size_t i = 0; i < pending.size(); ++i )
+        {
+            if( 0 == fds[i].revents )
+            {
+                stillPending.push_back( pending[i] );
+                continue;
+            }
+
+            const STarget &target = m_targets[pending[i]];
+            COutputQueue *queue = queues[pending[i]].get();
+            if( ( fds[i].revents & POLLOUT ) && !flushRequest( target.m_socket, queue ) )
+            {
+                m_failed.push_back( target.m_socket );
+                continue;
+            }
+            bool answered( false );
+            if( ( fds[i].revents & ~POLLOUT ) && !receive( target, _replyCmd, start, &answered ) )
+            {
+                m_failed.push_back( target.m_socket );
+                continue;
+            }
+            // a credit may have come
+            if( !answered && !queue->empty() && !flushRequest( target.m_socket, queue ) )
+                m_failed.push_back( target.m_socket );
+            else if( !answered )
+                stillPending.push_back( pending[i] );
+        }
+        pending.swap( stillPending );
+    }
+
+    for( size_t i = 0; i < pending.size(); ++i )
+    {
+        // a partially written request breaks the framing of the connection
+        const size_t left( queues[pending[i]]->queuedBytes( laneCONTROL ) );
+        if( left > 0 && left < msgSizes[pending[i]] )
+            m_failed.push_back( m_targets[pending[i]].m_socket );
+        else
+            m_laggards.push_back( m_targets[pending[i]].m_socket );
+    }
+
+    return ( m_laggards.empty() && m_failed.empty() );
+}
+//=============================================================================
+bool CFanOutQuery::receive( const STarget &_target, uint16_t _replyCmd, uint64_t _start, bool *_answered )
+{
+    CProtocol::EStatus_t status;
+    try
+    {
+        status = _target.m_protocol->read( _target.m_socket );
+    }
+    catch( const exception& )
+    {
+        return false;
+    }
+
+    while( true )
+    {
+        try
+        {
+            if( !_target.m_protocol->checkoutNextMsg() )
+                break;
+        }
+        catch( const exception& )
+        {
+            return false;
+        }
+
+        if( !*_answered && _target.m_protocol->msgHeader().m_cmd == _replyCmd )
+        {
+            m_replies.push_back( SFanOutReply() );
+            SFanOutReply &reply = m_replies.back();
+            reply.m_socket = _target.m_socket;
+            reply.m_header = _target.m_protocol->getMsg( &reply.m_data );
+            reply.m_latencyUs = INet::monotonic_us() - _start;
+            *_answered = true;
+        }
+        else if( m_dispatcher )
+        {
+            m_dispatcher->dispatch( *_target.m_protocol );
+        }
+    }
+
+    // an answer, which came just before the connection was closed, still counts
+    return ( *_answered || CProtocol::stDISCONNECT != status );
+}
+//=============================================================================
+// memberof to silence doxygen warning:
+// warning: no matching class member found for
+// This happens because doxygen is not handling namespaces in arguments properly
+/**
+ * @memberof PROOFAgent::CFanOutQuery
+ *
+ */
+void CFanOutQuery::sampleTcpDiag( INet::CTcpDiagSummary *_summary ) const
+{
+    if( !_summary )
+        throw invalid_argument( "CFanOutQuery::sampleTcpDiag: the given pointer is NULL" );
+    for( size_t i = 0; i < m_targets.size(); ++i )
+        _summary->add( m_targets[i].m_socket );
+}
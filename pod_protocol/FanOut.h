@@ -0,0 +1,148 @@
+/************************************************************************/
+/**
+ * @file FanOut.h
+ * @brief Parallel scatter/gather of a request over many protocol connections
+ * @author Anar Manafov A.Manafov@gsi.de
+ */ /*
+
+        version number:     $LastChangedRevision$
+        created by:         Anar Manafov
+                            2012-11-06
+        last changed by:    $LastChangedBy$ $LastChangedDate$
+
+        Copyright (c) 2012 GSI, Scientific Computing division. All rights reserved.
+*************************************************************************/
+#ifndef FANOUT_H_
+#define FANOUT_H_
+//=============================================================================
+// STD
+#include <vector>
+// MiscCommon
+#include "def.h"
+// pod-protocol
+#include "Protocol.h"
+//=============================================================================
+namespace MiscCommon
+{
+    namespace INet
+    {
+        class CTcpDiagSummary;
+    }
+}
+//=============================================================================
+namespace PROOFAgent
+{
+    class CCmdDispatcher;
+//=============================================================================
+    struct SFanOutReply
+    {
+        SFanOutReply():
+            m_socket( -1 ),
+            m_latencyUs( 0 )
+        {
+        }
+        int m_socket;
+        SMessageHeader m_header;
+        MiscCommon::BYTEVector_t m_data;
+        // time from the start of the query
+        uint32_t m_latencyUs;
+    };
+    typedef std::vector<SFanOutReply> FanOutReplies_t;
+    typedef std::vector<int> SocketVector_t;
+//=============================================================================
+    /**
+     *
+     * @brief The class sends one request to many connections at once and gathers
+     * @brief the answers concurrently in a poll loop, bounded by a global deadline.
+     * @brief The request is written without blocking, the deadline covers sending as well.
+     * @brief Connections, which didn't answer in time, are reported as laggards,
+     * @brief connections, which were closed or failed, are reported as failed,
+     * @brief as well as connections, which got only a part of the request till the deadline.
+     * @note Other messages, which come while waiting, are passed to the dispatcher (if set)
+     * @note or dropped otherwise.
+     * @note Example:
+     * @code
+     *
+     * CFanOutQuery query;
+     * for( ... each worker ... )
+     *     query.add( worker.socket(), &worker.protocol() );
+     * query.run( cmdGET_HOST_INFO, BYTEVector_t(), cmdHOST_INFO, 2000 );
+     * for( size_t i = 0; i < query.replies().size(); ++i )
+     * {
+     *     SHostInfoCmd info;
+     *     info.convertFromData( query.replies()[i].m_data );
+     *     ...
+     * }
+     * // query.laggards() didn't answer within 2 seconds
+     *
+     * @endcode
+     *
+     */
+    class CFanOutQuery
+    {
+            struct STarget
+            {
+                STarget( int _socket, CProtocol *_protocol ):
+                    m_socket( _socket ),
+                    m_protocol( _protocol )
+                {
+                }
+                int m_socket;
+                CProtocol *m_protocol;
+            };
+            typedef std::vector<STarget> Targets_t;
+
+        public:
+            CFanOutQuery():
+                m_dispatcher( NULL )
+            {
+            }
+            // _protocol keeps negotiated capabilities and already buffered data of the connection,
+            // the caller keeps the ownership of both
+            void add( int _socket, CProtocol *_protocol )
+            {
+                m_targets.push_back( STarget( _socket, _protocol ) );
+            }
+            void clear()
+            {
+                m_targets.clear();
+            }
+            // handles unrelated messages, which come during the query
+            void setDispatcher( CCmdDispatcher *_dispatcher )
+            {
+                m_dispatcher = _dispatcher;
+            }
+            // sends _cmd with _data to all connections and waits at most _timeoutMs for _replyCmd
+            // return: true if all connections have answered
+            bool run( uint16_t _cmd, const MiscCommon::BYTEVector_t &_data, uint16_t _replyCmd, int _timeoutMs );
+            // results of the last run
+            const FanOutReplies_t &replies() const
+            {
+                return m_replies;
+            }
+            const SocketVector_t &laggards() const
+            {
+                return m_laggards;
+            }
+            const SocketVector_t &failed() const
+            {
+                return m_failed;
+            }
+            // adds TCP_INFO and queue depths of all connections to _summary,
+            // it helps to see whether laggards are slow workers or slow links
+            void sampleTcpDiag( MiscCommon::INet::CTcpDiagSummary *_summary ) const;
+
+        private:
+            // return: false if the connection is closed or broken
+            bool receive( const STarget &_target, uint16_t _replyCmd, uint64_t _start, bool *_answered );
+
+        private:
+            Targets_t m_targets;
+            CCmdDispatcher *m_dispatcher;
+            FanOutReplies_t m_replies;
+            SocketVector_t m_laggards;
+            SocketVector_t m_failed;
+    };
+}
+//=============================================================================
+#endif /* FANOUT_H_ */
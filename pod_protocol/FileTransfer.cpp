@@ -0,0 +1,421 @@
+/************************************************************************/
+/**
+ * @file FileTransfer.cpp
+ * @brief Uploads of files (job logs, ...) over pod_protocol
+ * @author Anar Manafov A.Manafov@gsi.de
+ */ /*
+
+        version number:     $LastChangedRevision$
+        created by:         Anar Manafov
+                            2012-10-30
+        last changed by:    $LastChangedBy$ $LastChangedDate$
+
+        Copyright (c) 2012 GSI, Scientific Computing division. All rights reserved.
+*************************************************************************/
+#ifdef __linux__
+// splice, fallocate
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#endif
+#include "FileTransfer.h"
+// STD
+#include <stdexcept>
+#include <algorithm>
+#include <cstdio>
+// API
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <sys/sendfile.h>
+#endif
+// MiscCommon
+#include "ErrorCode.h"
+#include "INet.h"
+// pod-protocol
+#include "CRC32C.h"
+//=============================================================================
+using namespace std;
+using namespace PROOFAgent;
+using namespace MiscCommon;
+using namespace MiscCommon::INet;
+//=============================================================================
+namespace
+{
+    // a size of buffers of the read/write path
+    const size_t COPY_BUFFER_SIZE = 1024 * 1024;
+
+    class CFileHandle
+    {
+        public:
+            explicit CFileHandle( int _fd ):
+                m_fd( _fd )
+            {
+            }
+            ~CFileHandle()
+            {
+                if( m_fd >= 0 )
+                    ::close( m_fd );
+            }
+            int get() const
+            {
+                return m_fd;
+            }
+
+        private:
+            CFileHandle( const CFileHandle& );
+            CFileHandle &operator=( const CFileHandle& );
+
+        private:
+            int m_fd;
+    };
+
+    // waits until a non-blocking descriptor is ready
+    void waitFd( int _fd, short _events )
+    {
+        pollfd pfd;
+        pfd.fd = _fd;
+        pfd.events = _events;
+        pfd.revents = 0;
+        while( ::poll( &pfd, 1, -1 ) < 0 )
+        {
+            if( EINTR != errno )
+                throw system_error( "Error occurred while waiting for a socket" );
+        }
+    }
+
+    // reads messages until a message with _cmd comes
+    SMessageHeader waitMsg( int _socket, CProtocol *_protocol, uint16_t _cmd, BYTEVector_t *_data )
+    {
+        while( !_protocol->checkoutNextMsg() )
+        {
+            const CProtocol::EStatus_t status = _protocol->read( _socket );
+            if( CProtocol::stDISCONNECT == status )
+                throw runtime_error( "The peer has closed the connection during a file upload." );
+            if( CProtocol::stAGAIN == status )
+                waitFd( _socket, POLLIN );
+        }
+
+        const SMessageHeader header = _protocol->getMsg( _data );
+        if( header.m_cmd != _cmd )
+        {
+            stringstream ss;
+            ss << "Unexpected command " << header.m_cmd << " during a file upload, expected " << _cmd;
+            throw runtime_error( ss.str() );
+        }
+        return header;
+    }
+
+    void writeAll( int _fd, const unsigned char *_buf, size_t _size, uint64_t _offset )
+    {
+        while( _size > 0 )
+        {
+            const ssize_t n = ::pwrite( _fd, _buf, _size, _offset );
+            if( n < 0 )
+            {
+                if( EINTR == errno )
+                    continue;
+                throw system_error( "Error occurred while writing an uploaded file" );
+            }
+            _buf += n;
+            _size -= n;
+            _offset += n;
+        }
+    }
+
+    // return: a number of read bytes, 0 - EOF
+    size_t readSome( int _fd, unsigned char *_buf, size_t _size )
+    {
+        while( true )
+        {
+            const ssize_t n = ::read( _fd, _buf, _size );
+            if( n > 0 )
+                return n;
+            if( 0 == n )
+                return 0;
+            if( EINTR == errno )
+                continue;
+            if( EAGAIN == errno || EWOULDBLOCK == errno )
+            {
+                waitFd( _fd, POLLIN );
+                continue;
+            }
+            throw system_error( "Error occurred while reading file data" );
+        }
+    }
+
+    // a name of the file in the upload directory, paths are not accepted
+    string safeName( const string &_name )
+    {
+        const string::size_type pos = _name.find_last_of( '/' );
+        const string name( ( string::npos == pos ) ? _name : _name.substr( pos + 1 ) );
+        if( name.empty() || "." == name || ".." == name )
+            throw runtime_error( "Bad name of an uploaded file: \"" + _name + "\"" );
+        return name;
+    }
+}
+//=============================================================================
+//=============================================================================
+//=============================================================================
+uint32_t PROOFAgent::fileCRC32C( int _fd, uint64_t _size )
+{
+    BYTEVector_t buf( COPY_BUFFER_SIZE );
+    uint32_t crc( 0 );
+    uint64_t offset( 0 );
+    while( offset < _size )
+    {
+        const size_t to_read( min<uint64_t>( buf.size(), _size - offset ) );
+        const ssize_t n = ::pread( _fd, &buf[0], to_read, offset );
+        if( n < 0 )
+        {
+            if( EINTR == errno )
+                continue;
+            throw system_error( "Error occurred while calculating a checksum of a file" );
+        }
+        if( 0 == n )
+            throw runtime_error( "The file is shorter than expected." );
+        crc = crc32c( crc, &buf[0], n );
+        offset += n;
+    }
+    return crc;
+}
+//=============================================================================
+//=============================================================================
+//=============================================================================
+SFileStatusCmd CFileSender::upload( int _socket, CProtocol *_protocol, const string &_path,
+                                    const string &_name, uint64_t *_sent ) const
+{
+    CFileHandle file( ::open( _path.c_str(), O_RDONLY ) );
+    if( file.get() < 0 )
+        throw system_error( "Can't open " + _path );
+
+    struct stat info;
+    if( ::fstat( file.get(), &info ) < 0 )
+        throw system_error( "Can't stat " + _path );
+
+    SFileUploadCmd offer;
+    offer.m_name = _name;
+    offer.m_size = info.st_size;
+    offer.m_crc = fileCRC32C( file.get(), offer.m_size );
+    BYTEVector_t data;
+    offer.convertToData( &data );
+    _protocol->write( _socket, cmdFILE_UPLOAD, data );
+
+    data.clear();
+    waitMsg( _socket, _protocol, cmdFILE_UPLOAD_OFFSET, &data );
+    SFileOffsetCmd offset;
+    offset.convertFromData( data );
+    if( offset.m_offset > offer.m_size )
+        throw runtime_error( "The peer requested an upload offset beyond the end of the file." );
+
+    {
+        // headers and file data are written separately, corking sends them in full segments
+        CCorkGuard cork( _socket );
+        for( uint64_t pos = offset.m_offset; pos < offer.m_size; )
+        {
+            const uint32_t len( min<uint64_t>( m_segmentSize, offer.m_size - pos ) );
+            // only the header is charged, the data doesn't pass the receive buffer of the peer
+            _protocol->writeHeader( _socket, createMsgHeader( cmdFILE_DATA, len, _protocol->caps() ) );
+            sendData( _socket, file.get(), pos, len );
+            pos += len;
+        }
+    }
+    if( _sent )
+        *_sent = offer.m_size - offset.m_offset;
+
+    data.clear();
+    waitMsg( _socket, _protocol, cmdFILE_UPLOAD_STATUS, &data );
+    SFileStatusCmd status;
+    status.convertFromData( data );
+    return status;
+}
+//=============================================================================
+void CFileSender::sendData( int _socket, int _fd, uint64_t _offset, uint64_t _size ) const
+{
+#ifdef __linux__
+    if( m_zeroCopy )
+    {
+        off_t offset( _offset );
+        while( _size > 0 )
+        {
+            const ssize_t n = ::sendfile( _socket, _fd, &offset, _size );
+            if( n < 0 )
+            {
+                if( EINTR == errno )
+                    continue;
+                if( EAGAIN == errno || EWOULDBLOCK == errno )
+                {
+                    waitFd( _socket, POLLOUT );
+                    continue;
+                }
+                throw system_error( "Error occurred while sending a file" );
+            }
+            if( 0 == n )
+                throw runtime_error( "The file was truncated during the upload." );
+            _size -= n;
+        }
+        return;
+    }
+#endif
+
+    BYTEVector_t buf( min<uint64_t>( COPY_BUFFER_SIZE, _size ) );
+    while( _size > 0 )
+    {
+        const ssize_t n = ::pread( _fd, &buf[0], min<uint64_t>( buf.size(), _size ), _offset );
+        if( n < 0 )
+        {
+            if( EINTR == errno )
+                continue;
+            throw system_error( "Error occurred while reading a file" );
+        }
+        if( 0 == n )
+            throw runtime_error( "The file was truncated during the upload." );
+        sendall( _socket, &buf[0], n, 0 );
+        _size -= n;
+        _offset += n;
+    }
+}
+//=============================================================================
+//=============================================================================
+//=============================================================================
+SFileStatusCmd CFileReceiver::receive( int _socket, CProtocol *_protocol, const SFileUploadCmd &_offer ) const
+{
+    const string path( m_dir + "/" + safeName( _offer.m_name ) );
+    const string partPath( path + ".part" );
+
+    CFileHandle file( ::open( partPath.c_str(), O_RDWR | O_CREAT, 0644 ) );
+    if( file.get() < 0 )
+        throw system_error( "Can't open " + partPath );
+
+    struct stat info;
+    if( ::fstat( file.get(), &info ) < 0 )
+        throw system_error( "Can't stat " + partPath );
+
+    // resume an interrupted upload, a longer file can't be a part of this one
+    SFileOffsetCmd offset;
+    offset.m_offset = info.st_size;
+    if( offset.m_offset > _offer.m_size )
+    {
+        if( ::ftruncate( file.get(), 0 ) < 0 )
+            throw system_error( "Can't truncate " + partPath );
+        offset.m_offset = 0;
+    }
+
+#ifdef __linux__
+    // reserve the space at once, the size is kept to be able to resume from it
+    if( _offer.m_size > offset.m_offset )
+        ::fallocate( file.get(), FALLOC_FL_KEEP_SIZE, offset.m_offset, _offer.m_size - offset.m_offset );
+#endif
+
+    BYTEVector_t data;
+    offset.convertToData( &data );
+    _protocol->write( _socket, cmdFILE_UPLOAD_OFFSET, data );
+
+    SFileStatusCmd status;
+    uint64_t pos( offset.m_offset );
+    while( pos < _offer.m_size )
+    {
+        while( !_protocol->checkoutNextHeader() )
+        {
+            const CProtocol::EStatus_t st = _protocol->read( _socket );
+            if( CProtocol::stDISCONNECT == st )
+                throw runtime_error( "The peer has closed the connection during a file upload." );
+            if( CProtocol::stAGAIN == st )
+                waitFd( _socket, POLLIN );
+        }
+
+        const SMessageHeader header = _protocol->getMsg( &data );
+        if( cmdFILE_DATA != header.m_cmd || header.m_len > _offer.m_size - pos )
+            throw runtime_error( "Unexpected message during a file upload." );
+
+        // a part of the data could be already read together with the header
+        const size_t buffered = _protocol->takeBuffered( &data, header.m_len );
+        if( buffered > 0 )
+            writeAll( file.get(), &data[0], buffered, pos );
+
+        receiveData( _socket, file.get(), pos + buffered, header.m_len - buffered );
+        pos += header.m_len;
+        _protocol->grantCredit( _socket );
+    }
+
+    status.m_crc = fileCRC32C( file.get(), _offer.m_size );
+    if( status.m_crc != _offer.m_crc )
+    {
+        status.m_status = fileCRC_MISMATCH;
+        ::unlink( partPath.c_str() );
+    }
+    else if( ::rename( partPath.c_str(), path.c_str() ) < 0 )
+    {
+        status.m_status = fileIO_ERROR;
+    }
+
+    data.clear();
+    status.convertToData( &data );
+    _protocol->write( _socket, cmdFILE_UPLOAD_STATUS, data );
+    return status;
+}
+//=============================================================================
+void CFileReceiver::receiveData( int _socket, int _fd, uint64_t _offset, uint64_t _size ) const
+{
+    if( 0 == _size )
+        return;
+
+#ifdef __linux__
+    int pipefd[2];
+    if( m_zeroCopy && 0 == ::pipe( pipefd ) )
+    {
+        CFileHandle pipeIn( pipefd[0] );
+        CFileHandle pipeOut( pipefd[1] );
+        // a larger pipe means less splice calls, the default is 64K
+        ::fcntl( pipeOut.get(), F_SETPIPE_SZ, COPY_BUFFER_SIZE );
+
+        loff_t offset( _offset );
+        while( _size > 0 )
+        {
+            const ssize_t n = ::splice( _socket, NULL, pipeOut.get(), NULL,
+                                        min<uint64_t>( COPY_BUFFER_SIZE, _size ), SPLICE_F_MOVE | SPLICE_F_MORE );
+            if( n < 0 )
+            {
+                if( EINTR == errno )
+                    continue;
+                if( EAGAIN == errno || EWOULDBLOCK == errno )
+                {
+                    waitFd( _socket, POLLIN );
+                    continue;
+                }
+                throw system_error( "Error occurred while receiving a file" );
+            }
+            if( 0 == n )
+                throw runtime_error( "The peer has closed the connection during a file upload." );
+
+            for( ssize_t left = n; left > 0; )
+            {
+                const ssize_t m = ::splice( pipeIn.get(), NULL, _fd, &offset, left, SPLICE_F_MOVE );
+                if( m < 0 )
+                {
+                    if( EINTR == errno )
+                        continue;
+                    throw system_error( "Error occurred while writing an uploaded file" );
+                }
+                left -= m;
+            }
+            _size -= n;
+        }
+        return;
+    }
+#endif
+
+    BYTEVector_t buf( min<uint64_t>( COPY_BUFFER_SIZE, _size ) );
+    while( _size > 0 )
+    {
+        const size_t n = readSome( _socket, &buf[0], min<uint64_t>( buf.size(), _size ) );
+        if( 0 == n )
+            throw runtime_error( "The peer has closed the connection during a file upload." );
+        writeAll( _fd, &buf[0], n, _offset );
+        _size -= n;
+        _offset += n;
+    }
+}
@@ -0,0 +1,131 @@
+/************************************************************************/
+/**
+ * @file FileTransfer.h
+ * @brief Uploads of files (job logs, ...) over pod_protocol
+ * @author Anar Manafov A.Manafov@gsi.de
+ */ /*
+
+        version number:     $LastChangedRevision$
+        created by:         Anar Manafov
+                            2012-10-30
+        last changed by:    $LastChangedBy$ $LastChangedDate$
+
+        Copyright (c) 2012 GSI, Scientific Computing division. All rights reserved.
+*************************************************************************/
+#ifndef FILETRANSFER_H_
+#define FILETRANSFER_H_
+//=============================================================================
+// STD
+#include <stdexcept>
+// MiscCommon
+#include "def.h"
+// pod-protocol
+#include "Protocol.h"
+#include "ProtocolCommands.h"
+//=============================================================================
+namespace PROOFAgent
+{
+//=============================================================================
+// An upload:
+//   sender                                 receiver
+//   cmdFILE_UPLOAD (SFileUploadCmd)  --->
+//                                    <---  cmdFILE_UPLOAD_OFFSET (SFileOffsetCmd)
+//   cmdFILE_DATA header + raw bytes  --->  (from the offset up to the end of the file)
+//   ...
+//                                    <---  cmdFILE_UPLOAD_STATUS (SFileStatusCmd)
+//
+// cmdFILE_DATA messages are framed by createMsgHeader, the data is moved by sendfile/splice
+// bypassing user space buffers. The receiver keeps incomplete files as <name>.part,
+// an interrupted upload of the same file continues from its size.
+// The integrity of the whole file is checked by CRC32C.
+// With capCREDIT only the cmdFILE_DATA headers are subject of the flow control,
+// the data doesn't pass the receive buffer of CProtocol.
+//
+    // a maximum size of a single cmdFILE_DATA message
+    const uint32_t g_fileSegmentSize = 256 * 1024 * 1024;
+    // a CRC32C of the first _size bytes of _fd
+    uint32_t fileCRC32C( int _fd, uint64_t _size );
+//=============================================================================
+    /**
+     *
+     * @brief The sending side of file uploads.
+     * @note The upload blocks until the receiver confirms the file.
+     *
+     */
+    class CFileSender
+    {
+        public:
+            CFileSender():
+                m_zeroCopy( true ),
+                m_segmentSize( g_fileSegmentSize )
+            {
+            }
+            // return: the status of the upload, the number of actually sent bytes is in _sent (can be NULL)
+            SFileStatusCmd upload( int _socket, CProtocol *_protocol, const std::string &_path,
+                                   const std::string &_name, uint64_t *_sent = NULL ) const;
+            // false - use read/send instead of sendfile (mostly for benchmarks)
+            void setZeroCopy( bool _zeroCopy )
+            {
+                m_zeroCopy = _zeroCopy;
+            }
+            // a maximum size of a cmdFILE_DATA message, g_fileSegmentSize by default
+            void setSegmentSize( uint32_t _size )
+            {
+                if( 0 == _size )
+                    throw std::invalid_argument( "CFileSender: a segment size must not be 0" );
+                m_segmentSize = _size;
+            }
+
+        private:
+            void sendData( int _socket, int _fd, uint64_t _offset, uint64_t _size ) const;
+
+        private:
+            bool m_zeroCopy;
+            uint32_t m_segmentSize;
+    };
+//=============================================================================
+    /**
+     *
+     * @brief The receiving side of file uploads.
+     * @note Example:
+     * @code
+     *
+     * CFileReceiver receiver( "/tmp/pod_logs" );
+     * ...
+     * case cmdFILE_UPLOAD:
+     *     {
+     *         SFileUploadCmd cmd;
+     *         cmd.convertFromData( data );
+     *         receiver.receive( socket, &protocol, cmd );
+     *     }
+     *
+     * @endcode
+     *
+     */
+    class CFileReceiver
+    {
+        public:
+            CFileReceiver( const std::string &_dir ):
+                m_dir( _dir ),
+                m_zeroCopy( true )
+            {
+            }
+            // answers the offer, receives the data and answers with the status
+            // return: the status sent to the peer
+            SFileStatusCmd receive( int _socket, CProtocol *_protocol, const SFileUploadCmd &_offer ) const;
+            // false - use read/pwrite instead of splice (mostly for benchmarks)
+            void setZeroCopy( bool _zeroCopy )
+            {
+                m_zeroCopy = _zeroCopy;
+            }
+
+        private:
+            void receiveData( int _socket, int _fd, uint64_t _offset, uint64_t _size ) const;
+
+        private:
+            std::string m_dir;
+            bool m_zeroCopy;
+    };
+}
+//=============================================================================
+#endif /* FILETRANSFER_H_ */
@@ -0,0 +1,188 @@
+/************************************************************************/
+/**
+ * @file Handover.cpp
+ * @brief A handover of listening sockets and live connections to a restarted agent
+ * @author Anar Manafov A.Manafov@gsi.de
+ */ /*
+
+        version number:     $LastChangedRevision$
+        created by:         Anar Manafov
+                            2012-11-19
+        last changed by:    $LastChangedBy$ $LastChangedDate$
+
+        Copyright (c) 2012 GSI, Scientific Computing division. All rights reserved.
+*************************************************************************/
+#include "Handover.h"
+// STD
+#include <stdexcept>
+#include <sstream>
+// API
+#include <poll.h>
+#include <time.h>
+#include <unistd.h>
+// MiscCommon
+#include "ErrorCode.h"
+#include "INet.h"
+//=============================================================================
+using namespace std;
+using namespace PROOFAgent;
+using namespace MiscCommon;
+//=============================================================================
+namespace
+{
+    // checks out the next message, reading the socket until the deadline
+    void waitMsg( CProtocol *_protocol, int _socket, uint64_t _deadline )
+    {
+        while( !_protocol->checkoutNextMsg() )
+        {
+            const uint64_t now( INet::monotonic_ms() );
+            if( now >= _deadline )
+                throw runtime_error( "Handover: the peer doesn't answer." );
+
+            pollfd pfd;
+            pfd.fd = _socket;
+            pfd.events = POLLIN;
+            pfd.revents = 0;
+            const int ready = ::poll( &pfd, 1, _deadline - now );
+            if( ready < 0 && EINTR != errno )
+                throw system_error( "Handover: poll error" );
+            if( ready <= 0 )
+                continue;
+            if( CProtocol::stDISCONNECT == _protocol->read( _socket ) )
+                throw runtime_error( "Handover: the peer has closed the connection." );
+        }
+    }
+}
+//=============================================================================
+//=============================================================================
+//=============================================================================
+void CHandoverSource::addListener( const string &_name, int _socket )
+{
+    SHandoverListenerCmd cmd;
+    cmd.m_name = _name;
+    m_items.push_back( SItem() );
+    m_items.back().m_cmd = cmdHANDOVER_LISTENER;
+    m_items.back().m_socket = _socket;
+    cmd.convertToData( &m_items.back().m_data );
+}
+//=============================================================================
+// memberof to silence doxygen warning:
+// warning: no matching class member found for
+// This happens because doxygen is not handling namespaces in arguments properly
+/**
+ * @memberof PROOFAgent::CHandoverSource
+ *
+ */
+void CHandoverSource::addConnection( const string &_name, int _socket, const CProtocol &_protocol )
+{
+    SProtocolStateCmd cmd;
+    _protocol.exportState( &cmd );
+    cmd.m_name = _name;
+    m_items.push_back( SItem() );
+    m_items.back().m_cmd = cmdHANDOVER_CONNECTION;
+    m_items.back().m_socket = _socket;
+    cmd.convertToData( &m_items.back().m_data );
+}
+//=============================================================================
+void CHandoverSource::transfer( int _socket, int _timeoutMs )
+{
+    // both agents are of the same host, but may be of different versions,
+    // so the handover itself uses the default (v1) framing
+    CProtocol protocol;
+    for( size_t i = 0; i < m_items.size(); ++i )
+        protocol.writeFd( _socket, m_items[i].m_cmd, m_items[i].m_data, m_items[i].m_socket );
+
+    SHandoverDoneCmd done;
+    done.m_count = m_items.size();
+    BYTEVector_t data;
+    done.convertToData( &data );
+    protocol.write( _socket, cmdHANDOVER_DONE, data );
+
+    const uint64_t deadline( INet::monotonic_ms() + _timeoutMs );
+    do
+    {
+        waitMsg( &protocol, _socket, deadline );
+    }
+    while( cmdHANDOVER_DONE != protocol.msgHeader().m_cmd );
+
+    SHandoverDoneCmd confirmed;
+    confirmed.convertFromData( protocol.msgData() );
+    if( confirmed.m_count != done.m_count )
+    {
+        stringstream ss;
+        ss << "Handover: the new agent has taken " << confirmed.m_count << " of " << done.m_count << " sockets.";
+        throw runtime_error( ss.str() );
+    }
+}
+//=============================================================================
+//=============================================================================
+//=============================================================================
+CHandoverTarget::~CHandoverTarget()
+{
+    for( size_t i = 0; i < m_listeners.size(); ++i )
+        ::close( m_listeners[i].second );
+    for( size_t i = 0; i < m_connections.size(); ++i )
+        ::close( m_connections[i].m_socket );
+}
+//=============================================================================
+void CHandoverTarget::receive( int _socket, int _timeoutMs )
+{
+    CProtocol protocol;
+    protocol.setFdPassing( true );
+    const uint64_t deadline( INet::monotonic_ms() + _timeoutMs );
+    uint32_t count( 0 );
+    while( true )
+    {
+        waitMsg( &protocol, _socket, deadline );
+        const uint16_t cmd( protocol.msgHeader().m_cmd );
+        if( cmdHANDOVER_DONE == cmd )
+            break;
+        if( cmdHANDOVER_LISTENER != cmd && cmdHANDOVER_CONNECTION != cmd )
+            continue;
+
+        const int fd( protocol.takeFd() );
+        if( -1 == fd )
+            throw runtime_error( "Handover: a socket has not been passed with its message." );
+        ++count;
+        if( cmdHANDOVER_LISTENER == cmd )
+        {
+            SHandoverListenerCmd listener;
+            listener.convertFromData( protocol.msgData() );
+            m_listeners.push_back( make_pair( listener.m_name, fd ) );
+        }
+        else
+        {
+            m_connections.push_back( SHandedConnection() );
+            m_connections.back().m_socket = fd;
+            m_connections.back().m_state.convertFromData( protocol.msgData() );
+        }
+    }
+
+    SHandoverDoneCmd done;
+    done.m_count = count;
+    BYTEVector_t data;
+    done.convertToData( &data );
+    protocol.write( _socket, cmdHANDOVER_DONE, data );
+}
+//=============================================================================
+int CHandoverTarget::takeListener( const string &_name )
+{
+    Listeners_t::iterator iter = m_listeners.begin();
+    Listeners_t::iterator iter_end = m_listeners.end();
+    for( ; iter != iter_end; ++iter )
+    {
+        if( iter->first != _name )
+            continue;
+        const int fd( iter->second );
+        m_listeners.erase( iter );
+        return fd;
+    }
+    return -1;
+}
+//=============================================================================
+HandedConnections_t CHandoverTarget::takeConnections()
+{
+    HandedConnections_t ret;
+    ret.swap( m_connections );
+    return ret;
+}
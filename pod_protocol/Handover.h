@@ -0,0 +1,113 @@
+/************************************************************************/
+/**
+ * @file Handover.h
+ * @brief A handover of listening sockets and live connections to a restarted agent
+ * @author Anar Manafov A.Manafov@gsi.de
+ */ /*
+
+        version number:     $LastChangedRevision$
+        created by:         Anar Manafov
+                            2012-11-19
+        last changed by:    $LastChangedBy$ $LastChangedDate$
+
+        Copyright (c) 2012 GSI, Scientific Computing division. All rights reserved.
+*************************************************************************/
+#ifndef HANDOVER_H_
+#define HANDOVER_H_
+//=============================================================================
+// STD
+#include <string>
+#include <vector>
+// MiscCommon
+#include "def.h"
+// pod-protocol
+#include "Protocol.h"
+#include "ProtocolCommands.h"
+//=============================================================================
+namespace PROOFAgent
+{
+//=============================================================================
+    // a connection taken over from the previous agent
+    struct SHandedConnection
+    {
+        SHandedConnection():
+            m_socket( -1 )
+        {
+        }
+        int m_socket;
+        // pass it to CProtocol::importState to continue the connection
+        SProtocolStateCmd m_state;
+    };
+    typedef std::vector<SHandedConnection> HandedConnections_t;
+//=============================================================================
+    /**
+     *
+     * @brief The running agent passes its listening sockets and, optionally, live connections
+     * @brief with their protocol state to the new agent over an AF_UNIX socket (SCM_RIGHTS).
+     * @brief The listening socket is never closed during the upgrade, connection attempts wait
+     * @brief in its backlog until the new agent accepts them, so no attempt is refused.
+     * @note The running agent must stop reading the passed connections before addConnection
+     * @note and flush its output queues. After transfer it must close its copies by ::close,
+     * @note not by smart_socket::close, which would shut the sockets down for the new agent too.
+     * @note Example:
+     * @code
+     *
+     * // the running agent, on a connection to its handover socket
+     * CHandoverSource source;
+     * source.addListener( "agent", server.getSocket() );
+     * source.addConnection( "wn-17", worker.socket(), worker.protocol() );
+     * source.transfer( handover_socket );
+     * ::close( server.detach() );
+     * ... exit ...
+     *
+     * // the new agent
+     * CSocketClient client( AF_UNIX );
+     * client.connectLocal( handover_path );
+     * CHandoverTarget target;
+     * target.receive( client.getSocket() );
+     * server.attach( target.takeListener( "agent" ) );
+     *
+     * @endcode
+     *
+     */
+    class CHandoverSource
+    {
+            struct SItem
+            {
+                uint16_t m_cmd;
+                int m_socket;
+                MiscCommon::BYTEVector_t m_data;
+            };
+            typedef std::vector<SItem> Items_t;
+
+        public:
+            // the caller keeps the ownership of the sockets
+            void addListener( const std::string &_name, int _socket );
+            void addConnection( const std::string &_name, int _socket, const CProtocol &_protocol );
+            // passes everything to the new agent and waits at most _timeoutMs for its confirmation.
+            // On failure an exception is thrown and the running agent should keep serving.
+            void transfer( int _socket, int _timeoutMs = 10000 );
+
+        private:
+            Items_t m_items;
+    };
+//=============================================================================
+    class CHandoverTarget
+    {
+        public:
+            ~CHandoverTarget();
+            // takes all descriptors from the previous agent and confirms the handover
+            void receive( int _socket, int _timeoutMs = 10000 );
+            // return: the listening socket or -1, the caller takes ownership
+            int takeListener( const std::string &_name );
+            // the caller takes ownership of the sockets
+            HandedConnections_t takeConnections();
+
+        private:
+            typedef std::vector<std::pair<std::string, int> > Listeners_t;
+            Listeners_t m_listeners;
+            HandedConnections_t m_connections;
+    };
+}
+//=============================================================================
+#endif /* HANDOVER_H_ */
@@ -0,0 +1,169 @@
+/************************************************************************/
+/**
+ * @file OutputQueue.cpp
+ * @brief A per-connection output queue with priority lanes
+ * @author Anar Manafov A.Manafov@gsi.de
+ */ /*
+
+        version number:     $LastChangedRevision$
+        created by:         Anar Manafov
+                            2012-11-08
+        last changed by:    $LastChangedBy$ $LastChangedDate$
+
+        Copyright (c) 2012 GSI, Scientific Computing division. All rights reserved.
+*************************************************************************/
+#include "OutputQueue.h"
+// API
+#include <sys/socket.h>
+#include <time.h>
+// MiscCommon
+#include "ErrorCode.h"
+#include "Metrics.h"
+// pod-protocol
+#include "ProtocolCommands.h"
+//=============================================================================
+using namespace std;
+using namespace PROOFAgent;
+using namespace MiscCommon;
+//=============================================================================
+namespace
+{
+#ifdef MSG_NOSIGNAL
+    const int SEND_FLAGS = MSG_DONTWAIT | MSG_NOSIGNAL;
+#else
+    const int SEND_FLAGS = MSG_DONTWAIT;
+#endif
+}
+//=============================================================================
+ELane PROOFAgent::laneOf( uint16_t _cmd )
+{
+    switch( _cmd )
+    {
+        case cmdHOST_INFO:
+        case cmdWNs_LIST:
+        case cmdWNs_LIST_DELTA:
+        case cmdFILE_UPLOAD:
+        case cmdFILE_DATA:
+            return laneBULK;
+        default:
+            return laneCONTROL;
+    }
+}
+//=============================================================================
+// memberof to silence doxygen warning:
+// warning: no matching class member found for
+// This happens because doxygen is not handling namespaces in arguments properly
+/**
+ * @memberof PROOFAgent::COutputQueue
+ *
+ */
+void COutputQueue::push( ELane _lane, uint16_t _cmd, const BYTEVector_t &_data )
+{
+    pushMsg( _lane, m_protocol.buildMsg( _cmd, _data ) );
+}
+//=============================================================================
+// memberof to silence doxygen warning:
+// warning: no matching class member found for
+// This happens because doxygen is not handling namespaces in arguments properly
+/**
+ * @memberof PROOFAgent::COutputQueue
+ *
+ */
+void COutputQueue::pushMsg( ELane _lane, const BYTEVector_t &_msg )
+{
+    if( _msg.empty() )
+        return;
+
+    m_lanes[_lane].push_back( SItem() );
+    SItem &item = m_lanes[_lane].back();
+    item.m_msg = _msg;
+    item.m_enqueued = metricsNowNs();
+    m_queuedBytes[_lane] += _msg.size();
+}
+//=============================================================================
+bool COutputQueue::grantCredit()
+{
+    BYTEVector_t msg;
+    if( !m_protocol.buildCredit( &msg ) )
+        return false;
+    m_credits.push_back( BYTEVector_t() );
+    m_credits.back().swap( msg );
+    return true;
+}
+//=============================================================================
+bool COutputQueue::flush( int _socket )
+{
+    while( true )
+    {
+        if( CREDIT_LANE == m_current )
+        {
+            BYTEVector_t &msg = m_credits.front();
+            const ssize_t n = ::send( _socket, &msg[m_offset], msg.size() - m_offset, SEND_FLAGS );
+            if( n < 0 )
+            {
+                if( EINTR == errno )
+                    continue;
+                if( EAGAIN == errno || EWOULDBLOCK == errno )
+                    return false;
+                throw system_error( "send data exception: " );
+            }
+            m_offset += n;
+            if( m_offset < msg.size() )
+                continue;
+            m_protocol.captureSent( msg );
+            m_credits.pop_front();
+            m_current = lanesCOUNT;
+        }
+        if( lanesCOUNT == m_current && !m_credits.empty() )
+        {
+            m_current = CREDIT_LANE;
+            m_offset = 0;
+            continue;
+        }
+        if( lanesCOUNT == m_current )
+        {
+            // take the next message from the highest priority lane
+            for( m_current = 0; m_current < lanesCOUNT && m_lanes[m_current].empty(); ++m_current )
+                ;
+            if( lanesCOUNT == m_current )
+                return true;
+            if( !m_protocol.hasSendCredit() )
+            {
+                m_current = lanesCOUNT;
+                return false;
+            }
+            m_offset = 0;
+            m_protocol.consumeSendCredit( m_lanes[m_current].front().m_msg.size() );
+        }
+
+        SItem &item = m_lanes[m_current].front();
+        const ssize_t n = ::send( _socket, &item.m_msg[m_offset], item.m_msg.size() - m_offset, SEND_FLAGS );
+        if( n < 0 )
+        {
+            if( EINTR == errno )
+                continue;
+            if( EAGAIN == errno || EWOULDBLOCK == errno )
+                return false;
+            throw system_error( "send data exception: " );
+        }
+
+        m_offset += n;
+        m_queuedBytes[m_current] -= n;
+        m_stats[m_current].m_bytes += n;
+        if( m_offset < item.m_msg.size() )
+            continue;
+
+        m_stats[m_current].m_delay.m_count++;
+        m_stats[m_current].m_delay.add( metricsNowNs() - item.m_enqueued );
+        m_protocol.captureSent( item.m_msg );
+        m_lanes[m_current].pop_front();
+        m_current = lanesCOUNT;
+    }
+}
+//=============================================================================
+uint64_t COutputQueue::oldestAgeUs( ELane _lane ) const
+{
+    if( m_lanes[_lane].empty() )
+        return 0;
+    return ( metricsNowNs() - m_lanes[_lane].front().m_enqueued ) / 1000;
+}
@@ -0,0 +1,171 @@
+/************************************************************************/
+/**
+ * @file OutputQueue.h
+ * @brief A per-connection output queue with priority lanes
+ * @author Anar Manafov A.Manafov@gsi.de
+ */ /*
+
+        version number:     $LastChangedRevision$
+        created by:         Anar Manafov
+                            2012-11-08
+        last changed by:    $LastChangedBy$ $LastChangedDate$
+
+        Copyright (c) 2012 GSI, Scientific Computing division. All rights reserved.
+*************************************************************************/
+#ifndef OUTPUTQUEUE_H_
+#define OUTPUTQUEUE_H_
+//=============================================================================
+// STD
+#include <deque>
+#include <ostream>
+// MiscCommon
+#include "def.h"
+// pod-protocol
+#include "Protocol.h"
+#include "CmdDispatcher.h"
+//=============================================================================
+namespace PROOFAgent
+{
+//=============================================================================
+    // lanes in the order of their priority
+    enum ELane
+    {
+        laneCONTROL = 0, // handshakes, requests, short answers
+        laneBULK = 1, // lists of workers, file offers, ...
+        lanesCOUNT
+    };
+    // the default lane of a command
+    ELane laneOf( uint16_t _cmd );
+//=============================================================================
+    struct SLaneStats
+    {
+        SLaneStats():
+            m_bytes( 0 )
+        {
+        }
+        // sent bytes
+        uint64_t m_bytes;
+        // time from push to the last byte handed to the socket, m_delay.m_count is a number of sent messages
+        SCmdStats m_delay;
+    };
+//=============================================================================
+    /**
+     *
+     * @brief The class keeps outgoing messages of a connection in priority lanes.
+     * @brief A message, which has started to be sent, is always finished first.
+     * @brief After that the next message is taken from the highest priority lane,
+     * @brief so control commands overtake queued bulk messages at message boundaries.
+     * @note Very large payloads should be sent as streams (CProtocol::writeStreamChunk)
+     * @note to give control commands a boundary at least every chunk.
+     * @note Example:
+     * @code
+     *
+     * COutputQueue queue( protocol );
+     * queue.push( cmdWNs_LIST, data ); // bulk
+     * queue.push( cmdSHUTDOWN, BYTEVector_t() ); // overtakes the list, if it is not being sent yet
+     * // in the event loop, when the socket is writable:
+     * if( !queue.flush( socket ) )
+     *     ... wait for POLLOUT ...
+     *
+     * @endcode
+     *
+     */
+    class COutputQueue
+    {
+            struct SItem
+            {
+                SItem():
+                    m_enqueued( 0 )
+                {
+                }
+                MiscCommon::BYTEVector_t m_msg;
+                uint64_t m_enqueued;
+            };
+            typedef std::deque<SItem> Lane_t;
+            static const size_t CREDIT_LANE = lanesCOUNT + 1;
+
+        public:
+            // _protocol frames the messages and keeps the flow control credit,
+            // the caller keeps the ownership
+            COutputQueue( CProtocol &_protocol ):
+                m_protocol( _protocol ),
+                m_current( lanesCOUNT ),
+                m_offset( 0 )
+            {
+                std::fill( m_queuedBytes, m_queuedBytes + lanesCOUNT, 0 );
+            }
+            // queues a message in the default lane of the command
+            void push( uint16_t _cmd, const MiscCommon::BYTEVector_t &_data )
+            {
+                push( laneOf( _cmd ), _cmd, _data );
+            }
+            void push( ELane _lane, uint16_t _cmd, const MiscCommon::BYTEVector_t &_data );
+            // queues an already framed message (see CProtocol::buildMsg)
+            void pushMsg( ELane _lane, const MiscCommon::BYTEVector_t &_msg );
+            // queues a credit of the connection (see CProtocol::buildCredit), if it is due.
+            // Credits are sent before any lane and don't need a credit themselves.
+            // Use it instead of CProtocol::grantCredit, which would break a partially sent message.
+            // return: true if a credit was queued
+            bool grantCredit();
+            // writes as much as the socket takes without blocking,
+            // a new message is started only if the peer has granted a credit (see CProtocol::grantCredit)
+            // return: true if the queue is empty
+            bool flush( int _socket );
+            bool empty() const
+            {
+                if( !m_credits.empty() )
+                    return false;
+                for( size_t i = 0; i < lanesCOUNT; ++i )
+                {
+                    if( !m_lanes[i].empty() )
+                        return false;
+                }
+                return true;
+            }
+            // return: true if flush would write now: a credit, a started message or a message with a send credit.
+            // An event loop waits for POLLOUT only then, otherwise for a credit from the peer (POLLIN).
+            bool canSend() const
+            {
+                if( !m_credits.empty() || lanesCOUNT != m_current )
+                    return true;
+                return ( !empty() && m_protocol.hasSendCredit() );
+            }
+            // not yet sent bytes of the lane
+            size_t queuedBytes( ELane _lane ) const
+            {
+                return m_queuedBytes[_lane];
+            }
+            // an age of the oldest message of the lane in microseconds, 0 if the lane is empty
+            uint64_t oldestAgeUs( ELane _lane ) const;
+            const SLaneStats &stats( ELane _lane ) const
+            {
+                return m_stats[_lane];
+            }
+
+        private:
+            CProtocol &m_protocol;
+            std::deque<MiscCommon::BYTEVector_t> m_credits;
+            Lane_t m_lanes[lanesCOUNT];
+            size_t m_queuedBytes[lanesCOUNT];
+            SLaneStats m_stats[lanesCOUNT];
+            // the lane of the message, which is being sent, lanesCOUNT - none, CREDIT_LANE - a credit
+            size_t m_current;
+            size_t m_offset;
+    };
+    inline std::ostream &operator<< ( std::ostream &_stream, const COutputQueue &_val )
+    {
+        const char *names[] = { "control", "bulk" };
+        for( size_t i = 0; i < lanesCOUNT; ++i )
+        {
+            const SLaneStats &stats = _val.stats( static_cast<ELane>( i ) );
+            _stream
+                    << names[i] << ": sent " << stats.m_delay.m_count << " msgs " << stats.m_bytes << " bytes"
+                    << ", delay p50 " << stats.m_delay.percentile( 50 ) / 1000
+                    << " us p99 " << stats.m_delay.percentile( 99 ) / 1000 << " us"
+                    << ", queued " << _val.queuedBytes( static_cast<ELane>( i ) ) << " bytes\n";
+        }
+        return _stream;
+    }
+}
+//=============================================================================
+#endif /* OUTPUTQUEUE_H_ */
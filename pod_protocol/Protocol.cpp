@@ -13,36 +13,293 @@
         Copyright (c) 2009-2011 GSI, Scientific Computing division. All rights reserved.
 *************************************************************************/
 #include "Protocol.h"
+// STD
+#include <stdexcept>
 // API
+#include <poll.h>
 #include <sys/socket.h>
 // MiscCommon
 #include "ErrorCode.h"
 #include "INet.h"
 #include "HexView.h"
+#include "Metrics.h"
+#include "Trace.h"
+// pod-protocol
+#include "CRC32C.h"
+#include "Compression.h"
+#include "ProtocolCommands.h"
+#include "ShmTransport.h"
+#include "Capture.h"
 //=============================================================================
 using namespace std;
 using namespace PROOFAgent;
 using namespace MiscCommon;
 using namespace MiscCommon::INet;
 //=============================================================================
-const size_t HEADER_SIZE = sizeof( SMessageHeader );
-const ssize_t MAX_MSG_SIZE = 256;
+namespace
+{
+    // the v1 header as it is sent over the wire
+    struct SMessageHeaderV1
+    {
+        char m_sign[10];
+        uint16_t m_cmd;
+        uint32_t m_len;
+    };
+    const size_t HEADER_V1_SIZE = sizeof( SMessageHeaderV1 );
+    const char g_msgV1Sign[] = "<POD_CMD>";
+    // MAGIC + FLAGS + CMD (max 3 bytes) + LEN (max 5 bytes) + CHANNEL (max 5 bytes) + CRC32C
+    const size_t HEADER_V2_MAX_SIZE = 1 + 1 + 3 + 5 + 5 + 4;
+    // a maximum size of a single read call
+    const size_t MAX_READ_SIZE = 64 * 1024;
+    // commands with own message counters, the rest is counted as "other"
+    const size_t METRICS_COMMANDS = 64;
 //=============================================================================
+    // messages by command and direction, counters are registered, when a command is seen first
+    class CProtocolMetrics
+    {
+        public:
+            CProtocolMetrics():
+                m_decode( CMetricsRegistry::instance().histogram( "misccommon_protocol_decode_seconds",
+                                                                  "Time of parsing, checking and decompressing of received messages",
+                                                                  "", 1e-9 ) )
+            {
+                for( size_t i = 0; i <= METRICS_COMMANDS; ++i )
+                    m_in[i] = m_out[i] = NULL;
+            }
+            static CProtocolMetrics &instance()
+            {
+                static CProtocolMetrics metrics;
+                return metrics;
+            }
+            CCounter &received( uint16_t _cmd )
+            {
+                return counter( m_in, _cmd, "in" );
+            }
+            CCounter &sent( uint16_t _cmd )
+            {
+                return counter( m_out, _cmd, "out" );
+            }
+            CHistogram &decode()
+            {
+                return m_decode;
+            }
+
+        private:
+            CCounter &counter( CCounter *volatile *_counters, uint16_t _cmd, const char *_dir )
+            {
+                const size_t i( min<size_t>( _cmd, METRICS_COMMANDS ) );
+                if( !_counters[i] )
+                {
+                    stringstream cmd;
+                    if( i < METRICS_COMMANDS )
+                        cmd << i;
+                    else
+                        cmd << "other";
+                    CCounter &c = CMetricsRegistry::instance().counter( "misccommon_protocol_messages_total",
+                                                                        "Protocol messages by command, out are built for sending",
+                                                                        metricsLabel( "cmd", cmd.str() ) + "," + metricsLabel( "dir", _dir ) );
+                    // the registry returns the same counter to all threads
+                    __sync_bool_compare_and_swap( &_counters[i], static_cast<CCounter *>( NULL ), &c );
+                }
+                return *_counters[i];
+            }
+
+        private:
+            CCounter *volatile m_in[METRICS_COMMANDS + 1];
+            CCounter *volatile m_out[METRICS_COMMANDS + 1];
+            CHistogram &m_decode;
+    };
 //=============================================================================
 //=============================================================================
-BYTEVector_t PROOFAgent::createMsg( uint16_t _cmd, const BYTEVector_t &_data )
+    // return: false if the header is incomplete
+    // throws if the header is bad/corrupted
+    bool parseHeader( const unsigned char *_msg, size_t _size, SMessageHeader *_header, uint32_t *_crc )
+    {
+        if( 0 == _size )
+            return false;
+
+        if( g_msgV2Magic == _msg[0] )
+        {
+            size_t pos( 2 );
+            if( _size < pos )
+                return false;
+
+            const uint8_t flags( _msg[1] );
+            uint32_t cmd( 0 );
+            size_t n = getVarint( _msg + pos, _size - pos, 3, &cmd );
+            if( 0 == n )
+                return false;
+            if( cmd > 0xFFFF )
+                throw runtime_error( "the protocol message is bad or corrupted. Invalid command id in the header." );
+            pos += n;
+
+            uint32_t len( 0 );
+            n = getVarint( _msg + pos, _size - pos, 5, &len );
+            if( 0 == n )
+                return false;
+            pos += n;
+
+            uint32_t channel( 0 );
+            if( flags & flagCHANNEL )
+            {
+                n = getVarint( _msg + pos, _size - pos, 5, &channel );
+                if( 0 == n )
+                    return false;
+                pos += n;
+            }
+
+            if( flags & flagCRC32C )
+            {
+                if( _size < pos + sizeof( uint32_t ) )
+                    return false;
+                *_crc = _msg[pos] | ( _msg[pos + 1] << 8 ) | ( _msg[pos + 2] << 16 ) |
+                        ( static_cast<uint32_t>( _msg[pos + 3] ) << 24 );
+                pos += sizeof( uint32_t );
+            }
+
+            _header->m_cmd = cmd;
+            _header->m_len = len;
+            _header->m_flags = flags;
+            _header->m_headerSize = pos;
+            _header->m_wireVersion = wireV2;
+            _header->m_channel = channel;
+            return true;
+        }
+
+        if( _size < HEADER_V1_SIZE )
+            return false;
+
+        SMessageHeaderV1 v1;
+        memcpy( &v1, _msg, HEADER_V1_SIZE );
+        if( 0 != memcmp( v1.m_sign, g_msgV1Sign, sizeof( g_msgV1Sign ) ) )
+        {
+            stringstream ss;
+            ss
+                    << "the protocol message is bad or corrupted. Invalid header:\n"
+                    <<  BYTEVectorHexView_t( BYTEVector_t( _msg, _msg + _size ) );
+            throw runtime_error( ss.str() );
+        }
+
+        _header->m_cmd = _normalizeRead16( v1.m_cmd );
+        _header->m_len = _normalizeRead32( v1.m_len );
+        _header->m_flags = 0;
+        _header->m_headerSize = HEADER_V1_SIZE;
+        _header->m_wireVersion = wireV1;
+        _header->m_channel = 0;
+        return true;
+    }
+    bool parseHeader( const BYTEVector_t &_msg, SMessageHeader *_header, uint32_t *_crc )
+    {
+        return ( _msg.empty() ? false : parseHeader( &_msg[0], _msg.size(), _header, _crc ) );
+    }
+}
+//=============================================================================
+//=============================================================================
+//=============================================================================
+void PROOFAgent::putVarint( BYTEVector_t *_buf, uint32_t _val )
 {
-    SMessageHeader header;
-    strncpy( header.m_sign, "<POD_CMD>", sizeof( header.m_sign ) );
-    header.m_cmd = _normalizeWrite16( _cmd );
-    header.m_len = _normalizeWrite32( _data.size() );
+    while( _val >= 0x80 )
+    {
+        _buf->push_back( static_cast<unsigned char>( _val | 0x80 ) );
+        _val >>= 7;
+    }
+    _buf->push_back( static_cast<unsigned char>( _val ) );
+}
+//=============================================================================
+size_t PROOFAgent::getVarint( const unsigned char *_buf, size_t _size, size_t _maxSize, uint32_t *_val )
+{
+    uint32_t val( 0 );
+    for( size_t i = 0; i < _size; ++i )
+    {
+        if( i >= _maxSize )
+            throw runtime_error( "the protocol message is bad or corrupted. Invalid varint." );
 
-    BYTEVector_t ret_val( HEADER_SIZE );
-    memcpy( &ret_val[0], reinterpret_cast<unsigned char *>( &header ), HEADER_SIZE );
-    copy( _data.begin(), _data.end(), back_inserter( ret_val ) );
+        val |= static_cast<uint32_t>( _buf[i] & 0x7F ) << ( 7 * i );
+        if( !( _buf[i] & 0x80 ) )
+        {
+            *_val = val;
+            return i + 1;
+        }
+    }
+    return 0;
+}
+//=============================================================================
+uint32_t PROOFAgent::protocolCaps()
+{
+    return ( g_protocolCaps | compressionCaps() );
+}
+//=============================================================================
+BYTEVector_t PROOFAgent::createMsg( uint16_t _cmd, const BYTEVector_t &_data, uint32_t _caps,
+                                    uint8_t _flags, uint32_t _channel )
+{
+    BYTEVector_t ret_val;
+    if( !( _caps & capHEADER_V2 ) )
+    {
+        if( 0 != _channel )
+            throw logic_error( "Logical channels require the v2 message header." );
+
+        SMessageHeaderV1 header;
+        memset( &header, 0, HEADER_V1_SIZE );
+        strncpy( header.m_sign, g_msgV1Sign, sizeof( header.m_sign ) );
+        header.m_cmd = _normalizeWrite16( _cmd );
+        header.m_len = _normalizeWrite32( _data.size() );
+
+        ret_val.reserve( HEADER_V1_SIZE + _data.size() );
+        ret_val.resize( HEADER_V1_SIZE );
+        memcpy( &ret_val[0], reinterpret_cast<unsigned char *>( &header ), HEADER_V1_SIZE );
+        ret_val.insert( ret_val.end(), _data.begin(), _data.end() );
+        return ret_val;
+    }
+
+    const bool useCRC( _caps & capCRC32C );
+    ret_val.reserve( HEADER_V2_MAX_SIZE + _data.size() );
+    ret_val.push_back( g_msgV2Magic );
+    if( useCRC )
+        _flags |= flagCRC32C;
+    if( 0 != _channel )
+        _flags |= flagCHANNEL;
+    ret_val.push_back( _flags );
+    putVarint( &ret_val, _cmd );
+    putVarint( &ret_val, _data.size() );
+    if( 0 != _channel )
+        putVarint( &ret_val, _channel );
+    if( useCRC )
+    {
+        uint32_t crc = crc32c( 0, &ret_val[0], ret_val.size() );
+        if( !_data.empty() )
+            crc = crc32c( crc, &_data[0], _data.size() );
+        ret_val.push_back( crc & 0xFF );
+        ret_val.push_back(( crc >> 8 ) & 0xFF );
+        ret_val.push_back(( crc >> 16 ) & 0xFF );
+        ret_val.push_back(( crc >> 24 ) & 0xFF );
+    }
+    ret_val.insert( ret_val.end(), _data.begin(), _data.end() );
 
     return ret_val;
+}
+//=============================================================================
+BYTEVector_t PROOFAgent::createMsgHeader( uint16_t _cmd, uint32_t _len, uint32_t _caps )
+{
+    BYTEVector_t ret_val;
+    if( !( _caps & capHEADER_V2 ) )
+    {
+        SMessageHeaderV1 header;
+        memset( &header, 0, HEADER_V1_SIZE );
+        strncpy( header.m_sign, g_msgV1Sign, sizeof( header.m_sign ) );
+        header.m_cmd = _normalizeWrite16( _cmd );
+        header.m_len = _normalizeWrite32( _len );
 
+        ret_val.resize( HEADER_V1_SIZE );
+        memcpy( &ret_val[0], reinterpret_cast<unsigned char *>( &header ), HEADER_V1_SIZE );
+        return ret_val;
+    }
+
+    ret_val.reserve( HEADER_V2_MAX_SIZE );
+    ret_val.push_back( g_msgV2Magic );
+    ret_val.push_back( 0 );
+    putVarint( &ret_val, _cmd );
+    putVarint( &ret_val, _len );
+    return ret_val;
 }
 //=============================================================================
 // return:
@@ -52,39 +309,75 @@ BYTEVector_t PROOFAgent::createMsg( uint16_t _cmd, const BYTEVector_t &_data )
 SMessageHeader PROOFAgent::parseMsg( BYTEVector_t *_data, const BYTEVector_t &_msg )
 {
     SMessageHeader header;
-    if( _msg.size() < HEADER_SIZE )
+    uint32_t crc( 0 );
+    if( !parseHeader( _msg, &header, &crc ) )
         return SMessageHeader();
 
-    memcpy( &header, &_msg[0], HEADER_SIZE );
-    if( !header.isValid() )
+    if( _msg.size() < header.m_headerSize + static_cast<size_t>( header.m_len ) )
+        return SMessageHeader();
+
+    BYTEVector_t::const_iterator iter = _msg.begin() + header.m_headerSize;
+    if( header.m_flags & flagCRC32C )
     {
-        stringstream ss;
-        ss
-                << "the protocol message is bad or corrupted. Invalid header:\n"
-                <<  BYTEVectorHexView_t( _msg );
-        throw runtime_error( ss.str() );
+        uint32_t calc = crc32c( 0, &_msg[0], header.m_headerSize - sizeof( uint32_t ) );
+        if( header.m_len > 0 )
+            calc = crc32c( calc, &( *iter ), header.m_len );
+        if( calc != crc )
+        {
+            stringstream ss;
+            ss
+                    << "the protocol message is bad or corrupted. CRC32C mismatch: expected "
+                    << hex << crc << " calculated " << calc;
+            throw runtime_error( ss.str() );
+        }
     }
 
-    header.m_cmd = _normalizeRead16( header.m_cmd );
-    header.m_len = _normalizeRead32( header.m_len );
-
     if( 0 == header.m_len )
         return header;
 
-    BYTEVector_t::const_iterator iter = _msg.begin() + HEADER_SIZE;
-    copy( iter, iter + header.m_len, back_inserter( *_data ) );
+    _data->insert( _data->end(), iter, iter + header.m_len );
 
     return header;
 }
 //=============================================================================
 //=============================================================================
 //=============================================================================
-CProtocol::CProtocol()
+CProtocol::CProtocol():
+    m_caps( 0 ),
+    m_compressionThreshold( g_compressionThreshold ),
+    m_dict( NULL ),
+    m_streamConsumer( NULL ),
+    m_readLimit( g_readLimit ),
+    m_sendCredit( 0 ),
+    m_recvWindow( g_receiveWindow ),
+    m_recvGranted( 0 ),
+    m_recvUsed( 0 ),
+    m_seqPacket( false ),
+    m_fdPassing( false ),
+    m_shm( NULL ),
+    m_capture( NULL ),
+    m_captureConnection( 0 )
 {
 }
 //=============================================================================
 CProtocol::~CProtocol()
 {
+    for( size_t i = 0; i < m_fds.size(); ++i )
+        ::close( m_fds[i] );
+}
+//=============================================================================
+void CProtocol::negotiate( uint32_t _peerCaps )
+{
+    m_caps = protocolCaps() & _peerCaps;
+    // both sides assume the initial credit, the receiver extends it by cmdCREDIT
+    m_sendCredit = g_initialCredit;
+    m_recvGranted = g_initialCredit;
+    m_recvUsed = 0;
+}
+//=============================================================================
+SFraming CProtocol::framing() const
+{
+    return SFraming( m_caps, ( NULL != m_dict ) ? m_dict->id() : 0, m_compressionThreshold );
 }
 //=============================================================================
 // memberof to silence doxygen warning:
@@ -102,13 +395,55 @@ SMessageHeader CProtocol::getMsg( BYTEVector_t *_data ) const
 //=============================================================================
 CProtocol::EStatus_t CProtocol::read( int _socket )
 {
-    BYTEVector_t tmp_buf( MAX_MSG_SIZE );
-    while( true )
+    CTraceSpan span( "CProtocol::read", "protocol" );
+    size_t total( 0 );
+    vector<int> fds;
+    while( total < m_readLimit )
     {
-        // need to read more to complete the header
-        // we use read (instead of recv) to allow non socket transports
-        const ssize_t bytes_read = ::read( _socket, &tmp_buf[0],
-                                           MAX_MSG_SIZE );
+        // read directly into the tail of the buffer
+        const size_t offset( m_buffer.size() );
+        // a packet must be taken at once, otherwise its tail is lost
+        const size_t to_read( m_seqPacket ? g_seqPacketSize : min( MAX_READ_SIZE, m_readLimit - total ) );
+        m_buffer.resize( offset + to_read );
+        ssize_t bytes_read( 0 );
+        try
+        {
+            if( m_shm )
+            {
+                // only the first read may wait
+                bytes_read = m_shm->read( &m_buffer[offset], to_read, 0 == total );
+            }
+            else if( m_seqPacket || m_fdPassing )
+            {
+                // only the first packet may block
+                int flags( ( m_seqPacket && total > 0 ) ? MSG_DONTWAIT : 0 );
+                if( m_seqPacket )
+                    flags |= MSG_TRUNC;
+                bytes_read = recv_with_fds( _socket, &m_buffer[offset], to_read, m_fdPassing ? &fds : NULL, flags );
+                m_fds.insert( m_fds.end(), fds.begin(), fds.end() );
+                fds.clear();
+                if( bytes_read > static_cast<ssize_t>( to_read ) )
+                    throw runtime_error( "The peer has sent a packet larger than the protocol allows." );
+            }
+            else
+            {
+                // we use read (instead of recv) to allow non socket transports
+                bytes_read = ::read( _socket, &m_buffer[offset], to_read );
+                if( bytes_read > 0 )
+                    SINetMetrics::instance().m_received.add( bytes_read );
+            }
+        }
+        catch( ... )
+        {
+            // the tail, which was reserved for the read, isn't data
+            m_buffer.resize( offset );
+            // descriptors of a truncated message (MSG_CTRUNC) don't belong to any message
+            for( vector<int>::const_iterator iter = fds.begin(); iter != fds.end(); ++iter )
+                ::close( *iter );
+            throw;
+        }
+        m_buffer.resize( offset + ( bytes_read > 0 ? bytes_read : 0 ) );
+
         if( 0 == bytes_read )
             return stDISCONNECT;
 
@@ -118,41 +453,118 @@ CProtocol::EStatus_t CProtocol::read( int _socket )
                 return stDISCONNECT;
 
             if( EAGAIN == errno || EWOULDBLOCK == errno )
-                return stAGAIN;
+            {
+                // an empty poll of a non-blocking socket isn't worth a span
+                if( 0 == total )
+                    span.dismiss();
+                span.setArg( "bytes", total );
+                return ( 0 == total ) ? stAGAIN : stOK;
+            }
 
             throw MiscCommon::system_error( "Error occurred while reading protocol message." );
         }
 
-        copy( tmp_buf.begin(), tmp_buf.begin() + bytes_read,
-              back_inserter( m_buffer ) );
-
-        if( bytes_read < MAX_MSG_SIZE )
+        total += bytes_read;
+        if( !m_seqPacket && static_cast<size_t>( bytes_read ) < to_read )
             break;
     }
 
+    span.setArg( "bytes", total );
     return stOK;
 }
 //=============================================================================
 bool CProtocol::checkoutNextMsg()
 {
+    CProtocolMetrics &metrics( CProtocolMetrics::instance() );
+    while( true )
+    {
+        CTraceSpan span( "CProtocol::checkoutNextMsg", "protocol" );
+        const uint64_t start( metricsNowNs() );
+        try
+        {
+            m_curDATA.clear();
+            m_msgHeader = parseMsg( &m_curDATA, m_buffer );
+            if( !m_msgHeader.isValid() )
+            {
+                span.dismiss();
+                return false;
+            }
+            span.setArg( "cmd", m_msgHeader.m_cmd );
+
+            // delete the message from the buffer
+            const size_t msgSize( m_msgHeader.m_headerSize + m_msgHeader.m_len );
+            if( m_capture )
+                m_capture->record( m_captureConnection, dirIN, &m_buffer[0], msgSize );
+            m_buffer.erase( m_buffer.begin(), m_buffer.begin() + msgSize );
+
+            if( m_caps & capCREDIT )
+            {
+                // credits are not subject of the flow control,
+                // credits of logical channels are returned to the caller
+                if( cmdCREDIT == m_msgHeader.m_cmd && 0 == m_msgHeader.m_channel )
+                {
+                    applyCredit( m_curDATA );
+                    continue;
+                }
+                if( cmdCREDIT != m_msgHeader.m_cmd )
+                    accountReceived( msgSize );
+            }
+
+            if( m_msgHeader.m_flags & flagCOMPRESSED )
+            {
+                BYTEVector_t raw;
+                decompressPayload( m_curDATA, &raw, m_dict );
+                m_curDATA.swap( raw );
+                m_msgHeader.m_len = m_curDATA.size();
+                m_msgHeader.m_flags &= ~flagCOMPRESSED;
+            }
+        }
+        catch( ... )
+        {
+            // TODO: Clear only until there is another <POD_CMD> found
+            m_buffer.clear();
+            throw;
+        }
+        metrics.decode().record( metricsNowNs() - start );
+        metrics.received( m_msgHeader.m_cmd ).add();
+
+        if( !( m_msgHeader.m_flags & flagSTREAM ) )
+            return true;
+
+        if( !m_streamConsumer )
+            throw runtime_error( "Received a stream chunk, but there is no stream consumer." );
+
+        m_streamConsumer->onStreamChunk( m_msgHeader.m_cmd, m_curDATA,
+                                         m_msgHeader.m_flags & flagSTREAM_END );
+    }
+}
+//=============================================================================
+bool CProtocol::checkoutNextHeader()
+{
+    m_curDATA.clear();
+    uint32_t crc( 0 );
+    m_msgHeader.clear();
     try
     {
-        m_curDATA.clear();
-        m_msgHeader = parseMsg( &m_curDATA, m_buffer );
-        if( !m_msgHeader.isValid() )
+        if( !parseHeader( m_buffer, &m_msgHeader, &crc ) )
+        {
+            m_msgHeader.clear();
             return false;
-
-        // delete the message from the buffer
-        m_buffer.erase( m_buffer.begin(),
-                        m_buffer.begin() + HEADER_SIZE + m_msgHeader.m_len );
+        }
     }
     catch( ... )
     {
-        // TODO: Clear only until there is another <POD_CMD> found
         m_buffer.clear();
         throw;
     }
 
+    if( m_msgHeader.m_flags & ( flagCRC32C | flagCOMPRESSED | flagSTREAM ) )
+        throw logic_error( "Bulk data must not be checksummed, compressed or streamed on the message level." );
+
+    m_buffer.erase( m_buffer.begin(), m_buffer.begin() + m_msgHeader.m_headerSize );
+    // the data is taken by the caller directly from the socket, it isn't buffered
+    if( m_caps & capCREDIT )
+        accountReceived( m_msgHeader.m_headerSize );
     return true;
 }
 //=============================================================================
@@ -163,10 +575,135 @@ bool CProtocol::checkoutNextMsg()
  * @memberof PROOFAgent::CProtocol
  *
  */
-void CProtocol::write( int _socket, uint16_t _cmd, const BYTEVector_t &_data ) const
+size_t CProtocol::takeBuffered( BYTEVector_t *_out, size_t _max )
+{
+    const size_t size( min( _max, m_buffer.size() ) );
+    _out->assign( m_buffer.begin(), m_buffer.begin() + size );
+    m_buffer.erase( m_buffer.begin(), m_buffer.begin() + size );
+    return size;
+}
+//=============================================================================
+// memberof to silence doxygen warning:
+// warning: no matching class member found for
+// This happens because doxygen is not handling namespaces in arguments properly
+/**
+ * @memberof PROOFAgent::CProtocol
+ *
+ */
+void CProtocol::write( int _socket, uint16_t _cmd, const BYTEVector_t &_data )
+{
+    writeMsg( _socket, buildMsg( _cmd, _data ) );
+}
+//=============================================================================
+// memberof to silence doxygen warning:
+// warning: no matching class member found for
+// This happens because doxygen is not handling namespaces in arguments properly
+/**
+ * @memberof PROOFAgent::CProtocol
+ *
+ */
+BYTEVector_t CProtocol::buildMsg( uint16_t _cmd, const BYTEVector_t &_data ) const
+{
+    CTraceSpan span( "CProtocol::buildMsg", "protocol" );
+    span.setArg( "cmd", _cmd );
+    CProtocolMetrics::instance().sent( _cmd ).add();
+    const ECompressionCodec codec( ( m_caps & capHEADER_V2 ) ? selectCodec( m_caps ) : codecNONE );
+    if( codecNONE != codec && _data.size() >= m_compressionThreshold )
+    {
+        BYTEVector_t payload;
+        if( compressPayload( codec, _data, &payload, m_dict ) )
+            return createMsg( _cmd, payload, m_caps, flagCOMPRESSED );
+    }
+
+    return createMsg( _cmd, _data, m_caps );
+}
+//=============================================================================
+// memberof to silence doxygen warning:
+// warning: no matching class member found for
+// This happens because doxygen is not handling namespaces in arguments properly
+/**
+ * @memberof PROOFAgent::CProtocol
+ *
+ */
+void CProtocol::writeMsg( int _socket, const BYTEVector_t &_msg )
+{
+    if( m_caps & capCREDIT )
+    {
+        waitSendCredit( _socket );
+        m_sendCredit -= _msg.size();
+    }
+    sendRaw( _socket, &_msg[0], _msg.size() );
+}
+//=============================================================================
+// memberof to silence doxygen warning:
+// warning: no matching class member found for
+// This happens because doxygen is not handling namespaces in arguments properly
+/**
+ * @memberof PROOFAgent::CProtocol
+ *
+ */
+void CProtocol::writeHeader( int _socket, const BYTEVector_t &_header )
+{
+    if( m_caps & capCREDIT )
+    {
+        waitSendCredit( _socket );
+        m_sendCredit -= _header.size();
+    }
+    sendRaw( _socket, &_header[0], _header.size(), -1, false );
+}
+//=============================================================================
+// memberof to silence doxygen warning:
+// warning: no matching class member found for
+// This happens because doxygen is not handling namespaces in arguments properly
+/**
+ * @memberof PROOFAgent::CProtocol
+ *
+ */
+void CProtocol::writeFd( int _socket, uint16_t _cmd, const BYTEVector_t &_data, int _fd )
+{
+    const BYTEVector_t msg( buildMsg( _cmd, _data ) );
+    if( m_caps & capCREDIT )
+    {
+        waitSendCredit( _socket );
+        m_sendCredit -= msg.size();
+    }
+    sendRaw( _socket, &msg[0], msg.size(), _fd );
+}
+//=============================================================================
+// memberof to silence doxygen warning:
+// warning: no matching class member found for
+// This happens because doxygen is not handling namespaces in arguments properly
+/**
+ * @memberof PROOFAgent::CProtocol
+ *
+ */
+void CProtocol::exportState( SProtocolStateCmd *_state ) const
+{
+    _state->m_caps = m_caps;
+    _state->m_sendCredit = m_sendCredit;
+    _state->m_recvWindow = m_recvWindow;
+    _state->m_recvGranted = m_recvGranted;
+    _state->m_recvUsed = m_recvUsed;
+    _state->m_buffered = m_buffer;
+}
+//=============================================================================
+// memberof to silence doxygen warning:
+// warning: no matching class member found for
+// This happens because doxygen is not handling namespaces in arguments properly
+/**
+ * @memberof PROOFAgent::CProtocol
+ *
+ */
+void CProtocol::importState( const SProtocolStateCmd &_state )
 {
-    BYTEVector_t msg( createMsg( _cmd, _data ) );
-    sendall( _socket, &msg[0], msg.size(), 0 );
+    m_caps = _state.m_caps & protocolCaps();
+    m_sendCredit = _state.m_sendCredit;
+    m_recvWindow = _state.m_recvWindow;
+    m_recvGranted = _state.m_recvGranted;
+    m_recvUsed = _state.m_recvUsed;
+    m_buffer = _state.m_buffered;
+    m_msgHeader.clear();
+    m_curDATA.clear();
 }
 //=============================================================================
 // memberof to silence doxygen warning:
@@ -176,9 +713,239 @@ void CProtocol::write( int _socket, uint16_t _cmd, const BYTEVector_t &_data ) c
  * @memberof PROOFAgent::CProtocol
  *
  */
-void CProtocol::writeSimpleCmd( int _socket, uint16_t _cmd ) const
+void CProtocol::captureSent( const BYTEVector_t &_msg )
+{
+    if( m_capture && !_msg.empty() )
+        m_capture->record( m_captureConnection, dirOUT, &_msg[0], _msg.size() );
+}
+//=============================================================================
+int CProtocol::takeFd()
+{
+    if( m_fds.empty() )
+        return -1;
+    const int fd( m_fds.front() );
+    m_fds.pop_front();
+    return fd;
+}
+//=============================================================================
+void CProtocol::sendRaw( int _socket, const unsigned char *_buf, size_t _len, int _fd, bool _capture )
+{
+    CTraceSpan span( "CProtocol::sendRaw", "protocol" );
+    span.setArg( "bytes", _len );
+    if( m_capture && _capture )
+        m_capture->record( m_captureConnection, dirOUT, _buf, _len );
+
+    if( m_shm )
+    {
+        if( -1 != _fd )
+            throw logic_error( "Descriptors can't be passed over the shared memory transport." );
+        m_shm->write( _buf, _len );
+        return;
+    }
+
+    size_t total( 0 );
+    while( total < _len )
+    {
+        // a packet is sent at once or not at all
+        const size_t len( m_seqPacket ? min( g_seqPacketSize, _len - total ) : _len - total );
+        size_t n( 0 );
+        if( -1 != _fd )
+        {
+            n = send_with_fd( _socket, _buf + total, len, _fd );
+            _fd = -1;
+        }
+        else
+        {
+            n = sendall( _socket, _buf + total, len, 0 );
+        }
+        total += n;
+    }
+}
+//=============================================================================
+// memberof to silence doxygen warning:
+// warning: no matching class member found for
+// This happens because doxygen is not handling namespaces in arguments properly
+/**
+ * @memberof PROOFAgent::CProtocol
+ *
+ */
+void CProtocol::writeStreamChunk( int _socket, uint16_t _cmd, const BYTEVector_t &_chunk, bool _last )
+{
+    if( !( m_caps & capSTREAM ) )
+        throw logic_error( "The peer doesn't support streamed messages." );
+
+    const uint8_t flags( flagSTREAM | ( _last ? flagSTREAM_END : 0 ) );
+    const ECompressionCodec codec( selectCodec( m_caps ) );
+    if( codecNONE != codec && _chunk.size() >= m_compressionThreshold )
+    {
+        BYTEVector_t payload;
+        if( compressPayload( codec, _chunk, &payload, m_dict ) )
+        {
+            writeMsg( _socket, createMsg( _cmd, payload, m_caps, flags | flagCOMPRESSED ) );
+            return;
+        }
+    }
+    writeMsg( _socket, createMsg( _cmd, _chunk, m_caps, flags ) );
+}
+//=============================================================================
+void CProtocol::writeStream( int _socket, uint16_t _cmd, int _fd, size_t _chunkSize )
+{
+    BYTEVector_t chunk( _chunkSize );
+    while( true )
+    {
+        // fill the whole chunk, pipes return data in small portions
+        size_t size( 0 );
+        while( size < _chunkSize )
+        {
+            const ssize_t n = ::read( _fd, &chunk[size], _chunkSize - size );
+            if( n < 0 )
+            {
+                if( EINTR == errno )
+                    continue;
+                throw MiscCommon::system_error( "Error occurred while reading a stream source." );
+            }
+            if( 0 == n )
+                break;
+            size += n;
+        }
+
+        if( 0 == size )
+            break;
+
+        chunk.resize( size );
+        writeStreamChunk( _socket, _cmd, chunk, false );
+        chunk.resize( _chunkSize );
+    }
+    writeStreamChunk( _socket, _cmd, BYTEVector_t(), true );
+}
+//=============================================================================
+// memberof to silence doxygen warning:
+// warning: no matching class member found for
+// This happens because doxygen is not handling namespaces in arguments properly
+/**
+ * @memberof PROOFAgent::CProtocol
+ *
+ */
+void CProtocol::writeSimpleCmd( int _socket, uint16_t _cmd )
 {
     BYTEVector_t data;
     write( _socket, _cmd, data );
 }
 //=============================================================================
+void CProtocol::accountReceived( size_t _size )
+{
+    // the peer may start a message while it has a credit,
+    // the initial credit covers messages sent before it has negotiated
+    if( m_recvUsed >= m_recvGranted + g_initialCredit )
+        throw runtime_error( "The peer has violated the flow control: a message without a credit." );
+    m_recvUsed += _size;
+}
+//=============================================================================
+// memberof to silence doxygen warning:
+// warning: no matching class member found for
+// This happens because doxygen is not handling namespaces in arguments properly
+/**
+ * @memberof PROOFAgent::CProtocol
+ *
+ */
+void CProtocol::applyCredit( const BYTEVector_t &_data )
+{
+    SCreditCmd cmd;
+    cmd.convertFromData( _data );
+    m_sendCredit += cmd.m_bytes;
+}
+//=============================================================================
+bool CProtocol::grantCredit( int _socket )
+{
+    BYTEVector_t msg;
+    if( !buildCredit( &msg ) )
+        return false;
+
+    // credits themselves are not subject of the flow control
+    sendRaw( _socket, &msg[0], msg.size() );
+    return true;
+}
+//=============================================================================
+// memberof to silence doxygen warning:
+// warning: no matching class member found for
+// This happens because doxygen is not handling namespaces in arguments properly
+/**
+ * @memberof PROOFAgent::CProtocol
+ *
+ */
+bool CProtocol::buildCredit( BYTEVector_t *_msg )
+{
+    if( !( m_caps & capCREDIT ) )
+        return false;
+
+    // the credit the peer still has
+    const uint64_t outstanding( m_recvGranted > m_recvUsed ? m_recvGranted - m_recvUsed : 0 );
+    if( outstanding >= m_recvWindow / 2 )
+        return false;
+
+    SCreditCmd cmd;
+    cmd.m_bytes = m_recvWindow - outstanding;
+    m_recvGranted += cmd.m_bytes;
+    BYTEVector_t data;
+    cmd.convertToData( &data );
+    *_msg = createMsg( cmdCREDIT, data, m_caps );
+    return true;
+}
+//=============================================================================
+void CProtocol::waitSendCredit( int _socket )
+{
+    while( !hasSendCredit() )
+    {
+        absorbCredits();
+        if( hasSendCredit() )
+            break;
+
+        if( m_shm )
+        {
+            if( stDISCONNECT == read( _socket ) )
+                throw runtime_error( "The peer has closed the connection while we were waiting for a flow control credit." );
+            continue;
+        }
+        pollfd pfd;
+        pfd.fd = _socket;
+        pfd.events = POLLIN;
+        pfd.revents = 0;
+        if( ::poll( &pfd, 1, -1 ) < 0 )
+        {
+            if( EINTR == errno )
+                continue;
+            throw MiscCommon::system_error( "Error occurred while waiting for a flow control credit." );
+        }
+        if( stDISCONNECT == read( _socket ) )
+            throw runtime_error( "The peer has closed the connection while we were waiting for a flow control credit." );
+    }
+}
+//=============================================================================
+void CProtocol::absorbCredits()
+{
+    size_t pos( 0 );
+    while( pos < m_buffer.size() )
+    {
+        SMessageHeader header;
+        uint32_t crc( 0 );
+        if( !parseHeader( &m_buffer[pos], m_buffer.size() - pos, &header, &crc ) )
+            return;
+        const size_t msgSize( header.m_headerSize + header.m_len );
+        if( m_buffer.size() - pos < msgSize )
+            return;
+
+        if( cmdCREDIT != header.m_cmd || 0 != header.m_channel )
+        {
+            pos += msgSize;
+            continue;
+        }
+
+        const BYTEVector_t msg( m_buffer.begin() + pos, m_buffer.begin() + pos + msgSize );
+        if( m_capture )
+            m_capture->record( m_captureConnection, dirIN, &msg[0], msg.size() );
+        BYTEVector_t data;
+        parseMsg( &data, msg );
+        applyCredit( data );
+        m_buffer.erase( m_buffer.begin() + pos, m_buffer.begin() + pos + msgSize );
+    }
+}
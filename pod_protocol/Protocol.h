@@ -17,43 +17,166 @@
 //=============================================================================
 // STD
 #include <cstring>
+#include <deque>
 // API
 #include <arpa/inet.h>
+#include <stdint.h>
 // MiscCommon
 #include "def.h"
 //=============================================================================
 namespace PROOFAgent
 {
+    class CCompressionDict;
+    class CShmTransport;
+    class CCaptureWriter;
+    struct SProtocolStateCmd;
 //=============================================================================
 // a very simple protocol
-// | <POD_CMD> (10) char | CMD (2) uint16_t | LEN (4) uint32_t | DATA (LEN) unsigned char |
+// v1: | <POD_CMD> (10) char | CMD (2) uint16_t | LEN (4) uint32_t | DATA (LEN) unsigned char |
+// v2: | MAGIC (1) | FLAGS (1) | CMD (varint) | LEN (varint) | CHANNEL (varint, optional) | CRC32C (4, optional) | DATA (LEN) unsigned char |
+//
+// The v2 header is used only when both peers announced it in cmdVERSION,
+// the receiving side always accepts both.
+    enum EWireVersion
+    {
+        wireUNKNOWN = 0,
+        wireV1 = 1,
+        wireV2 = 2
+    };
+    // v2 header flags
+    enum EMsgFlags
+    {
+        flagCRC32C = 0x01, // the header carries a CRC32C of the header and the data
+        flagCOMPRESSED = 0x02, // the data is compressed (see Compression.h)
+        flagSTREAM = 0x04, // the data is a chunk of a stream
+        flagSTREAM_END = 0x08, // the last chunk of a stream
+        flagCHANNEL = 0x10 // the header carries a logical channel id (see ChannelMux.h)
+    };
+    // capabilities, which are negotiated via cmdVERSION
+    enum EProtocolCaps
+    {
+        capHEADER_V2 = 0x01,
+        capCRC32C = 0x02,
+        capZLIB = 0x04,
+        capZSTD = 0x08,
+        capLZ4 = 0x10,
+        capSTREAM = 0x20,
+        capCREDIT = 0x40, // credit-based flow control (cmdCREDIT)
+        capCHANNELS = 0x80 // multiplexed logical channels
+    };
+    const unsigned char g_msgV2Magic = 0xD5;
+    // capabilities, which are always supported
+    const uint32_t g_protocolCaps = capHEADER_V2 | capCRC32C | capSTREAM | capCREDIT | capCHANNELS;
+    // a default size of stream chunks
+    const size_t g_streamChunkSize = 64 * 1024;
+    // a default limit of bytes CProtocol::read takes from a socket at once
+    const size_t g_readLimit = 256 * 1024;
+    // the largest packet CProtocol writes to and reads from a SOCK_SEQPACKET socket
+    const size_t g_seqPacketSize = 64 * 1024;
+    // flow control: bytes, which a peer may send right after the negotiation without a grant
+    const size_t g_initialCredit = 64 * 1024;
+    // flow control: a default amount of not yet checked out bytes a peer may send
+    const size_t g_receiveWindow = 1024 * 1024;
+    // all capabilities of this build, including optional compression codecs
+    uint32_t protocolCaps();
+//=============================================================================
     struct SMessageHeader
     {
         SMessageHeader():
             m_cmd( 0 ),
-            m_len( 0 )
+            m_len( 0 ),
+            m_flags( 0 ),
+            m_wireVersion( wireUNKNOWN ),
+            m_headerSize( 0 ),
+            m_channel( 0 )
         {
-            m_sign[0] = '\0';
         }
-        char m_sign[10];
         uint16_t m_cmd;
         uint32_t m_len;
+        uint8_t m_flags;
+        uint8_t m_wireVersion;
+        // a size of the header on the wire
+        uint8_t m_headerSize;
+        // a logical channel, 0 - the connection itself
+        uint32_t m_channel;
 
         bool isValid() const
         {
-            return( strcmp( m_sign, "<POD_CMD>" ) == 0 );
+            return ( wireUNKNOWN != m_wireVersion );
         }
         void clear()
         {
-            m_sign[0] = '\0';
             m_cmd = 0;
             m_len = 0;
+            m_flags = 0;
+            m_wireVersion = wireUNKNOWN;
+            m_headerSize = 0;
+            m_channel = 0;
         }
     };
 //=============================================================================
-    MiscCommon::BYTEVector_t createMsg( uint16_t _cmd, const MiscCommon::BYTEVector_t &_data );
+    // LEB128 varints, used by the v2 header and by compact command encodings
+    void putVarint( MiscCommon::BYTEVector_t *_buf, uint32_t _val );
+    // return: a number of consumed bytes or 0 if the buffer is incomplete,
+    // throws if the varint is longer than _maxSize bytes
+    size_t getVarint( const unsigned char *_buf, size_t _size, size_t _maxSize, uint32_t *_val );
+//=============================================================================
+    // _caps - capabilities of the peer, 0 means v1 header.
+    // _flags - additional v2 header flags (EMsgFlags) describing the data.
+    // _channel - a logical channel of the message, requires the v2 header.
+    MiscCommon::BYTEVector_t createMsg( uint16_t _cmd, const MiscCommon::BYTEVector_t &_data,
+                                        uint32_t _caps = 0, uint8_t _flags = 0, uint32_t _channel = 0 );
+//=============================================================================
+    // frames only a header of a message with _len bytes of data, which are sent separately
+    // (for example, by sendfile). Such messages carry neither CRC32C nor compression.
+    MiscCommon::BYTEVector_t createMsgHeader( uint16_t _cmd, uint32_t _len, uint32_t _caps = 0 );
 //=============================================================================
     SMessageHeader parseMsg( MiscCommon::BYTEVector_t *_data, const MiscCommon::BYTEVector_t &_msg );
+//=============================================================================
+    /**
+     *
+     * @brief An interface of receivers of streamed messages (see CProtocol::writeStream).
+     *
+     */
+    class IStreamConsumer
+    {
+        public:
+            virtual ~IStreamConsumer()
+            {
+            }
+            // _chunk is valid only during the call
+            virtual void onStreamChunk( uint16_t _cmd, const MiscCommon::BYTEVector_t &_chunk, bool _last ) = 0;
+    };
+//=============================================================================
+    /**
+     *
+     * @brief Everything besides a command and its data, which defines the bytes of a framed message:
+     * @brief negotiated capabilities, the compression dictionary and the compression threshold.
+     * @brief Connections with equal framings get equal messages from CProtocol::buildMsg.
+     *
+     */
+    struct SFraming
+    {
+        explicit SFraming( uint32_t _caps = 0, uint32_t _dictId = 0, size_t _compressionThreshold = 0 ):
+            m_caps( _caps ),
+            m_dictId( _dictId ),
+            m_compressionThreshold( _compressionThreshold )
+        {
+        }
+        bool operator< ( const SFraming &_val ) const
+        {
+            if( m_caps != _val.m_caps )
+                return m_caps < _val.m_caps;
+            if( m_dictId != _val.m_dictId )
+                return m_dictId < _val.m_dictId;
+            return m_compressionThreshold < _val.m_compressionThreshold;
+        }
+
+        uint32_t m_caps;
+        // 0 - no dictionary
+        uint32_t m_dictId;
+        size_t m_compressionThreshold;
+    };
 //=============================================================================
     /**
      *
@@ -74,13 +197,176 @@ namespace PROOFAgent
             } EStatus_t;
 
             EStatus_t read( int _socket );
-            void write( int _socket, uint16_t _cmd, const MiscCommon::BYTEVector_t &_data ) const;
-            void writeSimpleCmd( int _socket, uint16_t _cmd ) const;
+            // with flow control the write functions block until the peer grants a credit
+            void write( int _socket, uint16_t _cmd, const MiscCommon::BYTEVector_t &_data );
+            void writeSimpleCmd( int _socket, uint16_t _cmd );
+            // frames a message using the negotiated header and compression
+            MiscCommon::BYTEVector_t buildMsg( uint16_t _cmd, const MiscCommon::BYTEVector_t &_data ) const;
+            // sends a message framed by buildMsg (for example, from CResponseCache)
+            void writeMsg( int _socket, const MiscCommon::BYTEVector_t &_msg );
+            // sends a header framed by createMsgHeader, the caller sends its m_len bytes of bulk data.
+            // Like checkoutNextHeader on the receiver, the header is charged against the credit,
+            // but it is not captured: a capture keeps only complete messages.
+            void writeHeader( int _socket, const MiscCommon::BYTEVector_t &_header );
+            // sends the content of _fd (a file, a pipe, ...) until EOF as a stream of chunks,
+            // the stream is finished by an empty chunk
+            void writeStream( int _socket, uint16_t _cmd, int _fd, size_t _chunkSize = g_streamChunkSize );
+            // sends one chunk of a stream
+            void writeStreamChunk( int _socket, uint16_t _cmd, const MiscCommon::BYTEVector_t &_chunk, bool _last );
             SMessageHeader getMsg( MiscCommon::BYTEVector_t *_data ) const;
+            // the current message without copying it, valid until the next checkoutNextMsg
+            const SMessageHeader &msgHeader() const
+            {
+                return m_msgHeader;
+            }
+            const MiscCommon::BYTEVector_t &msgData() const
+            {
+                return m_curDATA;
+            }
+            // stream chunks are passed to the stream consumer,
+            // the function returns true only for regular messages
             bool checkoutNextMsg();
+            // parses only the header of the next message and removes it from the buffer,
+            // the caller takes m_len bytes of the data by itself: first takeBuffered, then the socket.
+            // It is used for bulk data (cmdFILE_DATA), which is not copied through the buffer.
+            // With capCREDIT only the header is charged against the receive window.
+            // return: false if the header is incomplete
+            bool checkoutNextHeader();
+            // moves at most _max already buffered bytes to _out
+            // return: a number of moved bytes
+            size_t takeBuffered( MiscCommon::BYTEVector_t *_out, size_t _max );
+            // the caller keeps the ownership
+            void setStreamConsumer( IStreamConsumer *_consumer )
+            {
+                m_streamConsumer = _consumer;
+            }
+            // at most _limit bytes are read from a socket per a read call,
+            // this bounds the memory of a connection to the largest message + _limit
+            void setReadLimit( size_t _limit )
+            {
+                m_readLimit = _limit;
+            }
+            size_t bufferedSize() const
+            {
+                return m_buffer.size();
+            }
+            // enables features announced by the peer in cmdVERSION
+            void negotiate( uint32_t _peerCaps );
+            uint32_t caps() const
+            {
+                return m_caps;
+            }
+            // messages larger than _threshold are compressed, if the peer supports it
+            void setCompressionThreshold( size_t _threshold )
+            {
+                m_compressionThreshold = _threshold;
+            }
+            // a dictionary shared with the peer, the caller keeps the ownership
+            void setCompressionDict( const CCompressionDict *_dict )
+            {
+                m_dict = _dict;
+            }
+            // a key of cached framed messages (see CResponseCache)
+            SFraming framing() const;
+            // Flow control (capCREDIT).
+            // The receiving side grants byte credits with cmdCREDIT, when messages are checked out.
+            // A sender may start a message while it has a positive credit, so the memory
+            // of a receiver is bounded by the window + the largest message.
+            // cmdCREDIT messages of the connection are handled internally and never returned by checkoutNextMsg,
+            // credits of logical channels are returned to be handled by CChannelMux.
+            void setReceiveWindow( size_t _window )
+            {
+                m_recvWindow = _window;
+            }
+            // sends cmdCREDIT if the peer has used at least a half of the window,
+            // should be called after checked out messages are processed
+            // return: true if a credit was sent
+            bool grantCredit( int _socket );
+            // the same as grantCredit, but the framed cmdCREDIT is returned to be queued by the caller,
+            // for example, when a partially sent message is still in the output (see COutputQueue)
+            bool buildCredit( MiscCommon::BYTEVector_t *_msg );
+            bool hasSendCredit() const
+            {
+                return ( !( m_caps & capCREDIT ) || m_sendCredit > 0 );
+            }
+            int64_t sendCredit() const
+            {
+                return m_sendCredit;
+            }
+            // accounts bytes of messages sent bypassing writeMsg (for example, by an output queue)
+            void consumeSendCredit( size_t _size )
+            {
+                if( m_caps & capCREDIT )
+                    m_sendCredit -= _size;
+            }
+            // waits for a credit, reading the socket, the other messages stay buffered
+            void waitSendCredit( int _socket );
+            // takes cmdCREDIT messages out of the buffer,
+            // non-blocking senders call it after read instead of waitSendCredit
+            void absorbCredits();
+            // Local transports (AF_UNIX).
+            // The socket is SOCK_SEQPACKET: messages are written in packets of at most g_seqPacketSize bytes,
+            // read takes whole packets. Files can't be sent by CFileSender over such sockets.
+            void setSeqPacket( bool _val )
+            {
+                m_seqPacket = _val;
+            }
+            // read collects descriptors passed by the peer (SCM_RIGHTS), only for AF_UNIX sockets
+            void setFdPassing( bool _val )
+            {
+                m_fdPassing = _val;
+            }
+            // sends a message together with a descriptor (for example, an accepted connection),
+            // the peer gets it by takeFd, when the message is checked out. _fd stays owned by the caller.
+            void writeFd( int _socket, uint16_t _cmd, const MiscCommon::BYTEVector_t &_data, int _fd );
+            // return: the next received descriptor, which the caller takes ownership of, or -1
+            int takeFd();
+            // messages go through the shared memory transport instead of the socket,
+            // socket arguments are ignored then (pass CShmTransport::fd()).
+            // The caller keeps the ownership.
+            void setShm( CShmTransport *_shm )
+            {
+                m_shm = _shm;
+            }
+            // the negotiated capabilities, flow control counters and not yet checked out bytes,
+            // it lets another process (a restarted agent) continue the connection, see Handover.h
+            void exportState( SProtocolStateCmd *_state ) const;
+            void importState( const SProtocolStateCmd &_state );
+            // every framed message of the connection (checked out, sent, credits) is appended to _capture
+            // under the id _connection, NULL switches the capture off. The caller keeps the ownership.
+            // Bulk messages (writeHeader, checkoutNextHeader) are not captured.
+            void setCapture( CCaptureWriter *_capture, uint32_t _connection )
+            {
+                m_capture = _capture;
+                m_captureConnection = _connection;
+            }
+            // captures a message sent bypassing the write functions (see COutputQueue)
+            void captureSent( const MiscCommon::BYTEVector_t &_msg );
+
+        private:
+            void accountReceived( size_t _size );
+            void applyCredit( const MiscCommon::BYTEVector_t &_data );
+            // sends the whole buffer, _fd (if not -1) is attached to the first byte
+            void sendRaw( int _socket, const unsigned char *_buf, size_t _len, int _fd = -1, bool _capture = true );
 
         private:
             MiscCommon::BYTEVector_t m_buffer;
+            uint32_t m_caps;
+            size_t m_compressionThreshold;
+            const CCompressionDict *m_dict;
+            IStreamConsumer *m_streamConsumer;
+            size_t m_readLimit;
+            int64_t m_sendCredit;
+            size_t m_recvWindow;
+            uint64_t m_recvGranted;
+            uint64_t m_recvUsed;
+            bool m_seqPacket;
+            bool m_fdPassing;
+            // received, but not yet taken descriptors
+            std::deque<int> m_fds;
+            CShmTransport *m_shm;
+            CCaptureWriter *m_capture;
+            uint32_t m_captureConnection;
 
             SMessageHeader m_msgHeader;
             MiscCommon::BYTEVector_t m_curDATA;
@@ -16,6 +16,7 @@
 // STD
 #include <stdint.h>
 #include <stdexcept>
+#include <algorithm>
 
 // MiscCommon
 #include "INet.h"
@@ -28,31 +29,48 @@ namespace inet = MiscCommon::INet;
 void SVersionCmd::normalizeToLocal()
 {
     m_version = inet::_normalizeRead16( m_version );
+    m_caps = inet::_normalizeRead32( m_caps );
 }
 //=============================================================================
 void SVersionCmd::normalizeToRemote()
 {
     m_version = inet::_normalizeWrite16( m_version );
+    m_caps = inet::_normalizeWrite32( m_caps );
 }
 //=============================================================================
 void SVersionCmd::_convertFromData( const MiscCommon::BYTEVector_t &_data )
 {
-    if( _data.size() < size() )
+    if( _data.size() < sizeof( m_version ) )
     {
         stringstream ss;
-        ss << "VersionCmd: Protocol message data is too short, expected " << size()
+        ss << "VersionCmd: Protocol message data is too short, expected " << sizeof( m_version )
            << " received " << _data.size();
         throw std::runtime_error( ss.str() );
     }
 
     m_version = _data[0];
     m_version += ( _data[1] << 8 );
+
+    // old peers (< v7) don't send capabilities
+    m_caps = 0;
+    if( _data.size() < size() )
+        return;
+
+    m_caps = _data[2];
+    m_caps += ( _data[3] << 8 );
+    m_caps += ( _data[4] << 16 );
+    m_caps += ( _data[5] << 24 );
 }
 //=============================================================================
 void SVersionCmd::_convertToData( MiscCommon::BYTEVector_t *_data ) const
 {
     _data->push_back( m_version & 0xFF );
     _data->push_back( m_version >> 8 );
+
+    _data->push_back( m_caps & 0xFF );
+    _data->push_back(( m_caps >> 8 ) & 0xFF );
+    _data->push_back(( m_caps >> 16 ) & 0xFF );
+    _data->push_back(( m_caps >> 24 ) & 0xFF );
 }
 //=============================================================================
 //=============================================================================
@@ -278,3 +296,426 @@ void SWnListCmd::_convertToData( MiscCommon::BYTEVector_t *_data ) const
         _data->push_back( '\0' );
     }
 }
+//=============================================================================
+//=============================================================================
+//=============================================================================
+void SEpochCmd::normalizeToLocal()
+{
+    m_epoch = inet::_normalizeRead32( m_epoch );
+    m_instance = inet::_normalizeRead32( m_instance );
+}
+//=============================================================================
+void SEpochCmd::normalizeToRemote()
+{
+    m_epoch = inet::_normalizeWrite32( m_epoch );
+    m_instance = inet::_normalizeWrite32( m_instance );
+}
+//=============================================================================
+void SEpochCmd::_convertFromData( const MiscCommon::BYTEVector_t &_data )
+{
+    if( _data.size() < size() )
+    {
+        stringstream ss;
+        ss << "EpochCmd: Protocol message data is too short, expected " << size()
+           << " received " << _data.size();
+        throw std::runtime_error( ss.str() );
+    }
+
+    m_epoch = _data[0];
+    m_epoch += ( _data[1] << 8 );
+    m_epoch += ( _data[2] << 16 );
+    m_epoch += ( _data[3] << 24 );
+    m_instance = _data[4];
+    m_instance += ( _data[5] << 8 );
+    m_instance += ( _data[6] << 16 );
+    m_instance += ( _data[7] << 24 );
+}
+//=============================================================================
+void SEpochCmd::_convertToData( MiscCommon::BYTEVector_t *_data ) const
+{
+    _data->push_back( m_epoch & 0xFF );
+    _data->push_back(( m_epoch >> 8 ) & 0xFF );
+    _data->push_back(( m_epoch >> 16 ) & 0xFF );
+    _data->push_back(( m_epoch >> 24 ) & 0xFF );
+    _data->push_back( m_instance & 0xFF );
+    _data->push_back(( m_instance >> 8 ) & 0xFF );
+    _data->push_back(( m_instance >> 16 ) & 0xFF );
+    _data->push_back(( m_instance >> 24 ) & 0xFF );
+}
+//=============================================================================
+//=============================================================================
+//=============================================================================
+namespace
+{
+    // reads _count NUL-terminated strings starting at _idx
+    void readStrings( const MiscCommon::BYTEVector_t &_data, size_t *_idx, uint32_t _count,
+                      MiscCommon::StringVector_t *_container )
+    {
+        _container->reserve( _count );
+        for( uint32_t i = 0; i < _count; ++i )
+        {
+            MiscCommon::BYTEVector_t::const_iterator first = _data.begin() + *_idx;
+            MiscCommon::BYTEVector_t::const_iterator last = std::find( first, _data.end(), '\0' );
+            if( last == _data.end() )
+                throw std::runtime_error( "WnListDeltaCmd: Protocol message data is too short" );
+            _container->push_back( string( first, last ) );
+            *_idx += ( last - first ) + 1;
+        }
+    }
+    uint32_t readCount( const MiscCommon::BYTEVector_t &_data, size_t *_idx )
+    {
+        uint32_t count( 0 );
+        const size_t n = ( *_idx < _data.size() ) ?
+                         getVarint( &_data[*_idx], _data.size() - *_idx, 5, &count ) : 0;
+        if( 0 == n )
+            throw std::runtime_error( "WnListDeltaCmd: Protocol message data is too short" );
+        *_idx += n;
+        return count;
+    }
+    void writeStrings( const MiscCommon::StringVector_t &_container, MiscCommon::BYTEVector_t *_data )
+    {
+        putVarint( _data, _container.size() );
+        MiscCommon::StringVector_t::const_iterator iter = _container.begin();
+        MiscCommon::StringVector_t::const_iterator iter_end = _container.end();
+        for( ; iter != iter_end; ++iter )
+        {
+            _data->insert( _data->end(), iter->begin(), iter->end() );
+            _data->push_back( '\0' );
+        }
+    }
+}
+//=============================================================================
+void SWnListDeltaCmd::normalizeToLocal()
+{
+    m_epoch = inet::_normalizeRead32( m_epoch );
+    m_instance = inet::_normalizeRead32( m_instance );
+}
+//=============================================================================
+void SWnListDeltaCmd::normalizeToRemote()
+{
+    m_epoch = inet::_normalizeWrite32( m_epoch );
+    m_instance = inet::_normalizeWrite32( m_instance );
+}
+//=============================================================================
+void SWnListDeltaCmd::_convertFromData( const MiscCommon::BYTEVector_t &_data )
+{
+    m_added.clear();
+    m_removed.clear();
+
+    const size_t fixedSize( sizeof( m_epoch ) + sizeof( m_instance ) + sizeof( m_full ) );
+    if( _data.size() < fixedSize )
+    {
+        stringstream ss;
+        ss << "WnListDeltaCmd: Protocol message data is too short, expected " << fixedSize
+           << " received " << _data.size();
+        throw std::runtime_error( ss.str() );
+    }
+
+    m_epoch = _data[0];
+    m_epoch += ( _data[1] << 8 );
+    m_epoch += ( _data[2] << 16 );
+    m_epoch += ( _data[3] << 24 );
+    m_instance = _data[4];
+    m_instance += ( _data[5] << 8 );
+    m_instance += ( _data[6] << 16 );
+    m_instance += ( _data[7] << 24 );
+    m_full = _data[8];
+
+    size_t idx( fixedSize );
+    uint32_t count = readCount( _data, &idx );
+    readStrings( _data, &idx, count, &m_added );
+    count = readCount( _data, &idx );
+    readStrings( _data, &idx, count, &m_removed );
+}
+//=============================================================================
+void SWnListDeltaCmd::_convertToData( MiscCommon::BYTEVector_t *_data ) const
+{
+    _data->reserve( _data->size() + size() + 8 );
+    _data->push_back( m_epoch & 0xFF );
+    _data->push_back(( m_epoch >> 8 ) & 0xFF );
+    _data->push_back(( m_epoch >> 16 ) & 0xFF );
+    _data->push_back(( m_epoch >> 24 ) & 0xFF );
+    _data->push_back( m_instance & 0xFF );
+    _data->push_back(( m_instance >> 8 ) & 0xFF );
+    _data->push_back(( m_instance >> 16 ) & 0xFF );
+    _data->push_back(( m_instance >> 24 ) & 0xFF );
+    _data->push_back( m_full );
+
+    writeStrings( m_added, _data );
+    writeStrings( m_removed, _data );
+}
+//=============================================================================
+//=============================================================================
+//=============================================================================
+namespace
+{
+    void write32( uint32_t _val, MiscCommon::BYTEVector_t *_data )
+    {
+        for( size_t i = 0; i < sizeof( _val ); ++i )
+            _data->push_back(( _val >> ( 8 * i ) ) & 0xFF );
+    }
+    void write64( uint64_t _val, MiscCommon::BYTEVector_t *_data )
+    {
+        for( size_t i = 0; i < sizeof( _val ); ++i )
+            _data->push_back(( _val >> ( 8 * i ) ) & 0xFF );
+    }
+    uint32_t read32( const MiscCommon::BYTEVector_t &_data, size_t _idx )
+    {
+        uint32_t val( 0 );
+        for( size_t i = 0; i < sizeof( val ); ++i )
+            val |= static_cast<uint32_t>( _data[_idx + i] ) << ( 8 * i );
+        return val;
+    }
+    uint64_t read64( const MiscCommon::BYTEVector_t &_data, size_t _idx )
+    {
+        uint64_t val( 0 );
+        for( size_t i = 0; i < sizeof( val ); ++i )
+            val |= static_cast<uint64_t>( _data[_idx + i] ) << ( 8 * i );
+        return val;
+    }
+}
+//=============================================================================
+void SFileUploadCmd::normalizeToLocal()
+{
+    m_size = inet::_normalizeRead64( m_size );
+    m_crc = inet::_normalizeRead32( m_crc );
+}
+//=============================================================================
+void SFileUploadCmd::normalizeToRemote()
+{
+    m_size = inet::_normalizeWrite64( m_size );
+    m_crc = inet::_normalizeWrite32( m_crc );
+}
+//=============================================================================
+void SFileUploadCmd::_convertFromData( const MiscCommon::BYTEVector_t &_data )
+{
+    const size_t fixedSize( sizeof( m_size ) + sizeof( m_crc ) );
+    MiscCommon::BYTEVector_t::const_iterator last = ( _data.size() > fixedSize ) ?
+                                                    std::find( _data.begin() + fixedSize, _data.end(), '\0' ) :
+                                                    _data.end();
+    if( last == _data.end() )
+    {
+        stringstream ss;
+        ss << "FileUploadCmd: Protocol message data is too short, expected at least " << fixedSize + 1
+           << " received " << _data.size();
+        throw std::runtime_error( ss.str() );
+    }
+
+    m_size = read64( _data, 0 );
+    m_crc = read32( _data, sizeof( m_size ) );
+    m_name.assign( _data.begin() + fixedSize, last );
+}
+//=============================================================================
+void SFileUploadCmd::_convertToData( MiscCommon::BYTEVector_t *_data ) const
+{
+    _data->reserve( _data->size() + size() );
+    write64( m_size, _data );
+    write32( m_crc, _data );
+    _data->insert( _data->end(), m_name.begin(), m_name.end() );
+    _data->push_back( '\0' );
+}
+//=============================================================================
+//=============================================================================
+//=============================================================================
+void SFileOffsetCmd::normalizeToLocal()
+{
+    m_offset = inet::_normalizeRead64( m_offset );
+}
+//=============================================================================
+void SFileOffsetCmd::normalizeToRemote()
+{
+    m_offset = inet::_normalizeWrite64( m_offset );
+}
+//=============================================================================
+void SFileOffsetCmd::_convertFromData( const MiscCommon::BYTEVector_t &_data )
+{
+    if( _data.size() < size() )
+    {
+        stringstream ss;
+        ss << "FileOffsetCmd: Protocol message data is too short, expected " << size()
+           << " received " << _data.size();
+        throw std::runtime_error( ss.str() );
+    }
+
+    m_offset = read64( _data, 0 );
+}
+//=============================================================================
+void SFileOffsetCmd::_convertToData( MiscCommon::BYTEVector_t *_data ) const
+{
+    write64( m_offset, _data );
+}
+//=============================================================================
+//=============================================================================
+//=============================================================================
+void SFileStatusCmd::normalizeToLocal()
+{
+    m_status = inet::_normalizeRead16( m_status );
+    m_crc = inet::_normalizeRead32( m_crc );
+}
+//=============================================================================
+void SFileStatusCmd::normalizeToRemote()
+{
+    m_status = inet::_normalizeWrite16( m_status );
+    m_crc = inet::_normalizeWrite32( m_crc );
+}
+//=============================================================================
+void SFileStatusCmd::_convertFromData( const MiscCommon::BYTEVector_t &_data )
+{
+    if( _data.size() < size() )
+    {
+        stringstream ss;
+        ss << "FileStatusCmd: Protocol message data is too short, expected " << size()
+           << " received " << _data.size();
+        throw std::runtime_error( ss.str() );
+    }
+
+    m_status = _data[0];
+    m_status += ( _data[1] << 8 );
+    m_crc = read32( _data, sizeof( m_status ) );
+}
+//=============================================================================
+void SFileStatusCmd::_convertToData( MiscCommon::BYTEVector_t *_data ) const
+{
+    _data->push_back( m_status & 0xFF );
+    _data->push_back(( m_status >> 8 ) & 0xFF );
+    write32( m_crc, _data );
+}
+//=============================================================================
+//=============================================================================
+//=============================================================================
+void SCreditCmd::normalizeToLocal()
+{
+    m_bytes = inet::_normalizeRead32( m_bytes );
+}
+//=============================================================================
+void SCreditCmd::normalizeToRemote()
+{
+    m_bytes = inet::_normalizeWrite32( m_bytes );
+}
+//=============================================================================
+void SCreditCmd::_convertFromData( const MiscCommon::BYTEVector_t &_data )
+{
+    if( _data.size() < size() )
+    {
+        stringstream ss;
+        ss << "CreditCmd: Protocol message data is too short, expected " << size()
+           << " received " << _data.size();
+        throw std::runtime_error( ss.str() );
+    }
+
+    m_bytes = read32( _data, 0 );
+}
+//=============================================================================
+void SCreditCmd::_convertToData( MiscCommon::BYTEVector_t *_data ) const
+{
+    write32( m_bytes, _data );
+}
+//=============================================================================
+//=============================================================================
+//=============================================================================
+void SHandoverListenerCmd::_convertFromData( const MiscCommon::BYTEVector_t &_data )
+{
+    MiscCommon::BYTEVector_t::const_iterator last = std::find( _data.begin(), _data.end(), '\0' );
+    if( last == _data.end() )
+        throw std::runtime_error( "HandoverListenerCmd: Protocol message data is not terminated" );
+
+    m_name.assign( _data.begin(), last );
+}
+//=============================================================================
+void SHandoverListenerCmd::_convertToData( MiscCommon::BYTEVector_t *_data ) const
+{
+    _data->insert( _data->end(), m_name.begin(), m_name.end() );
+    _data->push_back( '\0' );
+}
+//=============================================================================
+//=============================================================================
+//=============================================================================
+void SProtocolStateCmd::normalizeToLocal()
+{
+    m_caps = inet::_normalizeRead32( m_caps );
+    m_sendCredit = inet::_normalizeRead64( m_sendCredit );
+    m_recvWindow = inet::_normalizeRead32( m_recvWindow );
+    m_recvGranted = inet::_normalizeRead64( m_recvGranted );
+    m_recvUsed = inet::_normalizeRead64( m_recvUsed );
+}
+//=============================================================================
+void SProtocolStateCmd::normalizeToRemote()
+{
+    m_caps = inet::_normalizeWrite32( m_caps );
+    m_sendCredit = inet::_normalizeWrite64( m_sendCredit );
+    m_recvWindow = inet::_normalizeWrite32( m_recvWindow );
+    m_recvGranted = inet::_normalizeWrite64( m_recvGranted );
+    m_recvUsed = inet::_normalizeWrite64( m_recvUsed );
+}
+//=============================================================================
+void SProtocolStateCmd::_convertFromData( const MiscCommon::BYTEVector_t &_data )
+{
+    const size_t fixedSize( sizeof( m_caps ) + sizeof( m_sendCredit ) + sizeof( m_recvWindow ) +
+                            sizeof( m_recvGranted ) + sizeof( m_recvUsed ) );
+    MiscCommon::BYTEVector_t::const_iterator last = ( _data.size() > fixedSize ) ?
+                                                    std::find( _data.begin() + fixedSize, _data.end(), '\0' ) :
+                                                    _data.end();
+    if( last == _data.end() )
+    {
+        stringstream ss;
+        ss << "ProtocolStateCmd: Protocol message data is too short, expected at least " << fixedSize + 1
+           << " received " << _data.size();
+        throw std::runtime_error( ss.str() );
+    }
+
+    size_t pos( 0 );
+    m_caps = read32( _data, pos );
+    pos += sizeof( m_caps );
+    m_sendCredit = read64( _data, pos );
+    pos += sizeof( m_sendCredit );
+    m_recvWindow = read32( _data, pos );
+    pos += sizeof( m_recvWindow );
+    m_recvGranted = read64( _data, pos );
+    pos += sizeof( m_recvGranted );
+    m_recvUsed = read64( _data, pos );
+    m_name.assign( _data.begin() + fixedSize, last );
+    m_buffered.assign( last + 1, _data.end() );
+}
+//=============================================================================
+void SProtocolStateCmd::_convertToData( MiscCommon::BYTEVector_t *_data ) const
+{
+    _data->reserve( _data->size() + size() );
+    write32( m_caps, _data );
+    write64( m_sendCredit, _data );
+    write32( m_recvWindow, _data );
+    write64( m_recvGranted, _data );
+    write64( m_recvUsed, _data );
+    _data->insert( _data->end(), m_name.begin(), m_name.end() );
+    _data->push_back( '\0' );
+    _data->insert( _data->end(), m_buffered.begin(), m_buffered.end() );
+}
+//=============================================================================
+//=============================================================================
+//=============================================================================
+void SHandoverDoneCmd::normalizeToLocal()
+{
+    m_count = inet::_normalizeRead32( m_count );
+}
+//=============================================================================
+void SHandoverDoneCmd::normalizeToRemote()
+{
+    m_count = inet::_normalizeWrite32( m_count );
+}
+//=============================================================================
+void SHandoverDoneCmd::_convertFromData( const MiscCommon::BYTEVector_t &_data )
+{
+    if( _data.size() < size() )
+    {
+        stringstream ss;
+        ss << "HandoverDoneCmd: Protocol message data is too short, expected " << size()
+           << " received " << _data.size();
+        throw std::runtime_error( ss.str() );
+    }
+
+    m_count = read32( _data, 0 );
+}
+//=============================================================================
+void SHandoverDoneCmd::_convertToData( MiscCommon::BYTEVector_t *_data ) const
+{
+    write32( m_count, _data );
+}
@@ -23,7 +23,14 @@
 #include "Protocol.h"
 //=============================================================================
 // v6: added m_timeStamp to SHostInfoCmd
-const uint16_t g_protocolCommandsVersion = 6;
+// v7: added m_caps to SVersionCmd,
+//     added cmdGET_WNs_LIST_DELTA/cmdWNs_LIST_DELTA,
+//     added cmdFILE_UPLOAD/cmdFILE_UPLOAD_OFFSET/cmdFILE_DATA/cmdFILE_UPLOAD_STATUS,
+//     added cmdCREDIT,
+//     added cmdCHANNEL_DATA/cmdCHANNEL_CLOSE,
+//     added cmdHANDOVER_LISTENER/cmdHANDOVER_CONNECTION/cmdHANDOVER_DONE,
+//     added cmdTRACE_DUMP/cmdTRACE_DATA
+const uint16_t g_protocolCommandsVersion = 7;
 //=============================================================================
 namespace PROOFAgent
 {
@@ -47,10 +54,25 @@ namespace PROOFAgent
         cmdGET_WRK_NUM, // request a number of PROOF workers, which pod wn want to spawn
         cmdWRK_NUM, // answer with number of PROOF wns,
         cmdGET_WNs_LIST, // request a list of available workers
-        cmdWNs_LIST // return a list of available workers
+        cmdWNs_LIST, // return a list of available workers
 
         // ----------- VERSION 6 --------------------
 
+        // ----------- VERSION 7 --------------------
+        cmdGET_WNs_LIST_DELTA, // request changes of the list of workers since the given epoch
+        cmdWNs_LIST_DELTA, // return changes of the list of workers
+        cmdFILE_UPLOAD, // offer a file (a job log, ...) to the peer
+        cmdFILE_UPLOAD_OFFSET, // answer on cmdFILE_UPLOAD with an offset to resume from
+        cmdFILE_DATA, // raw bytes of the file, see FileTransfer.h
+        cmdFILE_UPLOAD_STATUS, // the result of the upload
+        cmdCREDIT, // flow control: the peer may send more bytes, handled by CProtocol (or CChannelMux for channels)
+        cmdCHANNEL_DATA, // a chunk of bytes of a logical channel, see ChannelMux.h
+        cmdCHANNEL_CLOSE, // the sender has closed the logical channel
+        cmdHANDOVER_LISTENER, // a listening socket passed to a restarted agent, see Handover.h
+        cmdHANDOVER_CONNECTION, // a connection and its protocol state passed to a restarted agent
+        cmdHANDOVER_DONE, // the end of a handover and its confirmation
+        cmdTRACE_DUMP, // request the trace of the peer, see CTracer (Trace.h)
+        cmdTRACE_DATA // the trace as Chrome trace JSON (CTracer::writeChromeTrace)
     };
 //=============================================================================
     template<class _Owner>
@@ -73,27 +95,32 @@ namespace PROOFAgent
 //=============================================================================
     struct SVersionCmd: public SBasicCmd<SVersionCmd>
     {
-        SVersionCmd(): m_version( g_protocolCommandsVersion )
+        SVersionCmd():
+            m_version( g_protocolCommandsVersion ),
+            m_caps( protocolCaps() )
         {
         }
         void normalizeToLocal();
         void normalizeToRemote();
         size_t size() const
         {
-            return sizeof( m_version );
+            return sizeof( m_version ) + sizeof( m_caps );
         }
         void _convertFromData( const MiscCommon::BYTEVector_t &_data );
         void _convertToData( MiscCommon::BYTEVector_t *_data ) const;
         bool operator== ( const SVersionCmd &val ) const
         {
-            return ( m_version == val.m_version );
+            return ( m_version == val.m_version &&
+                     m_caps == val.m_caps );
         }
 
         uint16_t m_version;
+        // protocol capabilities (see EProtocolCaps), peers older than v7 don't send it
+        uint32_t m_caps;
     };
     inline std::ostream &operator<< ( std::ostream &_stream, const SVersionCmd &val )
     {
-        return _stream << val.m_version;
+        return _stream << val.m_version << " caps 0x" << std::hex << val.m_caps << std::dec;
     }
 //=============================================================================
     struct SHostInfoCmd: public SBasicCmd<SHostInfoCmd>
@@ -217,6 +244,318 @@ namespace PROOFAgent
         std::copy( val.m_container.begin(), val.m_container.end(), output );
         return _stream;
     }
+//=============================================================================
+    // an argument of cmdGET_WNs_LIST_DELTA
+    // | EPOCH (4) | INSTANCE (4) |
+    // the last epoch of the workers list seen by the client, 0 - nothing seen yet,
+    // and the instance of the server it was seen from (epochs restart with the server).
+    struct SEpochCmd: public SBasicCmd<SEpochCmd>
+    {
+        SEpochCmd():
+            m_epoch( 0 ),
+            m_instance( 0 )
+        {
+        }
+        void normalizeToLocal();
+        void normalizeToRemote();
+        size_t size() const
+        {
+            return sizeof( m_epoch ) + sizeof( m_instance );
+        }
+        void _convertFromData( const MiscCommon::BYTEVector_t &_data );
+        void _convertToData( MiscCommon::BYTEVector_t *_data ) const;
+        bool operator== ( const SEpochCmd &_val ) const
+        {
+            return ( m_epoch == _val.m_epoch &&
+                     m_instance == _val.m_instance );
+        }
+
+        uint32_t m_epoch;
+        uint32_t m_instance;
+    };
+    inline std::ostream &operator<< ( std::ostream &_stream, const SEpochCmd &_val )
+    {
+        return _stream << _val.m_epoch << " of " << std::hex << _val.m_instance << std::dec;
+    }
+//=============================================================================
+    // an answer on cmdGET_WNs_LIST_DELTA
+    // | EPOCH (4) | INSTANCE (4) | FULL (1) | N ADDED (varint) | ADDED strings | N REMOVED (varint) | REMOVED strings |
+    // if m_full is set, m_added contains the whole list and m_removed is empty
+    struct SWnListDeltaCmd: public SBasicCmd<SWnListDeltaCmd>
+    {
+        SWnListDeltaCmd():
+            m_epoch( 0 ),
+            m_instance( 0 ),
+            m_full( 0 )
+        {
+        }
+        size_t size() const
+        {
+            size_t size( sizeof( m_epoch ) + sizeof( m_instance ) + sizeof( m_full ) + 2 );
+            MiscCommon::StringVector_t::const_iterator iter = m_added.begin();
+            MiscCommon::StringVector_t::const_iterator iter_end = m_added.end();
+            for( ; iter != iter_end; ++iter )
+                size += iter->size() + 1;
+            iter = m_removed.begin();
+            iter_end = m_removed.end();
+            for( ; iter != iter_end; ++iter )
+                size += iter->size() + 1;
+            return size;
+        }
+        void normalizeToLocal();
+        void normalizeToRemote();
+        void _convertFromData( const MiscCommon::BYTEVector_t &_data );
+        void _convertToData( MiscCommon::BYTEVector_t *_data ) const;
+        bool operator== ( const SWnListDeltaCmd &val ) const
+        {
+            return ( m_epoch == val.m_epoch &&
+                     m_instance == val.m_instance &&
+                     m_full == val.m_full &&
+                     m_added == val.m_added &&
+                     m_removed == val.m_removed );
+        }
+
+        uint32_t m_epoch;
+        uint32_t m_instance;
+        uint8_t m_full;
+        MiscCommon::StringVector_t m_added;
+        MiscCommon::StringVector_t m_removed;
+    };
+    inline std::ostream &operator<< ( std::ostream &_stream, const SWnListDeltaCmd &val )
+    {
+        _stream
+                << "epoch " << val.m_epoch << ( val.m_full ? " (full)" : "" )
+                << ": +" << val.m_added.size() << " -" << val.m_removed.size();
+        return _stream;
+    }
+//=============================================================================
+    // an argument of cmdCREDIT: a number of bytes the peer may send in addition
+    struct SCreditCmd: public SBasicCmd<SCreditCmd>
+    {
+        SCreditCmd(): m_bytes( 0 )
+        {
+        }
+        void normalizeToLocal();
+        void normalizeToRemote();
+        size_t size() const
+        {
+            return sizeof( m_bytes );
+        }
+        void _convertFromData( const MiscCommon::BYTEVector_t &_data );
+        void _convertToData( MiscCommon::BYTEVector_t *_data ) const;
+        bool operator== ( const SCreditCmd &_val ) const
+        {
+            return ( m_bytes == _val.m_bytes );
+        }
+
+        uint32_t m_bytes;
+    };
+    inline std::ostream &operator<< ( std::ostream &_stream, const SCreditCmd &_val )
+    {
+        return _stream << _val.m_bytes;
+    }
+//=============================================================================
+    // an argument of cmdFILE_UPLOAD
+    // | SIZE (8) | CRC32C (4) | NAME string |
+    // m_crc is a checksum of the whole file, m_name is a file name without a path
+    struct SFileUploadCmd: public SBasicCmd<SFileUploadCmd>
+    {
+        SFileUploadCmd():
+            m_size( 0 ),
+            m_crc( 0 )
+        {
+        }
+        void normalizeToLocal();
+        void normalizeToRemote();
+        size_t size() const
+        {
+            return sizeof( m_size ) + sizeof( m_crc ) + m_name.size() + 1;
+        }
+        void _convertFromData( const MiscCommon::BYTEVector_t &_data );
+        void _convertToData( MiscCommon::BYTEVector_t *_data ) const;
+        bool operator== ( const SFileUploadCmd &_val ) const
+        {
+            return ( m_size == _val.m_size &&
+                     m_crc == _val.m_crc &&
+                     m_name == _val.m_name );
+        }
+
+        uint64_t m_size;
+        uint32_t m_crc;
+        std::string m_name;
+    };
+    inline std::ostream &operator<< ( std::ostream &_stream, const SFileUploadCmd &_val )
+    {
+        return _stream << _val.m_name << " (" << _val.m_size << " bytes, crc32c 0x"
+               << std::hex << _val.m_crc << std::dec << ")";
+    }
+//=============================================================================
+    // an answer on cmdFILE_UPLOAD: the receiver already has m_offset bytes of the file
+    struct SFileOffsetCmd: public SBasicCmd<SFileOffsetCmd>
+    {
+        SFileOffsetCmd(): m_offset( 0 )
+        {
+        }
+        void normalizeToLocal();
+        void normalizeToRemote();
+        size_t size() const
+        {
+            return sizeof( m_offset );
+        }
+        void _convertFromData( const MiscCommon::BYTEVector_t &_data );
+        void _convertToData( MiscCommon::BYTEVector_t *_data ) const;
+        bool operator== ( const SFileOffsetCmd &_val ) const
+        {
+            return ( m_offset == _val.m_offset );
+        }
+
+        uint64_t m_offset;
+    };
+    inline std::ostream &operator<< ( std::ostream &_stream, const SFileOffsetCmd &_val )
+    {
+        return _stream << _val.m_offset;
+    }
+//=============================================================================
+    enum EFileUploadStatus
+    {
+        fileOK = 0,
+        fileCRC_MISMATCH = 1, // the partial file is dropped, the next upload starts from scratch
+        fileIO_ERROR = 2
+    };
+    // an answer on the last cmdFILE_DATA
+    // | STATUS (2) | CRC32C (4) |
+    struct SFileStatusCmd: public SBasicCmd<SFileStatusCmd>
+    {
+        SFileStatusCmd():
+            m_status( fileOK ),
+            m_crc( 0 )
+        {
+        }
+        void normalizeToLocal();
+        void normalizeToRemote();
+        size_t size() const
+        {
+            return sizeof( m_status ) + sizeof( m_crc );
+        }
+        void _convertFromData( const MiscCommon::BYTEVector_t &_data );
+        void _convertToData( MiscCommon::BYTEVector_t *_data ) const;
+        bool operator== ( const SFileStatusCmd &_val ) const
+        {
+            return ( m_status == _val.m_status &&
+                     m_crc == _val.m_crc );
+        }
+
+        uint16_t m_status;
+        // a checksum calculated by the receiver
+        uint32_t m_crc;
+    };
+    inline std::ostream &operator<< ( std::ostream &_stream, const SFileStatusCmd &_val )
+    {
+        return _stream << "status " << _val.m_status << " crc32c 0x" << std::hex << _val.m_crc << std::dec;
+    }
+//=============================================================================
+    // an argument of cmdHANDOVER_LISTENER, the descriptor is attached to the message
+    // | NAME string |
+    struct SHandoverListenerCmd: public SBasicCmd<SHandoverListenerCmd>
+    {
+        void normalizeToLocal()
+        {
+        }
+        void normalizeToRemote()
+        {
+        }
+        size_t size() const
+        {
+            return m_name.size() + 1;
+        }
+        void _convertFromData( const MiscCommon::BYTEVector_t &_data );
+        void _convertToData( MiscCommon::BYTEVector_t *_data ) const;
+        bool operator== ( const SHandoverListenerCmd &_val ) const
+        {
+            return ( m_name == _val.m_name );
+        }
+
+        std::string m_name;
+    };
+    inline std::ostream &operator<< ( std::ostream &_stream, const SHandoverListenerCmd &_val )
+    {
+        return _stream << _val.m_name;
+    }
+//=============================================================================
+    // a state of CProtocol of a connection (see CProtocol::exportState), an argument of cmdHANDOVER_CONNECTION
+    // | CAPS (4) | SEND_CREDIT (8) | RECV_WINDOW (4) | RECV_GRANTED (8) | RECV_USED (8) | NAME string | BUFFERED bytes |
+    struct SProtocolStateCmd: public SBasicCmd<SProtocolStateCmd>
+    {
+        SProtocolStateCmd():
+            m_caps( 0 ),
+            m_sendCredit( 0 ),
+            m_recvWindow( 0 ),
+            m_recvGranted( 0 ),
+            m_recvUsed( 0 )
+        {
+        }
+        void normalizeToLocal();
+        void normalizeToRemote();
+        size_t size() const
+        {
+            return sizeof( m_caps ) + sizeof( m_sendCredit ) + sizeof( m_recvWindow ) +
+                   sizeof( m_recvGranted ) + sizeof( m_recvUsed ) + m_name.size() + 1 + m_buffered.size();
+        }
+        void _convertFromData( const MiscCommon::BYTEVector_t &_data );
+        void _convertToData( MiscCommon::BYTEVector_t *_data ) const;
+        bool operator== ( const SProtocolStateCmd &_val ) const
+        {
+            return ( m_caps == _val.m_caps &&
+                     m_sendCredit == _val.m_sendCredit &&
+                     m_recvWindow == _val.m_recvWindow &&
+                     m_recvGranted == _val.m_recvGranted &&
+                     m_recvUsed == _val.m_recvUsed &&
+                     m_name == _val.m_name &&
+                     m_buffered == _val.m_buffered );
+        }
+
+        uint32_t m_caps;
+        int64_t m_sendCredit;
+        uint32_t m_recvWindow;
+        uint64_t m_recvGranted;
+        uint64_t m_recvUsed;
+        // an application name of the connection (a worker id, ...)
+        std::string m_name;
+        // received, but not yet checked out bytes
+        MiscCommon::BYTEVector_t m_buffered;
+    };
+    inline std::ostream &operator<< ( std::ostream &_stream, const SProtocolStateCmd &_val )
+    {
+        return _stream
+               << _val.m_name << ": caps 0x" << std::hex << _val.m_caps << std::dec
+               << " credit " << _val.m_sendCredit << " buffered " << _val.m_buffered.size();
+    }
+//=============================================================================
+    // an argument of cmdHANDOVER_DONE: a number of passed (taken) descriptors
+    struct SHandoverDoneCmd: public SBasicCmd<SHandoverDoneCmd>
+    {
+        SHandoverDoneCmd(): m_count( 0 )
+        {
+        }
+        void normalizeToLocal();
+        void normalizeToRemote();
+        size_t size() const
+        {
+            return sizeof( m_count );
+        }
+        void _convertFromData( const MiscCommon::BYTEVector_t &_data );
+        void _convertToData( MiscCommon::BYTEVector_t *_data ) const;
+        bool operator== ( const SHandoverDoneCmd &_val ) const
+        {
+            return ( m_count == _val.m_count );
+        }
+
+        uint32_t m_count;
+    };
+    inline std::ostream &operator<< ( std::ostream &_stream, const SHandoverDoneCmd &_val )
+    {
+        return _stream << _val.m_count;
+    }
 }
 
 #endif /* PROTOCOLMESSAGES_H_ */
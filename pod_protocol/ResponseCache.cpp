@@ -0,0 +1,48 @@
+/************************************************************************/
+/**
+ * @file ResponseCache.cpp
+ * @brief A cache of framed answers on read-only protocol requests
+ * @author Anar Manafov A.Manafov@gsi.de
+ */ /*
+
+        version number:     $LastChangedRevision$
+        created by:         Anar Manafov
+                            2012-10-23
+        last changed by:    $LastChangedBy$ $LastChangedDate$
+
+        Copyright (c) 2012 GSI, Scientific Computing division. All rights reserved.
+*************************************************************************/
+#include "ResponseCache.h"
+//=============================================================================
+using namespace std;
+using namespace PROOFAgent;
+using namespace MiscCommon;
+//=============================================================================
+const BYTEVector_t *CResponseCache::find( uint16_t _cmd, const SFraming &_framing, uint64_t _generation )
+{
+    Container_t::const_iterator found = m_cache.find( Key_t( _cmd, _framing ) );
+    if( m_cache.end() == found || found->second.m_generation != _generation )
+    {
+        ++m_misses;
+        return NULL;
+    }
+
+    ++m_hits;
+    return &found->second.m_msg;
+}
+//=============================================================================
+const BYTEVector_t &CResponseCache::store( uint16_t _cmd, const SFraming &_framing, uint64_t _generation,
+                                           const BYTEVector_t &_msg )
+{
+    SEntry &entry = m_cache[Key_t( _cmd, _framing )];
+    entry.m_generation = _generation;
+    entry.m_msg = _msg;
+    return entry.m_msg;
+}
+//=============================================================================
+void CResponseCache::invalidate( uint16_t _cmd )
+{
+    Container_t::iterator iter = m_cache.lower_bound( Key_t( _cmd, SFraming() ) );
+    while( iter != m_cache.end() && iter->first.first == _cmd )
+        m_cache.erase( iter++ );
+}
@@ -0,0 +1,106 @@
+/************************************************************************/
+/**
+ * @file ResponseCache.h
+ * @brief A cache of framed answers on read-only protocol requests
+ * @author Anar Manafov A.Manafov@gsi.de
+ */ /*
+
+        version number:     $LastChangedRevision$
+        created by:         Anar Manafov
+                            2012-10-23
+        last changed by:    $LastChangedBy$ $LastChangedDate$
+
+        Copyright (c) 2012 GSI, Scientific Computing division. All rights reserved.
+*************************************************************************/
+#ifndef RESPONSECACHE_H_
+#define RESPONSECACHE_H_
+//=============================================================================
+// STD
+#include <map>
+// MiscCommon
+#include "def.h"
+// pod-protocol
+#include "Protocol.h"
+//=============================================================================
+namespace PROOFAgent
+{
+//=============================================================================
+    /**
+     *
+     * @brief The class keeps fully framed messages for answers, which rarely change
+     * @brief (cmdWNs_LIST, cmdWRK_NUM, cmdVERSION, ...).
+     * @brief An entry is valid as long as the generation of the underlying data is the same.
+     * @brief Entries are kept per framing (capabilities, compression dictionary and threshold),
+     * @brief since those define the bytes of a message.
+     * @note The class is not thread-safe.
+     * @note Example:
+     * @code
+     *
+     * const BYTEVector_t *msg = cache.find( cmdWNs_LIST, protocol.framing(), history.epoch() );
+     * if( !msg )
+     * {
+     *     SWnListCmd cmd;
+     *     ... fill cmd ...
+     *     BYTEVector_t data;
+     *     cmd.convertToData( &data );
+     *     msg = &cache.store( cmdWNs_LIST, protocol.framing(), history.epoch(),
+     *                         protocol.buildMsg( cmdWNs_LIST, data ) );
+     * }
+     * protocol.writeMsg( socket, *msg );
+     *
+     * @endcode
+     *
+     */
+    class CResponseCache
+    {
+            struct SEntry
+            {
+                SEntry():
+                    m_generation( 0 )
+                {
+                }
+                uint64_t m_generation;
+                MiscCommon::BYTEVector_t m_msg;
+            };
+            // command id and framing
+            typedef std::pair<uint16_t, SFraming> Key_t;
+            typedef std::map<Key_t, SEntry> Container_t;
+
+        public:
+            CResponseCache():
+                m_hits( 0 ),
+                m_misses( 0 )
+            {
+            }
+            // return: a cached message or NULL if there is none for the given generation
+            const MiscCommon::BYTEVector_t *find( uint16_t _cmd, const SFraming &_framing, uint64_t _generation );
+            // return: a reference to the cached copy of _msg, it stays valid until the next store of the same key
+            const MiscCommon::BYTEVector_t &store( uint16_t _cmd, const SFraming &_framing, uint64_t _generation,
+                                                   const MiscCommon::BYTEVector_t &_msg );
+            // drops all messages of the given command
+            void invalidate( uint16_t _cmd );
+            void clear()
+            {
+                m_cache.clear();
+            }
+            uint64_t hits() const
+            {
+                return m_hits;
+            }
+            uint64_t misses() const
+            {
+                return m_misses;
+            }
+
+        private:
+            Container_t m_cache;
+            uint64_t m_hits;
+            uint64_t m_misses;
+    };
+    inline std::ostream &operator<< ( std::ostream &_stream, const CResponseCache &_val )
+    {
+        return _stream << "response cache: hits " << _val.hits() << " misses " << _val.misses();
+    }
+}
+//=============================================================================
+#endif /* RESPONSECACHE_H_ */
@@ -0,0 +1,367 @@
+/************************************************************************/
+/**
+ * @file ShmTransport.cpp
+ * @brief A shared memory transport of protocol messages for co-located processes
+ * @author Anar Manafov A.Manafov@gsi.de
+ */ /*
+
+        version number:     $LastChangedRevision$
+        created by:         Anar Manafov
+                            2012-11-16
+        last changed by:    $LastChangedBy$ $LastChangedDate$
+
+        Copyright (c) 2012 GSI, Scientific Computing division. All rights reserved.
+*************************************************************************/
+#include "ShmTransport.h"
+// STD
+#include <algorithm>
+#include <stdexcept>
+#include <cstring>
+// API
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <sys/eventfd.h>
+#include <sys/syscall.h>
+#endif
+// MiscCommon
+#include "ErrorCode.h"
+#include "INet.h"
+//=============================================================================
+using namespace std;
+using namespace PROOFAgent;
+using namespace MiscCommon;
+//=============================================================================
+namespace
+{
+    const uint32_t SHM_MAGIC = 0x504F4453; // "PODS"
+    const size_t CACHE_LINE = 64;
+    // a sleeping side re-checks the ring at least this often (ms)
+    const int SLEEP_CHECK_MS = 100;
+
+    inline void cpuRelax()
+    {
+#if defined(__i386__) || defined(__x86_64__)
+        asm volatile( "pause" ::: "memory" );
+#else
+        asm volatile( "" ::: "memory" );
+#endif
+    }
+
+    int createMemfd()
+    {
+#if defined(__linux__) && defined(SYS_memfd_create)
+        const int memfd = syscall( SYS_memfd_create, "pod-shm", 1 /*MFD_CLOEXEC*/ );
+        if( memfd >= 0 )
+            return memfd;
+#endif
+        // older kernels: an unlinked file of the tmpfs
+        char path[] = "/dev/shm/pod-shm-XXXXXX";
+        const int fd = mkstemp( path );
+        if( fd < 0 )
+            throw system_error( "Can't create a shared memory segment" );
+        ::unlink( path );
+        return fd;
+    }
+
+    int createEventFd()
+    {
+#ifdef __linux__
+        const int fd = eventfd( 0, EFD_NONBLOCK | EFD_CLOEXEC );
+        if( fd < 0 )
+            throw system_error( "Can't create an eventfd" );
+        return fd;
+#else
+        throw runtime_error( "The shared memory transport requires Linux." );
+#endif
+    }
+
+    struct SSegment
+    {
+        uint32_t m_magic;
+        uint32_t m_ringSize;
+    };
+}
+//=============================================================================
+// one direction of the transport, lives in the shared segment
+struct CShmTransport::SRing
+{
+    // bytes ever written, changed only by the producer
+    volatile uint64_t m_head;
+    char m_pad1[CACHE_LINE - sizeof( uint64_t )];
+    // bytes ever read, changed only by the consumer
+    volatile uint64_t m_tail;
+    char m_pad2[CACHE_LINE - sizeof( uint64_t )];
+    // the consumer sleeps (or polls fd()) waiting for data
+    volatile uint32_t m_readerWaiting;
+    // the producer sleeps waiting for space
+    volatile uint32_t m_writerWaiting;
+    // the producer has closed the transport
+    volatile uint32_t m_closed;
+    char m_pad3[CACHE_LINE - 3 * sizeof( uint32_t )];
+};
+//=============================================================================
+//=============================================================================
+//=============================================================================
+CShmTransport::CShmTransport():
+    m_memfd( -1 ),
+    m_side( 0 ),
+    m_base( NULL ),
+    m_mapSize( 0 ),
+    m_in( NULL ),
+    m_out( NULL ),
+    m_inData( NULL ),
+    m_outData( NULL ),
+    m_mask( 0 ),
+    m_nonBlock( false ),
+    // spinning only steals the time of the peer on a single CPU
+    m_spinNs( ::sysconf( _SC_NPROCESSORS_ONLN ) > 1 ? g_shmSpinNs : 0 )
+{
+    m_efd[0] = m_efd[1] = -1;
+}
+//=============================================================================
+CShmTransport::~CShmTransport()
+{
+    close();
+    release();
+}
+//=============================================================================
+void CShmTransport::release()
+{
+    if( m_base )
+        ::munmap( m_base, m_mapSize );
+    m_base = NULL;
+    if( -1 != m_memfd )
+        ::close( m_memfd );
+    m_memfd = -1;
+    for( size_t i = 0; i < 2; ++i )
+    {
+        if( -1 != m_efd[i] )
+            ::close( m_efd[i] );
+        m_efd[i] = -1;
+    }
+}
+//=============================================================================
+void CShmTransport::create( size_t _ringSize )
+{
+    release();
+    size_t ringSize( CACHE_LINE );
+    while( ringSize < _ringSize )
+        ringSize <<= 1;
+
+    m_memfd = createMemfd();
+    const size_t size( CACHE_LINE + 2 * ( sizeof( SRing ) + ringSize ) );
+    if( ::ftruncate( m_memfd, size ) < 0 )
+        throw system_error( "Can't size the shared memory segment" );
+    m_efd[0] = createEventFd();
+    m_efd[1] = createEventFd();
+
+    // a new file is zero filled, so both rings are empty
+    SSegment segment;
+    segment.m_magic = SHM_MAGIC;
+    segment.m_ringSize = ringSize;
+    if( ::pwrite( m_memfd, &segment, sizeof( segment ), 0 ) != sizeof( segment ) )
+        throw system_error( "Can't initialize the shared memory segment" );
+
+    m_side = 0;
+    map( m_memfd );
+}
+//=============================================================================
+void CShmTransport::map( int _memfd )
+{
+    struct stat st;
+    if( ::fstat( _memfd, &st ) < 0 )
+        throw system_error( "Can't stat the shared memory segment" );
+    m_mapSize = st.st_size;
+    if( m_mapSize < CACHE_LINE + 2 * sizeof( SRing ) )
+        throw runtime_error( "Bad shared memory segment." );
+
+    void *base = ::mmap( NULL, m_mapSize, PROT_READ | PROT_WRITE, MAP_SHARED, _memfd, 0 );
+    if( MAP_FAILED == base )
+        throw system_error( "Can't map the shared memory segment" );
+    m_base = static_cast<unsigned char *>( base );
+
+    const SSegment *segment = reinterpret_cast<const SSegment *>( m_base );
+    const size_t ringSize( segment->m_ringSize );
+    if( SHM_MAGIC != segment->m_magic || 0 == ringSize || ( ringSize & ( ringSize - 1 ) ) ||
+        m_mapSize != CACHE_LINE + 2 * ( sizeof( SRing ) + ringSize ) )
+        throw runtime_error( "Bad shared memory segment." );
+    m_mask = ringSize - 1;
+
+    // | SSegment | ring 0 | data 0 | ring 1 | data 1 |, side 0 writes the ring 0
+    unsigned char *ring0 = m_base + CACHE_LINE;
+    unsigned char *ring1 = ring0 + sizeof( SRing ) + ringSize;
+    m_out = reinterpret_cast<SRing *>( 0 == m_side ? ring0 : ring1 );
+    m_in = reinterpret_cast<SRing *>( 0 == m_side ? ring1 : ring0 );
+    m_outData = reinterpret_cast<unsigned char *>( m_out ) + sizeof( SRing );
+    m_inData = reinterpret_cast<unsigned char *>( m_in ) + sizeof( SRing );
+}
+//=============================================================================
+void CShmTransport::sendTo( int _socket ) const
+{
+    if( !is_valid() )
+        throw logic_error( "The shared memory transport is not created." );
+    INet::send_fd( _socket, m_memfd );
+    INet::send_fd( _socket, m_efd[0] );
+    INet::send_fd( _socket, m_efd[1] );
+}
+//=============================================================================
+void CShmTransport::receiveFrom( int _socket )
+{
+    release();
+    m_memfd = INet::recv_fd( _socket );
+    m_efd[0] = INet::recv_fd( _socket );
+    m_efd[1] = INet::recv_fd( _socket );
+    m_side = 1;
+    map( m_memfd );
+}
+//=============================================================================
+void CShmTransport::wake( int _side ) const
+{
+    const uint64_t one( 1 );
+    // EAGAIN means the counter is already signaled
+    while( ::write( m_efd[_side], &one, sizeof( one ) ) < 0 && EINTR == errno )
+        ;
+}
+//=============================================================================
+void CShmTransport::sleep() const
+{
+    pollfd pfd;
+    pfd.fd = m_efd[m_side];
+    pfd.events = POLLIN;
+    pfd.revents = 0;
+    if( ::poll( &pfd, 1, SLEEP_CHECK_MS ) < 0 && EINTR != errno )
+        throw system_error( "Error occurred while waiting for the shared memory peer" );
+    uint64_t counter( 0 );
+    while( ::read( m_efd[m_side], &counter, sizeof( counter ) ) < 0 && EINTR == errno )
+        ;
+}
+//=============================================================================
+ssize_t CShmTransport::read( unsigned char *_buf, size_t _len, bool _wait )
+{
+    if( !is_valid() )
+        throw logic_error( "The shared memory transport is not created." );
+    const bool wait( _wait && !m_nonBlock );
+
+    uint64_t spinUntil( 0 );
+    while( true )
+    {
+        const uint64_t tail( m_in->m_tail );
+        const uint64_t head( m_in->m_head );
+        __sync_synchronize();
+        if( head != tail )
+        {
+            if( m_in->m_readerWaiting )
+                m_in->m_readerWaiting = 0;
+
+            const size_t n( min( static_cast<uint64_t>( _len ), head - tail ) );
+            const size_t pos( tail & m_mask );
+            const size_t first( min( n, static_cast<size_t>( m_mask + 1 - pos ) ) );
+            memcpy( _buf, m_inData + pos, first );
+            memcpy( _buf + first, m_inData, n - first );
+            __sync_synchronize();
+            m_in->m_tail = tail + n;
+            __sync_synchronize();
+            if( m_in->m_writerWaiting )
+                wake( 1 - m_side );
+            return n;
+        }
+        if( m_in->m_closed )
+            return 0;
+
+        if( !wait && !m_nonBlock )
+        {
+            // a probe of a blocking transport, nobody is going to poll fd()
+            errno = EAGAIN;
+            return -1;
+        }
+        if( wait && m_spinNs > 0 )
+        {
+            if( 0 == spinUntil )
+                spinUntil = metricsNowNs() + m_spinNs;
+            if( metricsNowNs() < spinUntil )
+            {
+                for( size_t i = 0; i < 64 && m_in->m_head == tail; ++i )
+                    cpuRelax();
+                continue;
+            }
+        }
+
+        // announce the wait and re-check, the writer signals only announced waiters
+        m_in->m_readerWaiting = 1;
+        __sync_synchronize();
+        if( m_in->m_head != tail || m_in->m_closed )
+            continue;
+        if( !wait )
+        {
+            errno = EAGAIN;
+            return -1;
+        }
+        sleep();
+    }
+}
+//=============================================================================
+void CShmTransport::write( const unsigned char *_buf, size_t _len )
+{
+    if( !is_valid() )
+        throw logic_error( "The shared memory transport is not created." );
+
+    uint64_t spinUntil( 0 );
+    while( _len > 0 )
+    {
+        if( m_in->m_closed )
+            throw runtime_error( "The shared memory peer has closed the transport." );
+
+        const uint64_t head( m_out->m_head );
+        const uint64_t tail( m_out->m_tail );
+        __sync_synchronize();
+        const uint64_t space( m_mask + 1 - ( head - tail ) );
+        if( space > 0 )
+        {
+            if( m_out->m_writerWaiting )
+                m_out->m_writerWaiting = 0;
+
+            const size_t n( min( static_cast<uint64_t>( _len ), space ) );
+            const size_t pos( head & m_mask );
+            const size_t first( min( n, static_cast<size_t>( m_mask + 1 - pos ) ) );
+            memcpy( m_outData + pos, _buf, first );
+            memcpy( m_outData, _buf + first, n - first );
+            __sync_synchronize();
+            m_out->m_head = head + n;
+            __sync_synchronize();
+            if( m_out->m_readerWaiting )
+                wake( 1 - m_side );
+            _buf += n;
+            _len -= n;
+            spinUntil = 0;
+            continue;
+        }
+
+        if( 0 == spinUntil )
+            spinUntil = metricsNowNs() + m_spinNs;
+        if( metricsNowNs() < spinUntil )
+        {
+            cpuRelax();
+            continue;
+        }
+        m_out->m_writerWaiting = 1;
+        __sync_synchronize();
+        if( m_out->m_tail != tail )
+            continue;
+        sleep();
+    }
+}
+//=============================================================================
+void CShmTransport::close()
+{
+    if( !is_valid() || m_out->m_closed )
+        return;
+    __sync_synchronize();
+    m_out->m_closed = 1;
+    __sync_synchronize();
+    wake( 1 - m_side );
+}
@@ -0,0 +1,124 @@
+/************************************************************************/
+/**
+ * @file ShmTransport.h
+ * @brief A shared memory transport of protocol messages for co-located processes
+ * @author Anar Manafov A.Manafov@gsi.de
+ */ /*
+
+        version number:     $LastChangedRevision$
+        created by:         Anar Manafov
+                            2012-11-16
+        last changed by:    $LastChangedBy$ $LastChangedDate$
+
+        Copyright (c) 2012 GSI, Scientific Computing division. All rights reserved.
+*************************************************************************/
+#ifndef SHMTRANSPORT_H_
+#define SHMTRANSPORT_H_
+//=============================================================================
+// API
+#include <sys/types.h>
+#include <stdint.h>
+// MiscCommon
+#include "def.h"
+#include "MiscUtils.h"
+//=============================================================================
+namespace PROOFAgent
+{
+//=============================================================================
+    // a default capacity of each direction, a power of 2
+    const size_t g_shmRingSize = 1024 * 1024;
+    // a default time a reader spins before it sleeps on the eventfd (no spinning on a single CPU)
+    const uint32_t g_shmSpinNs = 50000;
+//=============================================================================
+    /**
+     *
+     * @brief The class connects two processes of the same host by a pair of single producer/single consumer
+     * @brief byte rings in a memfd segment. A side, which waits for data or for space, sleeps on its eventfd
+     * @brief after a short spin, the other side signals the eventfd only if the waiter has announced itself,
+     * @brief so a busy connection runs without syscalls.
+     * @brief The segment and the eventfds are passed to the peer over an AF_UNIX socket (SCM_RIGHTS).
+     * @note CProtocol uses the transport by setShm, its functions get fd() instead of a socket then.
+     * @note The transport doesn't detect a crash of the peer, use the AF_UNIX socket for that.
+     * @note Example:
+     * @code
+     *
+     * // the agent
+     * CShmTransport shm;
+     * shm.create();
+     * shm.sendTo( ui_socket );
+     * CProtocol protocol;
+     * protocol.setShm( &shm );
+     * protocol.writeSimpleCmd( shm.fd(), cmdGET_WRK_NUM );
+     *
+     * // the UI
+     * CShmTransport shm;
+     * shm.receiveFrom( agent_socket );
+     * protocol.setShm( &shm );
+     * protocol.read( shm.fd() );
+     *
+     * @endcode
+     *
+     */
+    class CShmTransport: public MiscCommon::NONCopyable
+    {
+            struct SRing;
+
+        public:
+            CShmTransport();
+            ~CShmTransport();
+
+            // creates the segment, _ringSize is rounded up to a power of 2
+            void create( size_t _ringSize = g_shmRingSize );
+            // passes the segment to the peer, which calls receiveFrom
+            void sendTo( int _socket ) const;
+            void receiveFrom( int _socket );
+            bool is_valid() const
+            {
+                return ( NULL != m_base );
+            }
+            // the eventfd of this side, it becomes readable, when read or write would not block anymore
+            int fd() const
+            {
+                return m_efd[m_side];
+            }
+            // read returns -1 with EAGAIN instead of waiting, fd() can be polled then
+            void setNonBlock( bool _val = true )
+            {
+                m_nonBlock = _val;
+            }
+            void setSpin( uint32_t _ns )
+            {
+                m_spinNs = _ns;
+            }
+
+            // return: a number of read bytes, 0 if the peer has closed the transport,
+            // -1 and EAGAIN if there is no data and _wait is false or the transport is non-blocking
+            ssize_t read( unsigned char *_buf, size_t _len, bool _wait = true );
+            // writes all bytes, waits for space if the ring is full
+            void write( const unsigned char *_buf, size_t _len );
+            // the peer reads the remaining data and gets 0 then
+            void close();
+
+        private:
+            void release();
+            void map( int _memfd );
+            void wake( int _side ) const;
+            void sleep() const;
+
+        private:
+            int m_memfd;
+            int m_efd[2];
+            int m_side;
+            unsigned char *m_base;
+            size_t m_mapSize;
+            SRing *m_in;
+            SRing *m_out;
+            unsigned char *m_inData;
+            unsigned char *m_outData;
+            uint64_t m_mask;
+            bool m_nonBlock;
+            uint32_t m_spinNs;
+    };
+}
+//=============================================================================
+#endif /* SHMTRANSPORT_H_ */
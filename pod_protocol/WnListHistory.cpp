@@ -0,0 +1,162 @@
+/************************************************************************/
+/**
+ * @file WnListHistory.cpp
+ * @brief Versioned list of workers, used to answer cmdGET_WNs_LIST_DELTA
+ * @author Anar Manafov A.Manafov@gsi.de
+ */ /*
+
+        version number:     $LastChangedRevision$
+        created by:         Anar Manafov
+                            2012-10-16
+        last changed by:    $LastChangedBy$ $LastChangedDate$
+
+        Copyright (c) 2012 GSI, Scientific Computing division. All rights reserved.
+*************************************************************************/
+#include "WnListHistory.h"
+// API
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+// STD
+#include <algorithm>
+#include <iterator>
+//=============================================================================
+using namespace std;
+using namespace PROOFAgent;
+using namespace MiscCommon;
+//=============================================================================
+namespace
+{
+    // a random non-zero id, histories of one process differ as well
+    uint32_t newInstance()
+    {
+        static uint32_t counter( 0 );
+        uint32_t ret( 0 );
+        const int fd = ::open( "/dev/urandom", O_RDONLY );
+        if( fd >= 0 )
+        {
+            if( ::read( fd, &ret, sizeof( ret ) ) != sizeof( ret ) )
+                ret = 0;
+            ::close( fd );
+        }
+        // no /dev/urandom: the start time and the pid
+        ret ^= static_cast<uint32_t>( time( NULL ) ) ^ ( static_cast<uint32_t>( getpid() ) << 16 ) ^ ++counter;
+        return ( 0 == ret ) ? 1 : ret;
+    }
+}
+//=============================================================================
+CWnListHistory::CWnListHistory( size_t _maxHistory ):
+    m_epoch( 0 ),
+    m_instance( newInstance() ),
+    m_maxHistory( _maxHistory )
+{
+}
+//=============================================================================
+bool CWnListHistory::add( const string &_wn )
+{
+    if( !m_list.insert( _wn ).second )
+        return false;
+
+    record( true, _wn );
+    return true;
+}
+//=============================================================================
+bool CWnListHistory::remove( const string &_wn )
+{
+    StringSet_t::iterator iter = m_list.find( _wn );
+    if( m_list.end() == iter )
+        return false;
+
+    // record first, _wn may refer to the element we are going to erase
+    record( false, _wn );
+    m_list.erase( iter );
+    return true;
+}
+//=============================================================================
+void CWnListHistory::assign( const StringVector_t &_list )
+{
+    const StringSet_t newList( _list.begin(), _list.end() );
+
+    StringVector_t removed;
+    set_difference( m_list.begin(), m_list.end(), newList.begin(), newList.end(),
+                    back_inserter( removed ) );
+    StringVector_t added;
+    set_difference( newList.begin(), newList.end(), m_list.begin(), m_list.end(),
+                    back_inserter( added ) );
+
+    StringVector_t::const_iterator iter = removed.begin();
+    StringVector_t::const_iterator iter_end = removed.end();
+    for( ; iter != iter_end; ++iter )
+        remove( *iter );
+
+    iter = added.begin();
+    iter_end = added.end();
+    for( ; iter != iter_end; ++iter )
+        add( *iter );
+}
+//=============================================================================
+void CWnListHistory::record( bool _added, const string &_wn )
+{
+    ++m_epoch;
+    m_history.push_back( SChange( m_epoch, _added, _wn ) );
+    if( m_history.size() > m_maxHistory )
+        m_history.pop_front();
+}
+//=============================================================================
+void CWnListHistory::getDelta( const SEpochCmd &_since, SWnListDeltaCmd *_delta ) const
+{
+    _delta->m_epoch = m_epoch;
+    _delta->m_instance = m_instance;
+    _delta->m_added.clear();
+    _delta->m_removed.clear();
+    _delta->m_full = 0;
+
+    const uint32_t since( _since.m_epoch );
+    const bool sameInstance( _since.m_instance == m_instance );
+    if( sameInstance && since == m_epoch )
+        return;
+
+    // the client never got the list, got it from another instance (the server was restarted),
+    // or the history doesn't reach back to its epoch
+    const bool truncated( !m_history.empty() && m_history.front().m_epoch > since + 1 );
+    if( !sameInstance || 0 == since || since > m_epoch || truncated || m_history.empty() )
+    {
+        _delta->m_full = 1;
+        _delta->m_added.assign( m_list.begin(), m_list.end() );
+        return;
+    }
+
+    // net changes: a worker, which was added and removed again, is not reported
+    map<string, int> net;
+    History_t::const_reverse_iterator iter = m_history.rbegin();
+    History_t::const_reverse_iterator iter_end = m_history.rend();
+    for( ; iter != iter_end && iter->m_epoch > since; ++iter )
+        net[iter->m_wn] += iter->m_added ? 1 : -1;
+
+    map<string, int>::const_iterator wn = net.begin();
+    map<string, int>::const_iterator wn_end = net.end();
+    for( ; wn != wn_end; ++wn )
+    {
+        if( wn->second > 0 )
+            _delta->m_added.push_back( wn->first );
+        else if( wn->second < 0 )
+            _delta->m_removed.push_back( wn->first );
+    }
+}
+//=============================================================================
+//=============================================================================
+//=============================================================================
+void CWnListReplica::apply( const SWnListDeltaCmd &_delta )
+{
+    if( _delta.m_full )
+        m_list.clear();
+
+    StringVector_t::const_iterator iter = _delta.m_removed.begin();
+    StringVector_t::const_iterator iter_end = _delta.m_removed.end();
+    for( ; iter != iter_end; ++iter )
+        m_list.erase( *iter );
+
+    m_list.insert( _delta.m_added.begin(), _delta.m_added.end() );
+    m_epoch = _delta.m_epoch;
+    m_instance = _delta.m_instance;
+}
@@ -0,0 +1,131 @@
+/************************************************************************/
+/**
+ * @file WnListHistory.h
+ * @brief Versioned list of workers, used to answer cmdGET_WNs_LIST_DELTA
+ * @author Anar Manafov A.Manafov@gsi.de
+ */ /*
+
+        version number:     $LastChangedRevision$
+        created by:         Anar Manafov
+                            2012-10-16
+        last changed by:    $LastChangedBy$ $LastChangedDate$
+
+        Copyright (c) 2012 GSI, Scientific Computing division. All rights reserved.
+*************************************************************************/
+#ifndef WNLISTHISTORY_H_
+#define WNLISTHISTORY_H_
+//=============================================================================
+// STD
+#include <deque>
+// MiscCommon
+#include "def.h"
+// pod-protocol
+#include "ProtocolCommands.h"
+//=============================================================================
+namespace PROOFAgent
+{
+//=============================================================================
+    /**
+     *
+     * @brief The server side of the incremental workers list.
+     * @brief Every change of the list increments the epoch. The last _maxHistory changes are kept,
+     * @brief older clients get a full snapshot.
+     * @brief Epochs restart with the server, so every history has a random instance id.
+     * @brief Clients of another instance (a restarted server) get a full snapshot too.
+     *
+     */
+    class CWnListHistory
+    {
+            struct SChange
+            {
+                SChange( uint32_t _epoch, bool _added, const std::string &_wn ):
+                    m_epoch( _epoch ),
+                    m_added( _added ),
+                    m_wn( _wn )
+                {
+                }
+                uint32_t m_epoch;
+                bool m_added;
+                std::string m_wn;
+            };
+            typedef std::deque<SChange> History_t;
+
+        public:
+            CWnListHistory( size_t _maxHistory = 16 * 1024 );
+            // return false if the worker is already in the list
+            bool add( const std::string &_wn );
+            // return false if the worker is not in the list
+            bool remove( const std::string &_wn );
+            // replaces the whole list, only differences are recorded
+            void assign( const MiscCommon::StringVector_t &_list );
+            uint32_t epoch() const
+            {
+                return m_epoch;
+            }
+            // never 0, it is the instance of a client, which has never got the list
+            uint32_t instance() const
+            {
+                return m_instance;
+            }
+            const MiscCommon::StringSet_t &list() const
+            {
+                return m_list;
+            }
+            // fills _delta with changes after the epoch _since
+            // or with a full snapshot if the history is already truncated or _since is of another instance.
+            void getDelta( const SEpochCmd &_since, SWnListDeltaCmd *_delta ) const;
+
+        private:
+            void record( bool _added, const std::string &_wn );
+
+        private:
+            MiscCommon::StringSet_t m_list;
+            History_t m_history;
+            uint32_t m_epoch;
+            uint32_t m_instance;
+            size_t m_maxHistory;
+    };
+//=============================================================================
+    /**
+     *
+     * @brief The client side of the incremental workers list.
+     *
+     */
+    class CWnListReplica
+    {
+        public:
+            CWnListReplica():
+                m_epoch( 0 ),
+                m_instance( 0 )
+            {
+            }
+            uint32_t epoch() const
+            {
+                return m_epoch;
+            }
+            uint32_t instance() const
+            {
+                return m_instance;
+            }
+            // the argument of the next cmdGET_WNs_LIST_DELTA
+            SEpochCmd request() const
+            {
+                SEpochCmd ret;
+                ret.m_epoch = m_epoch;
+                ret.m_instance = m_instance;
+                return ret;
+            }
+            void apply( const SWnListDeltaCmd &_delta );
+            const MiscCommon::StringSet_t &list() const
+            {
+                return m_list;
+            }
+
+        private:
+            MiscCommon::StringSet_t m_list;
+            uint32_t m_epoch;
+            uint32_t m_instance;
+    };
+}
+//=============================================================================
+#endif /* WNLISTHISTORY_H_ */
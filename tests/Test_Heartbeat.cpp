@@ -0,0 +1,136 @@
+/************************************************************************/
+/**
+ * @file Test_Heartbeat.cpp
+ * @brief Unit tests of Heartbeat
+ * @author Anar Manafov A.Manafov@gsi.de
+ */ /*
+
+        version number:     $LastChangedRevision$
+        created by:         Anar Manafov
+                            2012-11-22
+        last changed by:    $LastChangedBy$ $LastChangedDate$
+
+        Copyright (c) 2012 GSI, Scientific Computing division. All rights reserved.
+*************************************************************************/
+// BOOST: tests
+// Defines test_main function to link with actual unit test code.
+#define BOOST_TEST_DYN_LINK
+#define BOOST_AUTO_TEST_MAIN    // Boost 1.33
+#define BOOST_TEST_MAIN
+#include <boost/test/auto_unit_test.hpp>
+// STD
+#include <algorithm>
+#include <stdexcept>
+#include <string>
+#include <vector>
+// API
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+// MiscCommon
+#include "Heartbeat.h"
+//=============================================================================
+using namespace std;
+using namespace MiscCommon;
+using namespace MiscCommon::INet;
+using boost::unit_test::test_suite;
+//=============================================================================
+BOOST_AUTO_TEST_SUITE( MiscCommon_Heartbeat );
+//=============================================================================
+BOOST_AUTO_TEST_CASE( test_heartbeat )
+{
+    // the reference vectors of SipHash-2-4
+    unsigned char key[16];
+    unsigned char msg[15];
+    for( size_t i = 0; i < sizeof( key ); ++i )
+        key[i] = i;
+    for( size_t i = 0; i < sizeof( msg ); ++i )
+        msg[i] = i;
+    BOOST_CHECK_EQUAL( siphash24( key, msg, 0 ), 0x726fdb47dd0e0e31ULL );
+    BOOST_CHECK_EQUAL( siphash24( key, msg, 15 ), 0xa129ca6149be45e5ULL );
+
+    BOOST_CHECK_THROW( SHeartbeatKey( "" ), invalid_argument );
+    const SHeartbeatKey secret( "0123456789abcdef" );
+    CHeartbeatMonitor monitor( secret, 200, 10 );
+    const string loopback( "127.0.0.1" );
+    const unsigned short port( monitor.bind( 0, &loopback ) );
+    vector<uint32_t> workers;
+    for( uint32_t i = 0; i < 1000; ++i )
+    {
+        workers.push_back( i );
+        monitor.watch( i );
+    }
+    BOOST_CHECK( monitor.isAlive( 999 ) );
+    BOOST_CHECK( !monitor.isAlive( 1000 ) );
+
+    CHeartbeatSender sender( secret );
+    // "localhost" may resolve to ::1 first, the monitor is IPv4 only
+    sender.connect( port, "localhost" );
+    vector<uint32_t> missed;
+    // half of the workers go silent, the other half beats every round,
+    // a round ends, when the monitor has processed all its beats
+    const vector<uint32_t> beating( workers.begin(), workers.begin() + 500 );
+    size_t rounds( 0 );
+    for( ; rounds < 1000 && missed.size() < 500; ++rounds )
+    {
+        const uint64_t accepted( monitor.stats().m_accepted );
+        sender.beat( beating );
+        for( int i = 0; i < 100 && monitor.stats().m_accepted < accepted + beating.size(); ++i )
+            monitor.process( 10, &missed );
+        BOOST_REQUIRE_EQUAL( monitor.stats().m_accepted, accepted + beating.size() );
+        monitor.process( 10, &missed );
+    }
+    BOOST_CHECK_EQUAL( sender.refused(), 0u );
+    BOOST_CHECK_EQUAL( missed.size(), 500u );
+    sort( missed.begin(), missed.end() );
+    BOOST_CHECK_EQUAL( missed.front(), 500u );
+    BOOST_CHECK_EQUAL( missed.back(), 999u );
+    BOOST_CHECK( monitor.isAlive( 0 ) );
+    BOOST_CHECK( !monitor.isAlive( 500 ) );
+    BOOST_CHECK_EQUAL( monitor.stats().m_accepted, 500 * rounds );
+    BOOST_CHECK_EQUAL( monitor.stats().m_missed, 500u );
+
+    // a silent worker is alive again with its next beat
+    sender.beat( 500 );
+    for( int i = 0; i < 100 && !monitor.isAlive( 500 ); ++i )
+        monitor.process( 10, NULL );
+    BOOST_CHECK( monitor.isAlive( 500 ) );
+    // a repeated connect replaces the socket
+    sender.connect( port, loopback );
+    const uint64_t accepted( monitor.stats().m_accepted );
+    sender.beat( 0 );
+    for( int i = 0; i < 100 && monitor.stats().m_accepted == accepted; ++i )
+        monitor.process( 10, NULL );
+    BOOST_CHECK_EQUAL( monitor.stats().m_accepted, accepted + 1 );
+
+    // forged, replayed and unknown beats are rejected
+    const SHeartbeatStats before( monitor.stats() );
+    CHeartbeatSender forger( SHeartbeatKey( "wrong key" ) );
+    forger.connect( port, loopback );
+    forger.beat( 1 );
+    monitor.watch( 2000 );
+    SHeartbeat beat;
+    beat.m_worker = 2000;
+    beat.m_seq = 1;
+    unsigned char buf[SHeartbeat::SIZE];
+    beat.encode( secret, buf );
+    const int udp( socket( AF_INET, SOCK_DGRAM, 0 ) );
+    sockaddr_in addr;
+    memset( &addr, 0, sizeof( addr ) );
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons( port );
+    inet_aton( loopback.c_str(), &addr.sin_addr );
+    for( int i = 0; i < 2; ++i )
+        BOOST_REQUIRE( SHeartbeat::SIZE == sendto( udp, buf, sizeof( buf ), 0, reinterpret_cast<sockaddr *>( &addr ), sizeof( addr ) ) );
+    sender.beat( 5000 );
+    while( monitor.stats().m_received < before.m_received + 4 )
+        monitor.process( 10, NULL );
+    BOOST_CHECK_EQUAL( monitor.stats().m_badSignature, before.m_badSignature + 1 );
+    BOOST_CHECK_EQUAL( monitor.stats().m_accepted, before.m_accepted + 1 );
+    BOOST_CHECK_EQUAL( monitor.stats().m_replayed, before.m_replayed + 1 );
+    BOOST_CHECK_EQUAL( monitor.stats().m_unknown, before.m_unknown + 1 );
+    ::close( udp );
+}
+//=============================================================================
+BOOST_AUTO_TEST_SUITE_END();
@@ -0,0 +1,275 @@
+/************************************************************************/
+/**
+ * @file Test_INet.cpp
+ * @brief Unit tests of INet
+ * @author Anar Manafov A.Manafov@gsi.de
+ */ /*
+
+        version number:     $LastChangedRevision$
+        created by:         Anar Manafov
+                            2012-11-20
+        last changed by:    $LastChangedBy$ $LastChangedDate$
+
+        Copyright (c) 2012 GSI, Scientific Computing division. All rights reserved.
+*************************************************************************/
+// BOOST: tests
+// Defines test_main function to link with actual unit test code.
+#define BOOST_TEST_DYN_LINK
+#define BOOST_AUTO_TEST_MAIN    // Boost 1.33
+#define BOOST_TEST_MAIN
+#include <boost/test/auto_unit_test.hpp>
+// STD
+#include <cerrno>
+#include <cstring>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+// API
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <fcntl.h>
+#include <unistd.h>
+// MiscCommon
+#include "INet.h"
+#include "Metrics.h"
+//=============================================================================
+using namespace std;
+using namespace MiscCommon;
+using namespace MiscCommon::INet;
+using boost::unit_test::test_suite;
+//=============================================================================
+BOOST_AUTO_TEST_SUITE( MiscCommon_INet );
+//=============================================================================
+#ifdef __linux__
+BOOST_AUTO_TEST_CASE( test_tcp_diag )
+{
+    CSocketServer server;
+    const string loopback( "127.0.0.1" );
+    server.Bind( 0, &loopback );
+    server.Listen( 1 );
+    sockaddr_in addr;
+    socklen_t len( sizeof( addr ) );
+    getsockname( server.getSocket(), reinterpret_cast<sockaddr *>( &addr ), &len );
+    CSocketClient client;
+    client.connect( ntohs( addr.sin_port ), loopback );
+    smart_socket accepted( server.Accept() );
+
+    // unread data is seen in the input queue of the peer
+    const BYTEVector_t data( 1000, 'q' );
+    BOOST_REQUIRE( 1000 == ::write( client.getSocket(), &data[0], data.size() ) );
+    STcpDiag diag;
+    for( int i = 0; i < 100 && diag.get( STcpDiag::fINQ ) < data.size(); ++i )
+    {
+        BOOST_REQUIRE( accepted.tcp_diag( &diag ) );
+        usleep( 1000 );
+    }
+    BOOST_CHECK( diag.m_tcp );
+    BOOST_CHECK_EQUAL( diag.get( STcpDiag::fINQ ), data.size() );
+    BOOST_CHECK( diag.get( STcpDiag::fCWND ) > 0 );
+
+    // AF_UNIX sockets have no TCP_INFO
+    int fds[2];
+    BOOST_REQUIRE( 0 == socketpair( AF_UNIX, SOCK_STREAM, 0, fds ) );
+    STcpDiag local;
+    BOOST_REQUIRE( tcp_diag( fds[0], &local ) );
+    BOOST_CHECK( !local.m_tcp );
+    BOOST_CHECK( !tcp_diag( -1, &local ) );
+
+    CTcpDiagSummary summary;
+    summary.add( diag );
+    summary.add( local );
+    BOOST_CHECK( summary.add( client.getSocket() ) );
+    BOOST_CHECK_EQUAL( summary.size( STcpDiag::fRTT ), 2u );
+    BOOST_CHECK_EQUAL( summary.size( STcpDiag::fINQ ), 3u );
+    BOOST_CHECK_EQUAL( summary.percentile( STcpDiag::fINQ, 100 ), data.size() );
+    BOOST_CHECK_EQUAL( summary.percentile( STcpDiag::fINQ, 50 ), 0u );
+    stringstream ss;
+    ss << summary;
+    BOOST_CHECK( ss.str().find( "inq_bytes: p50 0" ) != string::npos );
+
+    // the sample as gauges of a registry
+    CMetricsRegistry registry;
+    BOOST_CHECK( publish_tcp_diag( accepted.get(), metricsLabel( "peer", "client" ), registry ) );
+    BOOST_CHECK( publish_tcp_diag( fds[0], metricsLabel( "peer", "local" ), registry ) );
+    BOOST_CHECK( !publish_tcp_diag( -1, "", registry ) );
+    stringstream exposition;
+    registry.writePrometheus( exposition );
+    BOOST_CHECK( string::npos != exposition.str().find( "misccommon_tcp_inq_bytes{peer=\"client\"} 1000\n" ) );
+    BOOST_CHECK( string::npos != exposition.str().find( "misccommon_tcp_inq_bytes{peer=\"local\"} 0\n" ) );
+    BOOST_CHECK( string::npos != exposition.str().find( "misccommon_tcp_rtt_us{peer=\"client\"}" ) );
+    BOOST_CHECK( string::npos == exposition.str().find( "misccommon_tcp_rtt_us{peer=\"local\"}" ) );
+
+    ::close( fds[0] );
+    ::close( fds[1] );
+}
+#else
+BOOST_AUTO_TEST_CASE( test_tcp_diag )
+{
+    // no diagnostics off Linux, the sample is left empty
+    int fds[2];
+    BOOST_REQUIRE( 0 == socketpair( AF_UNIX, SOCK_STREAM, 0, fds ) );
+    STcpDiag diag;
+    BOOST_CHECK( !tcp_diag( fds[0], &diag ) );
+    BOOST_CHECK_EQUAL( diag.get( STcpDiag::fINQ ), 0u );
+    ::close( fds[0] );
+    ::close( fds[1] );
+}
+#endif
+//=============================================================================
+int socketOption( int _socket, int _level, int _option )
+{
+    int val( -1 );
+    socklen_t len( sizeof( val ) );
+    BOOST_REQUIRE( 0 == getsockopt( _socket, _level, _option, &val, &len ) );
+    return val;
+}
+//=============================================================================
+BOOST_AUTO_TEST_CASE( test_socket_profile )
+{
+    CSocketServer server;
+    const string loopback( "127.0.0.1" );
+    server.Bind( 0, &loopback );
+    server.setProfile( profileLOW_LATENCY );
+    server.Listen( 1 );
+    sockaddr_in addr;
+    socklen_t len( sizeof( addr ) );
+    getsockname( server.getSocket(), reinterpret_cast<sockaddr *>( &addr ), &len );
+
+    CSocketClient client;
+    client.setProfile( profileLOW_LATENCY );
+    client.connect( ntohs( addr.sin_port ), loopback );
+    smart_socket accepted( server.Accept() );
+    BOOST_CHECK( 0 != socketOption( client.getSocket(), IPPROTO_TCP, TCP_NODELAY ) );
+    BOOST_CHECK( 0 != socketOption( accepted.get(), IPPROTO_TCP, TCP_NODELAY ) );
+
+    // the bulk profile enables Nagle again and sets the buffers (the kernel reports them doubled)
+    apply_profile( client.getSocket(), profileBULK, 128 * 1024 );
+    BOOST_CHECK_EQUAL( socketOption( client.getSocket(), IPPROTO_TCP, TCP_NODELAY ), 0 );
+    BOOST_CHECK_EQUAL( socketOption( client.getSocket(), SOL_SOCKET, SO_RCVBUF ), 256 * 1024 );
+#ifdef __linux__
+    // buffers only grow, to at least the minimum
+    const size_t tuned( autotune_buffers( client.getSocket(), 256 * 1024 ) );
+    BOOST_CHECK( 0 == tuned || tuned >= 256 * 1024 );
+    BOOST_CHECK_EQUAL( autotune_buffers( client.getSocket(), 0, 64 * 1024 ), 0u );
+    // each buffer is grown on its own, TCP_NODELAY is kept
+    const int nodelay( 1 );
+    const int sndBuf( 16 * 1024 );
+    const int rcvBuf( 128 * 1024 );
+    BOOST_REQUIRE( 0 == setsockopt( client.getSocket(), IPPROTO_TCP, TCP_NODELAY, &nodelay, sizeof( nodelay ) ) );
+    BOOST_REQUIRE( 0 == setsockopt( client.getSocket(), SOL_SOCKET, SO_SNDBUF, &sndBuf, sizeof( sndBuf ) ) );
+    BOOST_REQUIRE( 0 == setsockopt( client.getSocket(), SOL_SOCKET, SO_RCVBUF, &rcvBuf, sizeof( rcvBuf ) ) );
+    BOOST_CHECK_EQUAL( autotune_buffers( client.getSocket(), 64 * 1024, 64 * 1024 ), 64u * 1024 );
+    BOOST_CHECK_EQUAL( socketOption( client.getSocket(), SOL_SOCKET, SO_SNDBUF ), 128 * 1024 );
+    BOOST_CHECK_EQUAL( socketOption( client.getSocket(), SOL_SOCKET, SO_RCVBUF ), 256 * 1024 );
+    BOOST_CHECK( 0 != socketOption( client.getSocket(), IPPROTO_TCP, TCP_NODELAY ) );
+#endif
+
+#if defined(TCP_CORK) || defined(TCP_NOPUSH)
+#ifdef TCP_CORK
+    const int corkOption( TCP_CORK );
+#else
+    const int corkOption( TCP_NOPUSH );
+#endif
+    {
+        CCorkGuard cork( client.getSocket() );
+        BOOST_CHECK( 0 != socketOption( client.getSocket(), IPPROTO_TCP, corkOption ) );
+    }
+    BOOST_CHECK_EQUAL( socketOption( client.getSocket(), IPPROTO_TCP, corkOption ), 0 );
+#endif
+
+    // not TCP sockets are left untouched
+    int fds[2];
+    BOOST_REQUIRE( 0 == socketpair( AF_UNIX, SOCK_STREAM, 0, fds ) );
+    apply_profile( fds[0], profileLOW_LATENCY );
+    ::close( fds[0] );
+    ::close( fds[1] );
+}
+//=============================================================================
+BOOST_AUTO_TEST_CASE( test_connect )
+{
+    CSocketServer server;
+    const string loopback( "127.0.0.1" );
+    server.Bind( 0, &loopback );
+    server.Listen( 256 );
+    sockaddr_in addr;
+    socklen_t len( sizeof( addr ) );
+    getsockname( server.getSocket(), reinterpret_cast<sockaddr *>( &addr ), &len );
+    const unsigned short port( ntohs( addr.sin_port ) );
+
+    // a bound, but not listening socket: connections are refused
+    CSocketServer closed;
+    closed.Bind( 0, &loopback );
+    getsockname( closed.getSocket(), reinterpret_cast<sockaddr *>( &addr ), &len );
+    const unsigned short refusedPort( ntohs( addr.sin_port ) );
+
+    CSocketClient client;
+    client.connect( port, loopback );
+    const int accepted( server.Accept() );
+    BOOST_CHECK( accepted >= 0 );
+    ::close( accepted );
+
+    // failed attempts are repeated after the backoff: 50 + 100 ms
+    SConnectPolicy policy;
+    policy.m_attempts = 3;
+    policy.m_backoffMs = 50;
+    const uint64_t start( monotonic_ms() );
+    BOOST_CHECK_THROW( connect_to( loopback, refusedPort, policy ), runtime_error );
+    BOOST_CHECK( monotonic_ms() - start >= 150 );
+
+    // many connections at once, a few in flight
+    ConnectTargets_t targets( 100, SConnectTarget( loopback, port ) );
+    targets[50] = SConnectTarget( loopback, refusedPort );
+    ConnectResults_t results;
+    connect_all( targets, &results, 8 );
+    BOOST_REQUIRE_EQUAL( results.size(), targets.size() );
+    for( size_t i = 0; i < results.size(); ++i )
+    {
+        if( 50 == i )
+        {
+            BOOST_CHECK_EQUAL( results[i].m_socket, INVALID_SOCKET );
+            BOOST_CHECK_EQUAL( results[i].m_errno, ECONNREFUSED );
+            BOOST_CHECK( !results[i].m_error.empty() );
+            continue;
+        }
+        BOOST_REQUIRE( results[i].m_socket >= 0 );
+        BOOST_CHECK( 0 == ( fcntl( results[i].m_socket, F_GETFL ) & O_NONBLOCK ) );
+        ::close( results[i].m_socket );
+        ::close( server.Accept() );
+    }
+}
+//=============================================================================
+BOOST_AUTO_TEST_CASE( test_socket2string )
+{
+    CSocketServer server;
+    const string loopback( "127.0.0.1" );
+    server.Bind( 0, &loopback );
+    sockaddr_in addr;
+    socklen_t len( sizeof( addr ) );
+    getsockname( server.getSocket(), reinterpret_cast<sockaddr *>( &addr ), &len );
+    string name;
+    socket2string( server.getSocket(), &name );
+    stringstream port;
+    port << ":" << ntohs( addr.sin_port );
+    BOOST_CHECK( !name.empty() );
+    BOOST_CHECK( name.size() > port.str().size() && 0 == name.compare( name.size() - port.str().size(), string::npos, port.str() ) );
+
+    // IPv6 sockets, if the host has IPv6 loopback
+    smart_socket v6( AF_INET6, SOCK_STREAM, 0 );
+    sockaddr_in6 addr6;
+    memset( &addr6, 0, sizeof( addr6 ) );
+    addr6.sin6_family = AF_INET6;
+    addr6.sin6_addr = in6addr_loopback;
+    if( !v6.is_valid() || 0 != ::bind( v6.get(), reinterpret_cast<sockaddr *>( &addr6 ), sizeof( addr6 ) ) )
+        return;
+    len = sizeof( addr6 );
+    getsockname( v6.get(), reinterpret_cast<sockaddr *>( &addr6 ), &len );
+    name.clear();
+    socket2string( v6.get(), &name );
+    stringstream port6;
+    port6 << ":" << ntohs( addr6.sin6_port );
+    BOOST_CHECK( !name.empty() );
+    BOOST_CHECK( name.size() > port6.str().size() && 0 == name.compare( name.size() - port6.str().size(), string::npos, port6.str() ) );
+}
+//=============================================================================
+BOOST_AUTO_TEST_SUITE_END();
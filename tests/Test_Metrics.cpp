@@ -0,0 +1,152 @@
+/************************************************************************/
+/**
+ * @file Test_Metrics.cpp
+ * @brief Unit tests of Metrics and MetricsServer
+ * @author Anar Manafov A.Manafov@gsi.de
+ */ /*
+
+        version number:     $LastChangedRevision$
+        created by:         Anar Manafov
+                            2012-11-29
+        last changed by:    $LastChangedBy$ $LastChangedDate$
+
+        Copyright (c) 2012 GSI, Scientific Computing division. All rights reserved.
+*************************************************************************/
+// BOOST: tests
+// Defines test_main function to link with actual unit test code.
+#define BOOST_TEST_DYN_LINK
+#define BOOST_AUTO_TEST_MAIN    // Boost 1.33
+#define BOOST_TEST_MAIN
+#include <boost/test/auto_unit_test.hpp>
+// STD
+#include <sstream>
+#include <stdexcept>
+#include <string>
+// API
+#include <pthread.h>
+#include <sys/socket.h>
+#include <unistd.h>
+// MiscCommon
+#include "INet.h"
+#include "Metrics.h"
+#include "MetricsServer.h"
+//=============================================================================
+using namespace std;
+using namespace MiscCommon;
+using namespace MiscCommon::INet;
+using boost::unit_test::test_suite;
+//=============================================================================
+BOOST_AUTO_TEST_SUITE( MiscCommon_Metrics );
+//=============================================================================
+void *addToCounter( void *_counter )
+{
+    for( size_t i = 0; i < 100000; ++i )
+        reinterpret_cast<CCounter *>( _counter )->add();
+    return NULL;
+}
+//=============================================================================
+// sends _request to the metrics server and returns the response
+string scrapeMetrics( CMetricsServer *_server, int _socket, const string &_request )
+{
+    sendall( _socket, reinterpret_cast<const unsigned char *>( _request.c_str() ), _request.size(), 0 );
+    if( _server )
+        BOOST_CHECK_EQUAL( _server->process( 1000 ), 1u );
+    string response;
+    char buf[4096];
+    ssize_t n( 0 );
+    while( ( n = ::recv( _socket, buf, sizeof( buf ), 0 ) ) > 0 )
+        response.append( buf, n );
+    return response;
+}
+//=============================================================================
+BOOST_AUTO_TEST_CASE( test_metrics )
+{
+    // the buckets of the histogram: powers of two are exact, the others are at most 1/8 too large
+    BOOST_CHECK_EQUAL( CHistogram::upperBound( CHistogram::bucket( 0 ) ), 1u );
+    for( uint64_t value = 1; value < ( 1ULL << CHistogram::MAX_BITS ); value = value * 3 + 1 )
+    {
+        const uint64_t upper( CHistogram::upperBound( CHistogram::bucket( value ) ) );
+        BOOST_CHECK( upper >= value && upper - value <= value / 8 );
+    }
+    for( size_t bits = 0; bits <= CHistogram::MAX_BITS; ++bits )
+        BOOST_CHECK_EQUAL( CHistogram::upperBound( CHistogram::bucket( 1ULL << bits ) ), 1ULL << bits );
+    BOOST_CHECK_EQUAL( CHistogram::bucket( 1ULL << 50 ), static_cast<size_t>( CHistogram::BUCKETS - 1 ) );
+
+    CMetricsRegistry registry;
+    CCounter &requests = registry.counter( "test_requests_total", "Requests", metricsLabel( "path", "/x" ) );
+    BOOST_CHECK_EQUAL( &requests, &registry.counter( "test_requests_total", "Requests", metricsLabel( "path", "/x" ) ) );
+    BOOST_CHECK_THROW( registry.gauge( "test_requests_total", "Requests" ), logic_error );
+    BOOST_CHECK_THROW( registry.counter( "bad name", "" ), invalid_argument );
+    // updates of several threads
+    pthread_t threads[4];
+    for( size_t i = 0; i < 4; ++i )
+        BOOST_REQUIRE( 0 == pthread_create( &threads[i], NULL, &addToCounter, &requests ) );
+    for( size_t i = 0; i < 4; ++i )
+        pthread_join( threads[i], NULL );
+    BOOST_CHECK_EQUAL( requests.value(), 400000u );
+
+    CGauge &connections = registry.gauge( "test_connections", "Open connections" );
+    connections.set( 10 );
+    connections.add( -3 );
+    BOOST_CHECK_EQUAL( connections.value(), 7 );
+
+    CHistogram &latency = registry.histogram( "test_latency_seconds", "Latency", "", 1e-9 );
+    for( uint64_t i = 1; i <= 1000; ++i )
+        latency.record( i );
+    SHistogramSnapshot snapshot;
+    latency.snapshot( &snapshot );
+    BOOST_CHECK_EQUAL( snapshot.m_count, 1000u );
+    BOOST_CHECK_EQUAL( snapshot.m_sum, 500500u );
+    BOOST_CHECK_EQUAL( snapshot.cumulative( 512 ), 512u );
+    BOOST_CHECK( snapshot.quantile( 0.5 ) >= 500 && snapshot.quantile( 0.5 ) <= 500 + 500 / 8 );
+    BOOST_CHECK( snapshot.quantile( 1 ) >= 1000 && snapshot.quantile( 1 ) <= 1000 + 1000 / 8 );
+
+    stringstream exposition;
+    registry.writePrometheus( exposition );
+    const string text( exposition.str() );
+    BOOST_CHECK( string::npos != text.find( "# TYPE test_requests_total counter\n" ) );
+    BOOST_CHECK( string::npos != text.find( "test_requests_total{path=\"/x\"} 400000\n" ) );
+    BOOST_CHECK( string::npos != text.find( "test_connections 7\n" ) );
+    BOOST_CHECK( string::npos != text.find( "# TYPE test_latency_seconds histogram\n" ) );
+    BOOST_CHECK( string::npos != text.find( "test_latency_seconds_bucket{le=\"5.12e-07\"} 512\n" ) );
+    BOOST_CHECK( string::npos != text.find( "test_latency_seconds_bucket{le=\"+Inf\"} 1000\n" ) );
+    BOOST_CHECK( string::npos != text.find( "test_latency_seconds_count 1000\n" ) );
+
+    // the exposition endpoint, served by the caller and by the thread of the server
+    CMetricsServer server( registry );
+    const unsigned short port( server.listen( 0 ) );
+    server.listenLocal( "@MiscCommon_test_metrics" );
+    {
+        CSocketClient client;
+        client.connect( port, "127.0.0.1" );
+        const string response( scrapeMetrics( &server, client.getSocket(), "GET /metrics HTTP/1.1\r\nHost: localhost\r\n\r\n" ) );
+        BOOST_CHECK_EQUAL( response.substr( 0, 15 ), "HTTP/1.0 200 OK" );
+        BOOST_CHECK( string::npos != response.find( "\r\n\r\n" + text.substr( 0, 10 ) ) );
+    }
+    {
+        CSocketClient client( AF_UNIX );
+        client.connectLocal( "@MiscCommon_test_metrics" );
+        const string response( scrapeMetrics( &server, client.getSocket(), "GET /other HTTP/1.0\r\n\r\n" ) );
+        BOOST_CHECK_EQUAL( response.substr( 0, 12 ), "HTTP/1.0 404" );
+    }
+    {
+        // a client, which resets its connection before it is accepted, doesn't block the server
+        CSocketClient client;
+        client.connect( port, "127.0.0.1" );
+        const linger reset = { 1, 0 };
+        BOOST_REQUIRE( 0 == setsockopt( client.getSocket(), SOL_SOCKET, SO_LINGER, &reset, sizeof( reset ) ) );
+        ::close( client.detach() );
+        server.process( 100 );
+        BOOST_CHECK_EQUAL( server.process( 0 ), 0u );
+    }
+    server.start();
+    {
+        CSocketClient client( AF_UNIX );
+        client.connectLocal( "@MiscCommon_test_metrics" );
+        const string response( scrapeMetrics( NULL, client.getSocket(), "GET /metrics HTTP/1.0\r\n\r\n" ) );
+        BOOST_CHECK( string::npos != response.find( "test_connections 7\n" ) );
+    }
+    server.stop();
+}
+//=============================================================================
+BOOST_AUTO_TEST_SUITE_END();
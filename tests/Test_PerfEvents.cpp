@@ -0,0 +1,138 @@
+/************************************************************************/
+/**
+ * @file Test_PerfEvents.cpp
+ * @brief Unit tests of PerfEvents
+ * @author Anar Manafov A.Manafov@gsi.de
+ */ /*
+
+        version number:     $LastChangedRevision$
+        created by:         Anar Manafov
+                            2012-12-01
+        last changed by:    $LastChangedBy$ $LastChangedDate$
+
+        Copyright (c) 2012 GSI, Scientific Computing division. All rights reserved.
+*************************************************************************/
+// BOOST: tests
+// Defines test_main function to link with actual unit test code.
+#define BOOST_TEST_DYN_LINK
+#define BOOST_AUTO_TEST_MAIN    // Boost 1.33
+#define BOOST_TEST_MAIN
+#include <boost/test/auto_unit_test.hpp>
+// STD
+#include <sstream>
+#include <string>
+#include <vector>
+// API
+#include <pthread.h>
+// MiscCommon
+#include "PerfEvents.h"
+#include "Trace.h"
+//=============================================================================
+using namespace std;
+using namespace MiscCommon;
+using boost::unit_test::test_suite;
+//=============================================================================
+BOOST_AUTO_TEST_SUITE( MiscCommon_PerfEvents );
+//=============================================================================
+// a loop, which the compiler can't drop
+uint64_t perfWork( size_t _n )
+{
+    volatile uint64_t sum( 0 );
+    for( size_t i = 0; i < _n; ++i )
+        sum += i * i;
+    return sum;
+}
+//=============================================================================
+void *perfInThread( void * )
+{
+    perfWork( 1000000 );
+    return NULL;
+}
+//=============================================================================
+BOOST_AUTO_TEST_CASE( test_perf_events )
+{
+    SPerfValues a;
+    SPerfValues b;
+    a.m_valid = ( 1u << perfCYCLES ) | ( 1u << perfINSTRUCTIONS );
+    b.m_valid = 1u << perfINSTRUCTIONS;
+    a.m_values[perfINSTRUCTIONS] = 100;
+    b.m_values[perfINSTRUCTIONS] = 40;
+    const SPerfValues diff( a - b );
+    BOOST_CHECK( diff.valid( perfINSTRUCTIONS ) );
+    BOOST_CHECK( !diff.valid( perfCYCLES ) );
+    BOOST_CHECK_EQUAL( diff.m_values[perfINSTRUCTIONS], 60u );
+    // a counter never goes back, a smaller value isn't a huge delta
+    BOOST_CHECK_EQUAL( ( b - a ).m_values[perfINSTRUCTIONS], 0u );
+    SPerfValues sum( SPerfValues::zero() );
+    sum += diff;
+    sum += diff;
+    BOOST_CHECK_EQUAL( sum.m_valid, diff.m_valid );
+    BOOST_CHECK_EQUAL( sum.m_values[perfINSTRUCTIONS], 120u );
+    BOOST_CHECK_EQUAL( string( perfCounterName( perfCACHE_MISSES ) ), "cache_misses" );
+
+    // perf events are often restricted (containers, VMs without a PMU),
+    // the group must work either way: it measures or it reports why not
+    CPerfGroup group;
+    SPerfValues delta;
+    {
+        CPerfScope scope( group, &delta );
+        perfWork( 1000000 );
+    }
+    if( group.available() )
+    {
+        BOOST_CHECK( 0 != delta.m_valid );
+        if( delta.valid( perfINSTRUCTIONS ) )
+            BOOST_CHECK( delta.m_values[perfINSTRUCTIONS] > 1000000 );
+    }
+    else
+    {
+        BOOST_TEST_MESSAGE( "hardware counters are unavailable: " << group.error() );
+        BOOST_CHECK( !group.error().empty() );
+        BOOST_CHECK_EQUAL( delta.m_valid, 0u );
+        SPerfValues values;
+        BOOST_CHECK( !group.read( &values ) );
+    }
+
+    // inherited counters count the threads started after the construction
+    CPerfGroup inherited( true );
+    BOOST_CHECK_EQUAL( inherited.available(), group.available() );
+    SPerfValues before;
+    inherited.read( &before );
+    pthread_t thread;
+    BOOST_REQUIRE( 0 == pthread_create( &thread, NULL, &perfInThread, NULL ) );
+    pthread_join( thread, NULL );
+    SPerfValues after;
+    inherited.read( &after );
+    if( ( after - before ).valid( perfINSTRUCTIONS ) )
+        BOOST_CHECK( ( after - before ).m_values[perfINSTRUCTIONS] > 1000000 );
+
+    // the counter deltas of spans
+    CTracer &tracer( CTracer::instance() );
+    tracer.clear();
+    tracer.enable( 64, true );
+    {
+        CTraceSpan span( "counted", "test" );
+        span.setArg( "n", 7 );
+        perfWork( 100000 );
+    }
+    vector<STraceEvent> events;
+    tracer.snapshot( &events );
+    BOOST_REQUIRE_EQUAL( events.size(), 1u );
+    stringstream json;
+    tracer.writeChromeTrace( json );
+    if( group.available() )
+    {
+        BOOST_CHECK_EQUAL( events[0].m_perfValid, delta.m_valid );
+        BOOST_CHECK( string::npos != json.str().find( ",\"args\":{\"n\":7," ) );
+    }
+    else
+    {
+        BOOST_CHECK_EQUAL( events[0].m_perfValid, 0u );
+        BOOST_CHECK( string::npos != json.str().find( ",\"args\":{\"n\":7}}" ) );
+    }
+    tracer.enable( 64 );
+    tracer.disable();
+    tracer.clear();
+}
+//=============================================================================
+BOOST_AUTO_TEST_SUITE_END();
@@ -0,0 +1,2027 @@
+/************************************************************************/
+/**
+ * @file Test_Protocol.cpp
+ * @brief Unit tests of pod_protocol
+ * @author Anar Manafov A.Manafov@gsi.de
+ */ /*
+
+        version number:     $LastChangedRevision$
+        created by:         Anar Manafov
+                            2012-10-02
+        last changed by:    $LastChangedBy$ $LastChangedDate$
+
+        Copyright (c) 2012 GSI, Scientific Computing division. All rights reserved.
+*************************************************************************/
+// BOOST: tests
+// Defines test_main function to link with actual unit test code.
+#define BOOST_TEST_DYN_LINK
+#define BOOST_AUTO_TEST_MAIN    // Boost 1.33
+#define BOOST_TEST_MAIN
+#include <boost/test/auto_unit_test.hpp>
+// BOOST
+#include <boost/bind.hpp>
+// STD
+#include <stdexcept>
+#include <fstream>
+#include <set>
+#include <map>
+#include <algorithm>
+#include <iterator>
+// API
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <netinet/tcp.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+// pod-protocol
+#include "Protocol.h"
+#include "ProtocolCommands.h"
+#include "CRC32C.h"
+#include "Compression.h"
+#include "WnListHistory.h"
+#include "ResponseCache.h"
+#include "FileTransfer.h"
+#include "CmdDispatcher.h"
+#include "FanOut.h"
+#include "OutputQueue.h"
+#include "ChannelMux.h"
+#include "INet.h"
+#include "ShmTransport.h"
+#include "Handover.h"
+#ifdef __linux__
+#include "EventLoop.h"
+#include "AsyncConnection.h"
+#endif
+#include "Capture.h"
+#include "Metrics.h"
+#include "Log.h"
+#include "Trace.h"
+//=============================================================================
+using namespace std;
+using namespace MiscCommon;
+using namespace MiscCommon::INet;
+using namespace PROOFAgent;
+using boost::unit_test::test_suite;
+//=============================================================================
+BOOST_AUTO_TEST_SUITE( pod_protocol );
+//=============================================================================
+BOOST_AUTO_TEST_CASE( test_crc32c )
+{
+    // the check value of CRC-32C
+    const string val( "123456789" );
+    const unsigned char *p = reinterpret_cast<const unsigned char *>( val.c_str() );
+    BOOST_CHECK_EQUAL( crc32c( 0, p, val.size() ), 0xE3069283 );
+    // chaining
+    BOOST_CHECK_EQUAL( crc32c( crc32c( 0, p, 4 ), p + 4, val.size() - 4 ), 0xE3069283 );
+}
+//=============================================================================
+BOOST_AUTO_TEST_CASE( test_msg_v1 )
+{
+    BYTEVector_t data( 1000, 'x' );
+    BYTEVector_t msg( createMsg( cmdGET_HOST_INFO, data ) );
+    BOOST_CHECK_EQUAL( msg.size(), data.size() + 16 );
+
+    BYTEVector_t res;
+    SMessageHeader header = parseMsg( &res, msg );
+    BOOST_CHECK( header.isValid() );
+    BOOST_CHECK_EQUAL( header.m_wireVersion, wireV1 );
+    BOOST_CHECK_EQUAL( header.m_cmd, cmdGET_HOST_INFO );
+    BOOST_CHECK_EQUAL( header.m_len, data.size() );
+    BOOST_CHECK( res == data );
+}
+//=============================================================================
+BOOST_AUTO_TEST_CASE( test_msg_v2 )
+{
+    BYTEVector_t data( 1000, 'x' );
+    BYTEVector_t msg( createMsg( cmdGET_HOST_INFO, data, capHEADER_V2 ) );
+    // MAGIC + FLAGS + CMD + LEN (2 bytes)
+    BOOST_CHECK_EQUAL( msg.size(), data.size() + 5 );
+
+    BYTEVector_t res;
+    SMessageHeader header = parseMsg( &res, msg );
+    BOOST_CHECK( header.isValid() );
+    BOOST_CHECK_EQUAL( header.m_wireVersion, wireV2 );
+    BOOST_CHECK_EQUAL( header.m_cmd, cmdGET_HOST_INFO );
+    BOOST_CHECK_EQUAL( header.m_len, data.size() );
+    BOOST_CHECK( res == data );
+
+    // an incomplete message
+    BYTEVector_t part( msg.begin(), msg.end() - 1 );
+    res.clear();
+    BOOST_CHECK( !parseMsg( &res, part ).isValid() );
+    part.resize( 3 );
+    BOOST_CHECK( !parseMsg( &res, part ).isValid() );
+}
+//=============================================================================
+BOOST_AUTO_TEST_CASE( test_msg_v2_crc )
+{
+    BYTEVector_t data( 100, 'x' );
+    BYTEVector_t msg( createMsg( cmdWNs_LIST, data, capHEADER_V2 | capCRC32C ) );
+
+    BYTEVector_t res;
+    SMessageHeader header = parseMsg( &res, msg );
+    BOOST_CHECK( header.isValid() );
+    BOOST_CHECK( header.m_flags & flagCRC32C );
+    BOOST_CHECK( res == data );
+
+    msg[msg.size() / 2] ^= 0x01;
+    res.clear();
+    BOOST_CHECK_THROW( parseMsg( &res, msg ), runtime_error );
+}
+//=============================================================================
+BOOST_AUTO_TEST_CASE( test_version_caps )
+{
+    SVersionCmd ver;
+    BYTEVector_t data;
+    ver.convertToData( &data );
+    BOOST_CHECK_EQUAL( data.size(), ver.size() );
+
+    SVersionCmd ver_res;
+    ver_res.convertFromData( data );
+    BOOST_CHECK( ver == ver_res );
+    BOOST_CHECK_EQUAL( ver_res.m_caps, protocolCaps() );
+
+    // an old peer sends only a version
+    data.resize( sizeof( uint16_t ) );
+    SVersionCmd old_ver;
+    old_ver.convertFromData( data );
+    BOOST_CHECK_EQUAL( old_ver.m_version, g_protocolCommandsVersion );
+    BOOST_CHECK_EQUAL( old_ver.m_caps, 0 );
+
+    CProtocol protocol;
+    protocol.negotiate( old_ver.m_caps );
+    BOOST_CHECK_EQUAL( protocol.caps(), 0 );
+    protocol.negotiate( ver_res.m_caps );
+    BOOST_CHECK_EQUAL( protocol.caps(), protocolCaps() );
+}
+//=============================================================================
+BOOST_AUTO_TEST_CASE( test_compression )
+{
+    const ECompressionCodec codec( selectCodec( compressionCaps() ) );
+    if( codecNONE == codec )
+        return;
+
+    SWnListCmd cmd;
+    for( size_t i = 0; i < 1000; ++i )
+    {
+        stringstream ss;
+        ss << "pod@wn" << i << ".gsi.de:22";
+        cmd.m_container.push_back( ss.str() );
+    }
+    BYTEVector_t data;
+    cmd.convertToData( &data );
+
+    BYTEVector_t payload;
+    BOOST_CHECK( compressPayload( codec, data, &payload ) );
+    BOOST_CHECK( payload.size() < data.size() / 2 );
+
+    BYTEVector_t res;
+    decompressPayload( payload, &res );
+    BOOST_CHECK( res == data );
+
+    // over a socket
+    int fds[2];
+    BOOST_REQUIRE( 0 == socketpair( AF_UNIX, SOCK_STREAM, 0, fds ) );
+    CProtocol sender;
+    sender.negotiate( protocolCaps() );
+    CProtocol receiver;
+    sender.write( fds[0], cmdWNs_LIST, data );
+    ::close( fds[0] );
+    while( CProtocol::stOK == receiver.read( fds[1] ) )
+        ;
+    ::close( fds[1] );
+
+    BOOST_REQUIRE( receiver.checkoutNextMsg() );
+    res.clear();
+    SMessageHeader header = receiver.getMsg( &res );
+    BOOST_CHECK_EQUAL( header.m_cmd, cmdWNs_LIST );
+    BOOST_CHECK_EQUAL( header.m_len, data.size() );
+    BOOST_CHECK( !( header.m_flags & flagCOMPRESSED ) );
+    BOOST_CHECK( res == data );
+
+    // a decompression bomb: a few bytes, which claim 200 MB
+    BYTEVector_t bomb( 1, codec );
+    putVarint( &bomb, 200 * 1024 * 1024 );
+    bomb.insert( bomb.end(), 4, 0 );
+    res.clear();
+    BOOST_CHECK_THROW( decompressPayload( bomb, &res ), runtime_error );
+    // an unknown codec is rejected before the size is looked at
+    bomb[0] = 0x7F;
+    BOOST_CHECK_THROW( decompressPayload( bomb, &res ), runtime_error );
+    // an empty raw payload
+    BYTEVector_t empty( 1, codec );
+    putVarint( &empty, 0 );
+    res.assign( 3, 'x' );
+    decompressPayload( empty, &res );
+    BOOST_CHECK_EQUAL( res.size(), 3u );
+}
+//=============================================================================
+// every codec on its own, codecs missing in this build are skipped
+BOOST_AUTO_TEST_CASE( test_compression_codecs )
+{
+    const uint32_t caps[] = { capZLIB, capZSTD, capLZ4 };
+    const ECompressionCodec codecs[] = { codecZLIB, codecZSTD, codecLZ4 };
+    const char *names[] = { "zlib", "zstd", "lz4" };
+
+    SWnListCmd cmd;
+    for( size_t i = 0; i < 1000; ++i )
+    {
+        stringstream ss;
+        ss << "pod@wn" << i << ".gsi.de:22";
+        cmd.m_container.push_back( ss.str() );
+    }
+    BYTEVector_t data;
+    cmd.convertToData( &data );
+    CCompressionDict dict;
+    dict.train( vector<BYTEVector_t>( 1, data ) );
+
+    for( size_t i = 0; i < sizeof( caps ) / sizeof( caps[0] ); ++i )
+    {
+        BYTEVector_t payload;
+        if( !( compressionCaps() & caps[i] ) )
+        {
+            BOOST_TEST_MESSAGE( names[i] << " isn't built in, skipped" );
+            BOOST_CHECK( !compressPayload( codecs[i], data, &payload ) );
+            continue;
+        }
+        BOOST_CHECK_EQUAL( selectCodec( caps[i] ), codecs[i] );
+        BOOST_REQUIRE( compressPayload( codecs[i], data, &payload ) );
+        BOOST_CHECK( payload.size() < data.size() / 2 );
+        BYTEVector_t res;
+        decompressPayload( payload, &res );
+        BOOST_CHECK( res == data );
+
+        payload.clear();
+        BOOST_REQUIRE( compressPayload( codecs[i], data, &payload, &dict ) );
+        res.clear();
+        decompressPayload( payload, &res, &dict );
+        BOOST_CHECK( res == data );
+    }
+}
+//=============================================================================
+BOOST_AUTO_TEST_CASE( test_compression_dict )
+{
+    const ECompressionCodec codec( selectCodec( compressionCaps() ) );
+    if( codecNONE == codec )
+        return;
+
+    vector<BYTEVector_t> samples;
+    for( size_t i = 0; i < 100; ++i )
+    {
+        SHostInfoCmd cmd;
+        cmd.m_username = "pod";
+        stringstream ss;
+        ss << "wn" << i << ".gsi.de";
+        cmd.m_host = ss.str();
+        cmd.m_version = "3.12";
+        cmd.m_PoDPath = "/home/pod/.PoD/wn/PoDWorker/long/path/to/the/installation";
+        BYTEVector_t data;
+        cmd.convertToData( &data );
+        samples.push_back( data );
+    }
+    CCompressionDict dict;
+    dict.train( samples );
+    BOOST_CHECK( !dict.empty() );
+
+    BYTEVector_t payload;
+    BOOST_REQUIRE( compressPayload( codec, samples[0], &payload, &dict ) );
+    BOOST_CHECK( payload.size() < samples[0].size() / 2 );
+
+    BYTEVector_t res;
+    decompressPayload( payload, &res, &dict );
+    BOOST_CHECK( res == samples[0] );
+
+    // a wrong dictionary
+    CCompressionDict other;
+    other.assign( samples[1] );
+    res.clear();
+    BOOST_CHECK_THROW( decompressPayload( payload, &res, &other ), runtime_error );
+}
+//=============================================================================
+BOOST_AUTO_TEST_CASE( test_wn_list_delta_cmd )
+{
+    SWnListDeltaCmd cmd;
+    cmd.m_epoch = 12345;
+    cmd.m_instance = 0xCAFEBABE;
+    cmd.m_added.push_back( "wn1" );
+    cmd.m_added.push_back( "wn2" );
+    cmd.m_removed.push_back( "wn3" );
+    BYTEVector_t data;
+    cmd.convertToData( &data );
+    BOOST_CHECK_EQUAL( data.size(), cmd.size() );
+
+    SWnListDeltaCmd cmd_res;
+    cmd_res.convertFromData( data );
+    BOOST_CHECK( cmd == cmd_res );
+
+    data.pop_back();
+    BOOST_CHECK_THROW( cmd_res.convertFromData( data ), runtime_error );
+
+    SEpochCmd epoch;
+    epoch.m_epoch = 7;
+    epoch.m_instance = 0xCAFEBABE;
+    data.clear();
+    epoch.convertToData( &data );
+    BOOST_CHECK_EQUAL( data.size(), epoch.size() );
+    SEpochCmd epoch_res;
+    epoch_res.convertFromData( data );
+    BOOST_CHECK( epoch == epoch_res );
+}
+//=============================================================================
+// an argument of cmdGET_WNs_LIST_DELTA of a client, which has seen _epoch of _history
+SEpochCmd epochOf( const CWnListHistory &_history, uint32_t _epoch )
+{
+    SEpochCmd ret;
+    ret.m_epoch = _epoch;
+    ret.m_instance = _history.instance();
+    return ret;
+}
+//=============================================================================
+// replays a churn of 10k workers and compares bytes on the wire
+// of full snapshots and of incremental updates
+BOOST_AUTO_TEST_CASE( test_wn_list_delta_churn )
+{
+    const size_t workers( 10000 );
+    const size_t rounds( 50 );
+    const size_t churn( 100 ); // workers replaced per round
+
+    CWnListHistory history;
+    for( size_t i = 0; i < workers; ++i )
+    {
+        stringstream ss;
+        ss << "pod@wn" << i << ".gsi.de:21001";
+        history.add( ss.str() );
+    }
+
+    CWnListReplica replica;
+    size_t fullBytes( 0 );
+    size_t deltaBytes( 0 );
+    size_t next( workers );
+    for( size_t r = 0; r < rounds; ++r )
+    {
+        // a client without changes of the list in between
+        {
+            const SEpochCmd req( replica.request() );
+            SWnListDeltaCmd delta;
+            history.getDelta( req, &delta );
+            BYTEVector_t data;
+            delta.convertToData( &data );
+            deltaBytes += createMsg( cmdWNs_LIST_DELTA, data, capHEADER_V2 ).size();
+
+            SWnListDeltaCmd delta_res;
+            delta_res.convertFromData( data );
+            replica.apply( delta_res );
+        }
+        BOOST_REQUIRE( replica.list() == history.list() );
+
+        SWnListCmd full;
+        full.m_container.assign( history.list().begin(), history.list().end() );
+        BYTEVector_t data;
+        full.convertToData( &data );
+        fullBytes += createMsg( cmdWNs_LIST, data, capHEADER_V2 ).size();
+
+        for( size_t i = 0; i < churn; ++i )
+        {
+            history.remove( *history.list().begin() );
+            stringstream ss;
+            ss << "pod@wn" << next++ << ".gsi.de:21001";
+            history.add( ss.str() );
+        }
+    }
+
+    BOOST_TEST_MESSAGE( "full snapshots: " << fullBytes << " bytes, deltas: " << deltaBytes << " bytes" );
+    // the first request is a full snapshot, then only 1% of the list changes
+    BOOST_CHECK( deltaBytes * 10 < fullBytes );
+
+    // an epoch, which is not in the history anymore
+    CWnListHistory short_history( 10 );
+    short_history.add( "wn1" );
+    const uint32_t old_epoch( short_history.epoch() );
+    for( size_t i = 0; i < 20; ++i )
+    {
+        stringstream ss;
+        ss << "wn_" << i;
+        short_history.add( ss.str() );
+    }
+    SWnListDeltaCmd delta;
+    short_history.getDelta( epochOf( short_history, old_epoch ), &delta );
+    BOOST_CHECK( delta.m_full );
+    BOOST_CHECK_EQUAL( delta.m_added.size(), 21 );
+
+    // nothing changed
+    short_history.getDelta( epochOf( short_history, short_history.epoch() ), &delta );
+    BOOST_CHECK( !delta.m_full );
+    BOOST_CHECK( delta.m_added.empty() && delta.m_removed.empty() );
+
+    // added and removed again
+    const uint32_t epoch( short_history.epoch() );
+    short_history.add( "tmp" );
+    short_history.remove( "tmp" );
+    short_history.remove( "wn1" );
+    short_history.getDelta( epochOf( short_history, epoch ), &delta );
+    BOOST_CHECK( delta.m_added.empty() );
+    BOOST_CHECK_EQUAL( delta.m_removed.size(), 1 );
+}
+//=============================================================================
+BOOST_AUTO_TEST_CASE( test_wn_list_restart )
+{
+    CWnListHistory server;
+    server.add( "wn1" );
+    server.add( "wn2" );
+    server.add( "wn3" );
+    CWnListReplica replica;
+    SWnListDeltaCmd delta;
+    server.getDelta( replica.request(), &delta );
+    replica.apply( delta );
+    BOOST_REQUIRE( replica.list() == server.list() );
+    BOOST_CHECK_EQUAL( replica.instance(), server.instance() );
+    BOOST_CHECK( 0 != replica.instance() );
+
+    // the server restarts and reaches a higher epoch with another list,
+    // the client's epoch alone would look like a valid point in its history
+    CWnListHistory restarted;
+    BOOST_CHECK( restarted.instance() != server.instance() );
+    restarted.add( "wn1" );
+    restarted.add( "wn4" );
+    restarted.add( "wn5" );
+    restarted.add( "wn6" );
+    BOOST_REQUIRE( restarted.epoch() > replica.epoch() );
+    restarted.getDelta( replica.request(), &delta );
+    BOOST_CHECK( delta.m_full );
+    replica.apply( delta );
+    BOOST_CHECK( replica.list() == restarted.list() );
+    BOOST_CHECK_EQUAL( replica.instance(), restarted.instance() );
+
+    // the same epoch after a restart
+    CWnListHistory again;
+    again.add( "wn7" );
+    again.add( "wn8" );
+    again.add( "wn9" );
+    again.add( "wn10" );
+    BOOST_REQUIRE_EQUAL( again.epoch(), replica.epoch() );
+    again.getDelta( replica.request(), &delta );
+    BOOST_CHECK( delta.m_full );
+    replica.apply( delta );
+    BOOST_CHECK( replica.list() == again.list() );
+
+    // and further deltas of the new instance are incremental
+    again.remove( "wn7" );
+    again.getDelta( replica.request(), &delta );
+    BOOST_CHECK( !delta.m_full );
+    replica.apply( delta );
+    BOOST_CHECK( replica.list() == again.list() );
+}
+//=============================================================================
+BOOST_AUTO_TEST_CASE( test_response_cache )
+{
+    CWnListHistory history;
+    history.add( "wn1" );
+    history.add( "wn2" );
+
+    CProtocol protocol;
+    protocol.negotiate( protocolCaps() );
+    CResponseCache cache;
+
+    size_t built( 0 );
+    const BYTEVector_t *first( NULL );
+    for( size_t i = 0; i < 10; ++i )
+    {
+        const BYTEVector_t *msg = cache.find( cmdWNs_LIST, protocol.framing(), history.epoch() );
+        if( !msg )
+        {
+            SWnListCmd cmd;
+            cmd.m_container.assign( history.list().begin(), history.list().end() );
+            BYTEVector_t data;
+            cmd.convertToData( &data );
+            msg = &cache.store( cmdWNs_LIST, protocol.framing(), history.epoch(),
+                                protocol.buildMsg( cmdWNs_LIST, data ) );
+            ++built;
+        }
+        if( !first )
+            first = msg;
+        // hits are served from the very same buffer
+        BOOST_CHECK_EQUAL( first, msg );
+    }
+    BOOST_CHECK_EQUAL( built, 1 );
+    BOOST_CHECK_EQUAL( cache.hits(), 9 );
+    BOOST_CHECK_EQUAL( cache.misses(), 1 );
+
+    BYTEVector_t data;
+    SWnListCmd cmd;
+    BOOST_REQUIRE( parseMsg( &data, *first ).isValid() );
+    cmd.convertFromData( data );
+    BOOST_CHECK_EQUAL( cmd.m_container.size(), 2 );
+
+    // the data changed
+    history.add( "wn3" );
+    BOOST_CHECK( !cache.find( cmdWNs_LIST, protocol.framing(), history.epoch() ) );
+    // an old peer needs another framing
+    BOOST_CHECK( !cache.find( cmdWNs_LIST, SFraming(), 0 ) );
+    BOOST_CHECK_EQUAL( cache.misses(), 3 );
+
+    // the same capabilities, but another compression
+    const uint64_t epoch( history.epoch() );
+    cache.store( cmdWNs_LIST, protocol.framing(), epoch, createMsg( cmdWNs_LIST, data ) );
+    CProtocol dictProtocol;
+    dictProtocol.negotiate( protocolCaps() );
+    CCompressionDict dict;
+    dict.assign( BYTEVector_t( 64, 'x' ) );
+    dictProtocol.setCompressionDict( &dict );
+    BOOST_CHECK( !cache.find( cmdWNs_LIST, dictProtocol.framing(), epoch ) );
+    CProtocol thresholdProtocol;
+    thresholdProtocol.negotiate( protocolCaps() );
+    thresholdProtocol.setCompressionThreshold( 1 );
+    BOOST_CHECK( !cache.find( cmdWNs_LIST, thresholdProtocol.framing(), epoch ) );
+    BOOST_CHECK( cache.find( cmdWNs_LIST, protocol.framing(), epoch ) );
+
+    cache.store( cmdWRK_NUM, SFraming(), 1, createMsg( cmdWRK_NUM, data ) );
+    cache.invalidate( cmdWNs_LIST );
+    BOOST_CHECK( !cache.find( cmdWNs_LIST, protocol.framing(), epoch ) );
+    BOOST_CHECK( cache.find( cmdWRK_NUM, SFraming(), 1 ) );
+}
+//=============================================================================
+struct SStreamCollector: public IStreamConsumer
+{
+    SStreamCollector():
+        m_chunks( 0 ),
+        m_bytes( 0 ),
+        m_crc( 0 ),
+        m_finished( false )
+    {
+    }
+    virtual void onStreamChunk( uint16_t _cmd, const BYTEVector_t &_chunk, bool _last )
+    {
+        BOOST_CHECK_EQUAL( _cmd, cmdWNs_LIST );
+        ++m_chunks;
+        m_bytes += _chunk.size();
+        if( !_chunk.empty() )
+            m_crc = crc32c( m_crc, &_chunk[0], _chunk.size() );
+        m_finished = _last;
+    }
+    size_t m_chunks;
+    size_t m_bytes;
+    uint32_t m_crc;
+    bool m_finished;
+};
+//=============================================================================
+BOOST_AUTO_TEST_CASE( test_stream )
+{
+    // 8 MB of incompressible data
+    const size_t size( 8 * 1024 * 1024 );
+    BYTEVector_t data( size );
+    uint32_t seed( 1 );
+    for( size_t i = 0; i < size; ++i )
+    {
+        seed = seed * 1103515245 + 12345;
+        data[i] = seed >> 16;
+    }
+    const uint32_t crc( crc32c( 0, &data[0], size ) );
+
+    int source[2];
+    BOOST_REQUIRE( 0 == pipe( source ) );
+    int fds[2];
+    BOOST_REQUIRE( 0 == socketpair( AF_UNIX, SOCK_STREAM, 0, fds ) );
+
+    const pid_t pid = fork();
+    BOOST_REQUIRE( pid >= 0 );
+    if( 0 == pid )
+    {
+        // a producer, which writes to a pipe
+        ::close( source[0] );
+        ::close( fds[0] );
+        ::close( fds[1] );
+        size_t total( 0 );
+        while( total < size )
+            total += ::write( source[1], &data[total], size - total );
+        _exit( 0 );
+    }
+    ::close( source[1] );
+
+    const pid_t sender_pid = fork();
+    BOOST_REQUIRE( sender_pid >= 0 );
+    if( 0 == sender_pid )
+    {
+        ::close( fds[1] );
+        CProtocol sender;
+        sender.negotiate( protocolCaps() );
+        sender.writeStream( fds[0], cmdWNs_LIST, source[0] );
+        sender.writeSimpleCmd( fds[0], cmdSHUTDOWN );
+        _exit( 0 );
+    }
+    ::close( source[0] );
+    ::close( fds[0] );
+
+    CProtocol receiver;
+    receiver.negotiate( protocolCaps() );
+    SStreamCollector collector;
+    receiver.setStreamConsumer( &collector );
+    size_t max_buffered( 0 );
+    bool shutdown( false );
+    while( CProtocol::stOK == receiver.read( fds[1] ) )
+    {
+        max_buffered = max( max_buffered, receiver.bufferedSize() );
+        while( receiver.checkoutNextMsg() )
+        {
+            BYTEVector_t res;
+            shutdown = ( cmdSHUTDOWN == receiver.getMsg( &res ).m_cmd );
+        }
+        receiver.grantCredit( fds[1] );
+    }
+    ::close( fds[1] );
+    waitpid( pid, NULL, 0 );
+    waitpid( sender_pid, NULL, 0 );
+
+    BOOST_CHECK( collector.m_finished );
+    BOOST_CHECK( shutdown );
+    BOOST_CHECK_EQUAL( collector.m_bytes, size );
+    BOOST_CHECK_EQUAL( collector.m_crc, crc );
+    BOOST_CHECK( collector.m_chunks > size / g_streamChunkSize );
+    // the buffer doesn't depend on the size of the message
+    BOOST_CHECK( max_buffered <= g_readLimit + g_streamChunkSize );
+}
+//=============================================================================
+// uploads _path over a socket pair, the sender runs in a child process and sends cmdSHUTDOWN after the upload
+// return: the status received by the receiver, _senderExit is the exit code of the sender
+SFileStatusCmd uploadFile( const string &_path, const string &_dir, bool _zeroCopy, uint64_t _expectedSent,
+                           int *_senderExit, uint32_t _segmentSize = g_fileSegmentSize )
+{
+    int fds[2];
+    BOOST_REQUIRE( 0 == socketpair( AF_UNIX, SOCK_STREAM, 0, fds ) );
+
+    const pid_t pid = fork();
+    BOOST_REQUIRE( pid >= 0 );
+    if( 0 == pid )
+    {
+        ::close( fds[1] );
+        CProtocol protocol;
+        protocol.negotiate( protocolCaps() );
+        CFileSender sender;
+        sender.setZeroCopy( _zeroCopy );
+        sender.setSegmentSize( _segmentSize );
+        uint64_t sent( 0 );
+        const SFileStatusCmd status = sender.upload( fds[0], &protocol, _path, "job.log", &sent );
+        // the connection is usable after the upload, the flow control isn't exhausted by the file data
+        protocol.writeSimpleCmd( fds[0], cmdSHUTDOWN );
+        _exit( ( fileOK == status.m_status && sent == _expectedSent ) ? 0 : 1 );
+    }
+    ::close( fds[0] );
+
+    CProtocol protocol;
+    protocol.negotiate( protocolCaps() );
+    while( !protocol.checkoutNextMsg() )
+        BOOST_REQUIRE( CProtocol::stOK == protocol.read( fds[1] ) );
+    BYTEVector_t data;
+    BOOST_REQUIRE_EQUAL( protocol.getMsg( &data ).m_cmd, cmdFILE_UPLOAD );
+    SFileUploadCmd offer;
+    offer.convertFromData( data );
+    BOOST_CHECK_EQUAL( offer.m_name, "job.log" );
+
+    CFileReceiver receiver( _dir );
+    receiver.setZeroCopy( _zeroCopy );
+    const SFileStatusCmd status = receiver.receive( fds[1], &protocol, offer );
+    while( !protocol.checkoutNextMsg() )
+        BOOST_REQUIRE( CProtocol::stOK == protocol.read( fds[1] ) );
+    BOOST_CHECK_EQUAL( protocol.getMsg( &data ).m_cmd, cmdSHUTDOWN );
+    ::close( fds[1] );
+
+    int exitStatus( 0 );
+    waitpid( pid, &exitStatus, 0 );
+    *_senderExit = WIFEXITED( exitStatus ) ? WEXITSTATUS( exitStatus ) : -1;
+    return status;
+}
+//=============================================================================
+BOOST_AUTO_TEST_CASE( test_file_upload )
+{
+    SFileUploadCmd offer;
+    offer.m_name = "job.log";
+    offer.m_size = 0x123456789ULL;
+    offer.m_crc = 0xDEADBEEF;
+    BYTEVector_t data;
+    offer.convertToData( &data );
+    SFileUploadCmd offer_res;
+    offer_res.convertFromData( data );
+    BOOST_CHECK( offer == offer_res );
+
+    char dirTemplate[] = "/tmp/MiscCommon_test_XXXXXX";
+    BOOST_REQUIRE( NULL != mkdtemp( dirTemplate ) );
+    const string dir( dirTemplate );
+    const string src( dir + "/src.log" );
+    const string dst( dir + "/job.log" );
+    const string part( dst + ".part" );
+
+    // 5 MB of a log-like content
+    string content;
+    for( size_t i = 0; content.size() < 5 * 1024 * 1024; ++i )
+    {
+        stringstream ss;
+        ss << "line " << i << ": PROOF worker lxb" << i % 1000 << ".gsi.de has started\n";
+        content += ss.str();
+    }
+    const size_t size( content.size() );
+    {
+        ofstream f( src.c_str() );
+        f << content;
+    }
+    const uint32_t crc( crc32c( 0, reinterpret_cast<const unsigned char*>( content.data() ), size ) );
+
+    const bool zeroCopy[] = { true, false };
+    for( size_t i = 0; i < 2; ++i )
+    {
+        // a full upload
+        int senderExit( -1 );
+        SFileStatusCmd status = uploadFile( src, dir, zeroCopy[i], size, &senderExit );
+        BOOST_CHECK_EQUAL( status.m_status, fileOK );
+        BOOST_CHECK_EQUAL( status.m_crc, crc );
+        BOOST_CHECK_EQUAL( senderExit, 0 );
+        {
+            ifstream f( dst.c_str() );
+            const string res( ( istreambuf_iterator<char>( f ) ), istreambuf_iterator<char>() );
+            BOOST_CHECK( res == content );
+        }
+        ::unlink( dst.c_str() );
+
+        // resume of an interrupted upload
+        {
+            ofstream f( part.c_str() );
+            f << content.substr( 0, 1024 * 1024 + 17 );
+        }
+        status = uploadFile( src, dir, zeroCopy[i], size - ( 1024 * 1024 + 17 ), &senderExit );
+        BOOST_CHECK_EQUAL( status.m_status, fileOK );
+        BOOST_CHECK_EQUAL( senderExit, 0 );
+        struct stat info;
+        BOOST_CHECK( 0 == ::stat( dst.c_str(), &info ) && static_cast<size_t>( info.st_size ) == size );
+        BOOST_CHECK( 0 != ::stat( part.c_str(), &info ) );
+        ::unlink( dst.c_str() );
+
+        // a corrupted partial file is detected and dropped
+        {
+            ofstream f( part.c_str() );
+            f << string( 1000, 'x' );
+        }
+        status = uploadFile( src, dir, zeroCopy[i], size - 1000, &senderExit );
+        BOOST_CHECK_EQUAL( status.m_status, fileCRC_MISMATCH );
+        BOOST_CHECK( 0 != ::stat( part.c_str(), &info ) );
+        BOOST_CHECK( 0 != ::stat( dst.c_str(), &info ) );
+
+        // many segments, each one is larger than the flow control window
+        BOOST_REQUIRE( protocolCaps() & capCREDIT );
+        status = uploadFile( src, dir, zeroCopy[i], size, &senderExit, 1024 * 1024 );
+        BOOST_CHECK_EQUAL( status.m_status, fileOK );
+        BOOST_CHECK_EQUAL( senderExit, 0 );
+        ::unlink( dst.c_str() );
+    }
+
+    ::unlink( src.c_str() );
+    ::rmdir( dir.c_str() );
+}
+//=============================================================================
+struct SDispatchCollector
+{
+    SDispatchCollector():
+        m_shutdowns( 0 ),
+        m_unknown( 0 )
+    {
+    }
+    void onHostInfo( const SHostInfoCmd &_cmd )
+    {
+        m_hosts.push_back( _cmd.m_host );
+    }
+    void onShutdown( const SMessageHeader &_header, const BYTEVector_t &_data )
+    {
+        BOOST_CHECK_EQUAL( _header.m_cmd, cmdSHUTDOWN );
+        BOOST_CHECK( _data.empty() );
+        ++m_shutdowns;
+    }
+    void onUnknown( const SMessageHeader &_header, const BYTEVector_t & )
+    {
+        m_unknown += _header.m_cmd;
+    }
+    StringVector_t m_hosts;
+    size_t m_shutdowns;
+    size_t m_unknown;
+};
+void throwingHandler( const SEpochCmd & )
+{
+    throw runtime_error( "handler error" );
+}
+//=============================================================================
+BOOST_AUTO_TEST_CASE( test_cmd_dispatcher )
+{
+    int fds[2];
+    BOOST_REQUIRE( 0 == socketpair( AF_UNIX, SOCK_STREAM, 0, fds ) );
+
+    CProtocol sender;
+    sender.negotiate( protocolCaps() );
+    for( int i = 0; i < 3; ++i )
+    {
+        SHostInfoCmd cmd;
+        stringstream ss;
+        ss << "lxb" << i << ".gsi.de";
+        cmd.m_host = ss.str();
+        BYTEVector_t data;
+        cmd.convertToData( &data );
+        sender.write( fds[0], cmdHOST_INFO, data );
+    }
+    sender.writeSimpleCmd( fds[0], cmdSHUTDOWN );
+    sender.writeSimpleCmd( fds[0], 1000 );
+    sender.writeSimpleCmd( fds[0], cmdGET_WRK_NUM );
+
+    SDispatchCollector collector;
+    CCmdDispatcher dispatcher;
+    dispatcher.registerCmd<SHostInfoCmd>( cmdHOST_INFO,
+                                          boost::bind( &SDispatchCollector::onHostInfo, &collector, _1 ) );
+    dispatcher.registerRaw( cmdSHUTDOWN, boost::bind( &SDispatchCollector::onShutdown, &collector, _1, _2 ) );
+
+    CProtocol receiver;
+    BOOST_REQUIRE( CProtocol::stOK == receiver.read( fds[1] ) );
+    // no fallback, the unknown command is only counted
+    BOOST_CHECK_EQUAL( dispatcher.dispatchAll( &receiver ), 6 );
+    BOOST_CHECK_EQUAL( collector.m_hosts.size(), 3 );
+    BOOST_CHECK_EQUAL( collector.m_hosts.back(), "lxb2.gsi.de" );
+    BOOST_CHECK_EQUAL( collector.m_shutdowns, 1 );
+    BOOST_CHECK_EQUAL( dispatcher.stats( cmdHOST_INFO ).m_count, 3 );
+    BOOST_CHECK_EQUAL( dispatcher.fallbackStats().m_count, 2 );
+    BOOST_CHECK( dispatcher.stats( cmdHOST_INFO ).percentile( 99 ) > 0 );
+
+    dispatcher.setFallback( boost::bind( &SDispatchCollector::onUnknown, &collector, _1, _2 ) );
+    dispatcher.registerCmd<SEpochCmd>( cmdGET_WNs_LIST_DELTA, &throwingHandler );
+    sender.writeSimpleCmd( fds[0], 1000 );
+    SEpochCmd epoch;
+    BYTEVector_t data;
+    epoch.convertToData( &data );
+    sender.write( fds[0], cmdGET_WNs_LIST_DELTA, data );
+    BOOST_REQUIRE( CProtocol::stOK == receiver.read( fds[1] ) );
+    BOOST_REQUIRE( receiver.checkoutNextMsg() );
+    BOOST_CHECK( dispatcher.dispatch( receiver ) );
+    BOOST_CHECK_EQUAL( collector.m_unknown, 1000 );
+    BOOST_REQUIRE( receiver.checkoutNextMsg() );
+    BOOST_CHECK_THROW( dispatcher.dispatch( receiver ), runtime_error );
+    BOOST_CHECK_EQUAL( dispatcher.stats( cmdGET_WNs_LIST_DELTA ).m_errors, 1 );
+
+    stringstream ss;
+    ss << dispatcher;
+    BOOST_CHECK( ss.str().find( "fallback" ) != string::npos );
+
+    ::close( fds[0] );
+    ::close( fds[1] );
+}
+//=============================================================================
+// simulated workers: all of them get the request, the most answer after 50 ms,
+// the slow ones after 1 s and the broken one just closes its connection
+void simulateWorkers( const vector<int> &_sockets, const set<size_t> &_slow, size_t _broken )
+{
+    signal( SIGPIPE, SIG_IGN );
+    vector<CProtocol> protocols( _sockets.size() );
+    for( size_t i = 0; i < _sockets.size(); ++i )
+    {
+        while( !protocols[i].checkoutNextMsg() )
+        {
+            if( CProtocol::stOK != protocols[i].read( _sockets[i] ) )
+                _exit( 1 );
+        }
+        if( i == _broken )
+            ::close( _sockets[i] );
+    }
+
+    for( int round = 0; round < 2; ++round )
+    {
+        usleep( round ? 1000000 : 50000 );
+        for( size_t i = 0; i < _sockets.size(); ++i )
+        {
+            if( i == _broken || ( _slow.count( i ) > 0 ) != ( 1 == round ) )
+                continue;
+
+            SHostInfoCmd cmd;
+            stringstream ss;
+            ss << "lxb" << i << ".gsi.de";
+            cmd.m_host = ss.str();
+            BYTEVector_t data;
+            cmd.convertToData( &data );
+            try
+            {
+                // an unrelated message comes first
+                protocols[i].writeSimpleCmd( _sockets[i], cmdGET_WRK_NUM );
+                protocols[i].write( _sockets[i], cmdHOST_INFO, data );
+            }
+            catch( ... )
+            {
+            }
+        }
+    }
+}
+//=============================================================================
+void countWrkNum( const SMessageHeader &, const BYTEVector_t &, size_t *_count )
+{
+    ++*_count;
+}
+//=============================================================================
+BOOST_AUTO_TEST_CASE( test_fan_out )
+{
+    const size_t workers( 200 );
+    set<size_t> slow;
+    slow.insert( 7 );
+    slow.insert( 100 );
+    slow.insert( 150 );
+    const size_t broken( 42 );
+
+    vector<int> local;
+    vector<int> remote;
+    for( size_t i = 0; i < workers; ++i )
+    {
+        int fds[2];
+        BOOST_REQUIRE( 0 == socketpair( AF_UNIX, SOCK_STREAM, 0, fds ) );
+        local.push_back( fds[0] );
+        remote.push_back( fds[1] );
+    }
+
+    const pid_t pid = fork();
+    BOOST_REQUIRE( pid >= 0 );
+    if( 0 == pid )
+    {
+        for( size_t i = 0; i < workers; ++i )
+            ::close( local[i] );
+        simulateWorkers( remote, slow, broken );
+        _exit( 0 );
+    }
+    for( size_t i = 0; i < workers; ++i )
+        ::close( remote[i] );
+
+    vector<CProtocol> protocols( workers );
+    CFanOutQuery query;
+    for( size_t i = 0; i < workers; ++i )
+        query.add( local[i], &protocols[i] );
+    size_t wrkNum( 0 );
+    CCmdDispatcher dispatcher;
+    dispatcher.registerRaw( cmdGET_WRK_NUM, boost::bind( &countWrkNum, _1, _2, &wrkNum ) );
+    query.setDispatcher( &dispatcher );
+
+    timespec start;
+    clock_gettime( CLOCK_MONOTONIC, &start );
+    BOOST_CHECK( !query.run( cmdGET_HOST_INFO, BYTEVector_t(), cmdHOST_INFO, 500 ) );
+    timespec end;
+    clock_gettime( CLOCK_MONOTONIC, &end );
+    const double elapsed( ( end.tv_sec - start.tv_sec ) + ( end.tv_nsec - start.tv_nsec ) * 1e-9 );
+
+    // all answers are gathered concurrently: the whole query takes the deadline,
+    // not a sum of 50 ms round trips
+    BOOST_CHECK( elapsed >= 0.45 && elapsed < 0.9 );
+    BOOST_CHECK_EQUAL( query.replies().size(), workers - slow.size() - 1 );
+    BOOST_CHECK_EQUAL( wrkNum, query.replies().size() );
+    BOOST_REQUIRE_EQUAL( query.laggards().size(), slow.size() );
+    BOOST_CHECK_EQUAL( query.laggards()[0], local[7] );
+    BOOST_REQUIRE_EQUAL( query.failed().size(), 1 );
+    BOOST_CHECK_EQUAL( query.failed()[0], local[broken] );
+
+    for( size_t i = 0; i < query.replies().size(); ++i )
+    {
+        const SFanOutReply &reply = query.replies()[i];
+        const size_t idx = find( local.begin(), local.end(), reply.m_socket ) - local.begin();
+        SHostInfoCmd cmd;
+        cmd.convertFromData( reply.m_data );
+        stringstream ss;
+        ss << "lxb" << idx << ".gsi.de";
+        BOOST_CHECK_EQUAL( cmd.m_host, ss.str() );
+        BOOST_CHECK( reply.m_latencyUs >= 40000 );
+    }
+
+    for( size_t i = 0; i < workers; ++i )
+        ::close( local[i] );
+    waitpid( pid, NULL, 0 );
+}
+//=============================================================================
+// workers, which can't take the request: the deadline covers the scatter phase too
+BOOST_AUTO_TEST_CASE( test_fan_out_stuck )
+{
+    // a full socket buffer, the peer doesn't read
+    int full[2];
+    BOOST_REQUIRE( 0 == socketpair( AF_UNIX, SOCK_STREAM, 0, full ) );
+    BOOST_REQUIRE( 0 == fcntl( full[0], F_SETFL, O_NONBLOCK ) );
+    const BYTEVector_t junk( 64 * 1024, 'x' );
+    while( ::send( full[0], &junk[0], junk.size(), 0 ) > 0 )
+        ;
+    BOOST_REQUIRE( EAGAIN == errno || EWOULDBLOCK == errno );
+    BOOST_REQUIRE( 0 == fcntl( full[0], F_SETFL, 0 ) );
+    CProtocol fullProtocol;
+
+    // no flow control credit, the peer never grants one
+    int starved[2];
+    BOOST_REQUIRE( 0 == socketpair( AF_UNIX, SOCK_STREAM, 0, starved ) );
+    CProtocol starvedProtocol;
+    starvedProtocol.negotiate( protocolCaps() );
+    BOOST_REQUIRE( starvedProtocol.caps() & capCREDIT );
+    starvedProtocol.consumeSendCredit( g_initialCredit );
+    BOOST_REQUIRE( !starvedProtocol.hasSendCredit() );
+
+    CFanOutQuery query;
+    query.add( full[0], &fullProtocol );
+    query.add( starved[0], &starvedProtocol );
+    timespec start;
+    clock_gettime( CLOCK_MONOTONIC, &start );
+    BOOST_CHECK( !query.run( cmdGET_HOST_INFO, BYTEVector_t(), cmdHOST_INFO, 200 ) );
+    timespec end;
+    clock_gettime( CLOCK_MONOTONIC, &end );
+    const double elapsed( ( end.tv_sec - start.tv_sec ) + ( end.tv_nsec - start.tv_nsec ) * 1e-9 );
+    BOOST_CHECK( elapsed >= 0.15 && elapsed < 1 );
+    BOOST_CHECK( query.replies().empty() );
+    BOOST_CHECK( query.failed().empty() );
+    BOOST_REQUIRE_EQUAL( query.laggards().size(), 2u );
+    BOOST_CHECK_EQUAL( query.laggards()[0], full[0] );
+    BOOST_CHECK_EQUAL( query.laggards()[1], starved[0] );
+    // the socket modes of the caller are restored
+    BOOST_CHECK( !( fcntl( full[0], F_GETFL ) & O_NONBLOCK ) );
+
+    ::close( full[0] );
+    ::close( full[1] );
+    ::close( starved[0] );
+    ::close( starved[1] );
+}
+//=============================================================================
+BOOST_AUTO_TEST_CASE( test_output_queue )
+{
+    BOOST_CHECK_EQUAL( laneOf( cmdSHUTDOWN ), laneCONTROL );
+    BOOST_CHECK_EQUAL( laneOf( cmdVERSION ), laneCONTROL );
+    BOOST_CHECK_EQUAL( laneOf( cmdWNs_LIST ), laneBULK );
+
+    int fds[2];
+    BOOST_REQUIRE( 0 == socketpair( AF_UNIX, SOCK_STREAM, 0, fds ) );
+    const int sndbuf( 16 * 1024 );
+    setsockopt( fds[0], SOL_SOCKET, SO_SNDBUF, &sndbuf, sizeof( sndbuf ) );
+    BOOST_REQUIRE( 0 == fcntl( fds[1], F_SETFL, O_NONBLOCK ) );
+
+    CProtocol protocol;
+    protocol.negotiate( protocolCaps() & ~capCREDIT );
+    protocol.setCompressionThreshold( 0xFFFFFFFF );
+    COutputQueue queue( protocol );
+    const BYTEVector_t bulk( 1024 * 1024, 'x' );
+    queue.push( cmdWNs_LIST, bulk );
+    queue.push( cmdWNs_LIST, bulk );
+    BOOST_CHECK_EQUAL( queue.queuedBytes( laneBULK ), 2 * protocol.buildMsg( cmdWNs_LIST, bulk ).size() );
+
+    // the first list is being sent now, the shutdown overtakes only the second one
+    BOOST_CHECK( !queue.flush( fds[0] ) );
+    queue.push( cmdSHUTDOWN, BYTEVector_t() );
+    BOOST_CHECK( queue.queuedBytes( laneCONTROL ) > 0 );
+
+    CProtocol receiver;
+    vector<uint16_t> order;
+    while( order.size() < 3 )
+    {
+        queue.flush( fds[0] );
+        if( CProtocol::stOK != receiver.read( fds[1] ) )
+            continue;
+        while( receiver.checkoutNextMsg() )
+            order.push_back( receiver.msgHeader().m_cmd );
+    }
+    BOOST_CHECK( queue.empty() );
+    BOOST_CHECK_EQUAL( order[0], cmdWNs_LIST );
+    BOOST_CHECK_EQUAL( order[1], cmdSHUTDOWN );
+    BOOST_CHECK_EQUAL( order[2], cmdWNs_LIST );
+
+    BOOST_CHECK_EQUAL( queue.stats( laneCONTROL ).m_delay.m_count, 1 );
+    BOOST_CHECK_EQUAL( queue.stats( laneBULK ).m_delay.m_count, 2 );
+    BOOST_CHECK_EQUAL( queue.queuedBytes( laneBULK ), 0 );
+    BOOST_CHECK( queue.stats( laneBULK ).m_delay.percentile( 99 ) >= queue.stats( laneCONTROL ).m_delay.percentile( 99 ) );
+    stringstream ss;
+    ss << queue;
+    BOOST_CHECK( ss.str().find( "control: sent 1 msgs" ) != string::npos );
+
+    ::close( fds[0] );
+    ::close( fds[1] );
+}
+//=============================================================================
+BOOST_AUTO_TEST_CASE( test_flow_control )
+{
+    const size_t msgs( 2000 );
+    const BYTEVector_t payload( 8 * 1024, 'x' );
+    const size_t window( 128 * 1024 );
+
+    int fds[2];
+    BOOST_REQUIRE( 0 == socketpair( AF_UNIX, SOCK_STREAM, 0, fds ) );
+
+    const pid_t pid = fork();
+    BOOST_REQUIRE( pid >= 0 );
+    if( 0 == pid )
+    {
+        // a producer, which is much faster than the consumer
+        ::close( fds[1] );
+        CProtocol producer;
+        producer.negotiate( protocolCaps() );
+        producer.setCompressionThreshold( 0xFFFFFFFF );
+        for( size_t i = 0; i < msgs; ++i )
+            producer.write( fds[0], cmdWNs_LIST, payload );
+        producer.writeSimpleCmd( fds[0], cmdSHUTDOWN );
+        _exit( 0 );
+    }
+    ::close( fds[0] );
+    BOOST_REQUIRE( 0 == fcntl( fds[1], F_SETFL, O_NONBLOCK ) );
+
+    CProtocol consumer;
+    consumer.negotiate( protocolCaps() );
+    consumer.setReceiveWindow( window );
+    size_t received( 0 );
+    size_t max_buffered( 0 );
+    bool shutdown( false );
+    while( !shutdown )
+    {
+        if( !consumer.checkoutNextMsg() )
+        {
+            pollfd pfd;
+            pfd.fd = fds[1];
+            pfd.events = POLLIN;
+            poll( &pfd, 1, 1000 );
+            BOOST_REQUIRE( CProtocol::stDISCONNECT != consumer.read( fds[1] ) );
+            max_buffered = max( max_buffered, consumer.bufferedSize() );
+            continue;
+        }
+
+        shutdown = ( cmdSHUTDOWN == consumer.msgHeader().m_cmd );
+        if( !shutdown )
+        {
+            BOOST_REQUIRE( consumer.msgData() == payload );
+            ++received;
+        }
+        // a slow consumer
+        if( 0 == received % 16 )
+            usleep( 1000 );
+        consumer.grantCredit( fds[1] );
+    }
+    ::close( fds[1] );
+    waitpid( pid, NULL, 0 );
+
+    BOOST_CHECK_EQUAL( received, msgs );
+    // the memory of the consumer is bounded by the window and a message
+    BOOST_CHECK( max_buffered <= window + payload.size() + 64 );
+}
+//=============================================================================
+BOOST_AUTO_TEST_CASE( test_flow_control_violation )
+{
+    int fds[2];
+    BOOST_REQUIRE( 0 == socketpair( AF_UNIX, SOCK_STREAM, 0, fds ) );
+    BOOST_REQUIRE( 0 == fcntl( fds[0], F_SETFL, O_NONBLOCK ) );
+    BOOST_REQUIRE( 0 == fcntl( fds[1], F_SETFL, O_NONBLOCK ) );
+
+    // a peer, which ignores credits
+    CProtocol sender;
+    sender.negotiate( protocolCaps() & ~capCREDIT );
+    sender.setCompressionThreshold( 0xFFFFFFFF );
+    CProtocol receiver;
+    receiver.negotiate( protocolCaps() );
+
+    const BYTEVector_t payload( 4 * 1024, 'x' );
+    bool violated( false );
+    for( size_t i = 0; i < 64 && !violated; ++i )
+    {
+        sender.write( fds[0], cmdWNs_LIST, payload );
+        receiver.read( fds[1] );
+        try
+        {
+            while( receiver.checkoutNextMsg() )
+                ;
+        }
+        catch( const runtime_error& )
+        {
+            violated = true;
+        }
+    }
+    BOOST_CHECK( violated );
+
+    ::close( fds[0] );
+    ::close( fds[1] );
+}
+//=============================================================================
+BOOST_AUTO_TEST_CASE( test_msg_channel )
+{
+    const BYTEVector_t data( 100, 'x' );
+    const BYTEVector_t msg( createMsg( cmdCHANNEL_DATA, data, capHEADER_V2 | capCRC32C, 0, 300 ) );
+    BYTEVector_t res;
+    const SMessageHeader header = parseMsg( &res, msg );
+    BOOST_CHECK( header.isValid() );
+    BOOST_CHECK_EQUAL( header.m_channel, 300 );
+    BOOST_CHECK( header.m_flags & flagCHANNEL );
+    BOOST_CHECK( res == data );
+
+    BOOST_CHECK_EQUAL( parseMsg( &res, createMsg( cmdCHANNEL_DATA, data, capHEADER_V2 ) ).m_channel, 0 );
+    BOOST_CHECK_THROW( createMsg( cmdCHANNEL_DATA, data, 0, 0, 1 ), logic_error );
+}
+//=============================================================================
+struct SChannelSink
+{
+    SChannelSink():
+        m_bulkWhenSmallDone( 0 )
+    {
+    }
+    map<uint32_t, size_t> m_bytes;
+    // bytes of the channel 1, which have come before the channel 2 was complete
+    size_t m_bulkWhenSmallDone;
+};
+void channelData( uint32_t _channel, const BYTEVector_t &_data, size_t _small, SChannelSink *_sink )
+{
+    _sink->m_bytes[_channel] += _data.size();
+    if( 2 == _channel && _small == _sink->m_bytes[2] )
+        _sink->m_bulkWhenSmallDone = _sink->m_bytes[1];
+}
+void channelClose( uint32_t _channel, set<uint32_t> *_closed )
+{
+    _closed->insert( _channel );
+}
+// moves bytes between both sides, commands of the connection received by B are appended to _cmds
+// return: false if nothing has moved
+bool pumpChannels( int _fdA, CProtocol *_a, CChannelMux *_muxA, int _fdB, CProtocol *_b, CChannelMux *_muxB,
+                   vector<uint16_t> *_cmds = NULL )
+{
+    bool moved( false );
+    _muxA->flush( _fdA );
+    if( CProtocol::stOK == _b->read( _fdB ) )
+        moved = true;
+    while( _b->checkoutNextMsg() )
+    {
+        if( _muxB->onMsg() )
+            continue;
+        BOOST_REQUIRE( _cmds );
+        _cmds->push_back( _b->msgHeader().m_cmd );
+    }
+    _muxB->grantCredits();
+    _muxB->flush( _fdB );
+    if( CProtocol::stOK == _a->read( _fdA ) )
+        moved = true;
+    while( _a->checkoutNextMsg() )
+        BOOST_REQUIRE( _muxA->onMsg() );
+    return moved;
+}
+BOOST_AUTO_TEST_CASE( test_channel_mux )
+{
+    int fds[2];
+    BOOST_REQUIRE( 0 == socketpair( AF_UNIX, SOCK_STREAM, 0, fds ) );
+    BOOST_REQUIRE( 0 == fcntl( fds[0], F_SETFL, O_NONBLOCK ) );
+    BOOST_REQUIRE( 0 == fcntl( fds[1], F_SETFL, O_NONBLOCK ) );
+
+    CProtocol a;
+    a.negotiate( protocolCaps() );
+    CProtocol b;
+    b.negotiate( protocolCaps() );
+    CChannelMux muxA( a );
+    CChannelMux muxB( b );
+    // a bulk channel, a short one queued behind it and a channel with a stalled consumer
+    const size_t bulk( 2 * 1024 * 1024 );
+    const size_t small( 64 * 1024 );
+    const size_t stalled( 512 * 1024 );
+    SChannelSink sink;
+    map<uint32_t, size_t> &received = sink.m_bytes;
+    set<uint32_t> closed;
+    muxB.setDataHandler( boost::bind( channelData, _1, _2, small, &sink ) );
+    muxB.setCloseHandler( boost::bind( channelClose, _1, &closed ) );
+    BOOST_CHECK_THROW( muxA.send( 0, BYTEVector_t( 1 ) ), invalid_argument );
+
+    muxB.pause( 3 );
+    muxA.send( 1, BYTEVector_t( bulk, 'a' ) );
+    muxA.send( 2, BYTEVector_t( small, 'b' ) );
+    muxA.send( 3, BYTEVector_t( stalled, 'c' ) );
+
+    for( size_t i = 0; i < 100000 && received[1] < bulk; ++i )
+        pumpChannels( fds[0], &a, &muxA, fds[1], &b, &muxB );
+    BOOST_CHECK_EQUAL( received[1], bulk );
+    BOOST_CHECK_EQUAL( received[2], small );
+    // the short channel has not waited for the bulk one
+    BOOST_CHECK( sink.m_bulkWhenSmallDone > 0 );
+    BOOST_CHECK( sink.m_bulkWhenSmallDone <= small + g_channelChunkSize );
+    // the stalled channel has not blocked the others and is held by its own credit
+    BOOST_CHECK( received[3] <= g_channelInitialCredit + g_channelChunkSize );
+    BOOST_CHECK( muxA.queuedBytes( 3 ) > 0 );
+    BOOST_CHECK( muxA.sendCredit( 3 ) <= 0 );
+
+    muxB.resume( 3 );
+    muxA.close( 1 );
+    BOOST_CHECK_THROW( muxA.send( 1, BYTEVector_t( 1 ) ), logic_error );
+    for( size_t i = 0; i < 100000 && ( received[3] < stalled || closed.empty() ); ++i )
+        pumpChannels( fds[0], &a, &muxA, fds[1], &b, &muxB );
+    BOOST_CHECK_EQUAL( received[3], stalled );
+    BOOST_CHECK( closed.count( 1 ) );
+    BOOST_CHECK( muxA.flush( fds[0] ) );
+
+    // commands of the connection go through the mux, between whole frames
+    vector<uint16_t> cmds;
+    muxA.send( 2, BYTEVector_t( bulk, 'd' ) );
+    muxA.sendCmd( cmdGET_WRK_NUM, BYTEVector_t() );
+    for( size_t i = 0; i < 100000 && ( received[2] < small + bulk || cmds.empty() ); ++i )
+        pumpChannels( fds[0], &a, &muxA, fds[1], &b, &muxB, &cmds );
+    BOOST_CHECK_EQUAL( received[2], small + bulk );
+    BOOST_REQUIRE_EQUAL( cmds.size(), 1u );
+    BOOST_CHECK_EQUAL( cmds[0], cmdGET_WRK_NUM );
+    BOOST_CHECK( muxA.flush( fds[0] ) );
+
+    ::close( fds[0] );
+    ::close( fds[1] );
+}
+//=============================================================================
+BOOST_AUTO_TEST_CASE( test_local_seqpacket )
+{
+    stringstream path;
+    path << "/tmp/pod_test_local_" << getpid() << ".sock";
+    {
+        // a stale socket file of a dead server
+        CSocketServer dead( AF_UNIX, SOCK_SEQPACKET );
+        dead.BindLocal( path.str() );
+    }
+    CSocketServer server( AF_UNIX, SOCK_SEQPACKET );
+    server.BindLocal( path.str() );
+    server.Listen( 1 );
+    CSocketClient client( AF_UNIX, SOCK_SEQPACKET );
+    client.connectLocal( path.str() );
+    smart_socket accepted( server.Accept() );
+    BOOST_REQUIRE( accepted.is_valid() );
+    string name;
+    socket2string( accepted.get(), &name );
+    BOOST_CHECK_EQUAL( name, path.str() );
+    // the path is in use now
+    CSocketServer another( AF_UNIX, SOCK_SEQPACKET );
+    BOOST_CHECK_THROW( another.BindLocal( path.str() ), exception );
+
+    CProtocol sender;
+    sender.negotiate( protocolCaps() & ~capCREDIT );
+    sender.setSeqPacket( true );
+    CProtocol receiver;
+    receiver.negotiate( protocolCaps() & ~capCREDIT );
+    receiver.setSeqPacket( true );
+
+    // larger than a packet
+    BYTEVector_t big( 5 * g_seqPacketSize / 2 );
+    for( size_t i = 0; i < big.size(); ++i )
+        big[i] = i % 251;
+    sender.setCompressionThreshold( 0xFFFFFFFF );
+    sender.write( client.getSocket(), cmdWNs_LIST, big );
+    sender.writeSimpleCmd( client.getSocket(), cmdSHUTDOWN );
+
+    vector<uint16_t> cmds;
+    while( cmds.size() < 2 )
+    {
+        BOOST_REQUIRE( CProtocol::stDISCONNECT != receiver.read( accepted.get() ) );
+        while( receiver.checkoutNextMsg() )
+        {
+            cmds.push_back( receiver.msgHeader().m_cmd );
+            if( cmdWNs_LIST == receiver.msgHeader().m_cmd )
+                BOOST_CHECK( receiver.msgData() == big );
+        }
+    }
+    BOOST_CHECK_EQUAL( cmds[1], cmdSHUTDOWN );
+
+    // an oversized packet is rejected and leaves nothing in the buffer
+    const BYTEVector_t oversized( g_seqPacketSize + 1, 'x' );
+    BOOST_REQUIRE_EQUAL( ::send( client.getSocket(), &oversized[0], oversized.size(), 0 ), static_cast<ssize_t>( oversized.size() ) );
+    BOOST_CHECK_THROW( receiver.read( accepted.get() ), runtime_error );
+    sender.writeSimpleCmd( client.getSocket(), cmdSHUTDOWN );
+    BOOST_REQUIRE( CProtocol::stDISCONNECT != receiver.read( accepted.get() ) );
+    BOOST_REQUIRE( receiver.checkoutNextMsg() );
+    BOOST_CHECK_EQUAL( receiver.msgHeader().m_cmd, cmdSHUTDOWN );
+    ::unlink( path.str().c_str() );
+}
+//=============================================================================
+BOOST_AUTO_TEST_CASE( test_fd_passing )
+{
+    int fds[2];
+    BOOST_REQUIRE( 0 == socketpair( AF_UNIX, SOCK_STREAM, 0, fds ) );
+    int pipefd[2];
+    BOOST_REQUIRE( 0 == pipe( pipefd ) );
+
+    // the plain helpers
+    send_fd( fds[0], pipefd[0] );
+    const int raw = recv_fd( fds[1] );
+    BOOST_REQUIRE( raw >= 0 );
+    BOOST_CHECK( raw != pipefd[0] );
+    ::close( raw );
+
+    // hand over a descriptor with a protocol message, the message is followed by a regular one
+    CProtocol sender;
+    sender.negotiate( protocolCaps() );
+    CProtocol receiver;
+    receiver.negotiate( protocolCaps() );
+    receiver.setFdPassing( true );
+    const BYTEVector_t data( 10, 'd' );
+    sender.writeFd( fds[0], cmdUSE_PACKETFORWARDING_PROOF, data, pipefd[0] );
+    sender.writeSimpleCmd( fds[0], cmdSHUTDOWN );
+    ::close( pipefd[0] );
+
+    int passed( -1 );
+    size_t msgs( 0 );
+    while( msgs < 2 )
+    {
+        BOOST_REQUIRE( CProtocol::stDISCONNECT != receiver.read( fds[1] ) );
+        while( receiver.checkoutNextMsg() )
+        {
+            ++msgs;
+            if( cmdUSE_PACKETFORWARDING_PROOF == receiver.msgHeader().m_cmd )
+            {
+                BOOST_CHECK( receiver.msgData() == data );
+                passed = receiver.takeFd();
+            }
+        }
+    }
+    BOOST_REQUIRE( passed >= 0 );
+    BOOST_CHECK_EQUAL( receiver.takeFd(), -1 );
+
+    // the received descriptor is the read end of the pipe
+    const char hello[] = "hello";
+    BOOST_REQUIRE( sizeof( hello ) == ::write( pipefd[1], hello, sizeof( hello ) ) );
+    char buf[sizeof( hello )];
+    BOOST_REQUIRE( sizeof( hello ) == ::read( passed, buf, sizeof( buf ) ) );
+    BOOST_CHECK_EQUAL( string( buf ), string( hello ) );
+
+    ::close( passed );
+    ::close( pipefd[1] );
+    ::close( fds[0] );
+    ::close( fds[1] );
+}
+//=============================================================================
+BOOST_AUTO_TEST_CASE( test_shm_transport )
+{
+    int fds[2];
+    BOOST_REQUIRE( 0 == socketpair( AF_UNIX, SOCK_STREAM, 0, fds ) );
+    // a small ring, so messages wrap and the writer waits for space
+    const size_t ringSize( 4096 );
+    BYTEVector_t big( 100 * 1024 );
+    for( size_t i = 0; i < big.size(); ++i )
+        big[i] = i % 253;
+
+    const pid_t pid = fork();
+    BOOST_REQUIRE( pid >= 0 );
+    if( 0 == pid )
+    {
+        // echoes messages back until the transport is closed
+        ::close( fds[0] );
+        CShmTransport shm;
+        shm.receiveFrom( fds[1] );
+        CProtocol protocol;
+        protocol.setShm( &shm );
+        protocol.negotiate( protocolCaps() );
+        while( CProtocol::stDISCONNECT != protocol.read( shm.fd() ) )
+        {
+            while( protocol.checkoutNextMsg() )
+                protocol.write( shm.fd(), protocol.msgHeader().m_cmd, protocol.msgData() );
+            protocol.grantCredit( shm.fd() );
+        }
+        _exit( 0 );
+    }
+    ::close( fds[1] );
+
+    CShmTransport shm;
+    shm.create( ringSize );
+    shm.sendTo( fds[0] );
+    CProtocol protocol;
+    protocol.setShm( &shm );
+    protocol.negotiate( protocolCaps() );
+    protocol.setCompressionThreshold( 0xFFFFFFFF );
+
+    // nothing to read yet
+    shm.setNonBlock();
+    BOOST_CHECK_EQUAL( protocol.read( shm.fd() ), CProtocol::stAGAIN );
+    shm.setNonBlock( false );
+
+    for( size_t i = 0; i < 100; ++i )
+    {
+        protocol.writeSimpleCmd( shm.fd(), cmdGET_WRK_NUM );
+        while( !protocol.checkoutNextMsg() )
+            BOOST_REQUIRE_EQUAL( protocol.read( shm.fd() ), CProtocol::stOK );
+        BOOST_REQUIRE_EQUAL( protocol.msgHeader().m_cmd, cmdGET_WRK_NUM );
+    }
+
+    // the echo of a large message is read while it is still being written,
+    // so the reply of the peer is read by a separate poll loop
+    shm.setNonBlock();
+    protocol.write( shm.fd(), cmdWNs_LIST, big );
+    bool echoed( false );
+    while( !echoed )
+    {
+        if( CProtocol::stAGAIN == protocol.read( shm.fd() ) )
+        {
+            pollfd pfd;
+            pfd.fd = shm.fd();
+            pfd.events = POLLIN;
+            BOOST_REQUIRE( poll( &pfd, 1, 5000 ) > 0 );
+            continue;
+        }
+        while( protocol.checkoutNextMsg() )
+        {
+            BOOST_CHECK( protocol.msgData() == big );
+            echoed = true;
+        }
+        protocol.grantCredit( shm.fd() );
+    }
+
+    shm.close();
+    int status( -1 );
+    waitpid( pid, &status, 0 );
+    BOOST_CHECK( WIFEXITED( status ) && 0 == WEXITSTATUS( status ) );
+    ::close( fds[0] );
+}
+//=============================================================================
+BOOST_AUTO_TEST_CASE( test_handover )
+{
+    // the old agent listens and has a connection with a half received message
+    CSocketServer server;
+    const string loopback( "127.0.0.1" );
+    server.Bind( 0, &loopback );
+    server.Listen( 5 );
+    sockaddr_in addr;
+    socklen_t len( sizeof( addr ) );
+    getsockname( server.getSocket(), reinterpret_cast<sockaddr *>( &addr ), &len );
+    const unsigned short port( ntohs( addr.sin_port ) );
+
+    CSocketClient client1;
+    client1.connect( port, loopback );
+    const int accepted( server.Accept() );
+    BOOST_REQUIRE( accepted >= 0 );
+
+    CProtocol old;
+    old.negotiate( protocolCaps() & ~capCREDIT );
+    const BYTEVector_t data( 1000, 'h' );
+    const BYTEVector_t msg( createMsg( cmdWNs_LIST, data, old.caps() ) );
+    const size_t half( msg.size() / 2 );
+    BOOST_REQUIRE( static_cast<ssize_t>( half ) == ::write( client1.getSocket(), &msg[0], half ) );
+    SProtocolStateCmd state;
+    do
+    {
+        BOOST_REQUIRE( CProtocol::stDISCONNECT != old.read( accepted ) );
+        BOOST_REQUIRE( !old.checkoutNextMsg() );
+        old.exportState( &state );
+    }
+    while( state.m_buffered.size() < half );
+
+    // the old agent hands everything over and exits
+    int fds[2];
+    BOOST_REQUIRE( 0 == socketpair( AF_UNIX, SOCK_STREAM, 0, fds ) );
+    const pid_t pid = fork();
+    BOOST_REQUIRE( pid >= 0 );
+    if( 0 == pid )
+    {
+        ::close( fds[1] );
+        try
+        {
+            CHandoverSource source;
+            source.addListener( "agent", server.getSocket() );
+            source.addConnection( "client1", accepted, old );
+            source.transfer( fds[0] );
+        }
+        catch( ... )
+        {
+            _exit( 1 );
+        }
+        _exit( 0 );
+    }
+    ::close( fds[0] );
+    // this process plays the new agent, so it drops the copies of the old one
+    ::close( server.detach() );
+    ::close( accepted );
+
+    // a client connects in the middle of the upgrade and must not be refused
+    CSocketClient client2;
+    client2.connect( port, loopback );
+
+    CHandoverTarget target;
+    target.receive( fds[1] );
+    BOOST_CHECK_EQUAL( target.takeListener( "none" ), -1 );
+    CSocketServer newServer;
+    newServer.attach( target.takeListener( "agent" ) );
+    HandedConnections_t connections( target.takeConnections() );
+    BOOST_REQUIRE_EQUAL( connections.size(), 1u );
+    BOOST_CHECK_EQUAL( connections[0].m_state.m_name, string( "client1" ) );
+
+    int status( -1 );
+    waitpid( pid, &status, 0 );
+    BOOST_CHECK( WIFEXITED( status ) && 0 == WEXITSTATUS( status ) );
+    ::close( fds[1] );
+
+    // the new agent continues the message where the old one has stopped
+    CProtocol restored;
+    restored.importState( connections[0].m_state );
+    BOOST_CHECK_EQUAL( restored.caps(), old.caps() );
+    BOOST_REQUIRE( static_cast<ssize_t>( msg.size() - half ) == ::write( client1.getSocket(), &msg[half], msg.size() - half ) );
+    while( !restored.checkoutNextMsg() )
+        BOOST_REQUIRE( CProtocol::stDISCONNECT != restored.read( connections[0].m_socket ) );
+    BOOST_CHECK_EQUAL( restored.msgHeader().m_cmd, cmdWNs_LIST );
+    BOOST_CHECK( restored.msgData() == data );
+    ::close( connections[0].m_socket );
+
+    // the client, which has connected during the upgrade, is accepted by the new agent
+    const int accepted2( newServer.Accept() );
+    BOOST_CHECK( accepted2 >= 0 );
+    ::close( accepted2 );
+}
+//=============================================================================
+// the socket diagnostics are Linux only
+#ifdef __linux__
+BOOST_AUTO_TEST_CASE( test_fan_out_tcp_diag )
+{
+    CSocketServer server;
+    const string loopback( "127.0.0.1" );
+    server.Bind( 0, &loopback );
+    server.Listen( 1 );
+    sockaddr_in addr;
+    socklen_t len( sizeof( addr ) );
+    getsockname( server.getSocket(), reinterpret_cast<sockaddr *>( &addr ), &len );
+    CSocketClient client;
+    client.connect( ntohs( addr.sin_port ), loopback );
+    smart_socket accepted( server.Accept() );
+
+    // TCP_INFO of the connections of a fan-out query
+    CProtocol protocol;
+    CFanOutQuery query;
+    query.add( accepted.get(), &protocol );
+    CTcpDiagSummary fanout;
+    query.sampleTcpDiag( &fanout );
+    BOOST_CHECK_EQUAL( fanout.size( STcpDiag::fRTT ), 1u );
+}
+#endif
+//=============================================================================
+// the event loop is Linux only
+#ifdef __linux__
+// an echo server of the event loop, it closes a connection on cmdSHUTDOWN
+struct SAsyncEcho
+{
+    SAsyncEcho( CEventLoop &_loop, int _listener ):
+        m_loop( _loop ),
+        m_listener( _listener )
+    {
+        m_loop.add( m_listener, EPOLLIN, boost::bind( &SAsyncEcho::onAccept, this, _1 ) );
+    }
+    ~SAsyncEcho()
+    {
+        m_loop.remove( m_listener );
+        for( size_t i = 0; i < m_conns.size(); ++i )
+            delete m_conns[i];
+    }
+    void onAccept( uint32_t )
+    {
+        const int s( ::accept( m_listener, NULL, NULL ) );
+        if( s < 0 )
+            return;
+        CAsyncConnection *conn = new CAsyncConnection( m_loop, s );
+        m_conns.push_back( conn );
+        conn->readMsg( boost::bind( &SAsyncEcho::onMsg, this, conn, _1, _2, _3 ) );
+    }
+    void onMsg( CAsyncConnection *_conn, bool _ok, const SMessageHeader &_header, const BYTEVector_t &_data )
+    {
+        if( !_ok )
+            return;
+        if( cmdSHUTDOWN == _header.m_cmd )
+        {
+            _conn->close();
+            return;
+        }
+        _conn->write( _header.m_cmd, _data );
+        _conn->readMsg( boost::bind( &SAsyncEcho::onMsg, this, _conn, _1, _2, _3 ) );
+    }
+    CEventLoop &m_loop;
+    int m_listener;
+    vector<CAsyncConnection *> m_conns;
+};
+//=============================================================================
+// a client, which sends m_pings messages one after another and then asks the server to close
+struct SAsyncPinger
+{
+    SAsyncPinger( CEventLoop &_loop, size_t _pings ):
+        m_loop( _loop ),
+        m_conn( NULL ),
+        m_errno( -1 ),
+        m_pings( _pings ),
+        m_replies( 0 ),
+        m_written( 0 ),
+        m_closed( false )
+    {
+    }
+    ~SAsyncPinger()
+    {
+        delete m_conn;
+    }
+    void onConnected( CAsyncConnection *_conn, int _errno )
+    {
+        m_conn = _conn;
+        m_errno = _errno;
+        if( !m_conn )
+        {
+            m_loop.stop();
+            return;
+        }
+        ping();
+    }
+    void ping()
+    {
+        const BYTEVector_t data( 1 + m_replies * 100, static_cast<char>( m_replies ) );
+        m_conn->write( cmdGET_WRK_NUM, data, boost::bind( &SAsyncPinger::onWritten, this, _1 ) );
+        m_conn->readMsg( boost::bind( &SAsyncPinger::onReply, this, _1, _2, _3 ) );
+    }
+    void onWritten( bool _ok )
+    {
+        if( _ok )
+            ++m_written;
+    }
+    void onReply( bool _ok, const SMessageHeader &_header, const BYTEVector_t &_data )
+    {
+        if( !_ok )
+        {
+            m_loop.stop();
+            return;
+        }
+        BOOST_CHECK_EQUAL( _header.m_cmd, cmdGET_WRK_NUM );
+        BOOST_CHECK_EQUAL( _data.size(), 1 + m_replies * 100 );
+        BOOST_CHECK( _data.size() == 1 || static_cast<char>( m_replies ) == static_cast<char>( _data.back() ) );
+        if( ++m_replies < m_pings )
+        {
+            ping();
+            return;
+        }
+        m_conn->writeSimpleCmd( cmdSHUTDOWN );
+        m_conn->readMsg( boost::bind( &SAsyncPinger::onClosed, this, _1 ) );
+    }
+    void onClosed( bool _ok )
+    {
+        m_closed = !_ok;
+        m_loop.stop();
+    }
+    CEventLoop &m_loop;
+    CAsyncConnection *m_conn;
+    int m_errno;
+    size_t m_pings;
+    size_t m_replies;
+    size_t m_written;
+    bool m_closed;
+};
+//=============================================================================
+void logCall( vector<int> *_log, int _val )
+{
+    _log->push_back( _val );
+}
+//=============================================================================
+BOOST_AUTO_TEST_CASE( test_async_connection )
+{
+    // timers fire in the order of their deadlines, posted calls before them
+    {
+        CEventLoop loop;
+        vector<int> log;
+        loop.addTimer( 20, boost::bind( &logCall, &log, 2 ) );
+        loop.addTimer( 10, boost::bind( &logCall, &log, 1 ) );
+        const CEventLoop::TimerId_t canceled( loop.addTimer( 5, boost::bind( &logCall, &log, 3 ) ) );
+        BOOST_CHECK( loop.cancelTimer( canceled ) );
+        BOOST_CHECK( !loop.cancelTimer( canceled ) );
+        loop.post( boost::bind( &logCall, &log, 0 ) );
+        loop.run();
+        BOOST_REQUIRE_EQUAL( log.size(), 3u );
+        BOOST_CHECK_EQUAL( log[0], 0 );
+        BOOST_CHECK_EQUAL( log[1], 1 );
+        BOOST_CHECK_EQUAL( log[2], 2 );
+    }
+
+    CSocketServer server;
+    const string loopback( "127.0.0.1" );
+    server.Bind( 0, &loopback );
+    server.Listen( 16 );
+    sockaddr_in addr;
+    socklen_t len( sizeof( addr ) );
+    getsockname( server.getSocket(), reinterpret_cast<sockaddr *>( &addr ), &len );
+    const unsigned short port( ntohs( addr.sin_port ) );
+
+    // a chain of requests and replies, the server and the clients share one loop
+    CEventLoop loop;
+    SAsyncEcho echo( loop, server.getSocket() );
+    SAsyncPinger first( loop, 50 );
+    SAsyncPinger second( loop, 50 );
+    CAsyncConnection::connect( loop, loopback, port, 1000, boost::bind( &SAsyncPinger::onConnected, &first, _1, _2 ) );
+    CAsyncConnection::connect( loop, loopback, port, 1000, boost::bind( &SAsyncPinger::onConnected, &second, _1, _2 ) );
+    while( !( first.m_closed && second.m_closed ) && ( first.m_errno <= 0 && second.m_errno <= 0 ) )
+        BOOST_REQUIRE( loop.runOnce( 5000 ) > 0 );
+    BOOST_CHECK_EQUAL( first.m_errno, 0 );
+    BOOST_CHECK_EQUAL( first.m_replies, 50u );
+    BOOST_CHECK_EQUAL( first.m_written, 50u );
+    BOOST_CHECK( first.m_closed );
+    BOOST_CHECK_EQUAL( second.m_replies, 50u );
+    BOOST_CHECK( second.m_closed );
+    BOOST_CHECK( !first.m_conn->isOpen() );
+
+    // operations of a closed connection fail from the loop
+    first.m_conn->readMsg( boost::bind( &SAsyncPinger::onClosed, &first, _1 ) );
+    first.m_closed = false;
+    loop.runOnce( 0 );
+    BOOST_CHECK( first.m_closed );
+
+    // a refused connect
+    smart_socket unused( AF_INET, SOCK_STREAM, 0 );
+    sockaddr_in bound;
+    memset( &bound, 0, sizeof( bound ) );
+    bound.sin_family = AF_INET;
+    inet_aton( loopback.c_str(), &bound.sin_addr );
+    BOOST_REQUIRE( 0 == ::bind( unused.get(), reinterpret_cast<sockaddr *>( &bound ), sizeof( bound ) ) );
+    len = sizeof( bound );
+    getsockname( unused.get(), reinterpret_cast<sockaddr *>( &bound ), &len );
+    SAsyncPinger refused( loop, 1 );
+    CAsyncConnection::connect( loop, loopback, ntohs( bound.sin_port ), 1000, boost::bind( &SAsyncPinger::onConnected, &refused, _1, _2 ) );
+    while( refused.m_errno < 0 )
+        loop.runOnce( 1000 );
+    BOOST_CHECK( !refused.m_conn );
+    BOOST_CHECK_EQUAL( refused.m_errno, ECONNREFUSED );
+}
+#endif
+//=============================================================================
+BOOST_AUTO_TEST_CASE( test_capture )
+{
+    const string path( "/tmp/MiscCommon_test_capture.podcap" );
+    ::unlink( path.c_str() );
+    int fds[2];
+    BOOST_REQUIRE( 0 == socketpair( AF_UNIX, SOCK_STREAM, 0, fds ) );
+    {
+        CCaptureWriter capture( path );
+        CProtocol sender;
+        CProtocol receiver;
+        sender.negotiate( protocolCaps() );
+        receiver.negotiate( protocolCaps() );
+        sender.setCapture( &capture, 1 );
+        receiver.setCapture( &capture, 2 );
+
+        SIdCmd id;
+        id.m_id = 17;
+        BYTEVector_t data;
+        id.convertToData( &data );
+        sender.write( fds[0], cmdID, data );
+        sender.writeSimpleCmd( fds[0], cmdGET_WRK_NUM );
+        COutputQueue queue( sender );
+        queue.push( cmdSHUTDOWN, BYTEVector_t() );
+        BOOST_CHECK( queue.flush( fds[0] ) );
+        CChannelMux mux( sender );
+        mux.send( 1, BYTEVector_t( 10, 'm' ) );
+        BOOST_CHECK( mux.flush( fds[0] ) );
+        // bulk messages are not captured
+        sender.writeHeader( fds[0], createMsgHeader( cmdFILE_DATA, 4 ) );
+        BOOST_REQUIRE_EQUAL( ::send( fds[0], "bulk", 4, 0 ), 4 );
+
+        size_t received( 0 );
+        while( received < 4 )
+        {
+            BOOST_REQUIRE( CProtocol::stOK == receiver.read( fds[1] ) );
+            while( received < 4 && receiver.checkoutNextMsg() )
+                ++received;
+        }
+        while( !receiver.checkoutNextHeader() )
+            BOOST_REQUIRE( CProtocol::stOK == receiver.read( fds[1] ) );
+        BOOST_CHECK_EQUAL( receiver.msgHeader().m_cmd, cmdFILE_DATA );
+        BYTEVector_t bulk;
+        receiver.takeBuffered( &bulk, 4 );
+        while( bulk.size() < 4 )
+        {
+            char c;
+            BOOST_REQUIRE_EQUAL( ::recv( fds[1], &c, 1, 0 ), 1 );
+            bulk.push_back( c );
+        }
+        // switched off
+        sender.setCapture( NULL, 0 );
+        sender.writeSimpleCmd( fds[0], cmdGET_ID );
+    }
+
+    // a writer appends to an existing capture
+    {
+        CCaptureWriter capture( path );
+        const BYTEVector_t msg( createMsg( cmdSET_ID, BYTEVector_t(), 0 ) );
+        capture.record( 3, dirIN, &msg[0], msg.size() );
+    }
+
+    CCaptureReader reader( path );
+    vector<SCaptureRecord> records;
+    SCaptureRecord record;
+    while( reader.next( &record ) )
+        records.push_back( record );
+    BOOST_REQUIRE_EQUAL( records.size(), 9u );
+    const uint32_t connections[] = { 1, 1, 1, 1, 2, 2, 2, 2, 3 };
+    const ECaptureDir dirs[] = { dirOUT, dirOUT, dirOUT, dirOUT, dirIN, dirIN, dirIN, dirIN, dirIN };
+    const uint16_t cmds[] = { cmdID, cmdGET_WRK_NUM, cmdSHUTDOWN, cmdCHANNEL_DATA,
+                              cmdID, cmdGET_WRK_NUM, cmdSHUTDOWN, cmdCHANNEL_DATA, cmdSET_ID
+                            };
+    for( size_t i = 0; i < records.size(); ++i )
+    {
+        BOOST_CHECK_EQUAL( records[i].m_connection, connections[i] );
+        BOOST_CHECK_EQUAL( records[i].m_dir, dirs[i] );
+        BYTEVector_t data;
+        BOOST_CHECK_EQUAL( parseMsg( &data, records[i].m_msg ).m_cmd, cmds[i] );
+        BOOST_CHECK( i == 0 || records[i].m_timeNs >= records[i - 1].m_timeNs );
+    }
+    // the captured message is the framed message of the wire
+    SIdCmd id;
+    BYTEVector_t data;
+    parseMsg( &data, records[4].m_msg );
+    id.convertFromData( data );
+    BOOST_CHECK_EQUAL( id.m_id, 17u );
+
+    // a truncated file
+    BOOST_REQUIRE( 0 == truncate( path.c_str(), 8 + 17 + 2 ) );
+    CCaptureReader truncated( path );
+    BOOST_CHECK_THROW( truncated.next( &record ), runtime_error );
+    BOOST_CHECK_THROW( CCaptureReader( "/tmp/MiscCommon_test_capture.none" ), runtime_error );
+
+    ::unlink( path.c_str() );
+    ::close( fds[0] );
+    ::close( fds[1] );
+}
+//=============================================================================
+BOOST_AUTO_TEST_CASE( test_protocol_metrics )
+{
+    // INet, CProtocol and CLog report to the registry of the process
+    CMetricsRegistry &global( CMetricsRegistry::instance() );
+    CCounter &sent = global.counter( "misccommon_inet_sent_bytes_total", "" );
+    CCounter &received = global.counter( "misccommon_inet_received_bytes_total", "" );
+    CCounter &idIn = global.counter( "misccommon_protocol_messages_total", "",
+                                     metricsLabel( "cmd", "10" ) + "," + metricsLabel( "dir", "in" ) );
+    CCounter &idOut = global.counter( "misccommon_protocol_messages_total", "",
+                                      metricsLabel( "cmd", "10" ) + "," + metricsLabel( "dir", "out" ) );
+    CHistogram &decode = global.histogram( "misccommon_protocol_decode_seconds", "" );
+    BOOST_REQUIRE_EQUAL( static_cast<int>( cmdID ), 10 );
+    const uint64_t sentBefore( sent.value() );
+    const uint64_t receivedBefore( received.value() );
+    const uint64_t idInBefore( idIn.value() );
+    const uint64_t idOutBefore( idOut.value() );
+    SHistogramSnapshot snapshot;
+    decode.snapshot( &snapshot );
+    const uint64_t decodedBefore( snapshot.m_count );
+
+    int fds[2];
+    BOOST_REQUIRE( 0 == socketpair( AF_UNIX, SOCK_STREAM, 0, fds ) );
+    CProtocol sender;
+    CProtocol receiver;
+    SIdCmd id;
+    id.m_id = 17;
+    BYTEVector_t data;
+    id.convertToData( &data );
+    sender.write( fds[0], cmdID, data );
+    BOOST_REQUIRE( CProtocol::stOK == receiver.read( fds[1] ) );
+    BOOST_REQUIRE( receiver.checkoutNextMsg() );
+    ::close( fds[0] );
+    ::close( fds[1] );
+
+    const uint64_t size( createMsg( cmdID, data, 0 ).size() );
+    BOOST_CHECK_EQUAL( sent.value() - sentBefore, size );
+    BOOST_CHECK_EQUAL( received.value() - receivedBefore, size );
+    BOOST_CHECK_EQUAL( idOut.value() - idOutBefore, 1u );
+    BOOST_CHECK_EQUAL( idIn.value() - idInBefore, 1u );
+    decode.snapshot( &snapshot );
+    BOOST_CHECK_EQUAL( snapshot.m_count - decodedBefore, 1u );
+
+    CCounter &info = global.counter( "misccommon_log_messages_total", "", metricsLabel( "severity", "info" ) );
+    CCounter &debug = global.counter( "misccommon_log_dropped_total", "",
+                                      metricsLabel( "severity", "debug" ) + "," + metricsLabel( "reason", "level" ) );
+    const uint64_t infoBefore( info.value() );
+    const uint64_t debugBefore( debug.value() );
+    stringstream logStream;
+    CSTDOutLog log( &logStream, LOG_SEVERITY_INFO );
+    log.push( LOG_SEVERITY_INFO, 0, "test", "written" );
+    log.push( LOG_SEVERITY_DEBUG, 0, "test", "filtered" );
+    BOOST_CHECK_EQUAL( info.value() - infoBefore, 1u );
+    BOOST_CHECK_EQUAL( debug.value() - debugBefore, 1u );
+}
+//=============================================================================
+// the events of _events with the given name
+size_t countEvents( const vector<STraceEvent> &_events, const string &_name )
+{
+    size_t ret( 0 );
+    for( size_t i = 0; i < _events.size(); ++i )
+        ret += ( _name == _events[i].m_name ) ? 1 : 0;
+    return ret;
+}
+//=============================================================================
+BOOST_AUTO_TEST_CASE( test_protocol_trace )
+{
+    CTracer &tracer( CTracer::instance() );
+    vector<STraceEvent> events;
+    tracer.enable( 64 );
+
+    // the protocol spans of a message
+    int fds[2];
+    BOOST_REQUIRE( 0 == socketpair( AF_UNIX, SOCK_STREAM, 0, fds ) );
+    CProtocol sender;
+    CProtocol receiver;
+    sender.writeSimpleCmd( fds[0], cmdTRACE_DUMP );
+    BOOST_REQUIRE( CProtocol::stOK == receiver.read( fds[1] ) );
+    BOOST_REQUIRE( receiver.checkoutNextMsg() );
+    events.clear();
+    tracer.snapshot( &events );
+    BOOST_CHECK_EQUAL( countEvents( events, "CProtocol::buildMsg" ), 1u );
+    BOOST_CHECK_EQUAL( countEvents( events, "CProtocol::sendRaw" ), 1u );
+    BOOST_CHECK_EQUAL( countEvents( events, "CProtocol::read" ), 1u );
+    BOOST_CHECK_EQUAL( countEvents( events, "CProtocol::checkoutNextMsg" ), 1u );
+
+    // the dump on a protocol command
+    CCmdDispatcher dispatcher;
+    BYTEVector_t trace;
+    registerTraceDump( &dispatcher, &receiver, fds[1] );
+    BOOST_CHECK( dispatcher.dispatch( receiver ) );
+    BOOST_CHECK( !receiver.checkoutNextMsg() );
+    BOOST_REQUIRE( CProtocol::stOK == sender.read( fds[0] ) );
+    BOOST_REQUIRE( sender.checkoutNextMsg() );
+    BOOST_CHECK_EQUAL( sender.msgHeader().m_cmd, cmdTRACE_DATA );
+    sender.getMsg( &trace );
+    BOOST_CHECK( string::npos != string( trace.begin(), trace.end() ).find( "CProtocol::sendRaw" ) );
+    ::close( fds[0] );
+    ::close( fds[1] );
+
+    tracer.disable();
+    tracer.clear();
+}
+//=============================================================================
+BOOST_AUTO_TEST_SUITE_END();
@@ -0,0 +1,118 @@
+/************************************************************************/
+/**
+ * @file Test_Trace.cpp
+ * @brief Unit tests of Trace
+ * @author Anar Manafov A.Manafov@gsi.de
+ */ /*
+
+        version number:     $LastChangedRevision$
+        created by:         Anar Manafov
+                            2012-11-30
+        last changed by:    $LastChangedBy$ $LastChangedDate$
+
+        Copyright (c) 2012 GSI, Scientific Computing division. All rights reserved.
+*************************************************************************/
+// BOOST: tests
+// Defines test_main function to link with actual unit test code.
+#define BOOST_TEST_DYN_LINK
+#define BOOST_AUTO_TEST_MAIN    // Boost 1.33
+#define BOOST_TEST_MAIN
+#include <boost/test/auto_unit_test.hpp>
+// STD
+#include <fstream>
+#include <iterator>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+// API
+#include <pthread.h>
+#include <signal.h>
+#include <sys/stat.h>
+#include <unistd.h>
+// MiscCommon
+#include "Trace.h"
+//=============================================================================
+using namespace std;
+using namespace MiscCommon;
+using boost::unit_test::test_suite;
+//=============================================================================
+BOOST_AUTO_TEST_SUITE( MiscCommon_Trace );
+//=============================================================================
+void *traceInThread( void * )
+{
+    CTraceSpan span( "thread", "test" );
+    return NULL;
+}
+//=============================================================================
+BOOST_AUTO_TEST_CASE( test_trace )
+{
+    CTracer &tracer( CTracer::instance() );
+    vector<STraceEvent> events;
+    // nothing is recorded, when tracing is off
+    {
+        CTraceSpan span( "off", "test" );
+    }
+    tracer.snapshot( &events );
+    BOOST_CHECK( events.empty() );
+
+    tracer.enable( 64 );
+    {
+        CTraceSpan outer( "outer", "test" );
+        CTraceSpan inner( "inner", "test" );
+        inner.setArg( "n", 5 );
+        CTraceSpan dismissed( "dismissed", "test" );
+        dismissed.dismiss();
+    }
+    pthread_t thread;
+    BOOST_REQUIRE( 0 == pthread_create( &thread, NULL, &traceInThread, NULL ) );
+    pthread_join( thread, NULL );
+    tracer.snapshot( &events );
+    BOOST_REQUIRE_EQUAL( events.size(), 3u );
+    // the inner span ends first
+    BOOST_CHECK_EQUAL( string( events[0].m_name ), "inner" );
+    BOOST_CHECK_EQUAL( string( events[1].m_name ), "outer" );
+    BOOST_CHECK( events[1].m_start <= events[0].m_start );
+    BOOST_CHECK( events[1].m_start + events[1].m_duration >= events[0].m_start + events[0].m_duration );
+    BOOST_CHECK_EQUAL( events[0].m_arg, 5u );
+    BOOST_CHECK_EQUAL( string( events[2].m_name ), "thread" );
+    BOOST_CHECK( events[2].m_tid != events[0].m_tid );
+
+    stringstream json;
+    tracer.writeChromeTrace( json );
+    BOOST_CHECK_EQUAL( json.str().substr( 0, 17 ), "{\"displayTimeUnit" );
+    BOOST_CHECK( string::npos != json.str().find( "{\"name\":\"inner\",\"cat\":\"test\",\"ph\":\"X\"" ) );
+    BOOST_CHECK( string::npos != json.str().find( ",\"args\":{\"n\":5}}" ) );
+
+    // the ring keeps the newest events, but the one, which the writer might be overwriting
+    tracer.clear();
+    for( size_t i = 0; i < 100; ++i )
+    {
+        CTraceSpan span( "overflow", "test" );
+        span.setArg( "i", i );
+    }
+    events.clear();
+    tracer.snapshot( &events );
+    BOOST_REQUIRE_EQUAL( events.size(), 63u );
+    BOOST_CHECK_EQUAL( events.front().m_arg, 37u );
+    BOOST_CHECK_EQUAL( events.back().m_arg, 99u );
+
+    // the dump on a signal
+    const string path( "/tmp/MiscCommon_test_trace.json" );
+    ::unlink( path.c_str() );
+    tracer.dumpOnSignal( SIGUSR2, path );
+    BOOST_CHECK_THROW( tracer.dumpOnSignal( SIGUSR1, path ), logic_error );
+    raise( SIGUSR2 );
+    struct stat st;
+    for( size_t i = 0; i < 200 && 0 != ::stat( path.c_str(), &st ); ++i )
+        usleep( 10000 );
+    ifstream f( path.c_str() );
+    const string dump( ( istreambuf_iterator<char>( f ) ), istreambuf_iterator<char>() );
+    BOOST_CHECK( string::npos != dump.find( "\"traceEvents\"" ) );
+    ::unlink( path.c_str() );
+
+    tracer.disable();
+    tracer.clear();
+}
+//=============================================================================
+BOOST_AUTO_TEST_SUITE_END();